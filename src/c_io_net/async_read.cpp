@@ -0,0 +1,291 @@
+/**
+ * Reading whole files into memory in the background.
+ */
+// local headers
+#include "../common.hpp"
+#include "../utility.hpp"
+#include "async_read.hpp"
+// C++ headers
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+// C headers
+#include <cerrno>
+// C library headers
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+AsyncReadEngine::AsyncReadEngine(INT64 max_in_flight) {
+  this->_max_in_flight=std::max(max_in_flight,(INT64)1);
+#ifdef IMAGEGRID_USE_LIBURING
+  // io_uring can be missing or blocked at runtime even when built in
+  auto ring_error=io_uring_queue_init(this->_max_in_flight,&this->_ring,0);
+  if (ring_error == 0) {
+    this->_use_ring=true;
+  } else {
+    WARN_LOCAL("io_uring is not available, using threads for reads: " << -ring_error);
+  }
+  if (this->_use_ring) {
+    return;
+  }
+#endif
+  this->_start_workers();
+}
+
+AsyncReadEngine::~AsyncReadEngine() {
+  this->wait_all();
+#ifdef IMAGEGRID_USE_LIBURING
+  if (this->_use_ring) {
+    io_uring_queue_exit(&this->_ring);
+  }
+#endif
+  {
+    std::lock_guard<std::mutex> guard(this->_pool_mutex);
+    this->_pool_stopping=true;
+  }
+  this->_request_ready.notify_all();
+  for (auto& worker_thread : this->_workers) {
+    worker_thread.join();
+  }
+}
+
+void AsyncReadEngine::queue(const std::string& filename,
+                            AsyncReadCallback callback) {
+  auto request=std::make_unique<AsyncReadRequest>();
+  request->result.filename=filename;
+  request->callback=std::move(callback);
+  this->_queued.push_back(std::move(request));
+}
+
+void AsyncReadEngine::submit() {
+#ifdef IMAGEGRID_USE_LIBURING
+  if (this->_use_ring) {
+    this->_ring_submit();
+    return;
+  }
+#endif
+  if (this->_queued.empty()) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(this->_pool_mutex);
+    for (auto& request : this->_queued) {
+      this->_pool_submitted.push_back(std::move(request));
+      this->_in_flight++;
+    }
+  }
+  this->_queued.clear();
+  this->_request_ready.notify_all();
+}
+
+void AsyncReadEngine::wait_all() {
+  this->submit();
+#ifdef IMAGEGRID_USE_LIBURING
+  if (this->_use_ring) {
+    while (this->_in_flight > 0) {
+      struct io_uring_cqe* cqe;
+      auto wait_error=io_uring_wait_cqe(&this->_ring,&cqe);
+      if (wait_error == -EINTR) {
+        continue;
+      }
+      if (wait_error < 0) {
+        this->_ring_fail(wait_error);
+        break;
+      }
+      auto request=(AsyncReadRequest*)io_uring_cqe_get_data(cqe);
+      auto bytes_read=cqe->res;
+      io_uring_cqe_seen(&this->_ring,cqe);
+      auto size=(INT64)request->result.data.size();
+      if (bytes_read > 0) {
+        request->offset+=bytes_read;
+      }
+      // short reads are continued from where they left off
+      if (bytes_read > 0 && request->offset < size &&
+          this->_ring_prepare(request)) {
+        io_uring_submit(&this->_ring);
+        continue;
+      }
+      request->result.success=(request->offset == size);
+      if (bytes_read < 0) {
+        ERROR_LOCAL("Failed to read: " << request->result.filename << " " << -bytes_read);
+      }
+      this->_in_flight--;
+      this->_ring_requests.erase(std::find(this->_ring_requests.begin(),this->_ring_requests.end(),request));
+      this->_finish(std::unique_ptr<AsyncReadRequest>(request));
+      // start anything waiting for space in the ring
+      this->_ring_submit();
+    }
+    if (this->_use_ring) {
+      return;
+    }
+    // anything left queued is read by the threads instead
+    this->submit();
+  }
+#endif
+  while (this->_in_flight > 0) {
+    std::unique_ptr<AsyncReadRequest> request;
+    {
+      std::unique_lock<std::mutex> lock(this->_pool_mutex);
+      this->_result_ready.wait(lock,[this]() { return !this->_pool_finished.empty(); });
+      request=std::move(this->_pool_finished.front());
+      this->_pool_finished.pop_front();
+    }
+    this->_in_flight--;
+    this->_finish(std::move(request));
+  }
+}
+
+const char* AsyncReadEngine::backend_name() const {
+#ifdef IMAGEGRID_USE_LIBURING
+  if (this->_use_ring) {
+    return "io_uring";
+  }
+#endif
+  return "threads";
+}
+
+void AsyncReadEngine::_finish(std::unique_ptr<AsyncReadRequest> request) {
+  if (request->fd >= 0) {
+    close(request->fd);
+    request->fd=-1;
+  }
+  if (!request->result.success) {
+    request->result.data.clear();
+  }
+  request->callback(request->result);
+}
+
+void AsyncReadEngine::_start_workers() {
+  auto number_threads=worker_thread_count(this->_max_in_flight,this->_max_in_flight);
+  for (INT64 i=0; i < number_threads; i++) {
+    this->_workers.emplace_back(&AsyncReadEngine::_worker,this);
+  }
+}
+
+void AsyncReadEngine::_worker() {
+  while (true) {
+    std::unique_ptr<AsyncReadRequest> request;
+    {
+      std::unique_lock<std::mutex> lock(this->_pool_mutex);
+      this->_request_ready.wait(lock,[this]() { return this->_pool_stopping || !this->_pool_submitted.empty(); });
+      if (this->_pool_submitted.empty()) {
+        return;
+      }
+      request=std::move(this->_pool_submitted.front());
+      this->_pool_submitted.pop_front();
+    }
+    auto fd=open(request->result.filename.c_str(),O_RDONLY);
+    if (fd < 0) {
+      ERROR_LOCAL("Failed to open: " << request->result.filename);
+    } else {
+      request->result.success=read_whole_file(fd,request->result.data);
+      close(fd);
+      if (!request->result.success) {
+        ERROR_LOCAL("Failed to read: " << request->result.filename);
+      }
+    }
+    {
+      std::lock_guard<std::mutex> guard(this->_pool_mutex);
+      this->_pool_finished.push_back(std::move(request));
+    }
+    this->_result_ready.notify_one();
+  }
+}
+
+#ifdef IMAGEGRID_USE_LIBURING
+void AsyncReadEngine::_ring_submit() {
+  INT64 prepared=0;
+  while (!this->_queued.empty() && this->_in_flight < this->_max_in_flight) {
+    auto request=std::move(this->_queued.front());
+    this->_queued.pop_front();
+    struct stat file_stat;
+    request->fd=open(request->result.filename.c_str(),O_RDONLY);
+    if (request->fd < 0 || fstat(request->fd,&file_stat) < 0) {
+      ERROR_LOCAL("Failed to open: " << request->result.filename);
+      this->_finish(std::move(request));
+      continue;
+    }
+    request->result.data.resize(file_stat.st_size);
+    if (file_stat.st_size == 0) {
+      request->result.success=true;
+      this->_finish(std::move(request));
+      continue;
+    }
+    // the ring owns the request until its completion arrives
+    if (!this->_ring_prepare(request.get())) {
+      close(request->fd);
+      request->fd=-1;
+      this->_queued.push_front(std::move(request));
+      break;
+    }
+    this->_ring_requests.push_back(request.release());
+    this->_in_flight++;
+    prepared++;
+  }
+  if (prepared > 0) {
+    io_uring_submit(&this->_ring);
+  }
+}
+
+void AsyncReadEngine::_ring_fail(int wait_error) {
+  ERROR_LOCAL("Failed waiting for io_uring, using threads for reads: " << -wait_error);
+  // the ring is torn down before the buffers it was reading into are
+  // freed
+  io_uring_queue_exit(&this->_ring);
+  this->_use_ring=false;
+  auto requests=std::move(this->_ring_requests);
+  this->_ring_requests.clear();
+  for (auto request : requests) {
+    request->result.success=false;
+    this->_in_flight--;
+    this->_finish(std::unique_ptr<AsyncReadRequest>(request));
+  }
+  this->_start_workers();
+}
+
+bool AsyncReadEngine::_ring_prepare(AsyncReadRequest* request) {
+  auto sqe=io_uring_get_sqe(&this->_ring);
+  if (!sqe) {
+    return false;
+  }
+  io_uring_prep_read(sqe,
+                     request->fd,
+                     request->result.data.data()+request->offset,
+                     request->result.data.size()-request->offset,
+                     request->offset);
+  io_uring_sqe_set_data(sqe,request);
+  return true;
+}
+#endif
+
+bool read_whole_file(int fd,
+                     std::vector<unsigned char>& data) {
+  struct stat file_stat;
+  if (fstat(fd,&file_stat) < 0) {
+    return false;
+  }
+  return read_file_range(fd,0,file_stat.st_size,data);
+}
+
+bool read_file_range(int fd,
+                     INT64 offset,
+                     INT64 size,
+                     std::vector<unsigned char>& data) {
+  data.resize(size);
+  INT64 done=0;
+  while (done < size) {
+    auto bytes_read=pread(fd,data.data()+done,size-done,offset+done);
+    if (bytes_read < 0 && errno == EINTR) {
+      continue;
+    }
+    if (bytes_read <= 0) {
+      return false;
+    }
+    done+=bytes_read;
+  }
+  return true;
+}
@@ -0,0 +1,166 @@
+/**
+ * Header for reading whole files into memory in the background so
+ * several files can be in flight while earlier ones are decoded.
+ */
+#ifndef ASYNC_READ_HPP
+#define ASYNC_READ_HPP
+
+#include "../common.hpp"
+// C++ headers
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+// C library headers
+#ifdef IMAGEGRID_USE_LIBURING
+#include <liburing.h>
+#endif
+
+/**
+ * A file read into memory by AsyncReadEngine.
+ */
+class AsyncReadResult {
+public:
+  AsyncReadResult()=default;
+  std::string filename;
+  std::vector<unsigned char> data;
+  bool success{false};
+};
+
+/**
+ * Called with each finished read, the data may be moved out.
+ */
+typedef std::function<void(AsyncReadResult&)> AsyncReadCallback;
+
+/**
+ * Reads whole files into memory with batched submissions, using
+ * io_uring when built with liburing and the kernel allows it,
+ * otherwise a pool of threads doing blocking reads.
+ *
+ * Callbacks are always run on the thread that calls wait_all(), so
+ * decoders don't need to be thread safe, while the remaining reads
+ * carry on in the background.  Only one thread should use an engine
+ * at a time.
+ */
+class AsyncReadEngine {
+public:
+  AsyncReadEngine()=delete;
+  /**
+   * @param max_in_flight The most reads to have outstanding at once.
+   */
+  AsyncReadEngine(INT64 max_in_flight);
+  ~AsyncReadEngine();
+  AsyncReadEngine(const AsyncReadEngine&)=delete;
+  AsyncReadEngine(const AsyncReadEngine&&)=delete;
+  AsyncReadEngine& operator=(const AsyncReadEngine&)=delete;
+  AsyncReadEngine& operator=(const AsyncReadEngine&&)=delete;
+  /**
+   * Queue a read of a whole file.  Nothing is read until submit() or
+   * wait_all() is called.
+   *
+   * @param filename The file to read.
+   * @param callback Called with the result once the read finishes.
+   */
+  void queue(const std::string& filename,
+             AsyncReadCallback callback);
+  /**
+   * Start reading everything queued as a single batch.
+   */
+  void submit();
+  /**
+   * Submit anything queued and run callbacks as reads finish until
+   * every read is done.
+   */
+  void wait_all();
+  /** @return The name of the backend being used, for messages. */
+  const char* backend_name() const;
+private:
+  /**
+   * A read waiting to be started, in flight, or finished.
+   */
+  class AsyncReadRequest {
+  public:
+    AsyncReadRequest()=default;
+    AsyncReadResult result;
+    AsyncReadCallback callback;
+    /** The open file while the read is in flight. */
+    int fd{-1};
+    /** How much has been read so far. */
+    INT64 offset{0};
+  };
+  /**
+   * Run the callback for a finished request on the calling thread.
+   */
+  void _finish(std::unique_ptr<AsyncReadRequest> request);
+  /** Start the thread pool used without io_uring. */
+  void _start_workers();
+  /** Loop run by each thread in the pool. */
+  void _worker();
+  INT64 _max_in_flight;
+  /** Reads queued but not yet submitted. */
+  std::deque<std::unique_ptr<AsyncReadRequest>> _queued;
+  /** The number of reads submitted but not yet finished. */
+  INT64 _in_flight{0};
+#ifdef IMAGEGRID_USE_LIBURING
+  /**
+   * Open files and fill submission queue entries for queued reads
+   * until the ring is full.
+   */
+  void _ring_submit();
+  /**
+   * Queue a read of the rest of a file on the ring.
+   *
+   * @return If there was space in the submission queue.
+   */
+  bool _ring_prepare(AsyncReadRequest* request);
+  /**
+   * Give up on a ring that can no longer be waited on, failing the
+   * reads in flight on it and switching to the thread pool.
+   *
+   * @param wait_error The negative error from io_uring_wait_cqe.
+   */
+  void _ring_fail(int wait_error);
+  bool _use_ring{false};
+  /** Reads owned by the ring until their completions arrive. */
+  std::vector<AsyncReadRequest*> _ring_requests;
+  struct io_uring _ring;
+#endif
+  // the thread pool used without io_uring
+  std::vector<std::thread> _workers;
+  std::mutex _pool_mutex;
+  std::condition_variable _request_ready;
+  std::condition_variable _result_ready;
+  std::deque<std::unique_ptr<AsyncReadRequest>> _pool_submitted;
+  std::deque<std::unique_ptr<AsyncReadRequest>> _pool_finished;
+  bool _pool_stopping{false};
+};
+
+/**
+ * Read a whole open file with blocking reads.
+ *
+ * @param fd The open file.
+ * @param data Set to the contents of the file.
+ * @return If the whole file was read.
+ */
+bool read_whole_file(int fd,
+                     std::vector<unsigned char>& data);
+
+/**
+ * Read part of an open file with blocking reads.
+ *
+ * @param fd The open file.
+ * @param offset Where to start reading.
+ * @param size The number of bytes to read.
+ * @param data Set to the bytes read.
+ * @return If every byte was read.
+ */
+bool read_file_range(int fd,
+                     INT64 offset,
+                     INT64 size,
+                     std::vector<unsigned char>& data);
+
+#endif
@@ -0,0 +1,321 @@
+/**
+ * The manifest that records information about every image in a cache
+ * directory.
+ */
+// local headers
+#include "../common.hpp"
+#include "cache_manifest.hpp"
+#include "cache_root.hpp"
+#include "fileload.hpp"
+#include "mapped_table.hpp"
+// C++ headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+// C library headers
+#include <sys/stat.h>
+
+/**
+ * A record in the manifest file, names are stored separately after
+ * all records.
+ */
+struct CacheManifestRecord {
+  UINT64 name_offset;
+  UINT64 name_length;
+  INT64 width;
+  INT64 height;
+  INT64 file_size;
+  INT64 file_mtime;
+};
+
+bool CacheManifest::load(const std::string& manifest_filename) {
+  if (!this->_mapped_table.open(manifest_filename,
+                                CACHE_MANIFEST_MAGIC,
+                                sizeof(CacheManifestRecord))) {
+    if (std::filesystem::exists(manifest_filename)) {
+      WARN_LOCAL("Ignoring invalid cache manifest: " << manifest_filename);
+    }
+    return false;
+  }
+  return true;
+}
+
+bool CacheManifest::save(const std::string& manifest_filename) {
+  // merge everything in sorted order so the file can be binary searched
+  std::map<std::string,CacheManifestEntry> all_entries;
+  this->_read_mapped(all_entries);
+  for (const auto& updated_entry : this->_updated_entries) {
+    all_entries[updated_entry.first]=updated_entry.second;
+  }
+  if (!this->_write(manifest_filename,all_entries)) {
+    return false;
+  }
+  this->_updated_entries.clear();
+  return this->load(manifest_filename);
+}
+
+bool CacheManifest::save_updates(const std::string& manifest_filename) const {
+  std::map<std::string,CacheManifestEntry> updated_entries(this->_updated_entries.begin(),
+                                                           this->_updated_entries.end());
+  return this->_write(manifest_filename,updated_entries);
+}
+
+bool CacheManifest::merge(const std::string& manifest_filename) {
+  CacheManifest other_manifest;
+  if (!other_manifest.load(manifest_filename)) {
+    return false;
+  }
+  std::map<std::string,CacheManifestEntry> other_entries;
+  other_manifest._read_mapped(other_entries);
+  for (const auto& other_entry : other_entries) {
+    this->_updated_entries[other_entry.first]=other_entry.second;
+  }
+  return true;
+}
+
+void CacheManifest::_read_mapped(std::map<std::string,CacheManifestEntry>& entries) const {
+  for (INT64 i=0; i < this->_mapped_table.count(); i++) {
+    auto record=(const CacheManifestRecord*)this->_mapped_table.record(i);
+    entries[std::string(this->_mapped_table.record_name(i))]=
+      CacheManifestEntry{record->width,record->height,record->file_size,record->file_mtime};
+  }
+}
+
+bool CacheManifest::_write(const std::string& manifest_filename,
+                           const std::map<std::string,CacheManifestEntry>& all_entries) const {
+  MappedTableHeader header;
+  std::memcpy(header.magic,CACHE_MANIFEST_MAGIC,sizeof(CACHE_MANIFEST_MAGIC));
+  header.entry_count=all_entries.size();
+  header.names_size=0;
+  std::vector<CacheManifestRecord> records;
+  records.reserve(all_entries.size());
+  for (const auto& entry : all_entries) {
+    records.push_back(CacheManifestRecord{header.names_size,entry.first.size(),
+                                          entry.second.width,entry.second.height,
+                                          entry.second.file_size,entry.second.file_mtime});
+    header.names_size+=entry.first.size();
+  }
+  // write to a temporary file and rename so a manifest is never half written
+  auto temp_filename=manifest_filename+".tmp";
+  std::ofstream manifest_out(temp_filename,std::ios::binary | std::ios::trunc);
+  if (!manifest_out.is_open()) {
+    ERROR_LOCAL("Failed to write cache manifest: " << temp_filename);
+    return false;
+  }
+  manifest_out.write((const char*)&header,sizeof(header));
+  manifest_out.write((const char*)records.data(),records.size()*sizeof(CacheManifestRecord));
+  for (const auto& entry : all_entries) {
+    manifest_out.write(entry.first.data(),entry.first.size());
+  }
+  manifest_out.close();
+  if (!manifest_out) {
+    ERROR_LOCAL("Failed to write cache manifest: " << temp_filename);
+    return false;
+  }
+  std::error_code error_code;
+  std::filesystem::rename(temp_filename,manifest_filename,error_code);
+  if (error_code) {
+    ERROR_LOCAL("Failed to rename cache manifest: " << temp_filename);
+    return false;
+  }
+  return true;
+}
+
+bool CacheManifest::find(const std::string& name, CacheManifestEntry& entry) const {
+  auto updated_entry=this->_updated_entries.find(name);
+  if (updated_entry != this->_updated_entries.end()) {
+    entry=updated_entry->second;
+    return true;
+  }
+  return this->_find_mapped(name,entry);
+}
+
+void CacheManifest::update(const std::string& name, const CacheManifestEntry& entry) {
+  this->_updated_entries[name]=entry;
+}
+
+bool CacheManifest::dirty() const {
+  return !this->_updated_entries.empty();
+}
+
+bool CacheManifest::_find_mapped(const std::string& name, CacheManifestEntry& entry) const {
+  auto index=this->_mapped_table.find(name);
+  if (index < 0) {
+    return false;
+  }
+  auto record=(const CacheManifestRecord*)this->_mapped_table.record(index);
+  entry=CacheManifestEntry{record->width,record->height,record->file_size,record->file_mtime};
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// manifests for every cache directory seen so far
+
+std::mutex cache_manifests_mutex;
+std::unordered_map<std::string,std::unique_ptr<CacheManifest>> cache_manifests;
+
+/**
+ * Get the manifest for a cache directory, loading it if necessary.
+ * The caller must hold cache_manifests_mutex.
+ */
+CacheManifest* cache_manifest_for_directory(const std::string& directory) {
+  auto& manifest=cache_manifests[directory];
+  if (!manifest) {
+    manifest=std::make_unique<CacheManifest>();
+    auto manifest_filename=(std::filesystem::path(directory) / CACHE_MANIFEST_FILENAME).string();
+    if (manifest->load(manifest_filename)) {
+      MSG_LOCAL("Using cache manifest: " << manifest_filename);
+    }
+  }
+  return manifest.get();
+}
+
+std::string cache_directory(const std::string& filename) {
+  auto parent_path=std::filesystem::path(filename).parent_path();
+  if (cache_root_enabled()) {
+    return cache_root_directory(parent_path.string());
+  }
+  return (parent_path / IMAGEGRID_CACHE_DIRECTORY).string();
+}
+
+bool cache_file_stat(const std::string& filename,
+                     INT64& file_size,
+                     INT64& file_mtime) {
+  struct stat file_stat;
+  if (stat(filename.c_str(),&file_stat) < 0) {
+    return false;
+  }
+  file_size=(INT64)file_stat.st_size;
+  file_mtime=(INT64)file_stat.st_mtim.tv_sec*1000000000L+(INT64)file_stat.st_mtim.tv_nsec;
+  return true;
+}
+
+bool cache_manifest_find(const std::string& filename,
+                         CacheManifestEntry& entry) {
+  auto name=std::filesystem::path(filename).filename().string();
+  {
+    std::lock_guard<std::mutex> guard(cache_manifests_mutex);
+    if (!cache_manifest_for_directory(cache_directory(filename))->find(name,entry)) {
+      return false;
+    }
+  }
+  // a replaced image must have its header read again
+  INT64 file_size,file_mtime;
+  if (!cache_file_stat(filename,file_size,file_mtime) ||
+      file_size != entry.file_size || file_mtime != entry.file_mtime) {
+    MSG_LOCAL("Cache manifest entry is out of date: " << filename);
+    return false;
+  }
+  return true;
+}
+
+bool cache_manifest_update(const std::string& filename,
+                           INT64 width,
+                           INT64 height) {
+  CacheManifestEntry entry{width,height,0,0};
+  if (!cache_file_stat(filename,entry.file_size,entry.file_mtime)) {
+    ERROR_LOCAL("Failed to stat file for cache manifest: " << filename);
+    return false;
+  }
+  auto name=std::filesystem::path(filename).filename().string();
+  std::lock_guard<std::mutex> guard(cache_manifests_mutex);
+  cache_manifest_for_directory(cache_directory(filename))->update(name,entry);
+  return true;
+}
+
+bool cache_manifest_save_all() {
+  auto success=true;
+  std::lock_guard<std::mutex> guard(cache_manifests_mutex);
+  for (auto& directory_manifest : cache_manifests) {
+    if (directory_manifest.second->dirty()) {
+      auto manifest_filename=(std::filesystem::path(directory_manifest.first) / CACHE_MANIFEST_FILENAME).string();
+      MSG_LOCAL("Writing cache manifest: " << manifest_filename);
+      std::error_code error_code;
+      std::filesystem::create_directories(directory_manifest.first,error_code);
+      if (!directory_manifest.second->save(manifest_filename)) {
+        success=false;
+      }
+    }
+  }
+  return success;
+}
+
+std::string cache_shard_filename(const std::string& filename,
+                                 INT64 shard_index,
+                                 INT64 shard_count) {
+  return filename+CACHE_MANIFEST_SHARD_SUFFIX+std::to_string(shard_index)+"-"+std::to_string(shard_count);
+}
+
+std::vector<std::string> cache_find_shard_filenames(const std::string& directory,
+                                                    const std::string& filename) {
+  auto shard_prefix=filename+CACHE_MANIFEST_SHARD_SUFFIX;
+  std::vector<std::string> shard_filenames;
+  std::error_code error_code;
+  for (const auto& directory_entry : std::filesystem::directory_iterator(directory,error_code)) {
+    auto name=directory_entry.path().filename().string();
+    if (name.compare(0,shard_prefix.size(),shard_prefix) == 0 &&
+        name.compare(name.size()-4,4,".tmp") != 0) {
+      shard_filenames.push_back(directory_entry.path().string());
+    }
+  }
+  // merge in a fixed order so repeated merges give the same result
+  std::sort(shard_filenames.begin(),shard_filenames.end());
+  return shard_filenames;
+}
+
+std::string cache_manifest_shard_filename(INT64 shard_index,
+                                          INT64 shard_count) {
+  return cache_shard_filename(CACHE_MANIFEST_FILENAME,shard_index,shard_count);
+}
+
+bool cache_manifest_save_all_shard(INT64 shard_index,
+                                   INT64 shard_count) {
+  auto success=true;
+  std::lock_guard<std::mutex> guard(cache_manifests_mutex);
+  for (auto& directory_manifest : cache_manifests) {
+    if (directory_manifest.second->dirty()) {
+      auto manifest_filename=(std::filesystem::path(directory_manifest.first) /
+                              cache_manifest_shard_filename(shard_index,shard_count)).string();
+      MSG_LOCAL("Writing partial cache manifest: " << manifest_filename);
+      std::error_code error_code;
+      std::filesystem::create_directories(directory_manifest.first,error_code);
+      if (!directory_manifest.second->save_updates(manifest_filename)) {
+        success=false;
+      }
+    }
+  }
+  return success;
+}
+
+bool cache_manifest_merge_shards(const std::string& directory) {
+  auto shard_filenames=cache_find_shard_filenames(directory,CACHE_MANIFEST_FILENAME);
+  if (shard_filenames.empty()) {
+    return true;
+  }
+  std::lock_guard<std::mutex> guard(cache_manifests_mutex);
+  auto manifest=cache_manifest_for_directory(directory);
+  for (const auto& shard_filename : shard_filenames) {
+    MSG_LOCAL("Merging partial cache manifest: " << shard_filename);
+    if (!manifest->merge(shard_filename)) {
+      ERROR_LOCAL("Failed to merge partial cache manifest: " << shard_filename);
+      return false;
+    }
+  }
+  auto manifest_filename=(std::filesystem::path(directory) / CACHE_MANIFEST_FILENAME).string();
+  if (!manifest->save(manifest_filename)) {
+    return false;
+  }
+  // only remove the partial manifests once they are safely merged
+  std::error_code error_code;
+  for (const auto& shard_filename : shard_filenames) {
+    std::filesystem::remove(shard_filename,error_code);
+  }
+  return true;
+}
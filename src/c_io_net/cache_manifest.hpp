@@ -0,0 +1,215 @@
+/**
+ * Header for the manifest that records information about every image
+ * in a cache directory so images don't need to be opened at startup.
+ */
+#ifndef CACHE_MANIFEST_HPP
+#define CACHE_MANIFEST_HPP
+
+#include "../common.hpp"
+#include "mapped_table.hpp"
+// C++ headers
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+const std::string CACHE_MANIFEST_FILENAME{"manifest.bin"};
+
+// partial files written by a shard of a cache build are named like
+// manifest.bin.shard-INDEX-COUNT until they are merged
+const std::string CACHE_MANIFEST_SHARD_SUFFIX{".shard-"};
+
+// identifies the manifest file and its version
+const char CACHE_MANIFEST_MAGIC[MAPPED_TABLE_MAGIC_LENGTH]={'I','G','M','A','N','I','F','1'};
+
+/**
+ * Information about a single image in the manifest.
+ */
+struct CacheManifestEntry {
+  INT64 width;
+  INT64 height;
+  INT64 file_size;
+  INT64 file_mtime;
+};
+
+/**
+ * The manifest for a single cache directory.
+ *
+ * The file is a header, a table of fixed size records sorted by name,
+ * and a table of names.  It is memory mapped and searched in place so
+ * loading does not depend on the number of images.
+ */
+class CacheManifest {
+public:
+  CacheManifest()=default;
+  ~CacheManifest()=default;
+  CacheManifest(const CacheManifest&)=delete;
+  CacheManifest(const CacheManifest&&)=delete;
+  CacheManifest& operator=(const CacheManifest&)=delete;
+  CacheManifest& operator=(const CacheManifest&&)=delete;
+  /**
+   * Load a manifest from a file.
+   *
+   * @param manifest_filename The manifest file.
+   * @return If the manifest exists and is valid.
+   */
+  bool load(const std::string& manifest_filename);
+  /**
+   * Write the manifest out, including any updates.
+   *
+   * @param manifest_filename The manifest file.
+   * @return If writing was successful.
+   */
+  bool save(const std::string& manifest_filename);
+  /**
+   * Write out only the updates, leaving out anything loaded from the
+   * existing manifest.
+   *
+   * @param manifest_filename The file to write the updates to.
+   * @return If writing was successful.
+   */
+  bool save_updates(const std::string& manifest_filename) const;
+  /**
+   * Add every entry of another manifest file as an update, replacing
+   * any existing entries with the same name.
+   *
+   * @param manifest_filename The manifest file to merge in.
+   * @return If the file exists and is valid.
+   */
+  bool merge(const std::string& manifest_filename);
+  /**
+   * Find an image in the manifest.
+   *
+   * @param name The filename of the image without the directory.
+   * @param entry Set to the information about the image.
+   * @return If the image was found.
+   */
+  bool find(const std::string& name, CacheManifestEntry& entry) const;
+  /**
+   * Add or replace an image in the manifest.
+   *
+   * @param name The filename of the image without the directory.
+   * @param entry The information about the image.
+   */
+  void update(const std::string& name, const CacheManifestEntry& entry);
+  /** @return If there are updates that have not been saved. */
+  bool dirty() const;
+private:
+  bool _find_mapped(const std::string& name, CacheManifestEntry& entry) const;
+  void _read_mapped(std::map<std::string,CacheManifestEntry>& entries) const;
+  bool _write(const std::string& manifest_filename,
+              const std::map<std::string,CacheManifestEntry>& all_entries) const;
+  MappedTable _mapped_table;
+  /** Entries added or changed since the manifest was loaded. */
+  std::unordered_map<std::string,CacheManifestEntry> _updated_entries;
+};
+
+/**
+ * Find the cache directory for an image, in the cache root if one is
+ * used.
+ *
+ * @param filename The filename of the image.
+ * @return The cache directory.
+ */
+std::string cache_directory(const std::string& filename);
+
+/**
+ * Get what is recorded about a file to detect when it changes.
+ *
+ * @param filename The file.
+ * @param file_size Set to the size of the file in bytes.
+ * @param file_mtime Set to the modification time in nanoseconds.
+ * @return If the file could be checked.
+ */
+bool cache_file_stat(const std::string& filename,
+                     INT64& file_size,
+                     INT64& file_mtime);
+
+/**
+ * Look an image up in the manifest for its cache directory, loading
+ * the manifest the first time the directory is seen.  Entries for
+ * images whose size or modification time changed are not found.
+ *
+ * @param filename The filename of the image.
+ * @param entry Set to the information about the image.
+ * @return If the image was found.
+ */
+bool cache_manifest_find(const std::string& filename,
+                         CacheManifestEntry& entry);
+
+/**
+ * Record an image in the manifest for its cache directory.
+ *
+ * @param filename The filename of the image.
+ * @param width The width of the image in pixels.
+ * @param height The height of the image in pixels.
+ * @return If the image could be recorded.
+ */
+bool cache_manifest_update(const std::string& filename,
+                           INT64 width,
+                           INT64 height);
+
+/**
+ * Write out every manifest that has been updated.
+ *
+ * @return If all manifests were written successfully.
+ */
+bool cache_manifest_save_all();
+
+/**
+ * Get the filename of a partial file written by one shard of a cache
+ * build.
+ *
+ * @param filename The filename of the whole file without the directory.
+ * @param shard_index The index of the shard, starting at 0.
+ * @param shard_count The number of shards.
+ * @return The filename without the directory.
+ */
+std::string cache_shard_filename(const std::string& filename,
+                                 INT64 shard_index,
+                                 INT64 shard_count);
+
+/**
+ * Find every partial file written by the shards of a cache build.
+ *
+ * @param directory The cache directory.
+ * @param filename The filename of the whole file without the directory.
+ * @return The partial files in the order they should be merged.
+ */
+std::vector<std::string> cache_find_shard_filenames(const std::string& directory,
+                                                    const std::string& filename);
+
+/**
+ * Get the filename of the partial manifest written by one shard of a
+ * cache build.
+ *
+ * @param shard_index The index of the shard, starting at 0.
+ * @param shard_count The number of shards.
+ * @return The filename without the directory.
+ */
+std::string cache_manifest_shard_filename(INT64 shard_index,
+                                          INT64 shard_count);
+
+/**
+ * Write only the updates of every manifest to partial manifests for a
+ * shard, so shards building the same cache directory at once never
+ * write the same file.
+ *
+ * @param shard_index The index of the shard, starting at 0.
+ * @param shard_count The number of shards.
+ * @return If all partial manifests were written successfully.
+ */
+bool cache_manifest_save_all_shard(INT64 shard_index,
+                                   INT64 shard_count);
+
+/**
+ * Merge every partial manifest in a cache directory into its manifest
+ * and remove the partial manifests.
+ *
+ * @param directory The cache directory.
+ * @return If merging was successful, also true if there was nothing
+ *         to merge.
+ */
+bool cache_manifest_merge_shards(const std::string& directory);
+
+#endif
@@ -0,0 +1,226 @@
+/**
+ * The central cache root, where cached images are found by a hash of
+ * their contents and the least recently used are evicted to stay
+ * within a quota.
+ */
+// local headers
+#include "../common.hpp"
+#include "cache_manifest.hpp"
+#include "cache_root.hpp"
+#include "pyramid_cache.hpp"
+// C++ headers
+#include <algorithm>
+#include <filesystem>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+// C headers
+#include <cstdlib>
+// C library headers
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/**
+ * A content hash already found for an image, kept while the image is
+ * unchanged so each image is only hashed once.
+ */
+struct CacheRootKey {
+  INT64 file_size;
+  INT64 file_mtime;
+  std::string key;
+};
+
+std::mutex cache_root_mutex;
+std::string cache_root_path;
+INT64 cache_root_quota=0;
+/** The bytes used by cached images, -1 until it is first found. */
+INT64 cache_root_used=-1;
+/** If the cache root is being scanned, so only one scan runs at once. */
+bool cache_root_evicting=false;
+std::unordered_map<std::string,CacheRootKey> cache_root_keys;
+std::unordered_set<std::string> cache_root_touched;
+
+/**
+ * Format a hash as a fixed width hexadecimal string for a filename.
+ */
+std::string cache_root_hex(UINT64 value) {
+  std::ostringstream hex_stream;
+  hex_stream << std::hex << std::setw(16) << std::setfill('0') << value;
+  return hex_stream.str();
+}
+
+std::string cache_root_default() {
+  auto xdg_cache_home=std::getenv("XDG_CACHE_HOME");
+  if (xdg_cache_home && xdg_cache_home[0] != '\0') {
+    return (std::filesystem::path(xdg_cache_home) / CACHE_ROOT_DEFAULT_NAME).string();
+  }
+  auto home=std::getenv("HOME");
+  if (home && home[0] != '\0') {
+    return (std::filesystem::path(home) / ".cache" / CACHE_ROOT_DEFAULT_NAME).string();
+  }
+  return "";
+}
+
+bool cache_root_set(const std::string& root,
+                    INT64 quota_mb) {
+  std::error_code error_code;
+  std::filesystem::create_directories(std::filesystem::path(root) / CACHE_ROOT_OBJECTS_DIRECTORY,error_code);
+  if (error_code) {
+    ERROR_LOCAL("Failed to create cache root: " << root);
+    return false;
+  }
+  std::lock_guard<std::mutex> guard(cache_root_mutex);
+  cache_root_path=root;
+  cache_root_quota=quota_mb*1024L*1024L;
+  MSG_LOCAL("Using cache root: " << root << " with quota " << quota_mb << " MB");
+  return true;
+}
+
+bool cache_root_enabled() {
+  std::lock_guard<std::mutex> guard(cache_root_mutex);
+  return cache_root_path.length() != 0;
+}
+
+std::string cache_root_directory(const std::string& directory) {
+  std::error_code error_code;
+  auto absolute_directory=std::filesystem::absolute(directory,error_code).lexically_normal().string();
+  if (error_code) {
+    absolute_directory=directory;
+  }
+  std::lock_guard<std::mutex> guard(cache_root_mutex);
+  return (std::filesystem::path(cache_root_path) / CACHE_ROOT_DIRECTORIES_DIRECTORY /
+          cache_root_hex(pyramid_cache_hash_bytes((const unsigned char*)absolute_directory.data(),
+                                                  absolute_directory.size()))).string();
+}
+
+bool cache_root_filename(const std::string& filename,
+                         const std::string& extension,
+                         std::string& cache_directory,
+                         std::string& cache_filename) {
+  INT64 file_size,file_mtime;
+  if (!cache_file_stat(filename,file_size,file_mtime)) {
+    ERROR_LOCAL("Failed to stat file for cache root: " << filename);
+    return false;
+  }
+  std::string key;
+  {
+    std::lock_guard<std::mutex> guard(cache_root_mutex);
+    auto found=cache_root_keys.find(filename);
+    if (found != cache_root_keys.end() &&
+        found->second.file_size == file_size && found->second.file_mtime == file_mtime) {
+      key=found->second.key;
+    }
+  }
+  if (key.length() == 0) {
+    // the size is part of the key so sampled hashes of different
+    // sized images never collide
+    UINT64 hash;
+    if (!pyramid_cache_hash(filename,hash)) {
+      ERROR_LOCAL("Failed to hash file for cache root: " << filename);
+      return false;
+    }
+    key=cache_root_hex(hash)+"-"+cache_root_hex(file_size);
+    std::lock_guard<std::mutex> guard(cache_root_mutex);
+    cache_root_keys[filename]=CacheRootKey{file_size,file_mtime,key};
+  }
+  std::lock_guard<std::mutex> guard(cache_root_mutex);
+  // spread over subdirectories so no directory gets too big
+  cache_directory=(std::filesystem::path(cache_root_path) / CACHE_ROOT_OBJECTS_DIRECTORY / key.substr(0,2)).string();
+  cache_filename=key+"."+extension;
+  return true;
+}
+
+void cache_root_touch(const std::string& cache_filename) {
+  {
+    std::lock_guard<std::mutex> guard(cache_root_mutex);
+    if (cache_root_path.length() == 0 ||
+        !cache_root_touched.insert(cache_filename).second) {
+      return;
+    }
+  }
+  // the modification time is the last use, only the header records
+  // when the source image changed
+  utimensat(AT_FDCWD,cache_filename.c_str(),nullptr,0);
+}
+
+void cache_root_written(const std::string& cache_filename) {
+  INT64 file_size,file_mtime;
+  if (!cache_file_stat(cache_filename,file_size,file_mtime)) {
+    return;
+  }
+  auto evict=false;
+  {
+    std::lock_guard<std::mutex> guard(cache_root_mutex);
+    if (cache_root_path.length() == 0) {
+      return;
+    }
+    if (cache_root_used >= 0) {
+      cache_root_used+=file_size;
+    }
+    evict=(cache_root_quota > 0 &&
+           (cache_root_used < 0 || cache_root_used > cache_root_quota));
+  }
+  if (evict) {
+    cache_root_evict();
+  }
+}
+
+bool cache_root_evict() {
+  std::string root_path;
+  INT64 quota;
+  {
+    std::lock_guard<std::mutex> guard(cache_root_mutex);
+    if (cache_root_path.length() == 0 || cache_root_evicting) {
+      return true;
+    }
+    cache_root_evicting=true;
+    root_path=cache_root_path;
+    quota=cache_root_quota;
+  }
+  // find every cached file with when it was last used, without holding
+  // the lock so loading is never held up by the scan
+  std::vector<std::tuple<INT64,INT64,std::string>> cached_files;
+  INT64 used=0;
+  std::error_code error_code;
+  auto objects_directory=std::filesystem::path(root_path) / CACHE_ROOT_OBJECTS_DIRECTORY;
+  std::filesystem::recursive_directory_iterator it(objects_directory,error_code);
+  for (; !error_code && it != std::filesystem::recursive_directory_iterator(); it.increment(error_code)) {
+    auto path=it->path().string();
+    INT64 file_size,file_mtime;
+    std::error_code file_error_code;
+    if (!it->is_regular_file(file_error_code) || it->path().extension() == ".tmp" ||
+        !cache_file_stat(path,file_size,file_mtime)) {
+      continue;
+    }
+    cached_files.emplace_back(file_mtime,file_size,path);
+    used+=file_size;
+  }
+  std::vector<std::string> evicted_files;
+  if (quota > 0 && used > quota) {
+    auto target=quota/10*CACHE_ROOT_EVICT_TENTHS;
+    std::sort(cached_files.begin(),cached_files.end());
+    for (const auto& cached_file : cached_files) {
+      if (used <= target) {
+        break;
+      }
+      std::error_code remove_error_code;
+      if (std::filesystem::remove(std::get<2>(cached_file),remove_error_code)) {
+        used-=std::get<1>(cached_file);
+        evicted_files.push_back(std::get<2>(cached_file));
+      }
+    }
+    MSG_LOCAL("Evicted " << evicted_files.size() << " cached files from cache root: " << root_path);
+  }
+  std::lock_guard<std::mutex> guard(cache_root_mutex);
+  for (const auto& evicted_file : evicted_files) {
+    cache_root_touched.erase(evicted_file);
+  }
+  cache_root_used=used;
+  cache_root_evicting=false;
+  return (quota <= 0 || used <= quota);
+}
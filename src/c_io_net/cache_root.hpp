@@ -0,0 +1,102 @@
+/**
+ * Header for the central cache root, an optional single cache
+ * directory shared by every grid where cached images are found by a
+ * hash of their contents instead of where the images are.
+ */
+#ifndef CACHE_ROOT_HPP
+#define CACHE_ROOT_HPP
+
+#include "../common.hpp"
+// C++ headers
+#include <string>
+
+// the directory under $XDG_CACHE_HOME or ~/.cache used by default
+const std::string CACHE_ROOT_DEFAULT_NAME{"imagegrid"};
+
+// holds the cached images named by the hash of their contents
+const std::string CACHE_ROOT_OBJECTS_DIRECTORY{"objects"};
+
+// holds the manifests and zip indexes of each image directory
+const std::string CACHE_ROOT_DIRECTORIES_DIRECTORY{"directories"};
+
+// the quota in megabytes if none is given, 0 means no quota
+const INT64 CACHE_ROOT_QUOTA_DEFAULT_MB=16384;
+
+// evicting stops once this many tenths of the quota are used, so
+// eviction does not run again straight away
+const INT64 CACHE_ROOT_EVICT_TENTHS=9;
+
+/**
+ * Find the default cache root, $XDG_CACHE_HOME/imagegrid or
+ * ~/.cache/imagegrid if XDG_CACHE_HOME is not set.
+ *
+ * @return The default cache root, empty if there is no home directory.
+ */
+std::string cache_root_default();
+
+/**
+ * Use a central cache root instead of a cache directory next to each
+ * image.  Must be called before anything is cached.
+ *
+ * @param root The cache root.
+ * @param quota_mb The most megabytes cached images may use, 0 for no
+ *                 quota.
+ * @return If the cache root could be created.
+ */
+bool cache_root_set(const std::string& root,
+                    INT64 quota_mb);
+
+/** @return If a central cache root is used. */
+bool cache_root_enabled();
+
+/**
+ * Find where the manifest and zip index of an image directory are
+ * kept in the cache root.
+ *
+ * @param directory The directory of the images.
+ * @return The directory in the cache root.
+ */
+std::string cache_root_directory(const std::string& directory);
+
+/**
+ * Find the directory and filename of a cached image in the cache
+ * root, named by the hash of the image contents so copies of an image
+ * share one cache.
+ *
+ * @param filename The filename of the image.
+ * @param extension The extension of the cached file.
+ * @param cache_directory Set to the directory of the cached file.
+ * @param cache_filename Set to the cached filename without the directory.
+ * @return If the image could be hashed.
+ */
+bool cache_root_filename(const std::string& filename,
+                         const std::string& extension,
+                         std::string& cache_directory,
+                         std::string& cache_filename);
+
+/**
+ * Mark a cached file in the cache root as used so it is evicted last.
+ *
+ * @param cache_filename The cached file.
+ */
+void cache_root_touch(const std::string& cache_filename);
+
+/**
+ * Count a newly written cached file against the quota, evicting the
+ * least recently used cached files if the quota is exceeded.
+ *
+ * @param cache_filename The cached file.
+ */
+void cache_root_written(const std::string& cache_filename);
+
+/**
+ * Evict the least recently used cached files until the cache root is
+ * within its quota.  Does nothing if another thread is already
+ * evicting.
+ *
+ * @return If the cache root is within its quota, true if another
+ *         thread is evicting.
+ */
+bool cache_root_evict();
+
+#endif
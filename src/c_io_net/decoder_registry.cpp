@@ -0,0 +1,217 @@
+/**
+ * Finding the decoder for an image file from the magic number at the
+ * start of the file.
+ */
+// local headers
+#include "../common.hpp"
+#include "decoder_registry.hpp"
+#include "fileload.hpp"
+// C++ headers
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Load a tiff file, using the cached file if it is enough.
+ */
+bool load_tiff_file_as_rgba(const std::string& filename,
+                            const std::string& cached_filename,
+                            SubGridIndex& current_subgrid,
+                            LoadFileDataTransfer& data_transfer,
+                            INT64* row_temp_buffer) {
+  auto load_successful=load_tiff_as_rgba_cached(filename,
+                                                cached_filename,
+                                                current_subgrid,
+                                                data_transfer,
+                                                row_temp_buffer);
+  if (!load_successful) {
+    load_successful=load_tiff_as_rgba(filename,
+                                      current_subgrid,
+                                      data_transfer,
+                                      row_temp_buffer);
+  }
+  return load_successful;
+}
+
+/**
+ * Load a png file.
+ */
+bool load_png_file_as_rgba(const std::string& filename,
+                           const std::string& /* cached_filename */,
+                           SubGridIndex& current_subgrid,
+                           LoadFileDataTransfer& data_transfer,
+                           INT64* row_temp_buffer) {
+  return load_png_as_rgba(filename,
+                          current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+}
+
+/**
+ * Load a jpeg file.
+ */
+bool load_jpeg_file_as_rgba(const std::string& filename,
+                            const std::string& /* cached_filename */,
+                            SubGridIndex& current_subgrid,
+                            LoadFileDataTransfer& data_transfer,
+                            INT64* row_temp_buffer) {
+  return load_jpeg_as_rgba(filename,
+                           current_subgrid,
+                           data_transfer,
+                           row_temp_buffer);
+}
+
+/**
+ * Load a farbfeld, PPM or PAM file.
+ */
+bool load_raw_file_as_rgba(const std::string& filename,
+                           const std::string& /* cached_filename */,
+                           SubGridIndex& current_subgrid,
+                           LoadFileDataTransfer& data_transfer,
+                           INT64* row_temp_buffer) {
+  return load_raw_as_rgba(filename,
+                          current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+}
+
+/**
+ * Every decoder, the first one with a matching magic number is used.
+ */
+const std::vector<ImageDecoder> image_decoders{
+  {"TIFF",
+   {std::string("II*\0",4),std::string("MM\0*",4),
+    std::string("II+\0",4),std::string("MM\0+",4)},
+   DECODER_CAPABILITY_REGION | DECODER_CAPABILITY_CACHE,
+   check_tiff_file_region,
+   check_tiff,
+   read_tiff_data,
+   load_tiff_file_as_rgba,
+   load_tiff_memory_as_rgba},
+  {"PNG",
+   {std::string("\x89PNG\r\n\x1a\n",8)},
+   0,
+   nullptr,
+   check_png,
+   read_png_data,
+   load_png_file_as_rgba,
+   load_png_memory_as_rgba},
+  {"JPEG",
+   {std::string("\xff\xd8\xff",3)},
+   0,
+   nullptr,
+   check_jpeg,
+   read_jpeg_data,
+   load_jpeg_file_as_rgba,
+   load_jpeg_memory_as_rgba},
+  // NTS files are zip files that contain a tiff
+  {"NTS",
+   {std::string("PK\x03\x04",4)},
+   DECODER_CAPABILITY_REGION | DECODER_CAPABILITY_CACHE,
+   check_nts_region,
+   check_nts,
+   read_nts_data,
+   load_nts_as_rgba,
+   nullptr},
+  // uncompressed files meant for pre-converted datasets
+  {"Raw",
+   {std::string("farbfeld",8),std::string("P6",2),std::string("P7",2)},
+   0,
+   nullptr,
+   check_raw,
+   read_raw_data,
+   load_raw_file_as_rgba,
+   nullptr}
+};
+
+// remember the decoder for each file so files are only probed once
+std::mutex probed_decoders_mutex;
+std::unordered_map<std::string,const ImageDecoder*> probed_decoders;
+// remember if only a region of each file can be loaded
+std::mutex probed_regions_mutex;
+std::unordered_map<std::string,bool> probed_regions;
+
+const ImageDecoder* find_decoder_magic(const unsigned char* header,
+                                       INT64 header_length) {
+  for (const auto& decoder : image_decoders) {
+    for (const auto& magic_number : decoder.magic_numbers) {
+      if ((INT64)magic_number.size() <= header_length &&
+          std::memcmp(header,magic_number.data(),magic_number.size()) == 0) {
+        return &decoder;
+      }
+    }
+  }
+  return nullptr;
+}
+
+/**
+ * Find the decoder for a file without using the remembered result.
+ */
+const ImageDecoder* probe_decoder(const std::string& filename) {
+  unsigned char header[DECODER_MAGIC_MAX_LENGTH];
+  INT64 header_length=0;
+  std::ifstream image_file(filename,std::ios::binary);
+  if (image_file.is_open()) {
+    image_file.read((char*)header,DECODER_MAGIC_MAX_LENGTH);
+    header_length=image_file.gcount();
+  }
+  auto decoder=find_decoder_magic(header,header_length);
+  if (!decoder) {
+    for (const auto& extension_decoder : image_decoders) {
+      if (extension_decoder.check_extension(filename)) {
+        WARN_LOCAL("Using extension to find decoder for: " << filename);
+        decoder=&extension_decoder;
+        break;
+      }
+    }
+  }
+  return decoder;
+}
+
+const ImageDecoder* find_decoder(const std::string& filename) {
+  {
+    std::lock_guard<std::mutex> guard(probed_decoders_mutex);
+    auto probed_decoder=probed_decoders.find(filename);
+    if (probed_decoder != probed_decoders.end()) {
+      return probed_decoder->second;
+    }
+  }
+  auto decoder=probe_decoder(filename);
+  std::lock_guard<std::mutex> guard(probed_decoders_mutex);
+  probed_decoders[filename]=decoder;
+  return decoder;
+}
+
+bool decoder_has_capability(const ImageDecoder* decoder,
+                            unsigned int capability) {
+  return (decoder && (decoder->capabilities & capability) != 0);
+}
+
+bool decoder_check_region(const std::string& filename,
+                          const std::string& cached_filename) {
+  auto decoder=find_decoder(filename);
+  // the cache can change so it is checked every time
+  if (decoder_has_capability(decoder,DECODER_CAPABILITY_CACHE) &&
+      !cached_filename.empty() &&
+      check_tiff_cache_region(filename,cached_filename)) {
+    return true;
+  }
+  if (!decoder_has_capability(decoder,DECODER_CAPABILITY_REGION) ||
+      !decoder->check_region) {
+    return false;
+  }
+  {
+    std::lock_guard<std::mutex> guard(probed_regions_mutex);
+    auto probed_region=probed_regions.find(filename);
+    if (probed_region != probed_regions.end()) {
+      return probed_region->second;
+    }
+  }
+  auto region=decoder->check_region(filename);
+  std::lock_guard<std::mutex> guard(probed_regions_mutex);
+  probed_regions[filename]=region;
+  return region;
+}
@@ -0,0 +1,104 @@
+/**
+ * Header for finding the decoder for an image file from the magic
+ * number at the start of the file.
+ */
+#ifndef DECODER_REGISTRY_HPP
+#define DECODER_REGISTRY_HPP
+
+#include "../common.hpp"
+#include "fileload.hpp"
+// C++ headers
+#include <string>
+#include <vector>
+
+// the capabilities a decoder may have
+// the decoder can load only a region of a full size image for files
+// that pass its check_region
+const unsigned int DECODER_CAPABILITY_REGION=1 << 0;
+// the decoder loads from the cached file instead when it is enough
+const unsigned int DECODER_CAPABILITY_CACHE=1 << 1;
+
+/**
+ * The longest magic number a decoder can declare.
+ */
+const INT64 DECODER_MAGIC_MAX_LENGTH=8;
+
+/**
+ * A decoder for one image format.
+ */
+struct ImageDecoder {
+  /** The name of the format for messages. */
+  const char* name;
+  /** Any of these at the start of a file identify the format. */
+  std::vector<std::string> magic_numbers;
+  /** The DECODER_CAPABILITY_* flags for this decoder. */
+  unsigned int capabilities;
+  /**
+   * Check if only a region of a file can be loaded, nullptr without
+   * DECODER_CAPABILITY_REGION.
+   */
+  bool (*check_region)(const std::string& filename);
+  /** Used if the magic number can't be read, e.g. check_tiff. */
+  bool (*check_extension)(const std::string& filename);
+  /** Read the width and height of an image, see read_data. */
+  bool (*read_data)(const std::string& filename,
+                    INT64& width,
+                    INT64& height);
+  /** Load an image, see load_data_as_rgba. */
+  bool (*load_as_rgba)(const std::string& filename,
+                       const std::string& cached_filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer);
+  /** Load an image already read into memory, nullptr if not supported. */
+  bool (*load_memory_as_rgba)(const std::string& filename,
+                              const std::vector<unsigned char>& file_buffer,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64* row_temp_buffer);
+};
+
+/**
+ * Find the decoder for a file.  The start of the file is only read
+ * the first time a file is seen and the result is remembered.
+ *
+ * @param filename The image file.
+ * @return The decoder or nullptr if no decoder can read the file.
+ */
+const ImageDecoder* find_decoder(const std::string& filename);
+
+/**
+ * Find the decoder for the first bytes of a file.
+ *
+ * @param header The first bytes of the file.
+ * @param header_length The number of bytes in header.
+ * @return The decoder or nullptr if no magic number matches.
+ */
+const ImageDecoder* find_decoder_magic(const unsigned char* header,
+                                       INT64 header_length);
+
+/**
+ * @param decoder The decoder to check, may be nullptr.
+ * @param capability One of the DECODER_CAPABILITY_* flags.
+ * @return If the decoder has the capability, false if there is no
+ *         decoder.
+ */
+bool decoder_has_capability(const ImageDecoder* decoder,
+                            unsigned int capability);
+
+/**
+ * Check if only a region of the full size image of a file can be
+ * loaded, either from its pyramid cache or from the file itself.
+ * What the file itself allows is only checked the first time a file
+ * is seen and the result is remembered.
+ *
+ * @param filename The image file.
+ * @param cached_filename The pyramid cache file, empty if the cache
+ *                        isn't used.
+ * @return If loading a region of the full size image won't load the
+ *         whole image anyways.
+ */
+bool decoder_check_region(const std::string& filename,
+                          const std::string& cached_filename);
+
+#endif
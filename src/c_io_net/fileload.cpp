@@ -5,7 +5,16 @@
 // local headers
 #include "../common.hpp"
 #include "../utility.hpp"
+#include "cache_manifest.hpp"
+#include "cache_root.hpp"
+#include "decoder_registry.hpp"
 #include "fileload.hpp"
+#include "async_read.hpp"
+#include "mapped_file.hpp"
+#include "pyramid_cache.hpp"
+#include "zip_index.hpp"
+#include "zip_reader.hpp"
+#include "../c_misc/buffer_band_reduce.hpp"
 #include "../c_misc/buffer_manip.hpp"
 #include "../datatypes/coordinates.hpp"
 // don't really like this here, but it is here for now
@@ -15,17 +24,24 @@
 #include <filesystem>
 #include <fstream>
 #include <memory>
+#include <mutex>
+#include <new>
 // #include <iostream>
 #include <regex>
 #include <string>
+#include <unordered_set>
 #include <utility>
 #include <vector>
 // C headers
+#include <cctype>
 #include <cmath>
 #include <cstring>
 #include <cstddef>
 #include <cstdint>
 // C library headers
+#include <csetjmp>
+#include <fcntl.h>
+#include <jpeglib.h>
 #include <png.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -38,12 +54,11 @@
 std::regex regex_digits_search("([0-9]{1,4})",std::regex_constants::ECMAScript | std::regex_constants::icase);
 // match each filetype
 // TODO: have better file detection, e.g., magic numbers
-// give an empty file descriptor
-std::regex empty_search("^\\[\\[EMPTY\\]\\]$",std::regex_constants::ECMAScript | std::regex_constants::icase);
 std::regex jpeg_search("\\.jpeg$|\\.jpg$",std::regex_constants::ECMAScript | std::regex_constants::icase);
 std::regex nts_search("\\.zip",std::regex_constants::ECMAScript | std::regex_constants::icase);
 std::regex png_search("\\.png$",std::regex_constants::ECMAScript | std::regex_constants::icase);
 std::regex tiff_search("\\.tiff|\\.tif$",std::regex_constants::ECMAScript | std::regex_constants::icase);
+std::regex raw_search("\\.ff$|\\.ppm$|\\.pam$",std::regex_constants::ECMAScript | std::regex_constants::icase);
 
 std::vector<std::string> load_numbered_images(std::string images_path
                                               // , IMAGEDIRECTION *direction
@@ -154,54 +169,29 @@ bool read_data(const std::string& filename,
   auto cache_successful=false;
   auto successful=true;
   if (use_cache) {
-    // TODO: assuming read always successful if file opens
-    //       files are two lines for now
-    auto filename_txt=create_cache_filename(filename,TEXT_EXTENSION);
-    std::ifstream file_in_text(filename_txt);
-    if (std::filesystem::exists(filename_txt)) {
-      MSG_LOCAL("Using file: " << filename_txt << " as cache for: " << filename);
-      std::string line;
-      std::getline(file_in_text,line);
-      width=std::stoi(line);
-      std::getline(file_in_text,line);
-      height=std::stoi(line);
+    CacheManifestEntry manifest_entry;
+    if (cache_manifest_find(filename,manifest_entry)) {
+      width=manifest_entry.width;
+      height=manifest_entry.height;
       cache_successful=true;
       successful=true;
     }
   }
   if (!cache_successful) {
-    if (check_tiff(filename)) {
-      successful=read_tiff_data(filename,
-                                width,
-                                height);
-    } else if (check_png(filename)) {
-      successful=read_png_data(filename,
-                               width,
-                               height);
-    } else if (check_nts(filename)) {
-      // get temporary tiff
-      std::string temp_filename;
-      int tiff_fd=-1;
-      successful=get_tiff_from_nts_file(filename,
-                                        temp_filename,
-                                        tiff_fd);
-      if (successful) {
-        successful=read_tiff_data(temp_filename,
-                                  width,
-                                  height);
-        if (tiff_fd >= 0) {
-          close(tiff_fd);
-          MSG_LOCAL("Unlinking: " << temp_filename);
-          unlink(temp_filename.c_str());
-        }
-      }
-    } else if (check_empty(filename)) {
+    if (check_empty(filename)) {
       // TODO: find way to not use these as sentinel values
       width=0;
       height=0;
     } else {
-      ERROR_LOCAL("read_data can't read: " << filename);
-      successful=false;
+      auto decoder=find_decoder(filename);
+      if (!decoder) {
+        ERROR_LOCAL("read_data can't read: " << filename);
+        successful=false;
+      } else {
+        successful=decoder->read_data(filename,
+                                      width,
+                                      height);
+      }
     }
   }
   return successful;
@@ -217,61 +207,155 @@ bool load_data_as_rgba(const std::string& filename,
   //       cause program crash, whereas this is also where the check
   //       for empty squares take place
   bool load_successful=false;
-  if (check_tiff(filename)) {
-    MSG_LOCAL("Loading TIFF: " << filename);
-    load_successful=load_tiff_as_rgba_cached(cached_filename,
-                                             current_subgrid,
-                                             data_transfer,
-                                             row_temp_buffer);
-    if (!load_successful) {
-      load_successful=load_tiff_as_rgba(filename,
-                                        current_subgrid,
-                                        data_transfer,
-                                        row_temp_buffer);
-    }
-    MSG_LOCAL("Done TIFF: " << filename);
-  } else if (check_png(filename)) {
-      MSG_LOCAL("Loading PNG: " << filename);
-      // TODO: check success
-      load_successful=load_png_as_rgba(filename,
-                                       current_subgrid,
-                                       data_transfer,
-                                       row_temp_buffer);
-      MSG_LOCAL("Done PNG: " << filename);
-  } else if (check_nts(filename)) {
-    // get temporary tiff
-    std::string temp_filename;
-    int tiff_fd=-1;
-    MSG_LOCAL("Loading NTS: " << filename);
-    load_successful=load_tiff_as_rgba_cached(cached_filename,
-                                             current_subgrid,
-                                             data_transfer,
-                                             row_temp_buffer);
-    if (!load_successful) {
-       load_successful=get_tiff_from_nts_file(filename,
-                                              temp_filename,
-                                              tiff_fd);
-       if (load_successful) {
-         MSG_LOCAL("Loading TIFF: " << temp_filename);
-         load_successful=load_tiff_as_rgba(temp_filename,
-                                           current_subgrid,
-                                           data_transfer,
-                                           row_temp_buffer);
-         if (tiff_fd >= 0) {
-           close(tiff_fd);
-           MSG_LOCAL("Unlinking: " << temp_filename);
-           unlink(temp_filename.c_str());
-         }
-       }
-    }
-    MSG_LOCAL("Done NTS: " << filename);
-  } else if (check_empty(filename)) {
+  if (check_empty(filename)) {
+  } else {
+    auto decoder=find_decoder(filename);
+    if (!decoder) {
+      ERROR_LOCAL("load_data_as_rgba can't load: " << filename);
+    } else {
+      MSG_LOCAL("Loading " << decoder->name << ": " << filename);
+      load_successful=decoder->load_as_rgba(filename,
+                                            cached_filename,
+                                            current_subgrid,
+                                            data_transfer,
+                                            row_temp_buffer);
+      MSG_LOCAL("Done " << decoder->name << ": " << filename);
+    }
+  }
+  return load_successful;
+}
+
+bool check_load_from_memory(const std::string& filename,
+                            const std::string& cached_filename,
+                            LoadFileDataTransfer& data_transfer) {
+  if (check_empty(filename)) {
+    return false;
+  }
+  auto decoder=find_decoder(filename);
+  if (!decoder || !decoder->load_memory_as_rgba) {
+    return false;
+  }
+  // don't read the whole file if the much smaller cached file is used
+  if (decoder_has_capability(decoder,DECODER_CAPABILITY_CACHE) &&
+      check_valid_filename(cached_filename) &&
+      test_tiff_cache(filename,cached_filename,data_transfer)) {
+    return false;
+  }
+  std::error_code file_error;
+  auto file_size=std::filesystem::file_size(filename,file_error);
+  return (!file_error && (INT64)file_size <= ASYNC_READ_MAX_SIZE);
+}
+
+bool load_memory_as_rgba(const std::string& filename,
+                         const std::vector<unsigned char>& file_buffer,
+                         SubGridIndex& current_subgrid,
+                         LoadFileDataTransfer& data_transfer,
+                         INT64* row_temp_buffer) {
+  bool load_successful=false;
+  auto decoder=find_decoder(filename);
+  if (!decoder || !decoder->load_memory_as_rgba) {
+    ERROR_LOCAL("load_memory_as_rgba can't load: " << filename);
   } else {
-    ERROR_LOCAL("load_data_as_rgba can't load: " << filename);
+    MSG_LOCAL("Loading " << decoder->name << " from memory: " << filename);
+    load_successful=decoder->load_memory_as_rgba(filename,
+                                                 file_buffer,
+                                                 current_subgrid,
+                                                 data_transfer,
+                                                 row_temp_buffer);
+    MSG_LOCAL("Done " << decoder->name << ": " << filename);
   }
   return load_successful;
 }
 
+void allocate_zoom_level(INT64 width,
+                         INT64 height,
+                         SubGridIndex& current_subgrid,
+                         LoadFileZoomLevelData& file_data) {
+  auto zoom_out_shift=file_data.zoom_out_shift;
+  INT64 w_reduced=reduce_and_pad(width,1L << zoom_out_shift);
+  INT64 h_reduced=reduce_and_pad(height,1L << zoom_out_shift);
+  file_data.rgba_wpixel.set(current_subgrid,w_reduced);
+  file_data.rgba_hpixel.set(current_subgrid,h_reduced);
+  auto npixels_reduced=w_reduced*h_reduced;
+  file_data.rgba_data.set(current_subgrid,new PIXEL_RGBA[npixels_reduced]);
+  std::memset(file_data.rgba_data[current_subgrid],0,sizeof(PIXEL_RGBA)*npixels_reduced);
+}
+
+void allocate_zoom_level_gray(INT64 width,
+                              INT64 height,
+                              SubGridIndex& current_subgrid,
+                              LoadFileZoomLevelData& file_data) {
+  auto zoom_out_shift=file_data.zoom_out_shift;
+  INT64 w_reduced=reduce_and_pad(width,1L << zoom_out_shift);
+  INT64 h_reduced=reduce_and_pad(height,1L << zoom_out_shift);
+  file_data.rgba_wpixel.set(current_subgrid,w_reduced);
+  file_data.rgba_hpixel.set(current_subgrid,h_reduced);
+  auto npixels_reduced=w_reduced*h_reduced;
+  file_data.index_data.set(current_subgrid,new unsigned char[npixels_reduced]);
+  std::memset(file_data.index_data[current_subgrid],0,npixels_reduced);
+  file_data.palette.set(current_subgrid,nullptr);
+}
+
+void allocate_zoom_levels(INT64 width,
+                          INT64 height,
+                          SubGridIndex& current_subgrid,
+                          LoadFileDataTransfer& data_transfer) {
+  for (const auto& file_data : data_transfer.data_transfer) {
+    allocate_zoom_level(width,
+                        height,
+                        current_subgrid,
+                        *file_data);
+  }
+}
+
+void cascade_zoom_levels(SubGridIndex& current_subgrid,
+                         LoadFileDataTransfer& data_transfer,
+                         INT64* row_temp_buffer) {
+  // this assumes zoom_out is coming in ascending order
+  std::shared_ptr<LoadFileZoomLevelData> last_data;
+  for (const auto& file_data : data_transfer.data_transfer) {
+    // grayscale levels stay grayscale, the level after a palette
+    // indexed one is reduced by its loader
+    if (last_data && !last_data->palette[current_subgrid] &&
+        last_data->index_data[current_subgrid] && file_data->index_data[current_subgrid] &&
+        file_data->zoom_out_shift > last_data->zoom_out_shift) {
+      buffer_reduce_gray(last_data->index_data[current_subgrid],
+                         BufferPixelSize(last_data->rgba_wpixel[current_subgrid],
+                                         last_data->rgba_hpixel[current_subgrid]),
+                         file_data->index_data[current_subgrid],
+                         BufferPixelSize(file_data->rgba_wpixel[current_subgrid],
+                                         file_data->rgba_hpixel[current_subgrid]),
+                         file_data->zoom_out_shift-last_data->zoom_out_shift,
+                         row_temp_buffer);
+    } else if (last_data && last_data->rgba_data[current_subgrid] &&
+               file_data->zoom_out_shift > last_data->zoom_out_shift) {
+      auto step_zoom_out_shift=file_data->zoom_out_shift-last_data->zoom_out_shift;
+      auto source_size=BufferPixelSize(last_data->rgba_wpixel[current_subgrid],
+                                       last_data->rgba_hpixel[current_subgrid]);
+      auto dest_size=BufferPixelSize(file_data->rgba_wpixel[current_subgrid],
+                                     file_data->rgba_hpixel[current_subgrid]);
+      buffer_copy_reduce_standard(last_data->rgba_data[current_subgrid],
+                                  source_size,
+                                  BufferPixelCoordinate(0,0),
+                                  source_size,
+                                  file_data->rgba_data[current_subgrid],
+                                  dest_size,
+                                  dest_size,
+                                  BufferPixelCoordinate(0,0),
+                                  step_zoom_out_shift,
+                                  row_temp_buffer);
+    }
+    last_data=file_data;
+  }
+}
+
+void free_zoom_levels(SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer) {
+  for (const auto& file_data : data_transfer.data_transfer) {
+    file_data->free_rgba_data(current_subgrid);
+  }
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 // load specific files as RGB
 bool read_tiff_data(const std::string& filename,
@@ -284,139 +368,147 @@ bool read_tiff_data(const std::string& filename,
   if (!tif) {
     ERROR_LOCAL("load_tiff_as_rgba() Failed to allocate raster for: " << filename);
   } else {
-    uint32_t w,h;
-    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
-    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
-    width=w;
-    height=h;
+    success=read_tiff_data(tif,
+                           width,
+                           height);
     TIFFClose(tif);
-    success=true;
   }
   return success;
 }
 
-bool test_tiff_cache(const std::string& cached_filename,
-                     LoadFileDataTransfer& data_transfer) {
-  auto can_cache=true;
-  if (check_valid_filename(cached_filename) && !std::filesystem::exists(cached_filename)) {
-    can_cache=false;
+bool read_tiff_data(TIFF* tif,
+                    INT64& width,
+                    INT64& height) {
+  uint32_t w,h;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &w);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &h);
+  width=w;
+  height=h;
+  return true;
+}
+
+bool open_tiff_cache(const std::string& filename,
+                     const std::string& cached_filename,
+                     const LoadFileDataTransfer& data_transfer,
+                     PyramidCacheReader& reader) {
+  if (!check_valid_filename(cached_filename) || !reader.open(cached_filename)) {
     MSG_LOCAL("Cached file does not exist: " << cached_filename);
+    return false;
   }
-  auto sub_w=data_transfer.sub_size.w();
-  auto sub_h=data_transfer.sub_size.h();
-  if (can_cache) {
-    MSG_LOCAL("Cached file exists: " << cached_filename);
-    for (const auto& file_data : data_transfer.data_transfer) {
-      auto max_wpixel=sub_w*file_data->max_sub_wpixel;
-      auto max_hpixel=sub_h*file_data->max_sub_hpixel;
-      if (max_wpixel >= CACHE_MAX_PIXEL_SIZE || max_hpixel >= CACHE_MAX_PIXEL_SIZE) {
-        MSG_LOCAL("cached failed to be useful");
-        can_cache=false;
-        break;
-      }
+  if (!pyramid_cache_source_matches(filename,reader.source())) {
+    MSG_LOCAL("Cached file is out of date: " << cached_filename);
+    return false;
+  }
+  for (const auto& file_data : data_transfer.data_transfer) {
+    INT64 level_width,level_height;
+    if (!reader.find_level(file_data->zoom_out_shift,level_width,level_height)) {
+      MSG_LOCAL("Cached file has no zoom out shift " << file_data->zoom_out_shift << ": " << cached_filename);
+      return false;
     }
   }
-  return can_cache;
+  return true;
 }
 
-bool load_tiff_as_rgba_cached(const std::string& cached_filename,
+bool test_tiff_cache(const std::string& filename,
+                     const std::string& cached_filename,
+                     LoadFileDataTransfer& data_transfer) {
+  PyramidCacheReader reader;
+  return open_tiff_cache(filename,
+                         cached_filename,
+                         data_transfer,
+                         reader);
+}
+
+bool load_tiff_as_rgba_cached(const std::string& filename,
+                              const std::string& cached_filename,
                               SubGridIndex& current_subgrid,
                               LoadFileDataTransfer& data_transfer,
-                              INT64* row_temp_buffer) {
-  auto successful=false;
-  auto sub_w=data_transfer.sub_size.w();
-  auto sub_h=data_transfer.sub_size.h();
+                              INT64* /* row_temp_buffer */) {
+  PyramidCacheReader reader;
+  if (!open_tiff_cache(filename,
+                       cached_filename,
+                       data_transfer,
+                       reader)) {
+    return false;
+  }
+  MSG_LOCAL("Using cached file: " << cached_filename);
+  cache_root_touch(cached_filename);
+  auto successful=true;
+  auto region_used=false;
   auto original_width=data_transfer.original_rgba_wpixel[current_subgrid];
   auto original_height=data_transfer.original_rgba_hpixel[current_subgrid];
-  auto can_cache=test_tiff_cache(cached_filename,
-                                 data_transfer);
-  if (can_cache) {
-    MSG_LOCAL("Using cached file: " << cached_filename);
-    INT64 cached_zoom_out_shift=0;
-    // TODO: this could be a problem amongst wildly varying image sizes
-    //       solutions are to:
-    //           store max width/max height vs zoom_out
-    //           calculate the value in different places with similar functions
-    auto width_test=original_width;
-    auto height_test=original_height;
-    // TODO: this duplicates the calculation in
-    // ImageGrid::_write_cache, there should be a better way once
-    // the data structures are revised
-    while (sub_w*width_test >= CACHE_MAX_PIXEL_SIZE || sub_h*height_test >= CACHE_MAX_PIXEL_SIZE) {
-      cached_zoom_out_shift+=1;
-      width_test=reduce_and_pad(original_width,1L << cached_zoom_out_shift);
-      height_test=reduce_and_pad(original_height,1L << cached_zoom_out_shift);
-    }
-    png_image png_image_local;
-    memset(&png_image_local, 0, sizeof(png_image_local));
-    png_image_local.version=PNG_IMAGE_VERSION;
-    if (png_image_begin_read_from_file(&png_image_local, cached_filename.c_str()) == 0) {
-      ERROR_LOCAL("load_tiff_as_rgba() failed to read from png file: " << cached_filename);
+  auto cache_gray=(reader.channels() == 1);
+  // grayscale caches are kept as grayscale if the user can handle it
+  auto keep_gray=(cache_gray && data_transfer.allow_indexed);
+  std::vector<unsigned char> gray_buffer;
+  for (const auto& file_data : data_transfer.data_transfer) {
+    auto zoom_out_shift=file_data->zoom_out_shift;
+    INT64 level_width,level_height;
+    reader.find_level(zoom_out_shift,level_width,level_height);
+    if (level_width != reduce_and_pad(original_width,1L << zoom_out_shift) ||
+        level_height != reduce_and_pad(original_height,1L << zoom_out_shift)) {
+      WARN_LOCAL("Cached file does not match the image size: " << cached_filename);
+      successful=false;
+      break;
+    }
+    // only the tiles of the full size level that are needed are read
+    INT64 x0=0,y0=0,x1=level_width,y1=level_height;
+    if (data_transfer.region &&
+        data_transfer.data_transfer.size() == 1 &&
+        zoom_out_shift == 0 &&
+        find_tile_aligned_region(current_subgrid,
+                                 data_transfer,
+                                 level_width,level_height,
+                                 reader.tile_size(),reader.tile_size(),
+                                 x0,y0,x1,y1)) {
+      file_data->rgba_xpixel_offset.set(current_subgrid,x0);
+      file_data->rgba_ypixel_offset.set(current_subgrid,y0);
+      region_used=true;
+    }
+    auto region_width=x1-x0;
+    auto region_height=y1-y0;
+    file_data->rgba_wpixel.set(current_subgrid,region_width);
+    file_data->rgba_hpixel.set(current_subgrid,region_height);
+    if (keep_gray) {
+      auto gray_data=new (std::nothrow) unsigned char[region_width*region_height];
+      file_data->index_data.set(current_subgrid,gray_data);
+      file_data->palette.set(current_subgrid,nullptr);
+      successful=(gray_data &&
+                  reader.read_region(zoom_out_shift,x0,y0,x1,y1,gray_data));
     } else {
-      png_bytep png_raster;
-      png_image_local.format=PNG_FORMAT_RGBA;
-      png_raster=new unsigned char[PNG_IMAGE_SIZE(png_image_local)];
-      if (png_raster == NULL) {
-        ERROR_LOCAL("load_tiff_as_rgba() failed to allocate png buffer!");
-      } else {
-        if (png_image_finish_read(&png_image_local, NULL, png_raster, 0, NULL) == 0) {
-          ERROR_LOCAL("load_tiff_as_rgba() failed to read full png image!");
-        } else {
-          // TODO: test for mismatched size
-          auto png_width=(INT64)png_image_local.width;
-          auto png_height=(INT64)png_image_local.height;
-          INT64 last_zoom_out_shift=INT_MAX;
-          BufferPixelSize last_dest_size;
-          PIXEL_RGBA* last_buffer=nullptr;
-          for (const auto& file_data : data_transfer.data_transfer) {
-            auto zoom_out_shift=file_data->zoom_out_shift;
-            auto actual_zoom_out_shift=file_data->zoom_out_shift-cached_zoom_out_shift;
-            // TODO: might want to add an assert here but should be safe due to earlier check
-            INT64 w_reduced=reduce_and_pad(original_width,1L << zoom_out_shift);
-            INT64 h_reduced=reduce_and_pad(original_height,1L << zoom_out_shift);
-            file_data->rgba_wpixel.set(current_subgrid,w_reduced);
-            file_data->rgba_hpixel.set(current_subgrid,h_reduced);
-            INT64 npixels_reduced=w_reduced*h_reduced;
-            file_data->rgba_data.set(current_subgrid,new PIXEL_RGBA[npixels_reduced]);
-            std::memset(file_data->rgba_data[current_subgrid],0,sizeof(PIXEL_RGBA)*npixels_reduced);
-            if (last_buffer && zoom_out_shift > last_zoom_out_shift) {
-              auto step_zoom_out_shift=actual_zoom_out_shift-last_zoom_out_shift;
-              auto source_size=last_dest_size;
-              auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-              buffer_copy_reduce_standard(last_buffer,
-                                          source_size,
-                                          BufferPixelCoordinate(0,0),
-                                          source_size,
-                                          file_data->rgba_data[current_subgrid],
-                                          dest_size,
-                                          dest_size,
-                                          BufferPixelCoordinate(0,0),
-                                          step_zoom_out_shift,
-                                          row_temp_buffer);
-            } else {
-              auto source_size=BufferPixelSize(png_width,png_height);
-              auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-              buffer_copy_reduce_standard((PIXEL_RGBA*)png_raster,
-                                          source_size,
-                                          BufferPixelCoordinate(0,0),
-                                          source_size,
-                                          file_data->rgba_data[current_subgrid],
-                                          dest_size,
-                                          dest_size,
-                                          BufferPixelCoordinate(0,0),
-                                          actual_zoom_out_shift,
-                                          row_temp_buffer);
-            }
-            last_dest_size=BufferPixelSize(w_reduced,h_reduced);
-            last_zoom_out_shift=actual_zoom_out_shift;
-            last_buffer=file_data->rgba_data[current_subgrid];
-          }
+      auto rgba_data=new (std::nothrow) PIXEL_RGBA[region_width*region_height];
+      file_data->rgba_data.set(current_subgrid,rgba_data);
+      if (!rgba_data) {
+        successful=false;
+      } else if (cache_gray) {
+        gray_buffer.resize(region_width*region_height);
+        successful=reader.read_region(zoom_out_shift,x0,y0,x1,y1,gray_buffer.data());
+        if (successful) {
+          buffer_expand_gray_row(gray_buffer.data(),rgba_data,region_width*region_height);
         }
-        delete[] png_raster;
-        successful=true;
-        return successful;
+      } else {
+        successful=reader.read_region(zoom_out_shift,x0,y0,x1,y1,(unsigned char*)rgba_data);
       }
     }
+    if (!successful) {
+      ERROR_LOCAL("Failed to load cached file: " << cached_filename);
+      break;
+    }
+  }
+  if (successful) {
+    if (region_used) {
+      data_transfer.region_loaded=true;
+    }
+    if (data_transfer.track_cache_loaded) {
+      data_transfer.cache_loaded.set(current_subgrid,true);
+    }
+  } else {
+    for (const auto& file_data : data_transfer.data_transfer) {
+      file_data->rgba_xpixel_offset.set(current_subgrid,0);
+      file_data->rgba_ypixel_offset.set(current_subgrid,0);
+    }
+    free_zoom_levels(current_subgrid,
+                     data_transfer);
   }
   return successful;
 }
@@ -426,71 +518,1033 @@ bool load_tiff_as_rgba(const std::string& filename,
                        LoadFileDataTransfer& data_transfer,
                        INT64* row_temp_buffer) {
   auto success=false;
-  TIFF* tif=TIFFOpen(filename.c_str(), "r");
+  // read through a memory map so the page cache is used directly,
+  // falling back to libtiff's own reads if mapping isn't possible
+  MappedFile mapped_file;
+  TiffMemorySource tiff_source{nullptr,0,0};
+  TIFF* tif;
+  if (mapped_file.open(filename)) {
+    tiff_source.data=mapped_file.data();
+    tiff_source.size=(toff_t)mapped_file.size();
+    tif=open_tiff_memory(filename,tiff_source);
+  } else {
+    tif=TIFFOpen(filename.c_str(), "r");
+  }
   if (!tif) {
     ERROR_LOCAL("load_tiff_as_rgba() Failed to allocate raster for: " << filename);
   } else {
-    uint32_t tiff_width,tiff_height;
-    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
-    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
-    size_t npixels;
-    uint32_t* raster;
-    npixels=tiff_width*tiff_height;
-    raster=(uint32_t*)_TIFFmalloc(npixels*sizeof(uint32_t));
-    if (raster == NULL) {
-      ERROR_LOCAL("Failed to allocate raster for: " << filename);
-    } else {
-      if (!TIFFReadRGBAImageOriented(tif, tiff_width, tiff_height, raster, ORIENTATION_TOPLEFT, 0)) {
-        ERROR_LOCAL("Failed to read: " << filename);
-      } else {
-        // convert raster
-        // this assumes zoom_out is coming in ascending order
-        INT64 last_zoom_out_shift=INT_MAX;
-        BufferPixelSize last_dest_size;
-        PIXEL_RGBA* last_buffer=nullptr;
-        for (const auto& file_data : data_transfer.data_transfer) {
-          auto zoom_out_shift=file_data->zoom_out_shift;
-          INT64 w_reduced=reduce_and_pad(tiff_width,1L << zoom_out_shift);
-          INT64 h_reduced=reduce_and_pad(tiff_height,1L << zoom_out_shift);
-          file_data->rgba_wpixel.set(current_subgrid,w_reduced);
-          file_data->rgba_hpixel.set(current_subgrid,h_reduced);
-          auto npixels_reduced=w_reduced*h_reduced;
-          file_data->rgba_data.set(current_subgrid,new PIXEL_RGBA[npixels_reduced]);
-          std::memset(file_data->rgba_data[current_subgrid],0,sizeof(PIXEL_RGBA)*npixels_reduced);
-          if (last_buffer && zoom_out_shift > last_zoom_out_shift) {
-            auto step_zoom_out_shift=zoom_out_shift-last_zoom_out_shift;
-            auto source_size=last_dest_size;
-            auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-            buffer_copy_reduce_standard(last_buffer,
-                                        source_size,
-                                        BufferPixelCoordinate(0,0),
-                                        source_size,
-                                        file_data->rgba_data[current_subgrid],
-                                        dest_size,
-                                        dest_size,
-                                        BufferPixelCoordinate(0,0),
-                                        step_zoom_out_shift,
-                                        row_temp_buffer);
-          } else {
-            auto source_size=BufferPixelSize(tiff_width,tiff_height);
-            auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-            buffer_copy_reduce_tiff(raster,
-                                    source_size,
-                                    file_data->rgba_data[current_subgrid],
-                                    dest_size,
-                                    zoom_out_shift,
+    success=load_tiff_as_rgba(tif,
+                              filename,
+                              current_subgrid,
+                              data_transfer,
+                              row_temp_buffer);
+    TIFFClose(tif);
+  }
+  return success;
+}
+
+bool load_tiff_as_rgba(TIFF* tif,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer) {
+  auto success=false;
+  uint32_t tiff_width,tiff_height;
+  uint16_t tiff_orientation;
+  INT64 region_x0,region_y0,region_x1,region_y1;
+  TiffSampleLayout sample_layout;
+  std::vector<PIXEL_RGBA> palette_entries;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &tiff_orientation);
+  if (tiff_orientation != ORIENTATION_TOPLEFT) {
+    // strips and tiles come out in file order, so let libtiff
+    // reorient the whole image at once for anything unusual
+    success=load_tiff_as_rgba_whole(tif,
+                                    filename,
+                                    current_subgrid,
+                                    data_transfer,
                                     row_temp_buffer);
+  } else if (check_tiff_high_depth(tif,
+                                   sample_layout)) {
+    allocate_zoom_levels(tiff_width,
+                         tiff_height,
+                         current_subgrid,
+                         data_transfer);
+    const auto& first_data=data_transfer.data_transfer.front();
+    BufferBandReduce band_reduce(BufferPixelSize(tiff_width,tiff_height),
+                                 first_data->rgba_data[current_subgrid],
+                                 BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                                 first_data->rgba_hpixel[current_subgrid]),
+                                 first_data->zoom_out_shift,
+                                 row_temp_buffer);
+    if (!band_reduce.valid()) {
+      ERROR_LOCAL("Failed to allocate band for: " << filename);
+    } else {
+      success=load_tiff_high_depth(tif,
+                                   filename,
+                                   sample_layout,
+                                   data_transfer.stretch_color,
+                                   band_reduce);
+    }
+    if (success) {
+      band_reduce.finish();
+      cascade_zoom_levels(current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+    } else {
+      free_zoom_levels(current_subgrid,
+                       data_transfer);
+    }
+  } else if (data_transfer.region &&
+             check_tiff_region(tif) &&
+             data_transfer.data_transfer.size() == 1 &&
+             data_transfer.data_transfer.front()->zoom_out_shift == 0 &&
+             find_tiff_region(tif,
+                              current_subgrid,
+                              data_transfer,
+                              region_x0,region_y0,
+                              region_x1,region_y1)) {
+    success=load_tiff_region_as_rgba(tif,
+                                     filename,
+                                     current_subgrid,
+                                     data_transfer,
+                                     region_x0,region_y0,
+                                     region_x1,region_y1);
+  } else if (check_tiff_palette(tif,
+                                data_transfer,
+                                palette_entries)) {
+    success=load_tiff_palette(tif,
+                              filename,
+                              current_subgrid,
+                              data_transfer,
+                              std::make_shared<std::vector<PIXEL_RGBA>>(std::move(palette_entries)),
+                              row_temp_buffer);
+  } else if (check_tiff_gray(tif,
+                             data_transfer)) {
+    success=load_tiff_gray(tif,
+                           filename,
+                           current_subgrid,
+                           data_transfer,
+                           row_temp_buffer);
+  } else {
+    allocate_zoom_levels(tiff_width,
+                         tiff_height,
+                         current_subgrid,
+                         data_transfer);
+    // the first zoom level is reduced directly from the file a band
+    // at a time, the rest from the zoom level before
+    const auto& first_data=data_transfer.data_transfer.front();
+    // start from an overview if the file has a suitable one
+    INT64 overview_zoom_out_shift=0;
+    auto source_width=(INT64)tiff_width;
+    auto source_height=(INT64)tiff_height;
+    if (find_tiff_overview(tif,
+                           tiff_width,
+                           tiff_height,
+                           first_data->zoom_out_shift,
+                           overview_zoom_out_shift)) {
+      MSG_LOCAL("Using overview reduced by " << (1L << overview_zoom_out_shift) << " for: " << filename);
+      source_width=reduce_and_pad(tiff_width,1L << overview_zoom_out_shift);
+      source_height=reduce_and_pad(tiff_height,1L << overview_zoom_out_shift);
+    }
+    BufferBandReduce band_reduce(BufferPixelSize(source_width,source_height),
+                                 first_data->rgba_data[current_subgrid],
+                                 BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                                 first_data->rgba_hpixel[current_subgrid]),
+                                 first_data->zoom_out_shift-overview_zoom_out_shift,
+                                 row_temp_buffer);
+    auto memory_source=tiff_memory_source(tif);
+    INT64 samples_per_pixel;
+    if (!band_reduce.valid()) {
+      ERROR_LOCAL("Failed to allocate band for: " << filename);
+    } else if (memory_source &&
+               check_tiff_mapped(tif,
+                                 *memory_source,
+                                 samples_per_pixel)) {
+      load_tiff_mapped(tif,
+                       *memory_source,
+                       samples_per_pixel,
+                       band_reduce);
+      success=true;
+    } else if (TIFFIsTiled(tif)) {
+      success=load_tiff_tiles(tif,
+                              filename,
+                              TIFF_DECODE_BATCH_MAX_BYTES,
+                              band_reduce);
+    } else {
+      success=load_tiff_strips(tif,
+                               filename,
+                               TIFF_DECODE_BATCH_MAX_BYTES,
+                               band_reduce);
+    }
+    if (success) {
+      band_reduce.finish();
+      cascade_zoom_levels(current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+    } else {
+      free_zoom_levels(current_subgrid,
+                       data_transfer);
+    }
+  }
+  return success;
+}
+
+bool find_tiff_overview(TIFF* tif,
+                        INT64 width,
+                        INT64 height,
+                        INT64 max_zoom_out_shift,
+                        INT64& overview_zoom_out_shift) {
+  overview_zoom_out_shift=0;
+  if (max_zoom_out_shift <= 0) {
+    return false;
+  }
+  // copy the SubIFD offsets since they go away when changing directories
+  std::vector<toff_t> subifd_offsets;
+  uint16_t subifd_count;
+  toff_t* subifd_array;
+  if (TIFFGetField(tif, TIFFTAG_SUBIFD, &subifd_count, &subifd_array)) {
+    subifd_offsets.assign(subifd_array,subifd_array+subifd_count);
+  }
+  // the amount the current directory is reduced by, or zero if it is
+  // not a usable overview
+  auto overview_shift=[&]() -> INT64 {
+    uint32_t subfile_type,overview_width,overview_height;
+    uint16_t overview_orientation;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_SUBFILETYPE, &subfile_type);
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &overview_orientation);
+    if (!(subfile_type & FILETYPE_REDUCEDIMAGE) ||
+        overview_orientation != ORIENTATION_TOPLEFT) {
+      return 0;
+    }
+    TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &overview_width);
+    TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &overview_height);
+    // only overviews that line up exactly with a zoom level are used
+    for (INT64 shift=max_zoom_out_shift; shift > 0; shift--) {
+      if ((INT64)overview_width == reduce_and_pad(width,1L << shift) &&
+          (INT64)overview_height == reduce_and_pad(height,1L << shift)) {
+        return shift;
+      }
+    }
+    return 0;
+  };
+  // overviews are either extra top level directories or SubIFDs of
+  // the first directory
+  INT64 best_directory=-1;
+  toff_t best_offset=0;
+  auto number_directories=(INT64)TIFFNumberOfDirectories(tif);
+  for (INT64 directory=1; directory < number_directories; directory++) {
+    if (TIFFSetDirectory(tif,(tdir_t)directory)) {
+      auto shift=overview_shift();
+      if (shift > overview_zoom_out_shift) {
+        overview_zoom_out_shift=shift;
+        best_directory=directory;
+      }
+    }
+  }
+  for (const auto& offset : subifd_offsets) {
+    if (TIFFSetSubDirectory(tif,offset)) {
+      auto shift=overview_shift();
+      if (shift > overview_zoom_out_shift) {
+        overview_zoom_out_shift=shift;
+        best_directory=-1;
+        best_offset=offset;
+      }
+    }
+  }
+  // leave the file on the directory to read from
+  if (best_directory >= 0) {
+    TIFFSetDirectory(tif,(tdir_t)best_directory);
+  } else if (best_offset != 0) {
+    TIFFSetSubDirectory(tif,best_offset);
+  } else {
+    TIFFSetDirectory(tif,0);
+  }
+  return overview_zoom_out_shift > 0;
+}
+
+TiffDecodeWorkers::TiffDecodeWorkers(TIFF* tif,
+                                     const std::string& filename,
+                                     INT64 max_workers) {
+  this->_handles.push_back(tif);
+  auto memory_source=tiff_memory_source(tif);
+  auto directory_offset=TIFFCurrentDirOffset(tif);
+  for (INT64 worker=1; worker < max_workers; worker++) {
+    TIFF* worker_tif;
+    if (memory_source) {
+      // each handle needs its own position in the shared memory
+      this->_sources.push_back(std::make_unique<TiffMemorySource>(TiffMemorySource{memory_source->data,memory_source->size,0}));
+      worker_tif=open_tiff_memory(filename,*this->_sources.back());
+    } else {
+      worker_tif=TIFFOpen(filename.c_str(), "r");
+    }
+    if (!worker_tif) {
+      break;
+    }
+    // overviews may be SubIFDs so go by offset rather than index
+    if (!TIFFSetSubDirectory(worker_tif,directory_offset)) {
+      TIFFClose(worker_tif);
+      break;
+    }
+    this->_handles.push_back(worker_tif);
+  }
+}
+
+TiffDecodeWorkers::~TiffDecodeWorkers() {
+  // the first handle belongs to the caller
+  for (size_t worker=1; worker < this->_handles.size(); worker++) {
+    TIFFClose(this->_handles[worker]);
+  }
+}
+
+INT64 TiffDecodeWorkers::count() const {
+  return this->_handles.size();
+}
+
+TIFF* TiffDecodeWorkers::handle(INT64 worker) const {
+  return this->_handles[worker];
+}
+
+bool load_tiff_strips(TIFF* tif,
+                      const std::string& filename,
+                      INT64 batch_max_bytes,
+                      BufferBandReduce& band_reduce) {
+  auto success=true;
+  uint32_t tiff_width,tiff_height,tiff_rows_per_strip;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &tiff_rows_per_strip);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  INT64 rows_per_strip=std::max(std::min((INT64)tiff_rows_per_strip,height),(INT64)1);
+  INT64 strip_count=(height+rows_per_strip-1)/rows_per_strip;
+  // strips are compressed independently so a batch of them is
+  // decompressed at once, one handle per thread, into one half of the
+  // raster while the batch before is passed on in order from the other
+  INT64 strip_pixels=width*rows_per_strip;
+  auto batch_strips=std::max(std::min(batch_max_bytes/2/std::max((INT64)(strip_pixels*sizeof(uint32_t)),(INT64)1),
+                                      strip_count),
+                             (INT64)1);
+  auto batch_rows=rows_per_strip*batch_strips;
+  TiffDecodeWorkers workers(tif,
+                            filename,
+                            worker_thread_count(TIFF_DECODE_THREADS_MAX,batch_strips));
+  WorkerPool pool(workers.count());
+  auto raster=(uint32_t*)_TIFFmalloc(strip_pixels*batch_strips*2*sizeof(uint32_t));
+  if (raster == NULL) {
+    ERROR_LOCAL("Failed to allocate strip for: " << filename);
+    success=false;
+  } else {
+    std::vector<char> strip_success(batch_strips*2);
+    auto start_batch=[&](INT64 batch_row) {
+      auto first_slot=((batch_row/batch_rows)%2)*batch_strips;
+      pool.start(std::min(batch_strips,(height-batch_row+rows_per_strip-1)/rows_per_strip),
+                 [&,batch_row,first_slot](INT64 worker, INT64 i) {
+                   strip_success[first_slot+i]=TIFFReadRGBAStrip(workers.handle(worker),
+                                                                 batch_row+i*rows_per_strip,
+                                                                 raster+(first_slot+i)*strip_pixels);
+                 });
+    };
+    start_batch(0);
+    for (INT64 batch_row=0; batch_row < height && success; batch_row+=batch_rows) {
+      pool.wait();
+      if (batch_row+batch_rows < height) {
+        start_batch(batch_row+batch_rows);
+      }
+      auto first_slot=((batch_row/batch_rows)%2)*batch_strips;
+      auto batch_count=std::min(batch_strips,(height-batch_row+rows_per_strip-1)/rows_per_strip);
+      for (INT64 i=0; i < batch_count; i++) {
+        auto strip_row=batch_row+i*rows_per_strip;
+        if (!strip_success[first_slot+i]) {
+          ERROR_LOCAL("Failed to read strip at row " << strip_row << " of: " << filename);
+          success=false;
+          break;
+        }
+        // libtiff returns each strip bottom row first
+        auto strip_rows=std::min(rows_per_strip,height-strip_row);
+        auto strip_raster=raster+(first_slot+i)*strip_pixels;
+        for (INT64 r=0; r < strip_rows; r++) {
+          buffer_copy_row_tiff(strip_raster+(strip_rows-1-r)*width,
+                               band_reduce.next_row(),
+                               width);
+          band_reduce.commit_row();
+        }
+      }
+    }
+    // the next batch may still be decoding into the raster
+    pool.wait();
+    _TIFFfree(raster);
+  }
+  return success;
+}
 
+bool load_tiff_tiles(TIFF* tif,
+                     const std::string& filename,
+                     INT64 batch_max_bytes,
+                     BufferBandReduce& band_reduce) {
+  auto success=true;
+  uint32_t tiff_width,tiff_height,tiff_tile_width,tiff_tile_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tiff_tile_width);
+  TIFFGetField(tif, TIFFTAG_TILELENGTH, &tiff_tile_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  INT64 tile_width=tiff_tile_width;
+  INT64 tile_height=tiff_tile_height;
+  INT64 tiles_across=(width+tile_width-1)/tile_width;
+  INT64 tiles_down=(height+tile_height-1)/tile_height;
+  // the tiles of a batch of tile rows are decompressed in parallel,
+  // one handle and tile buffer per thread, and gathered into one half
+  // of the row buffer while the batch before is passed on from the other
+  INT64 tile_row_pixels=width*tile_height;
+  auto batch_tile_rows=std::max(std::min(batch_max_bytes/2/std::max((INT64)(tile_row_pixels*sizeof(uint32_t)),(INT64)1),
+                                         tiles_down),
+                                (INT64)1);
+  auto batch_rows=tile_height*batch_tile_rows;
+  TiffDecodeWorkers workers(tif,
+                            filename,
+                            worker_thread_count(TIFF_DECODE_THREADS_MAX,tiles_across*batch_tile_rows));
+  WorkerPool pool(workers.count());
+  auto raster=(uint32_t*)_TIFFmalloc(tile_width*tile_height*workers.count()*sizeof(uint32_t));
+  auto tile_row_buffer=(uint32_t*)_TIFFmalloc(tile_row_pixels*batch_tile_rows*2*sizeof(uint32_t));
+  if (raster == NULL || tile_row_buffer == NULL) {
+    ERROR_LOCAL("Failed to allocate tiles for: " << filename);
+    success=false;
+  } else {
+    std::vector<char> tile_success(tiles_across*batch_tile_rows*2);
+    auto start_batch=[&](INT64 batch_y) {
+      auto first_tile_row=((batch_y/batch_rows)%2)*batch_tile_rows;
+      auto batch_count=std::min(batch_tile_rows,(height-batch_y+tile_height-1)/tile_height);
+      pool.start(batch_count*tiles_across,
+                 [&,batch_y,first_tile_row](INT64 worker, INT64 i) {
+                   auto tile_row=i/tiles_across;
+                   auto tile_x=(i%tiles_across)*tile_width;
+                   auto tile_y=batch_y+tile_row*tile_height;
+                   auto worker_raster=raster+worker*tile_width*tile_height;
+                   auto slot=(first_tile_row+tile_row)*tiles_across+i%tiles_across;
+                   tile_success[slot]=TIFFReadRGBATile(workers.handle(worker), tile_x, tile_y, worker_raster);
+                   if (tile_success[slot]) {
+                     // libtiff returns each tile bottom row first
+                     auto tile_rows=std::min(tile_height,height-tile_y);
+                     auto tile_columns=std::min(tile_width,width-tile_x);
+                     auto row_buffer=tile_row_buffer+(first_tile_row+tile_row)*tile_row_pixels;
+                     for (INT64 r=0; r < tile_rows; r++) {
+                       std::memcpy(row_buffer+r*width+tile_x,
+                                   worker_raster+(tile_height-1-r)*tile_width,
+                                   tile_columns*sizeof(uint32_t));
+                     }
+                   }
+                 });
+    };
+    start_batch(0);
+    for (INT64 batch_y=0; batch_y < height && success; batch_y+=batch_rows) {
+      pool.wait();
+      if (batch_y+batch_rows < height) {
+        start_batch(batch_y+batch_rows);
+      }
+      auto first_tile_row=((batch_y/batch_rows)%2)*batch_tile_rows;
+      auto batch_count=std::min(batch_tile_rows,(height-batch_y+tile_height-1)/tile_height);
+      for (INT64 tile_row=0; tile_row < batch_count && success; tile_row++) {
+        auto tile_y=batch_y+tile_row*tile_height;
+        for (INT64 i=0; i < tiles_across; i++) {
+          if (!tile_success[(first_tile_row+tile_row)*tiles_across+i]) {
+            ERROR_LOCAL("Failed to read tile at " << i*tile_width << "," << tile_y << " of: " << filename);
+            success=false;
+            break;
+          }
+        }
+        if (success) {
+          auto row_buffer=tile_row_buffer+(first_tile_row+tile_row)*tile_row_pixels;
+          auto tile_rows=std::min(tile_height,height-tile_y);
+          for (INT64 r=0; r < tile_rows; r++) {
+            buffer_copy_row_tiff(row_buffer+r*width,
+                                 band_reduce.next_row(),
+                                 width);
+            band_reduce.commit_row();
           }
-          last_dest_size=BufferPixelSize(w_reduced,h_reduced);
-          last_zoom_out_shift=zoom_out_shift;
-          last_buffer=file_data->rgba_data[current_subgrid];
         }
-        success=true;
       }
-      _TIFFfree(raster);
     }
-    TIFFClose(tif);
+  }
+  // the next batch may still be decoding into the buffers
+  pool.wait();
+  if (raster) { _TIFFfree(raster); }
+  if (tile_row_buffer) { _TIFFfree(tile_row_buffer); }
+  return success;
+}
+
+bool check_tiff_palette(TIFF* tif,
+                        const LoadFileDataTransfer& data_transfer,
+                        std::vector<PIXEL_RGBA>& palette) {
+  // only the full size zoom level is kept as indices
+  if (!data_transfer.allow_indexed ||
+      data_transfer.data_transfer.empty() ||
+      data_transfer.data_transfer.front()->zoom_out_shift != 0 ||
+      TIFFIsTiled(tif)) {
+    return false;
+  }
+  uint16_t bits_per_sample,samples_per_pixel,planar_config,photometric;
+  uint16_t *red,*green,*blue;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar_config);
+  if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric) ||
+      photometric != PHOTOMETRIC_PALETTE ||
+      bits_per_sample != 8 ||
+      samples_per_pixel != 1 ||
+      planar_config != PLANARCONFIG_CONTIG ||
+      !TIFFGetField(tif, TIFFTAG_COLORMAP, &red, &green, &blue)) {
+    return false;
+  }
+  palette.resize(BUFFER_PALETTE_SIZE);
+  buffer_palette_from_colormap(red,green,blue,1L << bits_per_sample,palette.data());
+  return true;
+}
+
+bool load_tiff_palette(TIFF* tif,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       std::shared_ptr<std::vector<PIXEL_RGBA>> palette,
+                       INT64* row_temp_buffer) {
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  const auto& first_data=data_transfer.data_transfer.front();
+  auto index_data=new (std::nothrow) unsigned char[width*height];
+  if (!index_data) {
+    ERROR_LOCAL("Failed to allocate indices for: " << filename);
+    return false;
+  }
+  first_data->rgba_wpixel.set(current_subgrid,width);
+  first_data->rgba_hpixel.set(current_subgrid,height);
+  first_data->index_data.set(current_subgrid,index_data);
+  first_data->palette.set(current_subgrid,palette);
+  for (size_t k=1; k < data_transfer.data_transfer.size(); k++) {
+    allocate_zoom_level(width,
+                        height,
+                        current_subgrid,
+                        *data_transfer.data_transfer[k]);
+  }
+  auto success=read_tiff_strips_8bit(tif,
+                                     filename,
+                                     width,
+                                     height,
+                                     index_data);
+  // the next zoom level is reduced from expanded rows, the rest cascade from it
+  if (success && data_transfer.data_transfer.size() > 1) {
+    const auto& second_data=data_transfer.data_transfer[1];
+    BufferBandReduce band_reduce(BufferPixelSize(width,height),
+                                 second_data->rgba_data[current_subgrid],
+                                 BufferPixelSize(second_data->rgba_wpixel[current_subgrid],
+                                                 second_data->rgba_hpixel[current_subgrid]),
+                                 second_data->zoom_out_shift,
+                                 row_temp_buffer);
+    if (!band_reduce.valid()) {
+      ERROR_LOCAL("Failed to allocate band for: " << filename);
+      success=false;
+    } else {
+      for (INT64 j=0; j < height; j++) {
+        buffer_expand_palette_row(index_data+j*width,
+                                  palette->data(),
+                                  band_reduce.next_row(),
+                                  width);
+        band_reduce.commit_row();
+      }
+      band_reduce.finish();
+      cascade_zoom_levels(current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+    }
+  }
+  if (!success) {
+    free_zoom_levels(current_subgrid,
+                     data_transfer);
+  }
+  return success;
+}
+
+bool check_tiff_gray(TIFF* tif,
+                     const LoadFileDataTransfer& data_transfer) {
+  // the first zoom level is decoded in place so it must be full size
+  if (!data_transfer.allow_indexed ||
+      data_transfer.data_transfer.empty() ||
+      data_transfer.data_transfer.front()->zoom_out_shift != 0 ||
+      TIFFIsTiled(tif)) {
+    return false;
+  }
+  uint16_t bits_per_sample,samples_per_pixel,sample_format,planar_config,photometric;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &sample_format);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar_config);
+  return (TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric) &&
+          photometric == PHOTOMETRIC_MINISBLACK &&
+          bits_per_sample == 8 &&
+          samples_per_pixel == 1 &&
+          sample_format == SAMPLEFORMAT_UINT &&
+          planar_config == PLANARCONFIG_CONTIG);
+}
+
+bool load_tiff_gray(TIFF* tif,
+                    const std::string& filename,
+                    SubGridIndex& current_subgrid,
+                    LoadFileDataTransfer& data_transfer,
+                    INT64* row_temp_buffer) {
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  for (const auto& file_data : data_transfer.data_transfer) {
+    allocate_zoom_level_gray(width,
+                             height,
+                             current_subgrid,
+                             *file_data);
+  }
+  const auto& first_data=data_transfer.data_transfer.front();
+  auto success=read_tiff_strips_8bit(tif,
+                                     filename,
+                                     width,
+                                     height,
+                                     first_data->index_data[current_subgrid]);
+  if (success) {
+    cascade_zoom_levels(current_subgrid,
+                        data_transfer,
+                        row_temp_buffer);
+  } else {
+    free_zoom_levels(current_subgrid,
+                     data_transfer);
+  }
+  return success;
+}
+
+bool read_tiff_strips_8bit(TIFF* tif,
+                           const std::string& filename,
+                           INT64 width,
+                           INT64 height,
+                           unsigned char* data) {
+  uint32_t tiff_rows_per_strip;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &tiff_rows_per_strip);
+  INT64 rows_per_strip=std::max(std::min((INT64)tiff_rows_per_strip,height),(INT64)1);
+  INT64 strip_count=(height+rows_per_strip-1)/rows_per_strip;
+  // each strip is exactly its rows of pixels so it is decoded in place
+  TiffDecodeWorkers workers(tif,
+                            filename,
+                            worker_thread_count(TIFF_DECODE_THREADS_MAX,strip_count));
+  std::vector<char> strip_success(strip_count);
+  parallel_for(strip_count,
+               workers.count(),
+               [&](INT64 worker, INT64 i) {
+                 auto strip_row=i*rows_per_strip;
+                 auto strip_size=std::min(rows_per_strip,height-strip_row)*width;
+                 strip_success[i]=(TIFFReadEncodedStrip(workers.handle(worker),
+                                                        i,
+                                                        data+strip_row*width,
+                                                        strip_size) == strip_size);
+               });
+  for (INT64 i=0; i < strip_count; i++) {
+    if (!strip_success[i]) {
+      ERROR_LOCAL("Failed to read strip at row " << i*rows_per_strip << " of: " << filename);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool check_tiff_high_depth(TIFF* tif,
+                           TiffSampleLayout& sample_layout) {
+  uint16_t bits_per_sample,samples_per_pixel,sample_format,planar_config,photometric;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &samples_per_pixel);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &sample_format);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar_config);
+  if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric) ||
+      planar_config != PLANARCONFIG_CONTIG ||
+      !((photometric == PHOTOMETRIC_MINISBLACK && samples_per_pixel >= 1) ||
+        (photometric == PHOTOMETRIC_RGB && samples_per_pixel >= 3))) {
+    return false;
+  }
+  // libtiff only shifts 16-bit samples down to 8 bits, which leaves
+  // images that use a small part of the range nearly black
+  auto high_depth=((sample_format == SAMPLEFORMAT_IEEEFP && (bits_per_sample == 32 || bits_per_sample == 64)) ||
+                   (sample_format == SAMPLEFORMAT_INT && (bits_per_sample == 16 || bits_per_sample == 32)) ||
+                   (sample_format == SAMPLEFORMAT_UINT && (bits_per_sample == 16 || bits_per_sample == 32)));
+  if (high_depth) {
+    sample_layout.bits_per_sample=bits_per_sample;
+    sample_layout.samples_per_pixel=samples_per_pixel;
+    sample_layout.sample_format=sample_format;
+  }
+  return high_depth;
+}
+
+void convert_tiff_samples(const unsigned char* source,
+                          const TiffSampleLayout& sample_layout,
+                          FLOAT32* dest,
+                          INT64 count) {
+  if (sample_layout.sample_format == SAMPLEFORMAT_IEEEFP) {
+    if (sample_layout.bits_per_sample == 32) {
+      std::memcpy(dest,source,count*sizeof(FLOAT32));
+    } else {
+      buffer_convert_samples((const double*)source,dest,count);
+    }
+  } else if (sample_layout.sample_format == SAMPLEFORMAT_INT) {
+    if (sample_layout.bits_per_sample == 16) {
+      buffer_convert_samples((const int16_t*)source,dest,count);
+    } else {
+      buffer_convert_samples((const int32_t*)source,dest,count);
+    }
+  } else {
+    if (sample_layout.bits_per_sample == 16) {
+      buffer_convert_samples((const uint16_t*)source,dest,count);
+    } else {
+      buffer_convert_samples((const uint32_t*)source,dest,count);
+    }
+  }
+}
+
+bool find_tiff_stretch(TIFF* tif,
+                       const std::string& filename,
+                       const TiffSampleLayout& sample_layout,
+                       FLOAT64& black_level,
+                       FLOAT64& white_level) {
+  auto tiled=TIFFIsTiled(tif);
+  INT64 chunk_count=tiled ? TIFFNumberOfTiles(tif) : TIFFNumberOfStrips(tif);
+  INT64 chunk_size=tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+  auto bytes_per_sample=sample_layout.bits_per_sample/8;
+  auto spp=sample_layout.samples_per_pixel;
+  // alpha and extra samples don't affect the stretch
+  auto color_samples=std::min(spp,(INT64)3);
+  auto chunk_step=std::max(chunk_count/STRETCH_SAMPLE_CHUNKS,(INT64)1);
+  auto sampled_chunks=(chunk_count+chunk_step-1)/chunk_step;
+  auto chunk_pixels=chunk_size/(bytes_per_sample*spp);
+  auto pixel_step=std::max((sampled_chunks*chunk_pixels*color_samples)/STRETCH_SAMPLE_MAX,(INT64)1);
+  auto chunk_buffer=(unsigned char*)_TIFFmalloc(chunk_size);
+  std::vector<FLOAT32> chunk_samples(chunk_pixels*spp);
+  std::vector<FLOAT32> stretch_samples;
+  if (chunk_buffer == NULL) {
+    ERROR_LOCAL("Failed to allocate chunk for: " << filename);
+    return false;
+  }
+  for (INT64 chunk=0; chunk < chunk_count; chunk+=chunk_step) {
+    auto read_size=(INT64)(tiled ?
+                           TIFFReadEncodedTile(tif, chunk, chunk_buffer, chunk_size) :
+                           TIFFReadEncodedStrip(tif, chunk, chunk_buffer, chunk_size));
+    if (read_size < 0) {
+      continue;
+    }
+    auto read_pixels=read_size/(bytes_per_sample*spp);
+    convert_tiff_samples(chunk_buffer,sample_layout,chunk_samples.data(),read_pixels*spp);
+    for (INT64 p=0; p < read_pixels; p+=pixel_step) {
+      for (INT64 c=0; c < color_samples; c++) {
+        stretch_samples.push_back(chunk_samples[p*spp+c]);
+      }
+    }
+  }
+  _TIFFfree(chunk_buffer);
+  auto success=buffer_stretch_levels(stretch_samples.data(),
+                                     stretch_samples.size(),
+                                     STRETCH_BLACK_FRACTION,
+                                     STRETCH_WHITE_FRACTION,
+                                     black_level,
+                                     white_level);
+  if (!success) {
+    ERROR_LOCAL("Failed to find any valid samples in: " << filename);
+  }
+  return success;
+}
+
+bool load_tiff_high_depth(TIFF* tif,
+                          const std::string& filename,
+                          const TiffSampleLayout& sample_layout,
+                          bool stretch_color,
+                          BufferBandReduce& band_reduce) {
+  FLOAT64 black_level,white_level;
+  if (sample_layout.sample_format == SAMPLEFORMAT_UINT &&
+      sample_layout.bits_per_sample == 16 &&
+      sample_layout.samples_per_pixel >= 3 &&
+      !stretch_color) {
+    // the whole range is used for every image like a shift to 8 bits,
+    // stretching each image to its own range would leave seams
+    // between neighbours
+    black_level=0.0;
+    white_level=(FLOAT64)UINT16_MAX;
+  } else if (!find_tiff_stretch(tif,
+                                filename,
+                                sample_layout,
+                                black_level,
+                                white_level)) {
+    return false;
+  } else {
+    MSG_LOCAL("Stretching " << filename << " from " << black_level << " to " << white_level);
+  }
+  // floating point data usually has a high dynamic range
+  BufferStretch stretch(sample_layout.sample_format == SAMPLEFORMAT_IEEEFP ?
+                        BufferStretchType::asinh : BufferStretchType::linear,
+                        black_level,
+                        white_level);
+  auto success=true;
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  auto spp=sample_layout.samples_per_pixel;
+  auto bytes_per_sample=sample_layout.bits_per_sample/8;
+  if (TIFFIsTiled(tif)) {
+    uint32_t tiff_tile_width,tiff_tile_height;
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tiff_tile_width);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &tiff_tile_height);
+    INT64 tile_width=tiff_tile_width;
+    INT64 tile_height=tiff_tile_height;
+    auto tile_size=(INT64)TIFFTileSize(tif);
+    auto tile_buffer=(unsigned char*)_TIFFmalloc(tile_size);
+    // a full row of tiles is gathered before being passed on
+    std::vector<FLOAT32> tile_row_samples(width*tile_height*spp);
+    if (tile_buffer == NULL) {
+      ERROR_LOCAL("Failed to allocate tile for: " << filename);
+      return false;
+    }
+    for (INT64 tile_y=0; tile_y < height && success; tile_y+=tile_height) {
+      auto tile_rows=std::min(tile_height,height-tile_y);
+      for (INT64 tile_x=0; tile_x < width; tile_x+=tile_width) {
+        if (TIFFReadEncodedTile(tif, TIFFComputeTile(tif, tile_x, tile_y, 0, 0), tile_buffer, tile_size) < 0) {
+          ERROR_LOCAL("Failed to read tile at " << tile_x << "," << tile_y << " of: " << filename);
+          success=false;
+          break;
+        }
+        auto tile_columns=std::min(tile_width,width-tile_x);
+        for (INT64 r=0; r < tile_rows; r++) {
+          convert_tiff_samples(tile_buffer+r*tile_width*spp*bytes_per_sample,
+                               sample_layout,
+                               tile_row_samples.data()+(r*width+tile_x)*spp,
+                               tile_columns*spp);
+        }
+      }
+      if (success) {
+        for (INT64 r=0; r < tile_rows; r++) {
+          buffer_stretch_row(tile_row_samples.data()+r*width*spp,
+                             spp,
+                             band_reduce.next_row(),
+                             width,
+                             stretch);
+          band_reduce.commit_row();
+        }
+      }
+    }
+    _TIFFfree(tile_buffer);
+  } else {
+    uint32_t tiff_rows_per_strip;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &tiff_rows_per_strip);
+    INT64 rows_per_strip=std::min((INT64)tiff_rows_per_strip,height);
+    auto strip_size=(INT64)TIFFStripSize(tif);
+    auto strip_buffer=(unsigned char*)_TIFFmalloc(strip_size);
+    std::vector<FLOAT32> row_samples(width*spp);
+    if (strip_buffer == NULL) {
+      ERROR_LOCAL("Failed to allocate strip for: " << filename);
+      return false;
+    }
+    for (INT64 strip_row=0; strip_row < height; strip_row+=rows_per_strip) {
+      if (TIFFReadEncodedStrip(tif, TIFFComputeStrip(tif, strip_row, 0), strip_buffer, strip_size) < 0) {
+        ERROR_LOCAL("Failed to read strip at row " << strip_row << " of: " << filename);
+        success=false;
+        break;
+      }
+      auto strip_rows=std::min(rows_per_strip,height-strip_row);
+      for (INT64 r=0; r < strip_rows; r++) {
+        convert_tiff_samples(strip_buffer+r*width*spp*bytes_per_sample,
+                             sample_layout,
+                             row_samples.data(),
+                             width*spp);
+        buffer_stretch_row(row_samples.data(),
+                           spp,
+                           band_reduce.next_row(),
+                           width,
+                           stretch);
+        band_reduce.commit_row();
+      }
+    }
+    _TIFFfree(strip_buffer);
+  }
+  return success;
+}
+
+bool check_tiff_region(TIFF* tif) {
+  // the same checks load_tiff_as_rgba makes before loading a region
+  uint16_t tiff_orientation;
+  TiffSampleLayout sample_layout;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_ORIENTATION, &tiff_orientation);
+  return (TIFFIsTiled(tif) &&
+          tiff_orientation == ORIENTATION_TOPLEFT &&
+          !check_tiff_high_depth(tif,sample_layout));
+}
+
+bool check_tiff_file_region(const std::string& filename) {
+  // only the directory is read
+  TIFF* tif=TIFFOpen(filename.c_str(), "r");
+  if (!tif) {
+    return false;
+  }
+  auto region=check_tiff_region(tif);
+  TIFFClose(tif);
+  return region;
+}
+
+bool check_tiff_cache_region(const std::string& filename,
+                             const std::string& cached_filename) {
+  PyramidCacheReader reader;
+  INT64 level_width,level_height;
+  return (check_valid_filename(cached_filename) &&
+          reader.open(cached_filename) &&
+          pyramid_cache_source_matches(filename,reader.source()) &&
+          reader.find_level(0,level_width,level_height));
+}
+
+bool find_tiff_region(TIFF* tif,
+                      const SubGridIndex& current_subgrid,
+                      const LoadFileDataTransfer& data_transfer,
+                      INT64& x0, INT64& y0,
+                      INT64& x1, INT64& y1) {
+  uint32_t tiff_width,tiff_height,tiff_tile_width,tiff_tile_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tiff_tile_width);
+  TIFFGetField(tif, TIFFTAG_TILELENGTH, &tiff_tile_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  INT64 tile_width=tiff_tile_width;
+  INT64 tile_height=tiff_tile_height;
+  if (tile_width <= 0 || tile_height <= 0) {
+    return false;
+  }
+  return find_tile_aligned_region(current_subgrid,
+                                  data_transfer,
+                                  width,height,
+                                  tile_width,tile_height,
+                                  x0,y0,x1,y1);
+}
+
+bool find_tile_aligned_region(const SubGridIndex& current_subgrid,
+                              const LoadFileDataTransfer& data_transfer,
+                              INT64 width, INT64 height,
+                              INT64 tile_width, INT64 tile_height,
+                              INT64& x0, INT64& y0,
+                              INT64& x1, INT64& y1) {
+  // move the region from square pixels to pixels of this image
+  const auto& first_data=data_transfer.data_transfer.front();
+  auto image_origin_x=current_subgrid.i()*first_data->max_sub_wpixel;
+  auto image_origin_y=current_subgrid.j()*first_data->max_sub_hpixel;
+  // expand out to whole tiles, keep at least one tile even if the
+  // image is not in the region at all
+  auto tile_align=[](INT64 start, INT64 end, INT64 size, INT64 tile_size,
+                     INT64& aligned_start, INT64& aligned_end) {
+    start=std::clamp(start,(INT64)0,size-1);
+    end=std::clamp(end,start+1,size);
+    aligned_start=(start/tile_size)*tile_size;
+    aligned_end=std::min(((end+tile_size-1)/tile_size)*tile_size,size);
+  };
+  tile_align(data_transfer.region->x0-image_origin_x,
+             data_transfer.region->x1-image_origin_x,
+             width,tile_width,x0,x1);
+  tile_align(data_transfer.region->y0-image_origin_y,
+             data_transfer.region->y1-image_origin_y,
+             height,tile_height,y0,y1);
+  return !(x0 == 0 && y0 == 0 && x1 == width && y1 == height);
+}
+
+bool load_tiff_region_as_rgba(TIFF* tif,
+                              const std::string& filename,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64 x0, INT64 y0,
+                              INT64 x1, INT64 y1) {
+  auto success=true;
+  uint32_t tiff_tile_width,tiff_tile_height;
+  TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tiff_tile_width);
+  TIFFGetField(tif, TIFFTAG_TILELENGTH, &tiff_tile_height);
+  INT64 tile_width=tiff_tile_width;
+  INT64 tile_height=tiff_tile_height;
+  auto region_width=x1-x0;
+  auto region_height=y1-y0;
+  auto raster=(uint32_t*)_TIFFmalloc(tile_width*tile_height*sizeof(uint32_t));
+  auto region_data=new (std::nothrow) PIXEL_RGBA[region_width*region_height];
+  if (raster == NULL || region_data == nullptr) {
+    ERROR_LOCAL("Failed to allocate region for: " << filename);
+    success=false;
+  } else {
+    for (INT64 tile_y=y0; tile_y < y1 && success; tile_y+=tile_height) {
+      auto tile_rows=std::min(tile_height,y1-tile_y);
+      for (INT64 tile_x=x0; tile_x < x1; tile_x+=tile_width) {
+        if (!TIFFReadRGBATile(tif, tile_x, tile_y, raster)) {
+          ERROR_LOCAL("Failed to read tile at " << tile_x << "," << tile_y << " of: " << filename);
+          success=false;
+          break;
+        }
+        // libtiff returns each tile bottom row first
+        auto tile_columns=std::min(tile_width,x1-tile_x);
+        for (INT64 r=0; r < tile_rows; r++) {
+          buffer_copy_row_tiff(raster+(tile_height-1-r)*tile_width,
+                               region_data+(tile_y-y0+r)*region_width+(tile_x-x0),
+                               tile_columns);
+        }
+      }
+    }
+  }
+  if (raster) { _TIFFfree(raster); }
+  if (success) {
+    const auto& first_data=data_transfer.data_transfer.front();
+    first_data->rgba_data.set(current_subgrid,region_data);
+    first_data->rgba_wpixel.set(current_subgrid,region_width);
+    first_data->rgba_hpixel.set(current_subgrid,region_height);
+    first_data->rgba_xpixel_offset.set(current_subgrid,x0);
+    first_data->rgba_ypixel_offset.set(current_subgrid,y0);
+    data_transfer.region_loaded=true;
+  } else {
+    delete[] region_data;
+  }
+  return success;
+}
+
+bool load_tiff_as_rgba_whole(TIFF* tif,
+                             const std::string& filename,
+                             SubGridIndex& current_subgrid,
+                             LoadFileDataTransfer& data_transfer,
+                             INT64* row_temp_buffer) {
+  auto success=false;
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  // do this in 64 bits so large images don't overflow
+  auto npixels=(INT64)tiff_width*(INT64)tiff_height;
+  auto raster=(uint32_t*)_TIFFmalloc(npixels*sizeof(uint32_t));
+  if (raster == NULL) {
+    ERROR_LOCAL("Failed to allocate raster for: " << filename);
+  } else {
+    if (!TIFFReadRGBAImageOriented(tif, tiff_width, tiff_height, raster, ORIENTATION_TOPLEFT, 0)) {
+      ERROR_LOCAL("Failed to read: " << filename);
+    } else {
+      allocate_zoom_levels(tiff_width,
+                           tiff_height,
+                           current_subgrid,
+                           data_transfer);
+      const auto& first_data=data_transfer.data_transfer.front();
+      buffer_copy_reduce_tiff(raster,
+                              BufferPixelSize(tiff_width,tiff_height),
+                              first_data->rgba_data[current_subgrid],
+                              BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                              first_data->rgba_hpixel[current_subgrid]),
+                              first_data->zoom_out_shift,
+                              row_temp_buffer);
+      cascade_zoom_levels(current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+      success=true;
+    }
+    _TIFFfree(raster);
   }
   return success;
 }
@@ -516,71 +1570,150 @@ bool load_png_as_rgba(const std::string& filename,
                       SubGridIndex& current_subgrid,
                       LoadFileDataTransfer& data_transfer,
                       INT64* row_temp_buffer) {
+  FILE* png_fp=fopen(filename.c_str(),"rb");
+  if (!png_fp) {
+    ERROR_LOCAL("load_png_as_rgba() failed to open file: " << filename);
+    return false;
+  }
+  auto success=load_png_as_rgba(png_fp,
+                                filename,
+                                current_subgrid,
+                                data_transfer,
+                                row_temp_buffer);
+  fclose(png_fp);
+  return success;
+}
+
+bool load_png_as_rgba(FILE* png_fp,
+                      const std::string& filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer) {
+  png_structp png_ptr=png_create_read_struct(PNG_LIBPNG_VER_STRING,NULL,NULL,NULL);
+  png_infop info_ptr=NULL;
+  if (png_ptr) {
+    info_ptr=png_create_info_struct(png_ptr);
+  }
+  if (!info_ptr) {
+    ERROR_LOCAL("load_png_as_rgba() failed to create png structs for: " << filename);
+    png_destroy_read_struct(&png_ptr,NULL,NULL);
+    return false;
+  }
+  // these change after setjmp so they must be volatile
+  BufferBandReduce* volatile band_reduce=nullptr;
+  volatile bool levels_allocated=false;
+  volatile bool success=false;
+  if (setjmp(png_jmpbuf(png_ptr))) {
+    // libpng jumps back here on any error
+    ERROR_LOCAL("load_png_as_rgba() failed to read: " << filename);
+    delete band_reduce;
+    if (levels_allocated) {
+      free_zoom_levels(current_subgrid,
+                       data_transfer);
+    }
+    png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
+    return false;
+  }
+  png_init_io(png_ptr,png_fp);
+  png_read_info(png_ptr,info_ptr);
+  if (png_get_interlace_type(png_ptr,info_ptr) != PNG_INTERLACE_NONE) {
+    // interlaced rows don't arrive in order so can't be streamed
+    png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
+    return load_png_as_rgba_whole(filename,
+                                  current_subgrid,
+                                  data_transfer,
+                                  row_temp_buffer);
+  }
+  // convert everything to 8-bit RGBA, the same as PNG_FORMAT_RGBA
+  png_set_expand(png_ptr);
+  png_set_scale_16(png_ptr);
+  png_set_gray_to_rgb(png_ptr);
+  png_set_add_alpha(png_ptr,0xFF,PNG_FILLER_AFTER);
+  png_read_update_info(png_ptr,info_ptr);
+  INT64 width=png_get_image_width(png_ptr,info_ptr);
+  INT64 height=png_get_image_height(png_ptr,info_ptr);
+  allocate_zoom_levels(width,
+                       height,
+                       current_subgrid,
+                       data_transfer);
+  levels_allocated=true;
+  // rows are decoded straight into the band that reduces the first
+  // zoom level, the rest are reduced from the zoom level before
+  const auto& first_data=data_transfer.data_transfer.front();
+  band_reduce=new (std::nothrow) BufferBandReduce(BufferPixelSize(width,height),
+                                                  first_data->rgba_data[current_subgrid],
+                                                  BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                                                  first_data->rgba_hpixel[current_subgrid]),
+                                                  first_data->zoom_out_shift,
+                                                  row_temp_buffer);
+  if (!band_reduce || !band_reduce->valid()) {
+    ERROR_LOCAL("load_png_as_rgba() failed to allocate band for: " << filename);
+  } else {
+    for (INT64 row=0; row < height; row++) {
+      png_read_row(png_ptr,(png_bytep)band_reduce->next_row(),NULL);
+      band_reduce->commit_row();
+    }
+    band_reduce->finish();
+    cascade_zoom_levels(current_subgrid,
+                        data_transfer,
+                        row_temp_buffer);
+    success=true;
+  }
+  delete band_reduce;
+  if (!success) {
+    free_zoom_levels(current_subgrid,
+                     data_transfer);
+  }
+  png_destroy_read_struct(&png_ptr,&info_ptr,NULL);
+  return success;
+}
+
+bool load_png_as_rgba_whole(const std::string& filename,
+                            SubGridIndex& current_subgrid,
+                            LoadFileDataTransfer& data_transfer,
+                            INT64* row_temp_buffer) {
   bool success=false;
   png_image image;
   memset(&image, 0, (sizeof image));
   // TODO: check libpng library, may not want this
   image.version=PNG_IMAGE_VERSION;
   if (png_image_begin_read_from_file(&image, filename.c_str()) == 0) {
-    ERROR_LOCAL("load_png_as_rgba() failed to read from file: " << filename);
+    ERROR_LOCAL("load_png_as_rgba_whole() failed to read from file: " << filename);
     success=false;
   } else {
     png_bytep raster;
     image.format=PNG_FORMAT_RGBA;
     raster=new unsigned char[PNG_IMAGE_SIZE(image)];
     if (raster == NULL) {
-      ERROR_LOCAL("load_png_as_rgba() failed to allocate buffer!");
+      ERROR_LOCAL("load_png_as_rgba_whole() failed to allocate buffer!");
     } else {
       if (png_image_finish_read(&image, NULL, raster, 0, NULL) == 0) {
-        ERROR_LOCAL("load_png_as_rgba() failed to read full image!");
+        ERROR_LOCAL("load_png_as_rgba_whole() failed to read full image!");
       } else {
         // TODO: test for mismatched size
         INT64 width=image.width;
         INT64 height=image.height;
-        INT64 last_zoom_out_shift=INT_MAX;
-        BufferPixelSize last_dest_size;
-        PIXEL_RGBA* last_buffer=nullptr;
-        for (const auto& file_data : data_transfer.data_transfer) {
-          auto zoom_out_shift=file_data->zoom_out_shift;
-          INT64 w_reduced=reduce_and_pad(width,1L << zoom_out_shift);
-          INT64 h_reduced=reduce_and_pad(height,1L << zoom_out_shift);
-          file_data->rgba_wpixel.set(current_subgrid,w_reduced);
-          file_data->rgba_hpixel.set(current_subgrid,h_reduced);
-          INT64 npixels_reduced=w_reduced*h_reduced;
-          file_data->rgba_data.set(current_subgrid,new PIXEL_RGBA[npixels_reduced]);
-          std::memset(file_data->rgba_data[current_subgrid],0,sizeof(PIXEL_RGBA)*npixels_reduced);
-          if (last_buffer && zoom_out_shift > last_zoom_out_shift) {
-            auto step_zoom_out_shift=zoom_out_shift-last_zoom_out_shift;
-            auto source_size=last_dest_size;
-            auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-            buffer_copy_reduce_standard(last_buffer,
-                                        source_size,
-                                        BufferPixelCoordinate(0,0),
-                                        source_size,
-                                        file_data->rgba_data[current_subgrid],
-                                        dest_size,
-                                        dest_size,
-                                        BufferPixelCoordinate(0,0),
-                                        step_zoom_out_shift,
-                                        row_temp_buffer);
-          } else {
-            auto source_size=BufferPixelSize(width,height);
-            auto dest_size=BufferPixelSize(w_reduced,h_reduced);
-            buffer_copy_reduce_standard((PIXEL_RGBA*)raster,
-                                        source_size,
-                                        BufferPixelCoordinate(0,0),
-                                        source_size,
-                                        file_data->rgba_data[current_subgrid],
-                                        dest_size,
-                                        dest_size,
-                                        BufferPixelCoordinate(0,0),
-                                        zoom_out_shift,
-                                        row_temp_buffer);
-          }
-          last_dest_size=BufferPixelSize(w_reduced,h_reduced);
-          last_zoom_out_shift=zoom_out_shift;
-          last_buffer=file_data->rgba_data[current_subgrid];
-        }
+        allocate_zoom_levels(width,
+                             height,
+                             current_subgrid,
+                             data_transfer);
+        const auto& first_data=data_transfer.data_transfer.front();
+        auto source_size=BufferPixelSize(width,height);
+        auto dest_size=BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                       first_data->rgba_hpixel[current_subgrid]);
+        buffer_copy_reduce_standard((PIXEL_RGBA*)raster,
+                                    source_size,
+                                    BufferPixelCoordinate(0,0),
+                                    source_size,
+                                    first_data->rgba_data[current_subgrid],
+                                    dest_size,
+                                    dest_size,
+                                    BufferPixelCoordinate(0,0),
+                                    first_data->zoom_out_shift,
+                                    row_temp_buffer);
+        cascade_zoom_levels(current_subgrid,
+                            data_transfer,
+                            row_temp_buffer);
         success=true;
       }
       delete[] raster;
@@ -590,42 +1723,196 @@ bool load_png_as_rgba(const std::string& filename,
   return success;
 }
 
-bool write_png_text(std::string filename_png,
-                    std::string filename_text,
-                    INT64 wpixel, INT64 hpixel,
-                    INT64 full_wpixel, INT64 full_hpixel,
-                    PIXEL_RGBA* rgba_data) {
-   char new_filename[PATH_BUFFER_SIZE]="";
-
-   auto c_str=filename_png.c_str();
-   auto c_size=filename_png.size();
-   if (c_size < PATH_BUFFER_SIZE) {
-     strncpy(new_filename,c_str,c_size);
-   } else {
-     // TODO: make sure this is handled
-     return false;
-   }
-   // write a PNG
-   // TODO: encapsulate this writing elsewhere
-   png_image image;
-   memset(&image, 0, (sizeof image));
-   image.version=PNG_IMAGE_VERSION;
-   image.opaque=NULL;
-   image.width=wpixel;
-   image.height=hpixel;
-   image.format=PNG_FORMAT_RGBA;
-   image.flags=0;
-   image.colormap_entries=0;
-   png_image_write_to_file(&image, new_filename, 0, (void*)rgba_data, 0, 0);
-   // finally write out a text file with vital information
-   if (filename_text == "") {
-     std::ofstream file_out_text;
-     file_out_text.open(filename_text,std::ios::trunc);
-     file_out_text << full_wpixel << std::endl << full_hpixel << std::endl;
-     file_out_text.close();
-     // TODO: add error checking
-   }
-   return true;
+/**
+ * Error handler for libjpeg that jumps back to the loader instead of
+ * exiting the program.
+ */
+struct JpegErrorManager {
+  struct jpeg_error_mgr error_mgr;
+  jmp_buf setjmp_buffer;
+};
+
+void jpeg_error_exit(j_common_ptr cinfo) {
+  auto error_manager=(JpegErrorManager*)cinfo->err;
+  char message[JMSG_LENGTH_MAX];
+  (*cinfo->err->format_message)(cinfo,message);
+  ERROR_LOCAL("libjpeg: " << message);
+  longjmp(error_manager->setjmp_buffer,1);
+}
+
+bool read_jpeg_data(const std::string& filename,
+                    INT64& width, INT64& height) {
+  FILE* jpeg_fp=fopen(filename.c_str(),"rb");
+  if (!jpeg_fp) {
+    ERROR_LOCAL("read_jpeg_data() failed to open file: " << filename);
+    return false;
+  }
+  struct jpeg_decompress_struct cinfo;
+  JpegErrorManager error_manager;
+  cinfo.err=jpeg_std_error(&error_manager.error_mgr);
+  error_manager.error_mgr.error_exit=jpeg_error_exit;
+  if (setjmp(error_manager.setjmp_buffer)) {
+    ERROR_LOCAL("read_jpeg_data() failed to read from file: " << filename);
+    jpeg_destroy_decompress(&cinfo);
+    fclose(jpeg_fp);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo,jpeg_fp);
+  jpeg_read_header(&cinfo,TRUE);
+  width=(INT64)cinfo.image_width;
+  height=(INT64)cinfo.image_height;
+  jpeg_destroy_decompress(&cinfo);
+  fclose(jpeg_fp);
+  return true;
+}
+
+bool load_jpeg_as_rgba(const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer) {
+  FILE* jpeg_fp=fopen(filename.c_str(),"rb");
+  if (!jpeg_fp) {
+    ERROR_LOCAL("load_jpeg_as_rgba() failed to open file: " << filename);
+    return false;
+  }
+  auto success=load_jpeg_as_rgba(jpeg_fp,
+                                 filename,
+                                 current_subgrid,
+                                 data_transfer,
+                                 row_temp_buffer);
+  fclose(jpeg_fp);
+  return success;
+}
+
+bool load_jpeg_as_rgba(FILE* jpeg_fp,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer) {
+  struct jpeg_decompress_struct cinfo;
+  JpegErrorManager error_manager;
+  cinfo.err=jpeg_std_error(&error_manager.error_mgr);
+  error_manager.error_mgr.error_exit=jpeg_error_exit;
+  // these change after setjmp so they must be volatile
+  BufferBandReduce* volatile band_reduce=nullptr;
+  JSAMPLE* volatile convert_row=nullptr;
+  volatile bool levels_allocated=false;
+  volatile bool success=false;
+  if (setjmp(error_manager.setjmp_buffer)) {
+    // libjpeg jumps back here on any error
+    ERROR_LOCAL("load_jpeg_as_rgba() failed to read: " << filename);
+    delete band_reduce;
+    delete[] convert_row;
+    if (levels_allocated) {
+      free_zoom_levels(current_subgrid,
+                       data_transfer);
+    }
+    jpeg_destroy_decompress(&cinfo);
+    return false;
+  }
+  jpeg_create_decompress(&cinfo);
+  jpeg_stdio_src(&cinfo,jpeg_fp);
+  jpeg_read_header(&cinfo,TRUE);
+  INT64 width=cinfo.image_width;
+  INT64 height=cinfo.image_height;
+  allocate_zoom_levels(width,
+                       height,
+                       current_subgrid,
+                       data_transfer);
+  levels_allocated=true;
+  // let libjpeg do as much of the reduction as it can while decoding,
+  // it supports scaling down by up to 8
+  const auto& first_data=data_transfer.data_transfer.front();
+  auto jpeg_zoom_out_shift=std::min(first_data->zoom_out_shift,JPEG_MAX_SCALE_SHIFT);
+  cinfo.scale_num=1;
+  cinfo.scale_denom=1U << jpeg_zoom_out_shift;
+  // libjpeg can't convert CMYK or YCCK to RGB, so those are decoded
+  // to CMYK and converted a row at a time like RGB without libjpeg-turbo
+  auto cmyk=(cinfo.jpeg_color_space == JCS_CMYK || cinfo.jpeg_color_space == JCS_YCCK);
+  auto direct_rgba=false;
+  if (cmyk) {
+    cinfo.out_color_space=JCS_CMYK;
+  } else {
+#ifdef JCS_EXTENSIONS
+    cinfo.out_color_space=JCS_EXT_RGBA;
+    direct_rgba=true;
+#else
+    cinfo.out_color_space=JCS_RGB;
+#endif
+  }
+  jpeg_start_decompress(&cinfo);
+  // libjpeg rounds up when scaling the same way reduce_and_pad does
+  INT64 output_width=cinfo.output_width;
+  INT64 output_height=cinfo.output_height;
+  band_reduce=new (std::nothrow) BufferBandReduce(BufferPixelSize(output_width,output_height),
+                                                  first_data->rgba_data[current_subgrid],
+                                                  BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                                                  first_data->rgba_hpixel[current_subgrid]),
+                                                  first_data->zoom_out_shift-jpeg_zoom_out_shift,
+                                                  row_temp_buffer);
+  if (!direct_rgba) {
+    convert_row=new (std::nothrow) JSAMPLE[output_width*cinfo.output_components];
+  }
+  if (!band_reduce || !band_reduce->valid() || (!direct_rgba && !convert_row)) {
+    ERROR_LOCAL("load_jpeg_as_rgba() failed to allocate band for: " << filename);
+    jpeg_abort_decompress(&cinfo);
+  } else {
+    while (cinfo.output_scanline < cinfo.output_height) {
+      if (direct_rgba) {
+        JSAMPROW row_pointer=(JSAMPROW)band_reduce->next_row();
+        jpeg_read_scanlines(&cinfo,&row_pointer,1);
+      } else {
+        JSAMPROW row_pointer=convert_row;
+        jpeg_read_scanlines(&cinfo,&row_pointer,1);
+        if (cmyk) {
+          buffer_copy_row_cmyk(convert_row,
+                               band_reduce->next_row(),
+                               output_width,
+                               cinfo.saw_Adobe_marker);
+        } else {
+          buffer_copy_row_rgb(convert_row,
+                              band_reduce->next_row(),
+                              output_width);
+        }
+      }
+      band_reduce->commit_row();
+    }
+    band_reduce->finish();
+    cascade_zoom_levels(current_subgrid,
+                        data_transfer,
+                        row_temp_buffer);
+    jpeg_finish_decompress(&cinfo);
+    success=true;
+  }
+  delete band_reduce;
+  delete[] convert_row;
+  if (!success) {
+    free_zoom_levels(current_subgrid,
+                     data_transfer);
+  }
+  jpeg_destroy_decompress(&cinfo);
+  return success;
+}
+
+bool write_png(const std::string& filename_png,
+               INT64 wpixel, INT64 hpixel,
+               PIXEL_RGBA* rgba_data) {
+  // write a PNG
+  png_image image;
+  memset(&image, 0, (sizeof image));
+  image.version=PNG_IMAGE_VERSION;
+  image.opaque=NULL;
+  image.width=wpixel;
+  image.height=hpixel;
+  image.format=PNG_FORMAT_RGBA;
+  image.flags=0;
+  image.colormap_entries=0;
+  if (png_image_write_to_file(&image, filename_png.c_str(), 0, (void*)rgba_data, 0, 0) == 0) {
+    ERROR_LOCAL("write_png() failed to write: " << filename_png);
+    return false;
+  }
+  return true;
 }
 
 bool check_tiff(const std::string& filename) {
@@ -636,13 +1923,21 @@ bool check_png(const std::string& filename) {
   return std::regex_search(filename,png_search);
 }
 
+bool check_jpeg(const std::string& filename) {
+  return std::regex_search(filename,jpeg_search);
+}
+
+bool check_raw(const std::string& filename) {
+  return std::regex_search(filename,raw_search);
+}
+
 bool check_nts(const std::string& filename) {
   // TODO: this is going to have to be a more complicated search
   return std::regex_search(filename,nts_search);
 }
 
 bool check_empty(const std::string& filename) {
-  return std::regex_search(filename,empty_search);
+  return filename == EMPTY_FILE_PLACEHOLDER;
 }
 
 bool load_image_grid_from_text (std::string text_file,
@@ -692,19 +1987,42 @@ bool load_image_grid_from_text (std::string text_file,
   return true;
 }
 
+// cache directories already created, so each is only created once
+std::mutex created_cache_directories_mutex;
+std::unordered_set<std::string> created_cache_directories;
+
 std::string create_cache_filename(const std::string& filename, const std::string& extension) {
-  // TODO: this really needs to be both profiled and called less
-  std::filesystem::path filename_path{filename};
-  auto filename_parent=filename_path.parent_path();
-  auto filename_base=filename_path.filename();
-  auto filename_ext=filename_path.extension();
-  auto filename_stem=filename_base.stem();
-  auto filename_new=filename_parent;
-  // add extension to beginning to distinguish among otherwise
-  // identically named files
-  filename_stem=std::filesystem::path(filename_ext.string().substr(1) + "_" + filename_stem.string() + "." + extension);
-  filename_new/="__imagegrid__cache__";
-  std::filesystem::create_directories(filename_new);
+  std::filesystem::path filename_new;
+  std::filesystem::path filename_stem;
+  if (cache_root_enabled()) {
+    std::string root_directory,root_filename;
+    if (!cache_root_filename(filename,extension,root_directory,root_filename)) {
+      return "";
+    }
+    filename_new=root_directory;
+    filename_stem=root_filename;
+  } else {
+    std::filesystem::path filename_path{filename};
+    auto filename_parent=filename_path.parent_path();
+    auto filename_base=filename_path.filename();
+    auto filename_ext=filename_path.extension();
+    filename_stem=filename_base.stem();
+    filename_new=filename_parent;
+    // add extension to beginning to distinguish among otherwise
+    // identically named files
+    filename_stem=std::filesystem::path(filename_ext.string().substr(1) + "_" + filename_stem.string() + "." + extension);
+    filename_new/=IMAGEGRID_CACHE_DIRECTORY;
+  }
+  {
+    std::lock_guard<std::mutex> guard(created_cache_directories_mutex);
+    if (created_cache_directories.insert(filename_new.string()).second) {
+      std::error_code error_code;
+      std::filesystem::create_directories(filename_new,error_code);
+      if (error_code) {
+        ERROR_LOCAL("Failed to create cache directory: " << filename_new);
+      }
+    }
+  }
   filename_new/=filename_stem;
   return filename_new.string();
 }
@@ -712,9 +2030,170 @@ std::string create_cache_filename(const std::string& filename, const std::string
 ////////////////////////////////////////////////////////////////////////////////
 // more complex filetypes
 
+bool read_nts_data(const std::string& filename,
+                   INT64& width,
+                   INT64& height) {
+  // read the tiff straight out of memory
+  MappedFile mapped_file;
+  std::vector<unsigned char> tiff_buffer;
+  TiffMemorySource tiff_source;
+  auto successful=find_tiff_in_nts_file(filename,
+                                        mapped_file,
+                                        tiff_buffer,
+                                        tiff_source);
+  if (successful) {
+    TIFF* tif=open_tiff_memory(filename,tiff_source);
+    if (!tif) {
+      ERROR_LOCAL("read_nts_data failed to open tiff within: " << filename);
+      successful=false;
+    } else {
+      successful=read_tiff_data(tif,
+                                width,
+                                height);
+      TIFFClose(tif);
+    }
+  }
+  return successful;
+}
+
+bool check_nts_region(const std::string& filename) {
+  MappedFile mapped_file;
+  std::vector<unsigned char> tiff_buffer;
+  TiffMemorySource tiff_source;
+  if (!find_tiff_in_nts_file(filename,
+                             mapped_file,
+                             tiff_buffer,
+                             tiff_source)) {
+    return false;
+  }
+  TIFF* tif=open_tiff_memory(filename,tiff_source);
+  if (!tif) {
+    return false;
+  }
+  auto region=check_tiff_region(tif);
+  TIFFClose(tif);
+  return region;
+}
+
+bool load_nts_as_rgba(const std::string& filename,
+                      const std::string& cached_filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer) {
+  auto load_successful=load_tiff_as_rgba_cached(filename,
+                                                cached_filename,
+                                                current_subgrid,
+                                                data_transfer,
+                                                row_temp_buffer);
+  if (!load_successful) {
+    MappedFile mapped_file;
+    std::vector<unsigned char> tiff_buffer;
+    TiffMemorySource tiff_source;
+    load_successful=find_tiff_in_nts_file(filename,
+                                          mapped_file,
+                                          tiff_buffer,
+                                          tiff_source);
+    if (load_successful) {
+      TIFF* tif=open_tiff_memory(filename,tiff_source);
+      if (!tif) {
+        ERROR_LOCAL("load_nts_as_rgba failed to open tiff within: " << filename);
+        load_successful=false;
+      } else {
+        load_successful=load_tiff_as_rgba(tif,
+                                          filename,
+                                          current_subgrid,
+                                          data_transfer,
+                                          row_temp_buffer);
+        TIFFClose(tif);
+      }
+    }
+  }
+  return load_successful;
+}
+
+bool find_tiff_in_nts_file(const std::string& filename,
+                           MappedFile& mapped_file,
+                           std::vector<unsigned char>& tiff_buffer,
+                           TiffMemorySource& source) {
+  // a known zip file only needs the member read, not the directory
+  ZipIndexEntry index_entry;
+  if (zip_index_find(filename,index_entry)) {
+    const auto& member=index_entry.member;
+    if (member.compression_method == ZIP_METHOD_STORED) {
+      // the CRC was checked when the member was indexed, checking it
+      // again would read every page of the mapping on every load
+      if (mapped_file.open(filename) &&
+          index_entry.data_offset >= 0 && member.uncompressed_size >= 0 &&
+          index_entry.data_offset <= mapped_file.size() &&
+          member.uncompressed_size <= mapped_file.size()-index_entry.data_offset) {
+        source={mapped_file.data()+index_entry.data_offset,(toff_t)member.uncompressed_size,0};
+        return true;
+      }
+      mapped_file.close();
+    } else if (index_entry.data_offset >= 0 && member.compressed_size >= 0 &&
+               member.compressed_size <= index_entry.file_size-index_entry.data_offset) {
+      // the entry is only found if the size still matches the zip
+      // file, so a corrupt entry can't ask for more than the file
+      std::vector<unsigned char> compressed_buffer;
+      auto fd=open(filename.c_str(),O_RDONLY);
+      if (fd >= 0) {
+        auto read_successful=read_file_range(fd,
+                                             index_entry.data_offset,
+                                             member.compressed_size,
+                                             compressed_buffer);
+        close(fd);
+        if (read_successful &&
+            zip_inflate_member(compressed_buffer.data(),member,tiff_buffer)) {
+          source={tiff_buffer.data(),tiff_buffer.size(),0};
+          return true;
+        }
+      }
+    }
+    WARN_LOCAL("Zip index out of date for: " << filename);
+  }
+  std::vector<ZipMember> members;
+  auto mapped=mapped_file.open(filename) &&
+    zip_read_central_directory(mapped_file.data(),mapped_file.size(),members);
+  if (mapped) {
+    std::string suffix=NTS_TIF_INTERNAL_EXTENSION;
+    for (auto& member : members) {
+      if (member.name.size() < suffix.size() ||
+          member.name.compare(member.name.size()-suffix.size(),suffix.size(),suffix) != 0) {
+        continue;
+      }
+      const unsigned char* member_data;
+      if (!zip_find_member_data(mapped_file.data(),mapped_file.size(),member,member_data)) {
+        break;
+      }
+      // stored tiffs are read straight from the mapping, the CRC is
+      // only checked here before the member is indexed
+      if (member.compression_method == ZIP_METHOD_STORED &&
+          member.compressed_size == member.uncompressed_size &&
+          zip_check_crc(member_data,member)) {
+        zip_index_update(filename,member,member_data-mapped_file.data());
+        source={member_data,(toff_t)member.uncompressed_size,0};
+        return true;
+      }
+      if (zip_inflate_member(member_data,member,tiff_buffer)) {
+        zip_index_update(filename,member,member_data-mapped_file.data());
+        mapped_file.close();
+        source={tiff_buffer.data(),tiff_buffer.size(),0};
+        return true;
+      }
+      break;
+    }
+  }
+  // anything unusual is left to libzip
+  mapped_file.close();
+  if (!get_tiff_from_nts_file(filename,tiff_buffer)) {
+    return false;
+  }
+  source={tiff_buffer.data(),tiff_buffer.size(),0};
+  return true;
+}
+
 bool get_tiff_from_nts_file(const std::string& filename,
-                            std::string& temp_filename,
-                            int& tiff_fd) {
+                            std::vector<unsigned char>& tiff_buffer) {
   // this flips to true when an appropriate file is fond
   bool found=false;
   // this flips to false on error
@@ -723,16 +2202,12 @@ bool get_tiff_from_nts_file(const std::string& filename,
   zip_t* zip_struct=NULL;
   const char* zip_name=filename.c_str();
   char zip_internal_name[PATH_BUFFER_SIZE];
-  char zip_tiff_name[PATH_BUFFER_SIZE];
-  char tiff_temp_filename[PATH_BUFFER_SIZE];
-  // TODO: I need to find the best way to get a temp path
-  strncpy(tiff_temp_filename,TEMP_TEMPLATE_TIF,PATH_BUFFER_SIZE-1);
   if (!(zip_struct=zip_open(zip_name,ZIP_RDONLY,&zip_error))) {
     zip_error_t error;
     zip_error_init_with_code(&error, zip_error);
     ERROR_LOCAL("zip_open error: '%s': %s\n" << zip_name << zip_error_strerror(&error));
     zip_error_fini(&error);
-    success=false;
+    return false;
   }
   zip_int64_t num_entries;
   if ((num_entries=zip_get_num_entries(zip_struct,0)) < 0) {
@@ -743,11 +2218,12 @@ bool get_tiff_from_nts_file(const std::string& filename,
   //       also assuming only one tiff file for now
   //       handling more than one will need a way to identify "correct" tif file
   if (success) {
-    for (int i=0; i < num_entries; i++) {
+    for (int i=0; i < num_entries && !found; i++) {
       const char* zip_internal_name_temp;
       zip_internal_name_temp=zip_get_name(zip_struct,i,0);
       if (zip_internal_name_temp) {
         strncpy(zip_internal_name,zip_internal_name_temp,PATH_BUFFER_SIZE-1);
+        zip_internal_name[PATH_BUFFER_SIZE-1]='\0';
         int zip_internal_name_length=strnlen(zip_internal_name,PATH_BUFFER_SIZE);
         const char* suffix=NTS_TIF_INTERNAL_EXTENSION;
         const unsigned int suffix_length=strlen(suffix);
@@ -757,71 +2233,521 @@ bool get_tiff_from_nts_file(const std::string& filename,
                     PATH_BUFFER_SIZE-zip_internal_name_length+suffix_length)
             == suffix_length) {
           found=true;
-          strncpy(zip_tiff_name,zip_internal_name,PATH_BUFFER_SIZE);
           zip_stat_t tiff_stat;
           zip_stat_init(&tiff_stat);
           if (zip_stat(zip_struct,zip_internal_name,0,&tiff_stat) < 0) {
             ERROR_LOCAL("zip_stat error: " << filename);
             success=false;
+          } else if (!(tiff_stat.valid & ZIP_STAT_SIZE) || !(tiff_stat.valid & ZIP_STAT_COMP_SIZE) ||
+                     !zip_check_member_size(ZipMember{zip_internal_name,
+                                                      ((tiff_stat.valid & ZIP_STAT_COMP_METHOD) ?
+                                                       (INT64)tiff_stat.comp_method : -1),
+                                                      (INT64)std::min(tiff_stat.comp_size,(zip_uint64_t)INT64_MAX),
+                                                      (INT64)std::min(tiff_stat.size,(zip_uint64_t)INT64_MAX),
+                                                      0,tiff_stat.crc})) {
+            // the size comes from the file so it is checked before allocating
+            ERROR_LOCAL("Invalid size for tiff in: " << filename);
+            success=false;
           } else {
-            zip_uint64_t tiff_size;
-            void* tiff_buff=NULL;
-            // get size of tiff
-            tiff_size=tiff_stat.size;
-            if ((tiff_buff=malloc(tiff_size))) {
-              zip_file* zip_file_struct;
-              if (!(zip_file_struct=zip_fopen(zip_struct,zip_internal_name,0))) {
-                ERROR_LOCAL("zip_fopen: " << filename);
-                free(tiff_buff);
+            // inflate the whole tiff into memory
+            tiff_buffer.resize(tiff_stat.size);
+            zip_file* zip_file_struct;
+            if (!(zip_file_struct=zip_fopen(zip_struct,zip_internal_name,0))) {
+              ERROR_LOCAL("zip_fopen: " << filename);
+              success=false;
+            } else {
+              auto bytes_read=zip_fread(zip_file_struct,tiff_buffer.data(),tiff_stat.size);
+              if (bytes_read < 0 || (zip_uint64_t)bytes_read != tiff_stat.size) {
+                ERROR_LOCAL("zip_fread: " << filename);
+                success=false;
+              }
+              if (zip_fclose(zip_file_struct) < 0) {
+                ERROR_LOCAL("zip_fclose: " << filename);
                 success=false;
-              } else {
-                // TODO: check number of bytes actually read
-                if (zip_fread(zip_file_struct,tiff_buff,tiff_size) < 0) {
-                  ERROR_LOCAL("zip_fread: " << filename);
-                  free(tiff_buff);
-                  zip_fclose(zip_file_struct);
-                  success=false;
-                } else {
-                  if (zip_fclose(zip_file_struct) < 0) {
-                    ERROR_LOCAL("zip_fclose: " << filename);
-                    free(tiff_buff);
-                    success=false;
-                  } else {
-                    // now write the tiff data to a temp file
-                    // this file stays open beyond the life of this function if successful
-                    if ((tiff_fd=mkstemps(tiff_temp_filename,4)) < 0) {
-                      ERROR_LOCAL("tiff_fd: " << filename);
-                      free(tiff_buff);
-                      success=false;
-                    } else {
-                      if (write(tiff_fd,tiff_buff,tiff_size) < 0) {
-                        ERROR_LOCAL("write: " << filename);
-                        free(tiff_buff);
-                        close(tiff_fd);
-                        tiff_fd=-1;
-                        success=false;
-                      };
-                      if (tiff_buff) { free(tiff_buff); }
-                      if (lseek(tiff_fd,0,SEEK_SET) < 0) {
-                        ERROR_LOCAL("lseek: " << filename);
-                        close(tiff_fd);
-                        tiff_fd=-1;
-                        success=false;
-                      }
-                    }
-                  }
-                }
               }
-            } else {
-              ERROR_LOCAL("malloc: " << filename);
-              success=false;
             }
           }
         }
       }
     }
   }
-  temp_filename=std::string(tiff_temp_filename);
   zip_close(zip_struct);
+  if (!(found && success)) {
+    tiff_buffer.clear();
+  }
   return found && success;
 }
+
+////////////////////////////////////////////////////////////////////////////////
+// reading tiff files from memory
+
+tmsize_t tiff_memory_read(thandle_t handle, void* buffer, tmsize_t size) {
+  auto source=(TiffMemorySource*)handle;
+  if (size < 0 || source->offset >= source->size) {
+    return 0;
+  }
+  auto bytes_read=std::min((toff_t)size,source->size-source->offset);
+  std::memcpy(buffer,source->data+source->offset,bytes_read);
+  source->offset+=bytes_read;
+  return (tmsize_t)bytes_read;
+}
+
+tmsize_t tiff_memory_write(thandle_t, void*, tmsize_t) {
+  // read only
+  return 0;
+}
+
+toff_t tiff_memory_seek(thandle_t handle, toff_t offset, int whence) {
+  auto source=(TiffMemorySource*)handle;
+  switch (whence) {
+  case SEEK_SET:
+    source->offset=offset;
+    break;
+  case SEEK_CUR:
+    source->offset+=offset;
+    break;
+  case SEEK_END:
+    source->offset=source->size+offset;
+    break;
+  default:
+    return (toff_t)-1;
+  }
+  return source->offset;
+}
+
+int tiff_memory_close(thandle_t) {
+  // the buffer is owned by the caller
+  return 0;
+}
+
+toff_t tiff_memory_size(thandle_t handle) {
+  return ((TiffMemorySource*)handle)->size;
+}
+
+int tiff_memory_map(thandle_t handle, void** base, toff_t* size) {
+  // libtiff reads directly from the buffer when it can
+  auto source=(TiffMemorySource*)handle;
+  *base=(void*)source->data;
+  *size=source->size;
+  return 1;
+}
+
+void tiff_memory_unmap(thandle_t, void*, toff_t) {
+}
+
+TIFF* open_tiff_memory(const std::string& name,
+                       TiffMemorySource& source) {
+  return TIFFClientOpen(name.c_str(), "r",
+                        (thandle_t)&source,
+                        tiff_memory_read,
+                        tiff_memory_write,
+                        tiff_memory_seek,
+                        tiff_memory_close,
+                        tiff_memory_size,
+                        tiff_memory_map,
+                        tiff_memory_unmap);
+}
+
+const TiffMemorySource* tiff_memory_source(TIFF* tif) {
+  if (TIFFGetReadProc(tif) != tiff_memory_read) {
+    return nullptr;
+  }
+  return (const TiffMemorySource*)TIFFClientdata(tif);
+}
+
+bool check_tiff_mapped(TIFF* tif,
+                       const TiffMemorySource& source,
+                       INT64& samples_per_pixel) {
+  uint16_t compression,bits_per_sample,tiff_samples_per_pixel,sample_format,planar_config,photometric;
+  TIFFGetFieldDefaulted(tif, TIFFTAG_COMPRESSION, &compression);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_BITSPERSAMPLE, &bits_per_sample);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLESPERPIXEL, &tiff_samples_per_pixel);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_SAMPLEFORMAT, &sample_format);
+  TIFFGetFieldDefaulted(tif, TIFFTAG_PLANARCONFIG, &planar_config);
+  if (!TIFFGetField(tif, TIFFTAG_PHOTOMETRIC, &photometric) ||
+      compression != COMPRESSION_NONE ||
+      bits_per_sample != 8 ||
+      sample_format != SAMPLEFORMAT_UINT ||
+      planar_config != PLANARCONFIG_CONTIG ||
+      !((photometric == PHOTOMETRIC_MINISBLACK && tiff_samples_per_pixel <= 2) ||
+        (photometric == PHOTOMETRIC_RGB && tiff_samples_per_pixel >= 3))) {
+    return false;
+  }
+  samples_per_pixel=tiff_samples_per_pixel;
+  // make sure every strip or tile is within the file before reading
+  // anything so a bad file can fall back to libtiff
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  auto tiled=TIFFIsTiled(tif);
+  toff_t* chunk_offsets;
+  if (!TIFFGetField(tif, tiled ? TIFFTAG_TILEOFFSETS : TIFFTAG_STRIPOFFSETS, &chunk_offsets)) {
+    return false;
+  }
+  INT64 chunk_count=tiled ? TIFFNumberOfTiles(tif) : TIFFNumberOfStrips(tif);
+  INT64 chunk_size=tiled ? TIFFTileSize(tif) : TIFFStripSize(tif);
+  INT64 last_chunk_size=chunk_size;
+  if (!tiled) {
+    // the last strip only holds the remaining rows
+    uint32_t tiff_rows_per_strip;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &tiff_rows_per_strip);
+    INT64 rows_per_strip=std::min((INT64)tiff_rows_per_strip,(INT64)tiff_height);
+    if (rows_per_strip <= 0) {
+      return false;
+    }
+    last_chunk_size=((INT64)tiff_height-(chunk_count-1)*rows_per_strip)*(INT64)tiff_width*samples_per_pixel;
+  }
+  for (INT64 chunk=0; chunk < chunk_count; chunk++) {
+    auto needed_size=(chunk == chunk_count-1) ? last_chunk_size : chunk_size;
+    if (chunk_offsets[chunk] > source.size ||
+        (toff_t)needed_size > source.size-chunk_offsets[chunk]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void load_tiff_mapped(TIFF* tif,
+                      const TiffMemorySource& source,
+                      INT64 samples_per_pixel,
+                      BufferBandReduce& band_reduce) {
+  uint32_t tiff_width,tiff_height;
+  TIFFGetField(tif, TIFFTAG_IMAGEWIDTH, &tiff_width);
+  TIFFGetField(tif, TIFFTAG_IMAGELENGTH, &tiff_height);
+  INT64 width=tiff_width;
+  INT64 height=tiff_height;
+  toff_t* chunk_offsets;
+  if (TIFFIsTiled(tif)) {
+    TIFFGetField(tif, TIFFTAG_TILEOFFSETS, &chunk_offsets);
+    uint32_t tiff_tile_width,tiff_tile_height;
+    TIFFGetField(tif, TIFFTAG_TILEWIDTH, &tiff_tile_width);
+    TIFFGetField(tif, TIFFTAG_TILELENGTH, &tiff_tile_height);
+    INT64 tile_width=tiff_tile_width;
+    INT64 tile_height=tiff_tile_height;
+    for (INT64 tile_y=0; tile_y < height; tile_y+=tile_height) {
+      auto tile_rows=std::min(tile_height,height-tile_y);
+      for (INT64 r=0; r < tile_rows; r++) {
+        auto dest_row=band_reduce.next_row();
+        for (INT64 tile_x=0; tile_x < width; tile_x+=tile_width) {
+          auto tile=TIFFComputeTile(tif, tile_x, tile_y, 0, 0);
+          auto tile_columns=std::min(tile_width,width-tile_x);
+          buffer_copy_row_samples(source.data+chunk_offsets[tile]+r*tile_width*samples_per_pixel,
+                                  samples_per_pixel,
+                                  1,
+                                  dest_row+tile_x,
+                                  tile_columns);
+        }
+        band_reduce.commit_row();
+      }
+    }
+  } else {
+    TIFFGetField(tif, TIFFTAG_STRIPOFFSETS, &chunk_offsets);
+    uint32_t tiff_rows_per_strip;
+    TIFFGetFieldDefaulted(tif, TIFFTAG_ROWSPERSTRIP, &tiff_rows_per_strip);
+    INT64 rows_per_strip=std::min((INT64)tiff_rows_per_strip,height);
+    for (INT64 strip_row=0; strip_row < height; strip_row+=rows_per_strip) {
+      auto strip_data=source.data+chunk_offsets[TIFFComputeStrip(tif, strip_row, 0)];
+      auto strip_rows=std::min(rows_per_strip,height-strip_row);
+      for (INT64 r=0; r < strip_rows; r++) {
+        buffer_copy_row_samples(strip_data+r*width*samples_per_pixel,
+                                samples_per_pixel,
+                                1,
+                                band_reduce.next_row(),
+                                width);
+        band_reduce.commit_row();
+      }
+    }
+  }
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// files already read into memory
+
+bool load_tiff_memory_as_rgba(const std::string& filename,
+                              const std::vector<unsigned char>& file_buffer,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64* row_temp_buffer) {
+  auto success=false;
+  TiffMemorySource tiff_source{file_buffer.data(),file_buffer.size(),0};
+  TIFF* tif=open_tiff_memory(filename,tiff_source);
+  if (!tif) {
+    ERROR_LOCAL("load_tiff_memory_as_rgba() failed to open: " << filename);
+  } else {
+    success=load_tiff_as_rgba(tif,
+                              filename,
+                              current_subgrid,
+                              data_transfer,
+                              row_temp_buffer);
+    TIFFClose(tif);
+  }
+  return success;
+}
+
+bool load_png_memory_as_rgba(const std::string& filename,
+                             const std::vector<unsigned char>& file_buffer,
+                             SubGridIndex& current_subgrid,
+                             LoadFileDataTransfer& data_transfer,
+                             INT64* row_temp_buffer) {
+  // libpng reads from a FILE* so give it one over the buffer
+  FILE* png_fp=fmemopen((void*)file_buffer.data(),file_buffer.size(),"rb");
+  if (!png_fp) {
+    ERROR_LOCAL("load_png_memory_as_rgba() failed to open: " << filename);
+    return false;
+  }
+  auto success=load_png_as_rgba(png_fp,
+                                filename,
+                                current_subgrid,
+                                data_transfer,
+                                row_temp_buffer);
+  fclose(png_fp);
+  return success;
+}
+
+bool load_jpeg_memory_as_rgba(const std::string& filename,
+                              const std::vector<unsigned char>& file_buffer,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64* row_temp_buffer) {
+  FILE* jpeg_fp=fmemopen((void*)file_buffer.data(),file_buffer.size(),"rb");
+  if (!jpeg_fp) {
+    ERROR_LOCAL("load_jpeg_memory_as_rgba() failed to open: " << filename);
+    return false;
+  }
+  auto success=load_jpeg_as_rgba(jpeg_fp,
+                                 filename,
+                                 current_subgrid,
+                                 data_transfer,
+                                 row_temp_buffer);
+  fclose(jpeg_fp);
+  return success;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// uncompressed files read straight from memory
+
+/**
+ * Skip whitespace and comments in a netpbm header.
+ */
+INT64 skip_netpbm_space(const unsigned char* data,
+                        INT64 size,
+                        INT64 position) {
+  while (position < size) {
+    if (data[position] == '#') {
+      while (position < size && data[position] != '\n') {
+        position++;
+      }
+    } else if (std::isspace(data[position])) {
+      position++;
+    } else {
+      break;
+    }
+  }
+  return position;
+}
+
+/**
+ * Read a token from a netpbm header.
+ */
+std::string read_netpbm_token(const unsigned char* data,
+                              INT64 size,
+                              INT64& position) {
+  position=skip_netpbm_space(data,size,position);
+  auto start=position;
+  while (position < size && !std::isspace(data[position]) && data[position] != '#') {
+    position++;
+  }
+  return std::string((const char*)data+start,position-start);
+}
+
+/**
+ * Read a positive number from a netpbm header, returns 0 if invalid.
+ */
+INT64 read_netpbm_number(const unsigned char* data,
+                         INT64 size,
+                         INT64& position) {
+  auto token=read_netpbm_token(data,size,position);
+  if (token.empty() || token.size() > 9 ||
+      token.find_first_not_of("0123456789") != std::string::npos) {
+    return 0;
+  }
+  return std::stol(token);
+}
+
+bool parse_raw_image_header(const unsigned char* data,
+                            INT64 size,
+                            RawImageLayout& layout) {
+  INT64 position;
+  INT64 maxval;
+  if (size >= 16 && std::memcmp(data,"farbfeld",8) == 0) {
+    layout.width=((INT64)data[8] << 24) | ((INT64)data[9] << 16) | ((INT64)data[10] << 8) | (INT64)data[11];
+    layout.height=((INT64)data[12] << 24) | ((INT64)data[13] << 16) | ((INT64)data[14] << 8) | (INT64)data[15];
+    layout.samples_per_pixel=4;
+    layout.bytes_per_sample=2;
+    layout.data_offset=16;
+  } else if (size >= 2 && data[0] == 'P' && data[1] == '6') {
+    position=2;
+    layout.width=read_netpbm_number(data,size,position);
+    layout.height=read_netpbm_number(data,size,position);
+    maxval=read_netpbm_number(data,size,position);
+    layout.samples_per_pixel=3;
+    layout.bytes_per_sample=(maxval > 255) ? 2 : 1;
+    // a single whitespace character separates the header from the pixels
+    layout.data_offset=position+1;
+    if (maxval != 255 && maxval != 65535) {
+      return false;
+    }
+  } else if (size >= 2 && data[0] == 'P' && data[1] == '7') {
+    position=2;
+    layout.width=0;
+    layout.height=0;
+    layout.samples_per_pixel=0;
+    maxval=0;
+    std::string token;
+    while (position < size && (token=read_netpbm_token(data,size,position)) != "ENDHDR") {
+      if (token == "WIDTH") {
+        layout.width=read_netpbm_number(data,size,position);
+      } else if (token == "HEIGHT") {
+        layout.height=read_netpbm_number(data,size,position);
+      } else if (token == "DEPTH") {
+        layout.samples_per_pixel=read_netpbm_number(data,size,position);
+      } else if (token == "MAXVAL") {
+        maxval=read_netpbm_number(data,size,position);
+      } else if (token == "TUPLTYPE") {
+        // the depth is enough to know the layout
+        while (position < size && data[position] != '\n') {
+          position++;
+        }
+      } else {
+        return false;
+      }
+    }
+    if (token != "ENDHDR" ||
+        layout.samples_per_pixel < 1 || layout.samples_per_pixel > 4 ||
+        (maxval != 255 && maxval != 65535)) {
+      return false;
+    }
+    layout.bytes_per_sample=(maxval > 255) ? 2 : 1;
+    layout.data_offset=position+1;
+  } else {
+    return false;
+  }
+  // check the pixels fit without overflowing
+  auto pixel_bytes=layout.samples_per_pixel*layout.bytes_per_sample;
+  return (layout.width > 0 && layout.height > 0 &&
+          layout.data_offset <= size &&
+          layout.width <= (size-layout.data_offset)/pixel_bytes &&
+          layout.height <= (size-layout.data_offset)/(pixel_bytes*layout.width));
+}
+
+bool check_raw_zero_copy(const RawImageLayout& layout,
+                         const unsigned char* pixels) {
+  // the bytes R,G,B,A only match PIXEL_RGBA on little endian machines
+  const PIXEL_RGBA red=0xFF;
+  if (!(layout.samples_per_pixel == 4 &&
+        layout.bytes_per_sample == 1 &&
+        *(const unsigned char*)&red == 0xFF &&
+        (std::uintptr_t)pixels % alignof(PIXEL_RGBA) == 0)) {
+    return false;
+  }
+  // any transparency would show through where other loaders give
+  // opaque pixels, so those files are copied and made opaque
+  const PIXEL_RGBA opaque=0xFF000000;
+  auto rgba_pixels=(const PIXEL_RGBA*)pixels;
+  for (INT64 j=0; j < layout.height; j++) {
+    PIXEL_RGBA alpha=opaque;
+    for (INT64 i=0; i < layout.width; i++) {
+      alpha&=rgba_pixels[j*layout.width+i];
+    }
+    if (alpha != opaque) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool read_raw_data(const std::string& filename,
+                   INT64& width,
+                   INT64& height) {
+  // mapping only touches the pages the header is on
+  MappedFile mapped_file;
+  RawImageLayout layout;
+  if (!mapped_file.open(filename) ||
+      !parse_raw_image_header(mapped_file.data(),mapped_file.size(),layout)) {
+    ERROR_LOCAL("read_raw_data() failed to read header for: " << filename);
+    return false;
+  }
+  width=layout.width;
+  height=layout.height;
+  return true;
+}
+
+bool load_raw_as_rgba(const std::string& filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer) {
+  auto success=false;
+  auto mapped_file=std::make_shared<MappedFile>();
+  RawImageLayout layout;
+  if (!mapped_file->open(filename)) {
+    ERROR_LOCAL("load_raw_as_rgba() failed to map: " << filename);
+  } else if (!parse_raw_image_header(mapped_file->data(),mapped_file->size(),layout)) {
+    ERROR_LOCAL("load_raw_as_rgba() failed to read header for: " << filename);
+  } else {
+    auto pixels=mapped_file->data()+layout.data_offset;
+    const auto& first_data=data_transfer.data_transfer.front();
+    if (first_data->zoom_out_shift == 0 &&
+        check_raw_zero_copy(layout,pixels)) {
+      // the file is already laid out as PIXEL_RGBA so the full size
+      // image is used where it is, the mapping is only read from
+      first_data->rgba_wpixel.set(current_subgrid,layout.width);
+      first_data->rgba_hpixel.set(current_subgrid,layout.height);
+      first_data->rgba_data.set(current_subgrid,(PIXEL_RGBA*)pixels);
+      first_data->rgba_mapping.set(current_subgrid,mapped_file);
+      for (const auto& file_data : data_transfer.data_transfer) {
+        if (file_data != first_data) {
+          allocate_zoom_level(layout.width,
+                              layout.height,
+                              current_subgrid,
+                              *file_data);
+        }
+      }
+      success=true;
+    } else {
+      allocate_zoom_levels(layout.width,
+                           layout.height,
+                           current_subgrid,
+                           data_transfer);
+      BufferBandReduce band_reduce(BufferPixelSize(layout.width,layout.height),
+                                   first_data->rgba_data[current_subgrid],
+                                   BufferPixelSize(first_data->rgba_wpixel[current_subgrid],
+                                                   first_data->rgba_hpixel[current_subgrid]),
+                                   first_data->zoom_out_shift,
+                                   row_temp_buffer);
+      if (!band_reduce.valid()) {
+        ERROR_LOCAL("Failed to allocate band for: " << filename);
+      } else {
+        auto row_bytes=layout.width*layout.samples_per_pixel*layout.bytes_per_sample;
+        for (INT64 j=0; j < layout.height; j++) {
+          buffer_copy_row_samples(pixels+j*row_bytes,
+                                  layout.samples_per_pixel,
+                                  layout.bytes_per_sample,
+                                  band_reduce.next_row(),
+                                  layout.width);
+          band_reduce.commit_row();
+        }
+        band_reduce.finish();
+        success=true;
+      }
+    }
+    if (success) {
+      cascade_zoom_levels(current_subgrid,
+                          data_transfer,
+                          row_temp_buffer);
+    } else {
+      free_zoom_levels(current_subgrid,
+                       data_transfer);
+    }
+  }
+  return success;
+}
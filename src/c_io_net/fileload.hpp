@@ -11,19 +11,93 @@
 #include "../datatypes/coordinates.hpp"
 // C++ headers
 #include <list>
+#include <memory>
 #include <string>
 #include <vector>
+// C headers
+#include <cstdio>
+// C library headers
+#include <tiffio.h>
 
 // don't like these forward declarations
+class BufferBandReduce;
 class LoadFileDataTransfer;
 class LoadFileZoomLevelData;
+class MappedFile;
+class PyramidCacheReader;
 
 enum IMAGEDIRECTION {tl_horiz_reset,tl_horiz_follow};
 
-const std::string TEXT_EXTENSION{"txt"};
-
 const std::string IMAGEGRID_CACHE_DIRECTORY{"__imagegrid__cache__"};
 
+/**
+ * The layout of samples in a tiff file that is read without the
+ * libtiff RGBA interface.
+ */
+struct TiffSampleLayout {
+  INT64 bits_per_sample;
+  INT64 samples_per_pixel;
+  /** One of the SAMPLEFORMAT_* values from libtiff. */
+  INT64 sample_format;
+};
+
+/**
+ * The layout of an uncompressed farbfeld, PPM (P6) or PAM (P7) file
+ * that is read straight from memory.
+ */
+struct RawImageLayout {
+  INT64 width;
+  INT64 height;
+  INT64 samples_per_pixel;
+  /** Either 1 or 2, two byte samples are big endian. */
+  INT64 bytes_per_sample;
+  /** Where the pixels start in the file. */
+  INT64 data_offset;
+};
+
+/**
+ * A tiff file held in memory for libtiff to read from.
+ */
+struct TiffMemorySource {
+  const unsigned char* data;
+  toff_t size;
+  toff_t offset;
+};
+
+/**
+ * Handles on an open tiff file so strips or tiles can be decompressed
+ * on several threads, each handle with its own decompressor.  Files
+ * held in memory share the memory, otherwise the file is opened
+ * again.  Every handle is on the same directory as the original.
+ */
+class TiffDecodeWorkers {
+public:
+  TiffDecodeWorkers()=delete;
+  /**
+   * @param tif The open tiff file, used as the first handle.
+   * @param filename The file to open again if tif is not in memory.
+   * @param max_workers The most handles wanted, fewer may be opened.
+   */
+  TiffDecodeWorkers(TIFF* tif,
+                    const std::string& filename,
+                    INT64 max_workers);
+  ~TiffDecodeWorkers();
+  TiffDecodeWorkers(const TiffDecodeWorkers&)=delete;
+  TiffDecodeWorkers(const TiffDecodeWorkers&&)=delete;
+  TiffDecodeWorkers& operator=(const TiffDecodeWorkers&)=delete;
+  TiffDecodeWorkers& operator=(const TiffDecodeWorkers&&)=delete;
+  /** @return The number of handles, at least one. */
+  INT64 count() const;
+  /**
+   * @param worker The worker from 0 to count()-1.
+   * @return The handle for that worker.
+   */
+  TIFF* handle(INT64 worker) const;
+private:
+  std::vector<TIFF*> _handles;
+  std::vector<std::unique_ptr<TiffMemorySource>> _sources;
+};
+
 /**
  * Load numbered images from a path in order
  *
@@ -76,6 +150,99 @@ bool load_data_as_rgba(const std::string& filename,
                        LoadFileDataTransfer& data_transfer,
                        INT64* row_temp_buffer);
 
+/**
+ * Check whether a file should be read into memory in the background
+ * and loaded with load_memory_as_rgba.  This is the case for files
+ * that aren't too large when the decoder can load from memory and
+ * the cached file won't be used instead.
+ *
+ * @param filename The filename to load.
+ * @param cached_filename The filename that cached the parts of the
+ *                        image fitting in 512x512.
+ * @param data_transfer The object used to transfer loaded data.
+ * @return If the file should be read into memory.
+ */
+bool check_load_from_memory(const std::string& filename,
+                            const std::string& cached_filename,
+                            LoadFileDataTransfer& data_transfer);
+
+/**
+ * Load data as RGB from a file already read into memory.
+ *
+ * @param filename The filename the data was read from.
+ * @param file_buffer The contents of the file.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image data was successful.
+ */
+bool load_memory_as_rgba(const std::string& filename,
+                         const std::vector<unsigned char>& file_buffer,
+                         SubGridIndex& current_subgrid,
+                         LoadFileDataTransfer& data_transfer,
+                         INT64* row_temp_buffer);
+
+/**
+ * Allocate the buffers for every zoom level of an image.
+ *
+ * @param width The width of the full size image in pixels.
+ * @param height The height of the full size image in pixels.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ */
+void allocate_zoom_levels(INT64 width,
+                          INT64 height,
+                          SubGridIndex& current_subgrid,
+                          LoadFileDataTransfer& data_transfer);
+
+/**
+ * Allocate the buffer for a single zoom level of an image.
+ *
+ * @param width The width of the full size image in pixels.
+ * @param height The height of the full size image in pixels.
+ * @param current_subgrid The current subgrid to load.
+ * @param file_data The zoom level to allocate.
+ */
+void allocate_zoom_level(INT64 width,
+                         INT64 height,
+                         SubGridIndex& current_subgrid,
+                         LoadFileZoomLevelData& file_data);
+
+/**
+ * Allocate the 8-bit grayscale buffer for a single zoom level of an
+ * image, it is held in index_data with no palette.
+ *
+ * @param width The width of the full size image in pixels.
+ * @param height The height of the full size image in pixels.
+ * @param current_subgrid The current subgrid to load.
+ * @param file_data The zoom level to allocate.
+ */
+void allocate_zoom_level_gray(INT64 width,
+                              INT64 height,
+                              SubGridIndex& current_subgrid,
+                              LoadFileZoomLevelData& file_data);
+
+/**
+ * Fill in every zoom level after the first by reducing the zoom level
+ * before it.
+ *
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ */
+void cascade_zoom_levels(SubGridIndex& current_subgrid,
+                         LoadFileDataTransfer& data_transfer,
+                         INT64* row_temp_buffer);
+
+/**
+ * Free the buffers for every zoom level of an image that failed to load.
+ *
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ */
+void free_zoom_levels(SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer);
+
 /**
  * Read data about a tiff file using libtiff
 
@@ -88,28 +255,57 @@ bool load_data_as_rgba(const std::string& filename,
  */
 bool read_tiff_data(const std::string& filename, INT64& width, INT64& height);
 
+/**
+ * Read data about an already open tiff file.
+ *
+ * @param tif The open tiff file.
+ * @param width Set as the width of the image in pixels.
+ * @param height Set as the height of the image in pixels.
+ * @return If reading image data was successful.
+ */
+bool read_tiff_data(TIFF* tif, INT64& width, INT64& height);
+
+
+/**
+ * Open the pyramid cache of an image and check it was built from the
+ * current image and has every zoom level being loaded.
+ *
+ * @param filename The filename of the image.
+ * @param cached_filename The pyramid cache file of the image.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param reader The reader to open the cache with.
+ * @return If the cache can be used.
+ */
+bool open_tiff_cache(const std::string& filename,
+                     const std::string& cached_filename,
+                     const LoadFileDataTransfer& data_transfer,
+                     PyramidCacheReader& reader);
 
-/** Test if caching makes sense for this tiff file.
+/** Test if the cache has everything needed to load this file.
  *
- * @param cached_filename The filename that cached the parts of the
- *                        image fitting in 512x512.
+ * @param filename The filename of the image.
+ * @param cached_filename The pyramid cache file of the image.
  * @param data_transfer The object used to transfer loaded data.
- * @return If loading image was successful.
+ * @return If the cache can be used.
  */
-bool test_tiff_cache(const std::string& cached_filename,
+bool test_tiff_cache(const std::string& filename,
+                     const std::string& cached_filename,
                      LoadFileDataTransfer& data_transfer);
 
 /**
- * Load a tiff file using cached value.
+ * Load a tiff file from its pyramid cache, only reading the tiles
+ * needed if just a region of the full size image is wanted.
  *
- * @param cached_filename The filename that cached the parts of the
- *                        image fitting in 512x512.
+ * @param filename The filename of the image, used to check the
+ *                 cache is not out of date.
+ * @param cached_filename The pyramid cache file of the image.
  * @param current_subgrid The current subgrid to load.
  * @param data_transfer The object used to transfer loaded data.
  * @param row_temp_buffer A buffer to use as a working area when loading images.
  * @return If loading image was successful.
  */
-bool load_tiff_as_rgba_cached(const std::string& cached_filename,
+bool load_tiff_as_rgba_cached(const std::string& filename,
+                              const std::string& cached_filename,
                               SubGridIndex& current_subgrid,
                               LoadFileDataTransfer& data_transfer,
                               INT64* row_temp_buffer);
@@ -130,6 +326,326 @@ bool load_tiff_as_rgba(const std::string& filename,
                       LoadFileDataTransfer& data_transfer,
                        INT64* row_temp_buffer);
 
+/**
+ * Load an already open tiff file using libtiff.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_tiff_as_rgba(TIFF* tif,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer);
+
+/**
+ * Check whether the full size zoom level of a tiff file can be kept
+ * as 8-bit palette indices rather than expanded to RGBA.
+ *
+ * @param tif The open tiff file.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param palette Set to the BUFFER_PALETTE_SIZE palette entries.
+ * @return If the file should be loaded with load_tiff_palette.
+ */
+bool check_tiff_palette(TIFF* tif,
+                        const LoadFileDataTransfer& data_transfer,
+                        std::vector<PIXEL_RGBA>& palette);
+
+/**
+ * Load a palette tiff file keeping the full size zoom level as
+ * indices, the other zoom levels are reduced to RGBA as usual.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename used in messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param palette The palette from check_tiff_palette.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_tiff_palette(TIFF* tif,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       std::shared_ptr<std::vector<PIXEL_RGBA>> palette,
+                       INT64* row_temp_buffer);
+
+/**
+ * Check whether a tiff file is 8-bit grayscale that can be kept as
+ * 8 bits per pixel at every zoom level.
+ *
+ * @param tif The open tiff file.
+ * @param data_transfer The object used to transfer loaded data.
+ * @return If the file should be loaded with load_tiff_gray.
+ */
+bool check_tiff_gray(TIFF* tif,
+                     const LoadFileDataTransfer& data_transfer);
+
+/**
+ * Load an 8-bit grayscale tiff file keeping every zoom level as
+ * grayscale.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename used in messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_tiff_gray(TIFF* tif,
+                    const std::string& filename,
+                    SubGridIndex& current_subgrid,
+                    LoadFileDataTransfer& data_transfer,
+                    INT64* row_temp_buffer);
+
+/**
+ * Decode every strip of a tiff file with one 8-bit sample per pixel
+ * straight into a buffer, several strips at a time.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename used in messages.
+ * @param width The width of the image in pixels.
+ * @param height The height of the image in pixels.
+ * @param data The buffer of width*height bytes.
+ * @return If every strip was read.
+ */
+bool read_tiff_strips_8bit(TIFF* tif,
+                           const std::string& filename,
+                           INT64 width,
+                           INT64 height,
+                           unsigned char* data);
+
+/**
+ * Check whether a tiff file has high bit depth or floating point
+ * samples that libtiff can't convert to RGBA well.
+ *
+ * @param tif The open tiff file.
+ * @param sample_layout Set to the layout of the samples.
+ * @return If the file should be loaded with load_tiff_high_depth.
+ */
+bool check_tiff_high_depth(TIFF* tif,
+                           TiffSampleLayout& sample_layout);
+
+/**
+ * Convert samples read from a tiff file to floating point.
+ *
+ * @param source The samples as read by libtiff.
+ * @param sample_layout The layout of the samples.
+ * @param dest The destination samples.
+ * @param count The number of samples.
+ */
+void convert_tiff_samples(const unsigned char* source,
+                          const TiffSampleLayout& sample_layout,
+                          FLOAT32* dest,
+                          INT64 count);
+
+/**
+ * Find the levels to stretch a high bit depth tiff file between from
+ * a histogram of a sample of its strips or tiles.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param sample_layout The layout of the samples.
+ * @param black_level Set to the black level.
+ * @param white_level Set to the white level.
+ * @return If the levels were found.
+ */
+bool find_tiff_stretch(TIFF* tif,
+                       const std::string& filename,
+                       const TiffSampleLayout& sample_layout,
+                       FLOAT64& black_level,
+                       FLOAT64& white_level);
+
+/**
+ * Load a high bit depth tiff file by decoding strips or tiles
+ * directly and stretching them to 8-bit levels.  16-bit unsigned
+ * color is shifted to 8 bits like libtiff does unless stretch_color
+ * is set, so neighbouring photos still match.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param sample_layout The layout of the samples.
+ * @param stretch_color Whether to stretch 16-bit unsigned color to
+ *                      the range of the image too.
+ * @param band_reduce Where to put the rows of the image.
+ * @return If loading image was successful.
+ */
+bool load_tiff_high_depth(TIFF* tif,
+                          const std::string& filename,
+                          const TiffSampleLayout& sample_layout,
+                          bool stretch_color,
+                          BufferBandReduce& band_reduce);
+
+/**
+ * Check if load_tiff_as_rgba can load only a region of the full size
+ * image of a tiff file, which is only done for tiled files that don't
+ * need reorienting or stretching.
+ *
+ * @param tif The open tiff file.
+ * @return If a region can be loaded.
+ */
+bool check_tiff_region(TIFF* tif);
+
+/**
+ * Check if only a region of the full size image of a tiff file can be
+ * loaded, see check_tiff_region.
+ *
+ * @param filename The tiff file.
+ * @return If a region can be loaded.
+ */
+bool check_tiff_file_region(const std::string& filename);
+
+/**
+ * Check if only a region of the full size image of the pyramid cache
+ * of an image can be loaded.
+ *
+ * @param filename The filename of the image.
+ * @param cached_filename The pyramid cache file of the image.
+ * @return If the cache is up to date and has the full size image.
+ */
+bool check_tiff_cache_region(const std::string& filename,
+                             const std::string& cached_filename);
+
+/**
+ * Find the part of a tiled tiff file needed for the region requested
+ * in data_transfer, expanded out to whole tiles.
+ *
+ * @param tif The open tiff file.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data, with
+ *                      the region to load.
+ * @param x0 Set to the left edge of the part of the image to load.
+ * @param y0 Set to the top edge of the part of the image to load.
+ * @param x1 Set to one past the right edge of the part of the image to load.
+ * @param y1 Set to one past the bottom edge of the part of the image to load.
+ * @return If only part of the image is needed.
+ */
+bool find_tiff_region(TIFF* tif,
+                      const SubGridIndex& current_subgrid,
+                      const LoadFileDataTransfer& data_transfer,
+                      INT64& x0, INT64& y0,
+                      INT64& x1, INT64& y1);
+
+/**
+ * Find the part of an image needed for the region requested in
+ * data_transfer, expanded out to whole tiles.
+ *
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data, with
+ *                      the region to load.
+ * @param width The width of the image in pixels.
+ * @param height The height of the image in pixels.
+ * @param tile_width The width of the tiles in pixels.
+ * @param tile_height The height of the tiles in pixels.
+ * @param x0 Set to the left edge of the part of the image to load.
+ * @param y0 Set to the top edge of the part of the image to load.
+ * @param x1 Set to one past the right edge of the part of the image to load.
+ * @param y1 Set to one past the bottom edge of the part of the image to load.
+ * @return If only part of the image is needed.
+ */
+bool find_tile_aligned_region(const SubGridIndex& current_subgrid,
+                              const LoadFileDataTransfer& data_transfer,
+                              INT64 width, INT64 height,
+                              INT64 tile_width, INT64 tile_height,
+                              INT64& x0, INT64& y0,
+                              INT64& x1, INT64& y1);
+
+/**
+ * Load only the tiles of a tiled tiff file that are within a region
+ * of the full size image.  The data is stored along with its offset
+ * within the image.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param x0 The left edge of the part of the image to load.
+ * @param y0 The top edge of the part of the image to load.
+ * @param x1 One past the right edge of the part of the image to load.
+ * @param y1 One past the bottom edge of the part of the image to load.
+ * @return If loading image was successful.
+ */
+bool load_tiff_region_as_rgba(TIFF* tif,
+                              const std::string& filename,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64 x0, INT64 y0,
+                              INT64 x1, INT64 y1);
+
+/**
+ * Find the overview in a tiff file that is reduced the most without
+ * going past the requested reduction.  Overviews can either be extra
+ * directories or SubIFDs marked as reduced images.
+ *
+ * @param tif The open tiff file, left on the directory to read from.
+ * @param width The width of the full size image in pixels.
+ * @param height The height of the full size image in pixels.
+ * @param max_zoom_out_shift The largest reduction wanted as a bit shift.
+ * @param overview_zoom_out_shift Set to how much the overview is
+ *                                reduced as a bit shift.
+ * @return If a suitable overview was found.
+ */
+bool find_tiff_overview(TIFF* tif,
+                        INT64 width,
+                        INT64 height,
+                        INT64 max_zoom_out_shift,
+                        INT64& overview_zoom_out_shift);
+
+/**
+ * Stream a stripped tiff file a batch of strips at a time, decoding
+ * the next batch in the background while each is passed on.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param batch_max_bytes The most memory to hold decoded strips in,
+ *                        half for the batch being decoded and half
+ *                        for the batch being passed on.
+ * @param band_reduce Where to send the rows that are read.
+ * @return If loading image was successful.
+ */
+bool load_tiff_strips(TIFF* tif,
+                      const std::string& filename,
+                      INT64 batch_max_bytes,
+                      BufferBandReduce& band_reduce);
+
+/**
+ * Stream a tiled tiff file a batch of rows of tiles at a time,
+ * decoding the next batch in the background while each is passed on.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param batch_max_bytes The most memory to hold decoded rows of tiles in,
+ *                        half for the batch being decoded and half
+ *                        for the batch being passed on.
+ * @param band_reduce Where to send the rows that are read.
+ * @return If loading image was successful.
+ */
+bool load_tiff_tiles(TIFF* tif,
+                     const std::string& filename,
+                     INT64 batch_max_bytes,
+                     BufferBandReduce& band_reduce);
+
+/**
+ * Load a whole tiff file at once, used for orientations that can't
+ * be streamed.
+ *
+ * @param tif The open tiff file.
+ * @param filename The filename for messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_tiff_as_rgba_whole(TIFF* tif,
+                             const std::string& filename,
+                             SubGridIndex& current_subgrid,
+                             LoadFileDataTransfer& data_transfer,
+                             INT64* row_temp_buffer);
+
 /**
  * Read data about a png file using libpng.
  *
@@ -141,7 +657,7 @@ bool load_tiff_as_rgba(const std::string& filename,
 bool read_png_data(const std::string& filename, INT64& width, INT64& height);
 
 /**
- * Load a png file using libpng.
+ * Load a png file using libpng, decoding a row at a time.
  *
  * @param filename The filename to load.
  * @param current_subgrid The current subgrid to load.
@@ -154,22 +670,91 @@ bool load_png_as_rgba(const std::string& filename,
                       LoadFileDataTransfer& data_transfer,
                       INT64* row_temp_buffer);
 
+/**
+ * Load a png file that is already open.  Interlaced files are read
+ * again from filename.
+ *
+ * @param png_fp The open file.
+ * @param filename The filename for messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_png_as_rgba(FILE* png_fp,
+                      const std::string& filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer);
+
+/**
+ * Load a whole png file at once using libpng, used for interlaced
+ * files that can't be decoded a row at a time.
+ *
+ * @param filename The filename to load.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_png_as_rgba_whole(const std::string& filename,
+                            SubGridIndex& current_subgrid,
+                            LoadFileDataTransfer& data_transfer,
+                            INT64* row_temp_buffer);
+
+/**
+ * Read data about a jpeg file using libjpeg.
+ *
+ * @param filename The filename to load.
+ * @param width Set as the width of the image in pixels.
+ * @param height Set as the height of the image in pixels.
+ * @return If reading image data was successful.
+ */
+bool read_jpeg_data(const std::string& filename, INT64& width, INT64& height);
+
+/**
+ * Load a jpeg file using libjpeg, letting libjpeg scale the image
+ * down while decoding when only reduced zoom levels are needed.
+ *
+ * @param filename The filename to load.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_jpeg_as_rgba(const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer);
+
+/**
+ * Load a jpeg file that is already open.
+ *
+ * @param jpeg_fp The open file.
+ * @param filename The filename for messages.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_jpeg_as_rgba(FILE* jpeg_fp,
+                       const std::string& filename,
+                       SubGridIndex& current_subgrid,
+                       LoadFileDataTransfer& data_transfer,
+                       INT64* row_temp_buffer);
+
 /**
  * Write a png file using libpng.
  *
  * @param filename_png The png filename to write.
- * @param filename_text The text filename to write containing data about the image within.
  * @param wpixel The width in pixels.
  * @param hpixel The height in pixels.
- * @param full_wpixel The full width in pixels to write to text file.
- * @param full_hpixel The full height in pixels to write to text file.
  * @param rgb_data The rgb data.
  * @return If writing image was successful.
  */
-bool write_png_text(std::string filename_png, std::string filename_text,
-                    INT64 wpixel, INT64 hpixel,
-                    INT64 full_wpixel, INT64 full_hpixel,
-                    PIXEL_RGBA* rgb_data);
+bool write_png(const std::string& filename_png,
+               INT64 wpixel, INT64 hpixel,
+               PIXEL_RGBA* rgb_data);
 
 /**
  * Check if a file is a tiff file.
@@ -187,6 +772,14 @@ bool check_tiff(const std::string& filename);
  */
 bool check_png(const std::string& filename);
 
+/**
+ * Check if a file is a jpeg file.
+ *
+ * @param filename The filname to check.
+ * @return If the file is a jpeg file.
+ */
+bool check_jpeg(const std::string& filename);
+
 /**
  * Check if a file is part of the Canadian National Topographic System
  * (NTS).
@@ -199,6 +792,14 @@ bool check_png(const std::string& filename);
  */
 bool check_nts(const std::string& filename);
 
+/**
+ * Check if filename is a farbfeld, PPM or PAM file.
+ *
+ * @param filename The filename to check.
+ * @return If the filename has one of the raw extensions.
+ */
+bool check_raw(const std::string& filename);
+
 /**
  * Check if a file is an empty file placeholder.
  *
@@ -223,26 +824,234 @@ bool load_image_grid_from_text(std::string text_file,
 
 /**
  * Create the cached filename with png extension from the real
- * filename.
+ * filename.  With a cache root the cached file is named by the hash
+ * of the image contents instead.
  *
  * @param filename The filename to use to create the cached filename.
  * @param extension The extension to create.
- * @return The cached filename.
+ * @return The cached filename, empty if a cache root is used and the
+ *         image could not be hashed.
  */
 std::string create_cache_filename(const std::string& filename,
                                   const std::string& extension);
 
 /**
- * Get a temporary tiff file from the Canadian national topographic
+ * Read data about a file from the Canadian national topographic
  * system.
  *
+ * @param filename The filename of the NTS zip file.
+ * @param width Set as the width of the image in pixels.
+ * @param height Set as the height of the image in pixels.
+ * @return If reading image data was successful.
+ */
+bool read_nts_data(const std::string& filename,
+                   INT64& width,
+                   INT64& height);
+
+/**
+ * Check if only a region of the full size image of the tiff in a file
+ * from the Canadian national topographic system can be loaded, see
+ * check_tiff_region.
+ *
+ * @param filename The filename of the NTS zip file.
+ * @return If a region can be loaded.
+ */
+bool check_nts_region(const std::string& filename);
+
+/**
+ * Load a file from the Canadian national topographic system, using
+ * the cached file if it is enough.
+ *
+ * @param filename The filename of the NTS zip file.
+ * @param cached_filename The filename that cached the parts of the
+ *                        image fitting in 512x512.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading image was successful.
+ */
+bool load_nts_as_rgba(const std::string& filename,
+                      const std::string& cached_filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer);
+
+/**
+ * Find the tiff file inside a file from the Canadian national
+ * topographic system, reading the zip directly from a memory map and
+ * falling back to libzip for anything it can't handle.
+ *
+ * @param filename The filename of the NTS zip file.
+ * @param mapped_file Maps the zip file, a stored tiff is read straight
+ *                    from here.
+ * @param tiff_buffer Holds the tiff file if it had to be inflated.
+ * @param source Set to the memory holding the tiff file, must not
+ *               outlive mapped_file or tiff_buffer.
+ * @return If the tiff file was found.
+ */
+bool find_tiff_in_nts_file(const std::string& filename,
+                           MappedFile& mapped_file,
+                           std::vector<unsigned char>& tiff_buffer,
+                           TiffMemorySource& source);
+
+/**
+ * Get a tiff file from the Canadian national topographic system as
+ * an in-memory buffer.
+ *
  * @param filename The filenam of the NTS zip file.
- * @param temp_filename The filename of the temp tiff file.
- * @param tiff_fd The file descriptor for the temp tiff file.
+ * @param tiff_buffer Set to the contents of the tiff file.
  * @return If loading was successful.
  */
 bool get_tiff_from_nts_file(const std::string& filename,
-                            std::string& temp_filename,
-                            int& tiff_fd);
+                            std::vector<unsigned char>& tiff_buffer);
+
+/**
+ * Open a tiff file held in memory with libtiff.
+ *
+ * @param name The name libtiff uses in messages.
+ * @param source The memory to read from, must outlive the returned handle.
+ * @return The tiff handle or NULL on failure.
+ */
+TIFF* open_tiff_memory(const std::string& name,
+                       TiffMemorySource& source);
+
+/**
+ * Find the memory a tiff file is being read from.
+ *
+ * @param tif The open tiff file.
+ * @return The memory if the file was opened with open_tiff_memory,
+ *         otherwise nullptr.
+ */
+const TiffMemorySource* tiff_memory_source(TIFF* tif);
+
+/**
+ * Check whether the current directory of a tiff file held in memory
+ * is uncompressed 8-bit data that can be read straight from memory.
+ *
+ * @param tif The open tiff file.
+ * @param source The memory the tiff file is held in.
+ * @param samples_per_pixel Set to the number of samples for each pixel.
+ * @return If load_tiff_mapped can read the directory.
+ */
+bool check_tiff_mapped(TIFF* tif,
+                       const TiffMemorySource& source,
+                       INT64& samples_per_pixel);
+
+/**
+ * Load an uncompressed tiff file held in memory by reading rows
+ * straight from the strips or tiles, with no copies made by libtiff.
+ *
+ * @param tif The open tiff file.
+ * @param source The memory the tiff file is held in.
+ * @param samples_per_pixel The number of samples for each pixel.
+ * @param band_reduce Where to put the rows of the image.
+ */
+void load_tiff_mapped(TIFF* tif,
+                      const TiffMemorySource& source,
+                      INT64 samples_per_pixel,
+                      BufferBandReduce& band_reduce);
+
+/**
+ * Load a tiff file already read into memory.
+ *
+ * @param filename The filename the data was read from.
+ * @param file_buffer The contents of the file.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading was successful.
+ */
+bool load_tiff_memory_as_rgba(const std::string& filename,
+                              const std::vector<unsigned char>& file_buffer,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64* row_temp_buffer);
+
+/**
+ * Load a png file already read into memory.
+ *
+ * @param filename The filename the data was read from.
+ * @param file_buffer The contents of the file.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading was successful.
+ */
+bool load_png_memory_as_rgba(const std::string& filename,
+                             const std::vector<unsigned char>& file_buffer,
+                             SubGridIndex& current_subgrid,
+                             LoadFileDataTransfer& data_transfer,
+                             INT64* row_temp_buffer);
+
+/**
+ * Load a jpeg file already read into memory.
+ *
+ * @param filename The filename the data was read from.
+ * @param file_buffer The contents of the file.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading was successful.
+ */
+bool load_jpeg_memory_as_rgba(const std::string& filename,
+                              const std::vector<unsigned char>& file_buffer,
+                              SubGridIndex& current_subgrid,
+                              LoadFileDataTransfer& data_transfer,
+                              INT64* row_temp_buffer);
+
+/**
+ * Read the header of a farbfeld, PPM (P6) or PAM (P7) file.  Only
+ * maximum values of 255 and 65535 are supported.
+ *
+ * @param data The start of the file.
+ * @param size The size of the file in bytes.
+ * @param layout Set to the layout of the file.
+ * @return If the header is valid and the pixels fit in the file.
+ */
+bool parse_raw_image_header(const unsigned char* data,
+                            INT64 size,
+                            RawImageLayout& layout);
+
+/**
+ * Check if the pixels of a raw file can be used as PIXEL_RGBA without
+ * being copied, i.e., 8-bit RGBA that is suitably aligned and fully
+ * opaque, since every other loader makes pixels opaque.
+ *
+ * @param layout The layout of the file.
+ * @param pixels Where the pixels are in memory.
+ * @return If the pixels can be used in place.
+ */
+bool check_raw_zero_copy(const RawImageLayout& layout,
+                         const unsigned char* pixels);
+
+/**
+ * Read the size of a farbfeld, PPM or PAM file.
+ *
+ * @param filename The filename to read.
+ * @param width Set as the width of the image in pixels.
+ * @param height Set as the height of the image in pixels.
+ * @return If reading image data was successful.
+ */
+bool read_raw_data(const std::string& filename,
+                   INT64& width,
+                   INT64& height);
+
+/**
+ * Load a farbfeld, PPM or PAM file through a memory map.  When the
+ * full size zoom level is requested and the file holds aligned 8-bit
+ * RGBA, that zoom level points straight into the mapping and is never
+ * copied.  Other layouts are converted a row at a time as they are
+ * reduced.
+ *
+ * @param filename The filename to load.
+ * @param current_subgrid The current subgrid to load.
+ * @param data_transfer The object used to transfer loaded data.
+ * @param row_temp_buffer A buffer to use as a working area when loading images.
+ * @return If loading was successful.
+ */
+bool load_raw_as_rgba(const std::string& filename,
+                      SubGridIndex& current_subgrid,
+                      LoadFileDataTransfer& data_transfer,
+                      INT64* row_temp_buffer);
 
 #endif
@@ -0,0 +1,56 @@
+/**
+ * Memory mapping files read-only.
+ */
+// local headers
+#include "../common.hpp"
+#include "mapped_file.hpp"
+// C++ headers
+#include <string>
+// C library headers
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::~MappedFile() {
+  this->close();
+}
+
+bool MappedFile::open(const std::string& filename) {
+  this->close();
+  auto fd=::open(filename.c_str(),O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat file_stat;
+  if (fstat(fd,&file_stat) < 0 || file_stat.st_size <= 0) {
+    ::close(fd);
+    return false;
+  }
+  auto mapped=mmap(NULL,file_stat.st_size,PROT_READ,MAP_PRIVATE,fd,0);
+  // the mapping stays valid after the descriptor is closed
+  ::close(fd);
+  if (mapped == MAP_FAILED) {
+    ERROR_LOCAL("mmap failed for: " << filename);
+    return false;
+  }
+  this->_data=(const unsigned char*)mapped;
+  this->_size=file_stat.st_size;
+  return true;
+}
+
+void MappedFile::close() {
+  if (this->_data) {
+    munmap((void*)this->_data,this->_size);
+    this->_data=nullptr;
+    this->_size=0;
+  }
+}
+
+const unsigned char* MappedFile::data() const {
+  return this->_data;
+}
+
+INT64 MappedFile::size() const {
+  return this->_size;
+}
@@ -0,0 +1,40 @@
+/**
+ * Header for memory mapping files read-only.
+ */
+#ifndef MAPPED_FILE_HPP
+#define MAPPED_FILE_HPP
+
+#include "../common.hpp"
+// C++ headers
+#include <string>
+
+/**
+ * A file mapped read-only into memory, unmapped when destroyed.
+ */
+class MappedFile {
+public:
+  MappedFile()=default;
+  ~MappedFile();
+  MappedFile(const MappedFile&)=delete;
+  MappedFile(const MappedFile&&)=delete;
+  MappedFile& operator=(const MappedFile&)=delete;
+  MappedFile& operator=(const MappedFile&&)=delete;
+  /**
+   * Map a file, unmapping any file already mapped.
+   *
+   * @param filename The file to map.
+   * @return If mapping was successful.
+   */
+  bool open(const std::string& filename);
+  /** Unmap the file. */
+  void close();
+  /** @return The start of the mapped file, or nullptr if nothing is mapped. */
+  const unsigned char* data() const;
+  /** @return The size of the mapped file in bytes. */
+  INT64 size() const;
+private:
+  const unsigned char* _data=nullptr;
+  INT64 _size=0;
+};
+
+#endif
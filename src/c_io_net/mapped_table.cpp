@@ -0,0 +1,99 @@
+/**
+ * Reading memory mapped tables of records sorted by name.
+ */
+// local headers
+#include "../common.hpp"
+#include "mapped_file.hpp"
+#include "mapped_table.hpp"
+// C++ headers
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <string_view>
+
+bool MappedTable::open(const std::string& filename,
+                       const char* magic,
+                       INT64 record_size) {
+  this->close();
+  if (!this->_mapped_file.open(filename)) {
+    return false;
+  }
+  auto data=this->_mapped_file.data();
+  auto size=(UINT64)this->_mapped_file.size();
+  auto header=(const MappedTableHeader*)data;
+  // the counts are checked against the size before they are multiplied
+  // so a corrupt file can't overflow past the end of the mapping
+  if (size < sizeof(MappedTableHeader) ||
+      std::memcmp(header->magic,magic,MAPPED_TABLE_MAGIC_LENGTH) != 0 ||
+      header->entry_count > (size-sizeof(MappedTableHeader))/record_size ||
+      header->names_size != size-sizeof(MappedTableHeader)-header->entry_count*record_size) {
+    this->close();
+    return false;
+  }
+  this->_record_size=record_size;
+  this->_count=header->entry_count;
+  this->_names_size=header->names_size;
+  this->_records=data+sizeof(MappedTableHeader);
+  this->_names=(const char*)(this->_records+this->_count*record_size);
+  for (INT64 i=0; i < this->_count; i++) {
+    MappedTableName record_name;
+    std::memcpy(&record_name,this->record(i),sizeof(record_name));
+    if (!this->check_name(record_name.name_offset,record_name.name_length)) {
+      this->close();
+      return false;
+    }
+  }
+  return true;
+}
+
+void MappedTable::close() {
+  this->_mapped_file.close();
+  this->_record_size=0;
+  this->_count=0;
+  this->_names_size=0;
+  this->_records=nullptr;
+  this->_names=nullptr;
+}
+
+INT64 MappedTable::count() const {
+  return this->_count;
+}
+
+const unsigned char* MappedTable::record(INT64 index) const {
+  return this->_records+index*this->_record_size;
+}
+
+bool MappedTable::check_name(UINT64 name_offset,
+                             UINT64 name_length) const {
+  return (name_offset <= this->_names_size &&
+          name_length <= this->_names_size-name_offset);
+}
+
+std::string_view MappedTable::name(UINT64 name_offset,
+                                   UINT64 name_length) const {
+  return std::string_view(this->_names+name_offset,name_length);
+}
+
+std::string_view MappedTable::record_name(INT64 index) const {
+  MappedTableName record_name;
+  std::memcpy(&record_name,this->record(index),sizeof(record_name));
+  return this->name(record_name.name_offset,record_name.name_length);
+}
+
+INT64 MappedTable::find(const std::string_view& name) const {
+  // search record indexes since records are only known by their size
+  INT64 low=0;
+  INT64 high=this->_count;
+  while (low < high) {
+    auto middle=low+(high-low)/2;
+    if (this->record_name(middle) < name) {
+      low=middle+1;
+    } else {
+      high=middle;
+    }
+  }
+  if (low == this->_count || this->record_name(low) != name) {
+    return -1;
+  }
+  return low;
+}
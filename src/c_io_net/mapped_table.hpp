@@ -0,0 +1,109 @@
+/**
+ * Header for reading files laid out as a header, a table of fixed
+ * size records sorted by name, and a table of names.  The file is
+ * memory mapped and searched in place, used by the cache manifest and
+ * the zip index.
+ */
+#ifndef MAPPED_TABLE_HPP
+#define MAPPED_TABLE_HPP
+
+#include "../common.hpp"
+#include "mapped_file.hpp"
+// C++ headers
+#include <string>
+#include <string_view>
+
+// the length of the magic number identifying each kind of table
+const INT64 MAPPED_TABLE_MAGIC_LENGTH=8;
+
+/**
+ * The start of a table file.
+ */
+struct MappedTableHeader {
+  char magic[MAPPED_TABLE_MAGIC_LENGTH];
+  UINT64 entry_count;
+  UINT64 names_size;
+};
+
+/**
+ * Every record starts with where its name is in the names table.
+ */
+struct MappedTableName {
+  UINT64 name_offset;
+  UINT64 name_length;
+};
+
+/**
+ * A table file mapped read-only.  Nothing in the file is trusted, the
+ * counts and the name of every record are checked against the size of
+ * the file when it is opened.
+ */
+class MappedTable {
+public:
+  MappedTable()=default;
+  ~MappedTable()=default;
+  MappedTable(const MappedTable&)=delete;
+  MappedTable(const MappedTable&&)=delete;
+  MappedTable& operator=(const MappedTable&)=delete;
+  MappedTable& operator=(const MappedTable&&)=delete;
+  /**
+   * Map a table file, closing any table already open.
+   *
+   * @param filename The table file.
+   * @param magic The magic number the file must start with.
+   * @param record_size The size of each record in bytes, records
+   *                    must start with a MappedTableName.
+   * @return If the file exists and is valid.
+   */
+  bool open(const std::string& filename,
+            const char* magic,
+            INT64 record_size);
+  /** Unmap the table. */
+  void close();
+  /** @return The number of records, 0 if nothing is open. */
+  INT64 count() const;
+  /**
+   * @param index The index of the record, less than count().
+   * @return The start of the record.
+   */
+  const unsigned char* record(INT64 index) const;
+  /**
+   * Check that a name stored in a record is inside the names table.
+   *
+   * @param name_offset The offset of the name in the names table.
+   * @param name_length The length of the name.
+   * @return If the name is inside the names table.
+   */
+  bool check_name(UINT64 name_offset,
+                  UINT64 name_length) const;
+  /**
+   * Get a name from the names table, which must have been checked.
+   *
+   * @param name_offset The offset of the name in the names table.
+   * @param name_length The length of the name.
+   * @return The name.
+   */
+  std::string_view name(UINT64 name_offset,
+                        UINT64 name_length) const;
+  /**
+   * @param index The index of the record, less than count().
+   * @return The name of the record.
+   */
+  std::string_view record_name(INT64 index) const;
+  /**
+   * Binary search for a record by name.
+   *
+   * @param name The name to find.
+   * @return The index of the record, or -1 if it is not found.
+   */
+  INT64 find(const std::string_view& name) const;
+private:
+  MappedFile _mapped_file;
+  INT64 _record_size=0;
+  INT64 _count=0;
+  UINT64 _names_size=0;
+  const unsigned char* _records=nullptr;
+  const char* _names=nullptr;
+};
+
+#endif
@@ -0,0 +1,731 @@
+/**
+ * The pyramid cache, a single file per image holding every zoom level
+ * cut into fixed size tiles.
+ */
+// local headers
+#include "../common.hpp"
+#include "../utility.hpp"
+#include "cache_manifest.hpp"
+#include "cache_root.hpp"
+#include "mapped_file.hpp"
+#include "pyramid_cache.hpp"
+#include "zip_index.hpp"
+#include "../c_misc/buffer_manip.hpp"
+// C++ headers
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+// C library headers
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#ifdef IMAGEGRID_USE_LZ4
+#include <lz4.h>
+#endif
+#ifdef IMAGEGRID_USE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef IMAGEGRID_USE_XXHASH
+#include <xxhash.h>
+#endif
+#include <zlib.h>
+
+INT64 pyramid_cache_default_codec() {
+#ifdef IMAGEGRID_USE_LZ4
+  return PYRAMID_CACHE_CODEC_LZ4;
+#else
+  return PYRAMID_CACHE_CODEC_DEFLATE;
+#endif
+}
+
+bool pyramid_cache_codec_supported(INT64 codec) {
+  switch (codec) {
+  case PYRAMID_CACHE_CODEC_DEFLATE:
+    return true;
+#ifdef IMAGEGRID_USE_LZ4
+  case PYRAMID_CACHE_CODEC_LZ4:
+    return true;
+#endif
+#ifdef IMAGEGRID_USE_ZSTD
+  case PYRAMID_CACHE_CODEC_ZSTD:
+    return true;
+#endif
+  default:
+    return false;
+  }
+}
+
+bool pyramid_cache_codec_from_name(const std::string& name,
+                                   INT64& codec) {
+  if (name == "deflate") {
+    codec=PYRAMID_CACHE_CODEC_DEFLATE;
+  } else if (name == "lz4") {
+    codec=PYRAMID_CACHE_CODEC_LZ4;
+  } else if (name == "zstd") {
+    codec=PYRAMID_CACHE_CODEC_ZSTD;
+  } else {
+    ERROR_LOCAL("Unknown cache codec: " << name);
+    return false;
+  }
+  if (!pyramid_cache_codec_supported(codec)) {
+    ERROR_LOCAL("Cache codec not supported by this build: " << name);
+    return false;
+  }
+  return true;
+}
+
+bool pyramid_cache_compress(INT64 codec,
+                            const unsigned char* source,
+                            INT64 source_size,
+                            std::vector<unsigned char>& compressed) {
+  switch (codec) {
+  case PYRAMID_CACHE_CODEC_DEFLATE: {
+    uLongf compressed_size=compressBound(source_size);
+    compressed.resize(compressed_size);
+    if (compress2(compressed.data(),&compressed_size,source,source_size,Z_BEST_SPEED) != Z_OK) {
+      return false;
+    }
+    compressed.resize(compressed_size);
+    return true;
+  }
+#ifdef IMAGEGRID_USE_LZ4
+  case PYRAMID_CACHE_CODEC_LZ4: {
+    compressed.resize(LZ4_compressBound(source_size));
+    auto compressed_size=LZ4_compress_default((const char*)source,(char*)compressed.data(),
+                                              source_size,compressed.size());
+    if (compressed_size <= 0) {
+      return false;
+    }
+    compressed.resize(compressed_size);
+    return true;
+  }
+#endif
+#ifdef IMAGEGRID_USE_ZSTD
+  case PYRAMID_CACHE_CODEC_ZSTD: {
+    compressed.resize(ZSTD_compressBound(source_size));
+    auto compressed_size=ZSTD_compress(compressed.data(),compressed.size(),
+                                       source,source_size,PYRAMID_CACHE_ZSTD_LEVEL);
+    if (ZSTD_isError(compressed_size)) {
+      return false;
+    }
+    compressed.resize(compressed_size);
+    return true;
+  }
+#endif
+  default:
+    return false;
+  }
+}
+
+bool pyramid_cache_decompress(INT64 codec,
+                              const unsigned char* source,
+                              INT64 source_size,
+                              unsigned char* dest,
+                              INT64 dest_size) {
+  switch (codec) {
+  case PYRAMID_CACHE_CODEC_DEFLATE: {
+    uLongf decoded_size=dest_size;
+    return (uncompress(dest,&decoded_size,source,source_size) == Z_OK &&
+            (INT64)decoded_size == dest_size);
+  }
+#ifdef IMAGEGRID_USE_LZ4
+  case PYRAMID_CACHE_CODEC_LZ4:
+    return (LZ4_decompress_safe((const char*)source,(char*)dest,source_size,dest_size) == dest_size);
+#endif
+#ifdef IMAGEGRID_USE_ZSTD
+  case PYRAMID_CACHE_CODEC_ZSTD: {
+    auto decoded_size=ZSTD_decompress(dest,dest_size,source,source_size);
+    return (!ZSTD_isError(decoded_size) && (INT64)decoded_size == dest_size);
+  }
+#endif
+  default:
+    return false;
+  }
+}
+
+bool PyramidCacheReader::open(const std::string& cache_filename) {
+  this->_header=nullptr;
+  if (!this->_mapped_file.open(cache_filename)) {
+    return false;
+  }
+  auto data=this->_mapped_file.data();
+  auto size=(UINT64)this->_mapped_file.size();
+  auto header=(const PyramidCacheHeader*)data;
+  // nothing in the file is trusted, counts are checked against the
+  // size by dividing so a corrupt file can't overflow the checks
+  auto valid=(size >= sizeof(PyramidCacheHeader) &&
+              std::memcmp(header->magic,PYRAMID_CACHE_MAGIC,sizeof(PYRAMID_CACHE_MAGIC)) == 0 &&
+              (header->channels == 1 || header->channels == 4) &&
+              header->tile_size > 0 &&
+              header->tile_size <= PYRAMID_CACHE_TILE_SIZE_MAX &&
+              pyramid_cache_codec_supported(header->codec) &&
+              header->level_count >= 0 &&
+              (UINT64)header->level_count <= (size-sizeof(PyramidCacheHeader))/sizeof(PyramidCacheLevel));
+  if (valid) {
+    // check the tile records are inside the file so reads never need to
+    auto levels=(const PyramidCacheLevel*)(data+sizeof(PyramidCacheHeader));
+    for (INT64 i=0; i < header->level_count; i++) {
+      const auto& level=levels[i];
+      if (level.width < 0 || level.height < 0 ||
+          level.width > PYRAMID_CACHE_LEVEL_SIZE_MAX ||
+          level.height > PYRAMID_CACHE_LEVEL_SIZE_MAX ||
+          level.tiles_w != (level.width+header->tile_size-1)/header->tile_size ||
+          level.tiles_h != (level.height+header->tile_size-1)/header->tile_size ||
+          level.tiles_offset < 0 ||
+          (UINT64)level.tiles_offset > size ||
+          (level.tiles_h > 0 &&
+           (UINT64)level.tiles_w > (size-level.tiles_offset)/sizeof(PyramidCacheTile)/level.tiles_h)) {
+        valid=false;
+        break;
+      }
+    }
+  }
+  if (!valid) {
+    WARN_LOCAL("Ignoring invalid pyramid cache: " << cache_filename);
+    this->_mapped_file.close();
+    return false;
+  }
+  this->_filename=cache_filename;
+  this->_header=header;
+  return true;
+}
+
+INT64 PyramidCacheReader::channels() const {
+  return this->_header->channels;
+}
+
+INT64 PyramidCacheReader::tile_size() const {
+  return this->_header->tile_size;
+}
+
+const PyramidCacheSource& PyramidCacheReader::source() const {
+  return this->_header->source;
+}
+
+bool PyramidCacheReader::find_level(INT64 zoom_out_shift,
+                                    INT64& width,
+                                    INT64& height) const {
+  auto level=this->_find_level(zoom_out_shift);
+  if (!level) {
+    return false;
+  }
+  width=level->width;
+  height=level->height;
+  return true;
+}
+
+bool PyramidCacheReader::read_region(INT64 zoom_out_shift,
+                                     INT64 x0, INT64 y0,
+                                     INT64 x1, INT64 y1,
+                                     unsigned char* dest) const {
+  auto level=this->_find_level(zoom_out_shift);
+  if (!level || x0 < 0 || y0 < 0 || x1 > level->width || y1 > level->height || x0 >= x1 || y0 >= y1) {
+    return false;
+  }
+  auto data=this->_mapped_file.data();
+  auto size=this->_mapped_file.size();
+  auto channels=this->_header->channels;
+  auto tile_size=this->_header->tile_size;
+  auto tiles=(const PyramidCacheTile*)(data+level->tiles_offset);
+  auto tile_i0=x0/tile_size;
+  auto tile_j0=y0/tile_size;
+  auto tiles_across=(x1-1)/tile_size-tile_i0+1;
+  auto tile_count=tiles_across*((y1-1)/tile_size-tile_j0+1);
+  auto dest_stride=(x1-x0)*channels;
+  auto thread_count=worker_thread_count(PYRAMID_CACHE_THREADS_MAX,tile_count);
+  std::vector<std::vector<unsigned char>> tile_buffers(thread_count,
+                                                       std::vector<unsigned char>(tile_size*tile_size*channels));
+  std::vector<char> tile_success(tile_count);
+  parallel_for(tile_count,
+               thread_count,
+               [&](INT64 worker, INT64 k) {
+                 auto tile_i=tile_i0+k%tiles_across;
+                 auto tile_j=tile_j0+k/tiles_across;
+                 const auto& tile=tiles[tile_j*level->tiles_w+tile_i];
+                 auto tile_x=tile_i*tile_size;
+                 auto tile_y=tile_j*tile_size;
+                 auto tile_w=std::min(tile_size,level->width-tile_x);
+                 auto tile_h=std::min(tile_size,level->height-tile_y);
+                 auto& tile_buffer=tile_buffers[worker];
+                 if (tile.offset < 0 || tile.size < 0 || tile.offset > size || tile.size > size-tile.offset ||
+                     !pyramid_cache_decompress(this->_header->codec,
+                                               data+tile.offset,
+                                               tile.size,
+                                               tile_buffer.data(),
+                                               tile_w*tile_h*channels)) {
+                   tile_success[k]=false;
+                   return;
+                 }
+                 // copy just the part of the tile inside the region
+                 auto copy_x0=std::max(x0,tile_x);
+                 auto copy_x1=std::min(x1,tile_x+tile_w);
+                 auto copy_y1=std::min(y1,tile_y+tile_h);
+                 for (auto y=std::max(y0,tile_y); y < copy_y1; y++) {
+                   std::memcpy(dest+(y-y0)*dest_stride+(copy_x0-x0)*channels,
+                               tile_buffer.data()+((y-tile_y)*tile_w+(copy_x0-tile_x))*channels,
+                               (copy_x1-copy_x0)*channels);
+                 }
+                 tile_success[k]=true;
+               });
+  for (INT64 k=0; k < tile_count; k++) {
+    if (!tile_success[k]) {
+      ERROR_LOCAL("Failed to read tile " << tile_i0+k%tiles_across << "," << tile_j0+k/tiles_across <<
+                  " at zoom out shift " << zoom_out_shift << " of: " << this->_filename);
+      return false;
+    }
+  }
+  return true;
+}
+
+std::vector<INT64> PyramidCacheReader::zoom_out_shifts() const {
+  std::vector<INT64> zoom_out_shift_list;
+  if (this->_header) {
+    auto levels=(const PyramidCacheLevel*)(this->_mapped_file.data()+sizeof(PyramidCacheHeader));
+    for (INT64 i=0; i < this->_header->level_count; i++) {
+      zoom_out_shift_list.push_back(levels[i].zoom_out_shift);
+    }
+  }
+  return zoom_out_shift_list;
+}
+
+const PyramidCacheLevel* PyramidCacheReader::_find_level(INT64 zoom_out_shift) const {
+  if (!this->_header) {
+    return nullptr;
+  }
+  auto levels=(const PyramidCacheLevel*)(this->_mapped_file.data()+sizeof(PyramidCacheHeader));
+  for (INT64 i=0; i < this->_header->level_count; i++) {
+    if (levels[i].zoom_out_shift == zoom_out_shift) {
+      return &levels[i];
+    }
+  }
+  return nullptr;
+}
+
+#ifndef IMAGEGRID_USE_XXHASH
+// the XXH64 primes
+const UINT64 XXH64_PRIME_1=0x9E3779B185EBCA87ULL;
+const UINT64 XXH64_PRIME_2=0xC2B2AE3D27D4EB4FULL;
+const UINT64 XXH64_PRIME_3=0x165667B19E3779F9ULL;
+const UINT64 XXH64_PRIME_4=0x85EBCA77C2B2AE63ULL;
+const UINT64 XXH64_PRIME_5=0x27D4EB2F165667C5ULL;
+
+static UINT64 xxh64_rotate(UINT64 value, int bits) {
+  return (value << bits) | (value >> (64-bits));
+}
+
+static UINT64 xxh64_read_64(const unsigned char* data) {
+  UINT64 value=0;
+  for (int i=7; i >= 0; i--) {
+    value=(value << 8) | data[i];
+  }
+  return value;
+}
+
+static UINT64 xxh64_read_32(const unsigned char* data) {
+  return (UINT64)data[0] | ((UINT64)data[1] << 8) | ((UINT64)data[2] << 16) | ((UINT64)data[3] << 24);
+}
+
+static UINT64 xxh64_round(UINT64 accumulator, UINT64 input) {
+  accumulator+=input*XXH64_PRIME_2;
+  return xxh64_rotate(accumulator,31)*XXH64_PRIME_1;
+}
+
+static UINT64 xxh64_merge_round(UINT64 accumulator, UINT64 value) {
+  accumulator^=xxh64_round(0,value);
+  return accumulator*XXH64_PRIME_1+XXH64_PRIME_4;
+}
+
+/**
+ * XXH64 with a seed of 0, for builds without libxxhash, giving the
+ * same hash as the library.
+ */
+static UINT64 xxh64(const unsigned char* data, INT64 size) {
+  auto end=data+size;
+  UINT64 hash;
+  if (size >= 32) {
+    UINT64 v1=XXH64_PRIME_1+XXH64_PRIME_2;
+    UINT64 v2=XXH64_PRIME_2;
+    UINT64 v3=0;
+    UINT64 v4=0-XXH64_PRIME_1;
+    for (; data+32 <= end; data+=32) {
+      v1=xxh64_round(v1,xxh64_read_64(data));
+      v2=xxh64_round(v2,xxh64_read_64(data+8));
+      v3=xxh64_round(v3,xxh64_read_64(data+16));
+      v4=xxh64_round(v4,xxh64_read_64(data+24));
+    }
+    hash=xxh64_rotate(v1,1)+xxh64_rotate(v2,7)+xxh64_rotate(v3,12)+xxh64_rotate(v4,18);
+    hash=xxh64_merge_round(hash,v1);
+    hash=xxh64_merge_round(hash,v2);
+    hash=xxh64_merge_round(hash,v3);
+    hash=xxh64_merge_round(hash,v4);
+  } else {
+    hash=XXH64_PRIME_5;
+  }
+  hash+=(UINT64)size;
+  for (; data+8 <= end; data+=8) {
+    hash^=xxh64_round(0,xxh64_read_64(data));
+    hash=xxh64_rotate(hash,27)*XXH64_PRIME_1+XXH64_PRIME_4;
+  }
+  if (data+4 <= end) {
+    hash^=xxh64_read_32(data)*XXH64_PRIME_1;
+    hash=xxh64_rotate(hash,23)*XXH64_PRIME_2+XXH64_PRIME_3;
+    data+=4;
+  }
+  for (; data < end; data++) {
+    hash^=(*data)*XXH64_PRIME_5;
+    hash=xxh64_rotate(hash,11)*XXH64_PRIME_1;
+  }
+  hash^=hash >> 33;
+  hash*=XXH64_PRIME_2;
+  hash^=hash >> 29;
+  hash*=XXH64_PRIME_3;
+  hash^=hash >> 32;
+  return hash;
+}
+#endif
+
+UINT64 pyramid_cache_hash_bytes(const unsigned char* data,
+                                INT64 size) {
+#ifdef IMAGEGRID_USE_XXHASH
+  return XXH64(data,size,0);
+#else
+  return xxh64(data,size);
+#endif
+}
+
+bool pyramid_cache_hash(const std::string& filename,
+                        UINT64& hash) {
+  MappedFile mapped_file;
+  if (!mapped_file.open(filename)) {
+    return false;
+  }
+  auto data=mapped_file.data();
+  auto size=mapped_file.size();
+  std::vector<unsigned char> sampled;
+  auto sampled_size=PYRAMID_CACHE_HASH_HEADER_SIZE+PYRAMID_CACHE_HASH_BLOCK_SIZE*PYRAMID_CACHE_HASH_BLOCK_COUNT;
+  if (size <= sampled_size) {
+    sampled.assign(data,data+size);
+  } else {
+    sampled.assign(data,data+PYRAMID_CACHE_HASH_HEADER_SIZE);
+    auto block_spacing=(size-PYRAMID_CACHE_HASH_HEADER_SIZE-PYRAMID_CACHE_HASH_BLOCK_SIZE)/PYRAMID_CACHE_HASH_BLOCK_COUNT;
+    for (INT64 i=0; i < PYRAMID_CACHE_HASH_BLOCK_COUNT; i++) {
+      auto block=data+PYRAMID_CACHE_HASH_HEADER_SIZE+(i+1)*block_spacing;
+      sampled.insert(sampled.end(),block,block+PYRAMID_CACHE_HASH_BLOCK_SIZE);
+    }
+  }
+  hash=pyramid_cache_hash_bytes(sampled.data(),sampled.size());
+  // 0 means not hashed
+  if (hash == 0) {
+    hash=1;
+  }
+  return true;
+}
+
+bool pyramid_cache_source(const std::string& filename,
+                          PyramidCacheSource& source) {
+  if (!cache_file_stat(filename,source.file_size,source.file_mtime)) {
+    return false;
+  }
+  if (!pyramid_cache_hash(filename,source.hash)) {
+    source.hash=0;
+  }
+  return true;
+}
+
+bool pyramid_cache_source_matches(const std::string& filename,
+                                  const PyramidCacheSource& source) {
+  INT64 file_size,file_mtime;
+  if (!cache_file_stat(filename,file_size,file_mtime) ||
+      file_size != source.file_size) {
+    return false;
+  }
+  if (file_mtime == source.file_mtime) {
+    return true;
+  }
+  UINT64 hash;
+  return (source.hash != 0 &&
+          pyramid_cache_hash(filename,hash) &&
+          hash == source.hash);
+}
+
+bool pyramid_cache_up_to_date(const std::string& cache_filename,
+                              const std::string& filename,
+                              INT64 zoom_out_shift_count) {
+  PyramidCacheReader reader;
+  if (!reader.open(cache_filename) ||
+      !pyramid_cache_source_matches(filename,reader.source())) {
+    return false;
+  }
+  for (INT64 zoom_out_shift=0; zoom_out_shift < zoom_out_shift_count; zoom_out_shift++) {
+    INT64 level_width,level_height;
+    if (!reader.find_level(zoom_out_shift,level_width,level_height)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool pyramid_cache_write(const std::string& cache_filename,
+                         const PyramidCacheSource& source,
+                         INT64 channels,
+                         INT64 codec,
+                         const std::vector<PyramidCacheLevelData>& levels) {
+  auto tile_size=PYRAMID_CACHE_TILE_SIZE;
+  PyramidCacheHeader header;
+  std::memcpy(header.magic,PYRAMID_CACHE_MAGIC,sizeof(PYRAMID_CACHE_MAGIC));
+  header.source=source;
+  header.channels=channels;
+  header.tile_size=tile_size;
+  header.codec=codec;
+  header.level_count=levels.size();
+  // the tile records of every level come straight after the levels
+  std::vector<PyramidCacheLevel> level_records;
+  std::vector<INT64> level_first_tile;
+  INT64 tile_count=0;
+  INT64 offset=sizeof(PyramidCacheHeader)+levels.size()*sizeof(PyramidCacheLevel);
+  for (const auto& level : levels) {
+    auto tiles_w=(level.width+tile_size-1)/tile_size;
+    auto tiles_h=(level.height+tile_size-1)/tile_size;
+    level_records.push_back(PyramidCacheLevel{level.zoom_out_shift,level.width,level.height,
+                                              tiles_w,tiles_h,offset});
+    level_first_tile.push_back(tile_count);
+    offset+=tiles_w*tiles_h*sizeof(PyramidCacheTile);
+    tile_count+=tiles_w*tiles_h;
+  }
+  // compress every tile
+  std::vector<std::vector<unsigned char>> compressed_tiles(tile_count);
+  std::vector<char> tile_success(tile_count);
+  auto thread_count=worker_thread_count(PYRAMID_CACHE_THREADS_MAX,tile_count);
+  std::vector<std::vector<unsigned char>> tile_buffers(thread_count,
+                                                       std::vector<unsigned char>(tile_size*tile_size*channels));
+  parallel_for(tile_count,
+               thread_count,
+               [&](INT64 worker, INT64 k) {
+                 auto level_index=std::upper_bound(level_first_tile.begin(),level_first_tile.end(),k)-level_first_tile.begin()-1;
+                 const auto& level=levels[level_index];
+                 const auto& level_record=level_records[level_index];
+                 auto tile_index=k-level_first_tile[level_index];
+                 auto tile_x=(tile_index%level_record.tiles_w)*tile_size;
+                 auto tile_y=(tile_index/level_record.tiles_w)*tile_size;
+                 auto tile_w=std::min(tile_size,level.width-tile_x);
+                 auto tile_h=std::min(tile_size,level.height-tile_y);
+                 auto& tile_buffer=tile_buffers[worker];
+                 for (INT64 y=0; y < tile_h; y++) {
+                   std::memcpy(tile_buffer.data()+y*tile_w*channels,
+                               level.data+((tile_y+y)*level.width+tile_x)*channels,
+                               tile_w*channels);
+                 }
+                 tile_success[k]=pyramid_cache_compress(codec,
+                                                        tile_buffer.data(),
+                                                        tile_w*tile_h*channels,
+                                                        compressed_tiles[k]);
+               });
+  std::vector<PyramidCacheTile> tile_records;
+  tile_records.reserve(tile_count);
+  for (INT64 k=0; k < tile_count; k++) {
+    if (!tile_success[k]) {
+      ERROR_LOCAL("Failed to compress pyramid cache tile for: " << cache_filename);
+      return false;
+    }
+    tile_records.push_back(PyramidCacheTile{offset,(INT64)compressed_tiles[k].size()});
+    offset+=compressed_tiles[k].size();
+  }
+  // write to a temporary file and rename so a cache is never half written
+  auto temp_filename=cache_filename+".tmp";
+  std::ofstream cache_out(temp_filename,std::ios::binary | std::ios::trunc);
+  if (!cache_out.is_open()) {
+    ERROR_LOCAL("Failed to write pyramid cache: " << temp_filename);
+    return false;
+  }
+  cache_out.write((const char*)&header,sizeof(header));
+  cache_out.write((const char*)level_records.data(),level_records.size()*sizeof(PyramidCacheLevel));
+  cache_out.write((const char*)tile_records.data(),tile_records.size()*sizeof(PyramidCacheTile));
+  for (const auto& compressed_tile : compressed_tiles) {
+    cache_out.write((const char*)compressed_tile.data(),compressed_tile.size());
+  }
+  cache_out.close();
+  if (!cache_out) {
+    ERROR_LOCAL("Failed to write pyramid cache: " << temp_filename);
+    return false;
+  }
+  std::error_code error_code;
+  std::filesystem::rename(temp_filename,cache_filename,error_code);
+  if (error_code) {
+    ERROR_LOCAL("Failed to rename pyramid cache: " << temp_filename);
+    return false;
+  }
+  return true;
+}
+
+INT64 pyramid_cache_write_job_bytes(const PyramidCacheWriteJob& job) {
+  INT64 bytes=0;
+  for (const auto& level : job.levels) {
+    bytes+=level.width*level.height*level.channels;
+  }
+  return bytes;
+}
+
+bool pyramid_cache_write_job_needed(const PyramidCacheWriteJob& job) {
+  PyramidCacheReader reader;
+  if (!reader.open(job.cache_filename) ||
+      !pyramid_cache_source_matches(job.filename,reader.source())) {
+    return true;
+  }
+  for (const auto& level : job.levels) {
+    INT64 level_width,level_height;
+    if (!reader.find_level(level.zoom_out_shift,level_width,level_height)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool pyramid_cache_write_job(const PyramidCacheWriteJob& job) {
+  // the manifest lets the grid be setup without opening any images
+  cache_manifest_update(job.filename,job.width,job.height);
+  if (job.levels.empty()) {
+    return true;
+  }
+  PyramidCacheSource source;
+  if (!pyramid_cache_source(job.filename,source)) {
+    ERROR_LOCAL("Failed to check image for pyramid cache: " << job.filename);
+    return false;
+  }
+  // keep the levels of an existing cache of the same image
+  std::vector<PyramidCacheWriteLevel> kept_levels;
+  PyramidCacheReader reader;
+  if (reader.open(job.cache_filename) &&
+      pyramid_cache_source_matches(job.filename,reader.source())) {
+    for (const auto& zoom_out_shift : reader.zoom_out_shifts()) {
+      INT64 level_width,level_height;
+      if (!reader.find_level(zoom_out_shift,level_width,level_height) ||
+          std::any_of(job.levels.begin(),job.levels.end(),
+                      [zoom_out_shift](const PyramidCacheWriteLevel& level) { return level.zoom_out_shift == zoom_out_shift; })) {
+        continue;
+      }
+      PyramidCacheWriteLevel kept_level{zoom_out_shift,level_width,level_height,reader.channels(),nullptr,nullptr,{}};
+      kept_level.buffer.resize(level_width*level_height*reader.channels());
+      if (reader.read_region(zoom_out_shift,0,0,level_width,level_height,kept_level.buffer.data())) {
+        kept_levels.push_back(std::move(kept_level));
+      }
+    }
+  }
+  std::vector<const PyramidCacheWriteLevel*> all_levels;
+  for (const auto& level : job.levels) {
+    all_levels.push_back(&level);
+  }
+  for (const auto& level : kept_levels) {
+    all_levels.push_back(&level);
+  }
+  std::sort(all_levels.begin(),all_levels.end(),
+            [](const PyramidCacheWriteLevel* a, const PyramidCacheWriteLevel* b) {
+              return a->zoom_out_shift < b->zoom_out_shift;
+            });
+  // kept as grayscale if every level is grayscale
+  auto all_gray=std::all_of(all_levels.begin(),all_levels.end(),
+                            [](const PyramidCacheWriteLevel* level) { return level->channels == 1 && !level->palette; });
+  std::vector<std::vector<PIXEL_RGBA>> expanded_levels;
+  std::vector<PyramidCacheLevelData> cache_levels;
+  for (const auto& level : all_levels) {
+    auto cache_data=level->pixels();
+    if (!all_gray && level->channels == 1) {
+      expanded_levels.emplace_back(level->width*level->height);
+      if (level->palette) {
+        buffer_expand_palette_row(cache_data,
+                                  level->palette->data(),
+                                  expanded_levels.back().data(),
+                                  level->width*level->height);
+      } else {
+        buffer_expand_gray_row(cache_data,
+                               expanded_levels.back().data(),
+                               level->width*level->height);
+      }
+      cache_data=(const unsigned char*)expanded_levels.back().data();
+    }
+    cache_levels.push_back(PyramidCacheLevelData{level->zoom_out_shift,
+                                                 level->width,level->height,
+                                                 cache_data});
+  }
+  MSG_LOCAL("Writing pyramid cache: " << job.cache_filename << " for " << job.filename <<
+            " with " << cache_levels.size() << " zoom levels");
+  if (!pyramid_cache_write(job.cache_filename,
+                           source,
+                           (all_gray ? 1 : 4),
+                           job.codec,
+                           cache_levels)) {
+    return false;
+  }
+  cache_root_written(job.cache_filename);
+  return true;
+}
+
+PyramidCacheWriteBack::PyramidCacheWriteBack() {
+  this->_thread=std::thread(&PyramidCacheWriteBack::_worker,this);
+}
+
+PyramidCacheWriteBack::~PyramidCacheWriteBack() {
+  {
+    std::lock_guard<std::mutex> guard(this->_mutex);
+    this->_stopping=true;
+    this->_jobs.clear();
+  }
+  this->_job_ready.notify_all();
+  if (this->_thread.joinable()) {
+    this->_thread.join();
+  }
+  // viewing is the only time most zip files are opened, so keep where
+  // their members are for the next session too
+  cache_manifest_save_all();
+  zip_index_save_all();
+}
+
+bool PyramidCacheWriteBack::busy(const std::string& cache_filename,
+                                 INT64 bytes) {
+  std::lock_guard<std::mutex> guard(this->_mutex);
+  return (this->_stopping ||
+          bytes > PYRAMID_CACHE_WRITE_BACK_MAX_BYTES-this->_pending_bytes ||
+          this->_pending.count(cache_filename) > 0);
+}
+
+bool PyramidCacheWriteBack::queue(PyramidCacheWriteJob&& job) {
+  auto bytes=pyramid_cache_write_job_bytes(job);
+  {
+    std::lock_guard<std::mutex> guard(this->_mutex);
+    if (this->_stopping ||
+        bytes > PYRAMID_CACHE_WRITE_BACK_MAX_BYTES-this->_pending_bytes ||
+        !this->_pending.insert(job.cache_filename).second) {
+      return false;
+    }
+    this->_pending_bytes+=bytes;
+    this->_jobs.push_back(std::move(job));
+  }
+  this->_job_ready.notify_one();
+  return true;
+}
+
+void PyramidCacheWriteBack::_worker() {
+  // threads compressing tiles are started from here and inherit this
+  setpriority(PRIO_PROCESS,(id_t)syscall(SYS_gettid),PYRAMID_CACHE_WRITE_BACK_NICE);
+  while (true) {
+    PyramidCacheWriteJob job;
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_job_ready.wait(lock,[this]() { return this->_stopping || !this->_jobs.empty(); });
+      if (this->_jobs.empty()) {
+        return;
+      }
+      job=std::move(this->_jobs.front());
+      this->_jobs.pop_front();
+    }
+    pyramid_cache_write_job(job);
+    std::lock_guard<std::mutex> guard(this->_mutex);
+    this->_pending.erase(job.cache_filename);
+    this->_pending_bytes-=pyramid_cache_write_job_bytes(job);
+  }
+}
@@ -0,0 +1,419 @@
+/**
+ * Header for the pyramid cache, a single file per image holding every
+ * zoom level cut into fixed size tiles so any tile of any level can
+ * be read on its own.
+ */
+#ifndef PYRAMID_CACHE_HPP
+#define PYRAMID_CACHE_HPP
+
+#include "../common.hpp"
+#include "mapped_file.hpp"
+// C++ headers
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+const std::string PYRAMID_CACHE_EXTENSION{"igp"};
+
+// identifies the pyramid cache file and its version
+const char PYRAMID_CACHE_MAGIC[8]={'I','G','P','Y','R','M','D','2'};
+
+// the width and height of the tiles in the pyramid cache
+const INT64 PYRAMID_CACHE_TILE_SIZE=256;
+// the largest tiles and zoom levels a cache file may claim, anything
+// larger is treated as corrupt before it is used to size anything
+const INT64 PYRAMID_CACHE_TILE_SIZE_MAX=4096;
+const INT64 PYRAMID_CACHE_LEVEL_SIZE_MAX=1L << 32;
+
+// the codecs tiles may be compressed with, lz4 and zstd are only
+// available if the viewer was built with them
+const INT64 PYRAMID_CACHE_CODEC_DEFLATE=1;
+const INT64 PYRAMID_CACHE_CODEC_LZ4=2;
+const INT64 PYRAMID_CACHE_CODEC_ZSTD=3;
+
+// zstd is the dense choice so it is worth compressing harder
+const INT64 PYRAMID_CACHE_ZSTD_LEVEL=9;
+
+// the most threads used to compress or decompress the tiles of one image
+const INT64 PYRAMID_CACHE_THREADS_MAX=8;
+
+// the most bytes of copied zoom levels held for caches written in the
+// background, including the one being written, later caches are
+// dropped before anything is copied and written the next time their
+// image is loaded
+const INT64 PYRAMID_CACHE_WRITE_BACK_MAX_BYTES=1L << 30;
+
+// the nice value of the thread writing caches in the background so
+// it only uses time loading and drawing don't need
+const int PYRAMID_CACHE_WRITE_BACK_NICE=19;
+
+// the hash of a source image covers its start, where the headers are,
+// and blocks sampled evenly through the rest so big images hash quickly
+const INT64 PYRAMID_CACHE_HASH_HEADER_SIZE=65536;
+const INT64 PYRAMID_CACHE_HASH_BLOCK_SIZE=4096;
+const INT64 PYRAMID_CACHE_HASH_BLOCK_COUNT=16;
+
+/**
+ * What is recorded about the source image a pyramid cache was built
+ * from to detect when the image changes.
+ */
+struct PyramidCacheSource {
+  INT64 file_size;
+  /** The modification time in nanoseconds. */
+  INT64 file_mtime;
+  /** The hash of sampled parts of the image, 0 if not hashed. */
+  UINT64 hash;
+};
+
+/**
+ * The start of a pyramid cache file.
+ */
+struct PyramidCacheHeader {
+  char magic[8];
+  PyramidCacheSource source;
+  /** The bytes per pixel, 4 for RGBA or 1 for grayscale. */
+  INT64 channels;
+  INT64 tile_size;
+  INT64 codec;
+  INT64 level_count;
+};
+
+/**
+ * A zoom level in a pyramid cache file, the levels follow the header.
+ */
+struct PyramidCacheLevel {
+  INT64 zoom_out_shift;
+  INT64 width;
+  INT64 height;
+  INT64 tiles_w;
+  INT64 tiles_h;
+  /** Where the tiles_w*tiles_h tile records of this level start. */
+  INT64 tiles_offset;
+};
+
+/**
+ * Where a compressed tile is in a pyramid cache file, tiles are
+ * stored row by row.
+ */
+struct PyramidCacheTile {
+  INT64 offset;
+  INT64 size;
+};
+
+/**
+ * A zoom level to write to a pyramid cache file.
+ */
+struct PyramidCacheLevelData {
+  INT64 zoom_out_shift;
+  INT64 width;
+  INT64 height;
+  /** The pixels of the level with width*channels bytes per row. */
+  const unsigned char* data;
+};
+
+/**
+ * Reads tiles of a pyramid cache file through a memory map.
+ */
+class PyramidCacheReader {
+public:
+  PyramidCacheReader()=default;
+  ~PyramidCacheReader()=default;
+  PyramidCacheReader(const PyramidCacheReader&)=delete;
+  PyramidCacheReader(const PyramidCacheReader&&)=delete;
+  PyramidCacheReader& operator=(const PyramidCacheReader&)=delete;
+  PyramidCacheReader& operator=(const PyramidCacheReader&&)=delete;
+  /**
+   * Open a pyramid cache file.
+   *
+   * @param cache_filename The pyramid cache file.
+   * @return If the file exists and is valid.
+   */
+  bool open(const std::string& cache_filename);
+  /** @return The bytes per pixel, 4 for RGBA or 1 for grayscale. */
+  INT64 channels() const;
+  /** @return The width and height of the tiles. */
+  INT64 tile_size() const;
+  /** @return What was recorded about the source image. */
+  const PyramidCacheSource& source() const;
+  /**
+   * Find a zoom level in the file.
+   *
+   * @param zoom_out_shift The zoom level.
+   * @param width Set to the width of the level in pixels.
+   * @param height Set to the height of the level in pixels.
+   * @return If the file has the zoom level.
+   */
+  bool find_level(INT64 zoom_out_shift,
+                  INT64& width,
+                  INT64& height) const;
+  /** @return The zoom levels in the file. */
+  std::vector<INT64> zoom_out_shifts() const;
+  /**
+   * Read a region of a zoom level, decompressing the tiles it covers
+   * on several threads.
+   *
+   * @param zoom_out_shift The zoom level.
+   * @param x0 The left edge of the region.
+   * @param y0 The top edge of the region.
+   * @param x1 The right edge of the region, exclusive.
+   * @param y1 The bottom edge of the region, exclusive.
+   * @param dest The destination with (x1-x0)*channels() bytes per row.
+   * @return If every tile could be read.
+   */
+  bool read_region(INT64 zoom_out_shift,
+                   INT64 x0, INT64 y0,
+                   INT64 x1, INT64 y1,
+                   unsigned char* dest) const;
+private:
+  const PyramidCacheLevel* _find_level(INT64 zoom_out_shift) const;
+  MappedFile _mapped_file;
+  const PyramidCacheHeader* _header=nullptr;
+  /** The filename used in messages. */
+  std::string _filename;
+};
+
+/**
+ * @return The fastest codec to decode that this build supports.
+ */
+INT64 pyramid_cache_default_codec();
+
+/**
+ * @param codec The codec.
+ * @return If this build can compress and decompress the codec.
+ */
+bool pyramid_cache_codec_supported(INT64 codec);
+
+/**
+ * Find a codec from its name.
+ *
+ * @param name The name of the codec, deflate, lz4 or zstd.
+ * @param codec Set to the codec.
+ * @return If the name is known and this build supports the codec.
+ */
+bool pyramid_cache_codec_from_name(const std::string& name,
+                                   INT64& codec);
+
+/**
+ * Compress a tile.
+ *
+ * @param codec The codec.
+ * @param source The pixels of the tile.
+ * @param source_size The size of the tile in bytes.
+ * @param compressed Set to the compressed tile.
+ * @return If compressing was successful.
+ */
+bool pyramid_cache_compress(INT64 codec,
+                            const unsigned char* source,
+                            INT64 source_size,
+                            std::vector<unsigned char>& compressed);
+
+/**
+ * Decompress a tile.
+ *
+ * @param codec The codec.
+ * @param source The compressed tile.
+ * @param source_size The size of the compressed tile in bytes.
+ * @param dest The pixels of the tile.
+ * @param dest_size The size the decompressed tile must be.
+ * @return If decompressing was successful and gave exactly dest_size bytes.
+ */
+bool pyramid_cache_decompress(INT64 codec,
+                              const unsigned char* source,
+                              INT64 source_size,
+                              unsigned char* dest,
+                              INT64 dest_size);
+
+/**
+ * Hash bytes with XXH64, using libxxhash if this build has it and the
+ * same hash computed here otherwise, so anything stored by the hash
+ * is found by every build.
+ *
+ * @param data The bytes.
+ * @param size The number of bytes.
+ * @return The hash.
+ */
+UINT64 pyramid_cache_hash_bytes(const unsigned char* data,
+                                INT64 size);
+
+/**
+ * Hash the start and sampled blocks of a file with XXH64.
+ *
+ * @param filename The file.
+ * @param hash Set to the hash, never 0.
+ * @return If the file could be read.
+ */
+bool pyramid_cache_hash(const std::string& filename,
+                        UINT64& hash);
+
+/**
+ * Find what to record about a source image.
+ *
+ * @param filename The source image.
+ * @param source Set to what is recorded about the image.
+ * @return If the image could be checked.
+ */
+bool pyramid_cache_source(const std::string& filename,
+                          PyramidCacheSource& source);
+
+/**
+ * Check if a source image is unchanged since a pyramid cache was
+ * built from it.  Only the size and modification time are checked
+ * unless the modification time changed and a hash was recorded, so a
+ * copied or touched image can keep its cache.
+ *
+ * @param filename The source image.
+ * @param source What was recorded about the image.
+ * @return If the image is unchanged.
+ */
+bool pyramid_cache_source_matches(const std::string& filename,
+                                  const PyramidCacheSource& source);
+
+/**
+ * Check if a pyramid cache exists, is valid, was built from the
+ * current version of its source image and has every zoom level.
+ *
+ * @param cache_filename The pyramid cache file.
+ * @param filename The source image.
+ * @param zoom_out_shift_count The number of zoom levels it must have.
+ * @return If the cache can be used.
+ */
+bool pyramid_cache_up_to_date(const std::string& cache_filename,
+                              const std::string& filename,
+                              INT64 zoom_out_shift_count);
+
+/**
+ * Write a pyramid cache file, compressing the tiles on several
+ * threads.
+ *
+ * @param cache_filename The pyramid cache file.
+ * @param source What to record about the source image.
+ * @param channels The bytes per pixel, 4 for RGBA or 1 for grayscale.
+ * @param codec The codec to compress the tiles with.
+ * @param levels The zoom levels to write.
+ * @return If writing was successful.
+ */
+bool pyramid_cache_write(const std::string& cache_filename,
+                         const PyramidCacheSource& source,
+                         INT64 channels,
+                         INT64 codec,
+                         const std::vector<PyramidCacheLevelData>& levels);
+
+/**
+ * A zoom level of an image to cache, either pointing at loaded data or
+ * holding a copy of it.
+ */
+struct PyramidCacheWriteLevel {
+  INT64 zoom_out_shift;
+  INT64 width;
+  INT64 height;
+  /** 4 for RGBA, 1 for palette indices or grayscale. */
+  INT64 channels;
+  /** The pixels if they are not copied into buffer. */
+  const unsigned char* data;
+  /** The palette for indices, null for grayscale or RGBA. */
+  std::shared_ptr<std::vector<PIXEL_RGBA>> palette;
+  /** A copy of the pixels, used instead of data if not empty. */
+  std::vector<unsigned char> buffer;
+  /** @return The pixels with width*channels bytes per row. */
+  const unsigned char* pixels() const {
+    return (this->buffer.empty() ? this->data : this->buffer.data());
+  }
+};
+
+/**
+ * Everything needed to write the pyramid cache of an image.
+ */
+struct PyramidCacheWriteJob {
+  /** The source image. */
+  std::string filename;
+  std::string cache_filename;
+  /** The full size of the image in pixels, recorded in the manifest. */
+  INT64 width;
+  INT64 height;
+  INT64 codec;
+  std::vector<PyramidCacheWriteLevel> levels;
+};
+
+/**
+ * @param job The image to cache.
+ * @return The bytes of zoom levels in the job.
+ */
+INT64 pyramid_cache_write_job_bytes(const PyramidCacheWriteJob& job);
+
+/**
+ * Check if writing a job would add anything to its pyramid cache, so
+ * images loaded again are not cached again.
+ *
+ * @param job The image to cache.
+ * @return If the cache is missing, out of date or lacks one of the
+ *         zoom levels in the job.
+ */
+bool pyramid_cache_write_job_needed(const PyramidCacheWriteJob& job);
+
+/**
+ * Write the pyramid cache of an image and record the image in the
+ * manifest.  Zoom levels in a valid existing cache that are not in
+ * the job are kept, so a cache built up from parts of an image
+ * gathers every zoom level over time.  Palette indices and grayscale
+ * are expanded to RGBA unless every level is grayscale.
+ *
+ * @param job The image to cache.
+ * @return If writing was successful.
+ */
+bool pyramid_cache_write_job(const PyramidCacheWriteJob& job);
+
+/**
+ * Writes pyramid caches one at a time on a low priority thread, used
+ * to cache images loaded while viewing.
+ */
+class PyramidCacheWriteBack {
+public:
+  PyramidCacheWriteBack();
+  /**
+   * Finish the cache being written, drop any others and save the
+   * manifests and zip indexes.
+   */
+  ~PyramidCacheWriteBack();
+  PyramidCacheWriteBack(const PyramidCacheWriteBack&)=delete;
+  PyramidCacheWriteBack(const PyramidCacheWriteBack&&)=delete;
+  PyramidCacheWriteBack& operator=(const PyramidCacheWriteBack&)=delete;
+  PyramidCacheWriteBack& operator=(const PyramidCacheWriteBack&&)=delete;
+  /**
+   * Check if a cache can't be queued, so its levels don't need to be
+   * copied.
+   *
+   * @param cache_filename The pyramid cache file.
+   * @param bytes The bytes of zoom levels that would be copied.
+   * @return If the cache is already queued or the levels don't fit in
+   *         PYRAMID_CACHE_WRITE_BACK_MAX_BYTES.
+   */
+  bool busy(const std::string& cache_filename,
+            INT64 bytes);
+  /**
+   * Queue a cache to be written, the levels must hold copies of the
+   * pixels.
+   *
+   * @param job The image to cache.
+   * @return If the job was queued, see busy.
+   */
+  bool queue(PyramidCacheWriteJob&& job);
+private:
+  /** Loop run by the writing thread. */
+  void _worker();
+  std::thread _thread;
+  std::mutex _mutex;
+  std::condition_variable _job_ready;
+  std::deque<PyramidCacheWriteJob> _jobs;
+  /** The cache files of queued jobs and the one being written. */
+  std::unordered_set<std::string> _pending;
+  /** The bytes of zoom levels held by queued jobs and the one being written. */
+  INT64 _pending_bytes{0};
+  bool _stopping{false};
+};
+
+#endif
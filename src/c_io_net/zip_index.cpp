@@ -0,0 +1,301 @@
+/**
+ * The index that records where the tiff member is inside every NTS
+ * zip file in a cache directory.
+ */
+// local headers
+#include "../common.hpp"
+#include "cache_manifest.hpp"
+#include "mapped_table.hpp"
+#include "zip_index.hpp"
+#include "zip_reader.hpp"
+// C++ headers
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * A record in the zip index file, the zip filename and member name
+ * are stored separately after all records.
+ */
+struct ZipIndexRecord {
+  UINT64 name_offset;
+  UINT64 name_length;
+  UINT64 member_name_offset;
+  UINT64 member_name_length;
+  INT64 file_size;
+  INT64 file_mtime;
+  INT64 data_offset;
+  INT64 compression_method;
+  INT64 compressed_size;
+  INT64 uncompressed_size;
+  INT64 local_header_offset;
+  UINT64 crc32;
+};
+
+bool ZipIndex::load(const std::string& index_filename) {
+  auto valid=this->_mapped_table.open(index_filename,
+                                      ZIP_INDEX_MAGIC,
+                                      sizeof(ZipIndexRecord));
+  // the member names are in the names table too
+  for (INT64 i=0; valid && i < this->_mapped_table.count(); i++) {
+    auto record=(const ZipIndexRecord*)this->_mapped_table.record(i);
+    valid=this->_mapped_table.check_name(record->member_name_offset,record->member_name_length);
+  }
+  if (!valid) {
+    if (std::filesystem::exists(index_filename)) {
+      WARN_LOCAL("Ignoring invalid zip index: " << index_filename);
+    }
+    this->_mapped_table.close();
+    return false;
+  }
+  return true;
+}
+
+/**
+ * Convert a record from the file back to an entry.
+ */
+static ZipIndexEntry zip_index_record_entry(const MappedTable& table,
+                                            INT64 index) {
+  auto record=(const ZipIndexRecord*)table.record(index);
+  ZipIndexEntry entry;
+  entry.file_size=record->file_size;
+  entry.file_mtime=record->file_mtime;
+  entry.data_offset=record->data_offset;
+  entry.member.name=table.name(record->member_name_offset,record->member_name_length);
+  entry.member.compression_method=record->compression_method;
+  entry.member.compressed_size=record->compressed_size;
+  entry.member.uncompressed_size=record->uncompressed_size;
+  entry.member.local_header_offset=record->local_header_offset;
+  entry.member.crc32=(uint32_t)record->crc32;
+  return entry;
+}
+
+bool ZipIndex::save(const std::string& index_filename) {
+  // merge everything in sorted order so the file can be binary searched
+  std::map<std::string,ZipIndexEntry> all_entries;
+  this->_read_mapped(all_entries);
+  for (const auto& updated_entry : this->_updated_entries) {
+    all_entries[updated_entry.first]=updated_entry.second;
+  }
+  if (!this->_write(index_filename,all_entries)) {
+    return false;
+  }
+  this->_updated_entries.clear();
+  return this->load(index_filename);
+}
+
+bool ZipIndex::save_updates(const std::string& index_filename) const {
+  std::map<std::string,ZipIndexEntry> updated_entries(this->_updated_entries.begin(),
+                                                      this->_updated_entries.end());
+  return this->_write(index_filename,updated_entries);
+}
+
+bool ZipIndex::merge(const std::string& index_filename) {
+  ZipIndex other_index;
+  if (!other_index.load(index_filename)) {
+    return false;
+  }
+  std::map<std::string,ZipIndexEntry> other_entries;
+  other_index._read_mapped(other_entries);
+  for (const auto& other_entry : other_entries) {
+    this->_updated_entries[other_entry.first]=other_entry.second;
+  }
+  return true;
+}
+
+void ZipIndex::_read_mapped(std::map<std::string,ZipIndexEntry>& entries) const {
+  for (INT64 i=0; i < this->_mapped_table.count(); i++) {
+    entries[std::string(this->_mapped_table.record_name(i))]=
+      zip_index_record_entry(this->_mapped_table,i);
+  }
+}
+
+bool ZipIndex::_write(const std::string& index_filename,
+                      const std::map<std::string,ZipIndexEntry>& all_entries) const {
+  MappedTableHeader header;
+  std::memcpy(header.magic,ZIP_INDEX_MAGIC,sizeof(ZIP_INDEX_MAGIC));
+  header.entry_count=all_entries.size();
+  header.names_size=0;
+  std::vector<ZipIndexRecord> records;
+  records.reserve(all_entries.size());
+  for (const auto& entry : all_entries) {
+    const auto& member=entry.second.member;
+    records.push_back(ZipIndexRecord{header.names_size,entry.first.size(),
+                                     header.names_size+entry.first.size(),member.name.size(),
+                                     entry.second.file_size,entry.second.file_mtime,
+                                     entry.second.data_offset,member.compression_method,
+                                     member.compressed_size,member.uncompressed_size,
+                                     member.local_header_offset,member.crc32});
+    header.names_size+=entry.first.size()+member.name.size();
+  }
+  // write to a temporary file and rename so an index is never half written
+  auto temp_filename=index_filename+".tmp";
+  std::ofstream index_out(temp_filename,std::ios::binary | std::ios::trunc);
+  if (!index_out.is_open()) {
+    ERROR_LOCAL("Failed to write zip index: " << temp_filename);
+    return false;
+  }
+  index_out.write((const char*)&header,sizeof(header));
+  index_out.write((const char*)records.data(),records.size()*sizeof(ZipIndexRecord));
+  for (const auto& entry : all_entries) {
+    index_out.write(entry.first.data(),entry.first.size());
+    index_out.write(entry.second.member.name.data(),entry.second.member.name.size());
+  }
+  index_out.close();
+  if (!index_out) {
+    ERROR_LOCAL("Failed to write zip index: " << temp_filename);
+    return false;
+  }
+  std::error_code error_code;
+  std::filesystem::rename(temp_filename,index_filename,error_code);
+  if (error_code) {
+    ERROR_LOCAL("Failed to rename zip index: " << temp_filename);
+    return false;
+  }
+  return true;
+}
+
+bool ZipIndex::find(const std::string& name, ZipIndexEntry& entry) const {
+  auto updated_entry=this->_updated_entries.find(name);
+  if (updated_entry != this->_updated_entries.end()) {
+    entry=updated_entry->second;
+    return true;
+  }
+  return this->_find_mapped(name,entry);
+}
+
+void ZipIndex::update(const std::string& name, const ZipIndexEntry& entry) {
+  this->_updated_entries[name]=entry;
+}
+
+bool ZipIndex::dirty() const {
+  return !this->_updated_entries.empty();
+}
+
+bool ZipIndex::_find_mapped(const std::string& name, ZipIndexEntry& entry) const {
+  auto index=this->_mapped_table.find(name);
+  if (index < 0) {
+    return false;
+  }
+  entry=zip_index_record_entry(this->_mapped_table,index);
+  return true;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// zip indexes for every cache directory seen so far
+
+std::mutex zip_indexes_mutex;
+std::unordered_map<std::string,std::unique_ptr<ZipIndex>> zip_indexes;
+
+/**
+ * Get the zip index for a cache directory, loading it if necessary.
+ * The caller must hold zip_indexes_mutex.
+ */
+ZipIndex* zip_index_for_directory(const std::string& directory) {
+  auto& index=zip_indexes[directory];
+  if (!index) {
+    index=std::make_unique<ZipIndex>();
+    auto index_filename=(std::filesystem::path(directory) / ZIP_INDEX_FILENAME).string();
+    if (index->load(index_filename)) {
+      MSG_LOCAL("Using zip index: " << index_filename);
+    }
+  }
+  return index.get();
+}
+
+bool zip_index_find(const std::string& filename,
+                    ZipIndexEntry& entry) {
+  INT64 file_size;
+  INT64 file_mtime;
+  if (!cache_file_stat(filename,file_size,file_mtime)) {
+    return false;
+  }
+  auto name=std::filesystem::path(filename).filename().string();
+  std::lock_guard<std::mutex> guard(zip_indexes_mutex);
+  return zip_index_for_directory(cache_directory(filename))->find(name,entry) &&
+    entry.file_size == file_size && entry.file_mtime == file_mtime;
+}
+
+bool zip_index_update(const std::string& filename,
+                      const ZipMember& member,
+                      INT64 data_offset) {
+  ZipIndexEntry entry;
+  if (!cache_file_stat(filename,entry.file_size,entry.file_mtime)) {
+    ERROR_LOCAL("Failed to stat file for zip index: " << filename);
+    return false;
+  }
+  entry.data_offset=data_offset;
+  entry.member=member;
+  auto name=std::filesystem::path(filename).filename().string();
+  std::lock_guard<std::mutex> guard(zip_indexes_mutex);
+  zip_index_for_directory(cache_directory(filename))->update(name,entry);
+  return true;
+}
+
+bool zip_index_save_all() {
+  auto success=true;
+  std::lock_guard<std::mutex> guard(zip_indexes_mutex);
+  for (auto& directory_index : zip_indexes) {
+    if (directory_index.second->dirty()) {
+      auto index_filename=(std::filesystem::path(directory_index.first) / ZIP_INDEX_FILENAME).string();
+      MSG_LOCAL("Writing zip index: " << index_filename);
+      std::error_code error_code;
+      std::filesystem::create_directories(directory_index.first,error_code);
+      if (!directory_index.second->save(index_filename)) {
+        success=false;
+      }
+    }
+  }
+  return success;
+}
+
+bool zip_index_save_all_shard(INT64 shard_index,
+                              INT64 shard_count) {
+  auto success=true;
+  std::lock_guard<std::mutex> guard(zip_indexes_mutex);
+  for (auto& directory_index : zip_indexes) {
+    if (directory_index.second->dirty()) {
+      auto index_filename=(std::filesystem::path(directory_index.first) /
+                           cache_shard_filename(ZIP_INDEX_FILENAME,shard_index,shard_count)).string();
+      MSG_LOCAL("Writing partial zip index: " << index_filename);
+      std::error_code error_code;
+      std::filesystem::create_directories(directory_index.first,error_code);
+      if (!directory_index.second->save_updates(index_filename)) {
+        success=false;
+      }
+    }
+  }
+  return success;
+}
+
+bool zip_index_merge_shards(const std::string& directory) {
+  auto shard_filenames=cache_find_shard_filenames(directory,ZIP_INDEX_FILENAME);
+  if (shard_filenames.empty()) {
+    return true;
+  }
+  std::lock_guard<std::mutex> guard(zip_indexes_mutex);
+  auto index=zip_index_for_directory(directory);
+  for (const auto& shard_filename : shard_filenames) {
+    MSG_LOCAL("Merging partial zip index: " << shard_filename);
+    if (!index->merge(shard_filename)) {
+      ERROR_LOCAL("Failed to merge partial zip index: " << shard_filename);
+      return false;
+    }
+  }
+  auto index_filename=(std::filesystem::path(directory) / ZIP_INDEX_FILENAME).string();
+  if (!index->save(index_filename)) {
+    return false;
+  }
+  // only remove the partial indexes once they are safely merged
+  std::error_code error_code;
+  for (const auto& shard_filename : shard_filenames) {
+    std::filesystem::remove(shard_filename,error_code);
+  }
+  return true;
+}
@@ -0,0 +1,162 @@
+/**
+ * Header for the index that records where the tiff member is inside
+ * every NTS zip file in a cache directory, so repeat loads don't need
+ * to read the zip central directory.
+ */
+#ifndef ZIP_INDEX_HPP
+#define ZIP_INDEX_HPP
+
+#include "../common.hpp"
+#include "mapped_table.hpp"
+#include "zip_reader.hpp"
+// C++ headers
+#include <map>
+#include <string>
+#include <unordered_map>
+
+const std::string ZIP_INDEX_FILENAME{"zip_index.bin"};
+
+// identifies the zip index file and its version
+const char ZIP_INDEX_MAGIC[MAPPED_TABLE_MAGIC_LENGTH]={'I','G','Z','I','N','D','X','1'};
+
+/**
+ * Where the wanted member is in a single zip file.
+ */
+struct ZipIndexEntry {
+  /** The size of the zip file, to detect changes. */
+  INT64 file_size;
+  /** The modification time of the zip file, to detect changes. */
+  INT64 file_mtime;
+  /** Where the compressed data of the member starts in the zip file. */
+  INT64 data_offset;
+  ZipMember member;
+};
+
+/**
+ * The zip index for a single cache directory.
+ *
+ * The file is laid out the same way as the cache manifest, a header,
+ * a table of fixed size records sorted by zip filename, and a table
+ * of names.  It is memory mapped and searched in place.
+ */
+class ZipIndex {
+public:
+  ZipIndex()=default;
+  ~ZipIndex()=default;
+  ZipIndex(const ZipIndex&)=delete;
+  ZipIndex(const ZipIndex&&)=delete;
+  ZipIndex& operator=(const ZipIndex&)=delete;
+  ZipIndex& operator=(const ZipIndex&&)=delete;
+  /**
+   * Load an index from a file.
+   *
+   * @param index_filename The index file.
+   * @return If the index exists and is valid.
+   */
+  bool load(const std::string& index_filename);
+  /**
+   * Write the index out, including any updates.
+   *
+   * @param index_filename The index file.
+   * @return If writing was successful.
+   */
+  bool save(const std::string& index_filename);
+  /**
+   * Write out only the updates, leaving out anything loaded from the
+   * existing index.
+   *
+   * @param index_filename The file to write the updates to.
+   * @return If writing was successful.
+   */
+  bool save_updates(const std::string& index_filename) const;
+  /**
+   * Add every entry of another index file as an update, replacing any
+   * existing entries with the same name.
+   *
+   * @param index_filename The index file to merge in.
+   * @return If the file exists and is valid.
+   */
+  bool merge(const std::string& index_filename);
+  /**
+   * Find a zip file in the index.
+   *
+   * @param name The filename of the zip file without the directory.
+   * @param entry Set to where the member is in the zip file.
+   * @return If the zip file was found.
+   */
+  bool find(const std::string& name, ZipIndexEntry& entry) const;
+  /**
+   * Add or replace a zip file in the index.
+   *
+   * @param name The filename of the zip file without the directory.
+   * @param entry Where the member is in the zip file.
+   */
+  void update(const std::string& name, const ZipIndexEntry& entry);
+  /** @return If there are updates that have not been saved. */
+  bool dirty() const;
+private:
+  bool _find_mapped(const std::string& name, ZipIndexEntry& entry) const;
+  void _read_mapped(std::map<std::string,ZipIndexEntry>& entries) const;
+  bool _write(const std::string& index_filename,
+              const std::map<std::string,ZipIndexEntry>& all_entries) const;
+  MappedTable _mapped_table;
+  /** Entries added or changed since the index was loaded. */
+  std::unordered_map<std::string,ZipIndexEntry> _updated_entries;
+};
+
+/**
+ * Look a zip file up in the index for its cache directory, loading
+ * the index the first time the directory is seen.  Entries for zip
+ * files that have changed since they were indexed are not returned.
+ *
+ * @param filename The filename of the zip file.
+ * @param entry Set to where the member is in the zip file.
+ * @return If an up to date entry was found.
+ */
+bool zip_index_find(const std::string& filename,
+                    ZipIndexEntry& entry);
+
+/**
+ * Record where a member is in a zip file in the index for its cache
+ * directory.  The CRC of the member must already have been checked,
+ * stored members found in the index are trusted without checking it
+ * again while the zip file is unchanged.
+ *
+ * @param filename The filename of the zip file.
+ * @param member The member that was found.
+ * @param data_offset Where the compressed data of the member starts.
+ * @return If the zip file could be recorded.
+ */
+bool zip_index_update(const std::string& filename,
+                      const ZipMember& member,
+                      INT64 data_offset);
+
+/**
+ * Write out every zip index that has been updated.
+ *
+ * @return If all indexes were written successfully.
+ */
+bool zip_index_save_all();
+
+/**
+ * Write only the updates of every zip index to partial indexes for a
+ * shard of a cache build, see cache_manifest_save_all_shard.
+ *
+ * @param shard_index The index of the shard, starting at 0.
+ * @param shard_count The number of shards.
+ * @return If all partial indexes were written successfully.
+ */
+bool zip_index_save_all_shard(INT64 shard_index,
+                              INT64 shard_count);
+
+/**
+ * Merge every partial zip index in a cache directory into its zip
+ * index and remove the partial indexes.
+ *
+ * @param directory The cache directory.
+ * @return If merging was successful, also true if there was nothing
+ *         to merge.
+ */
+bool zip_index_merge_shards(const std::string& directory);
+
+#endif
@@ -0,0 +1,285 @@
+/**
+ * Reading members straight out of zip files held in memory.
+ */
+// local headers
+#include "../common.hpp"
+#include "zip_reader.hpp"
+// C++ headers
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+// C headers
+#include <climits>
+#include <cstdint>
+// C library headers
+#ifdef IMAGEGRID_USE_LIBDEFLATE
+#include <libdeflate.h>
+#endif
+#include <zlib.h>
+
+// signatures of the zip records that are used
+const uint32_t ZIP_LOCAL_HEADER_SIGNATURE=0x04034b50;
+const uint32_t ZIP_CENTRAL_HEADER_SIGNATURE=0x02014b50;
+const uint32_t ZIP_END_SIGNATURE=0x06054b50;
+const uint32_t ZIP64_END_SIGNATURE=0x06064b50;
+const uint32_t ZIP64_LOCATOR_SIGNATURE=0x07064b50;
+// fixed sizes of the zip records that are used
+const INT64 ZIP_LOCAL_HEADER_SIZE=30;
+const INT64 ZIP_CENTRAL_HEADER_SIZE=46;
+const INT64 ZIP_END_SIZE=22;
+const INT64 ZIP64_END_SIZE=56;
+const INT64 ZIP64_LOCATOR_SIZE=20;
+// the end record can be followed by a comment of up to 64KiB
+const INT64 ZIP_COMMENT_MAX=0xffff;
+// the extra field holding zip64 sizes and offsets
+const uint16_t ZIP64_EXTRA_ID=0x0001;
+
+/**
+ * Zip files are always little-endian regardless of the machine.
+ */
+static uint16_t zip_read_16(const unsigned char* data) {
+  return (uint16_t)(data[0] | (data[1] << 8));
+}
+
+static uint32_t zip_read_32(const unsigned char* data) {
+  return (uint32_t)data[0] | ((uint32_t)data[1] << 8) |
+    ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+static uint64_t zip_read_64(const unsigned char* data) {
+  return (uint64_t)zip_read_32(data) | ((uint64_t)zip_read_32(data+4) << 32);
+}
+
+/**
+ * Replace 32-bit fields that overflowed with the values from the
+ * zip64 extra field, which only holds the fields that overflowed and
+ * always in this order.
+ */
+static bool zip_read_zip64_extra(const unsigned char* extra,
+                                 INT64 extra_length,
+                                 ZipMember& member) {
+  INT64 position=0;
+  while (position+4 <= extra_length) {
+    auto id=zip_read_16(extra+position);
+    auto length=(INT64)zip_read_16(extra+position+2);
+    position+=4;
+    if (position+length > extra_length) {
+      return false;
+    }
+    if (id == ZIP64_EXTRA_ID) {
+      INT64 field=position;
+      INT64* overflowed[3]={&member.uncompressed_size,
+                            &member.compressed_size,
+                            &member.local_header_offset};
+      for (auto value : overflowed) {
+        if (*value != UINT32_MAX) {
+          continue;
+        }
+        if (field+8 > position+length) {
+          return false;
+        }
+        *value=(INT64)zip_read_64(extra+field);
+        field+=8;
+      }
+    }
+    position+=length;
+  }
+  return true;
+}
+
+bool zip_read_central_directory(const unsigned char* data,
+                                INT64 size,
+                                std::vector<ZipMember>& members) {
+  members.clear();
+  if (size < ZIP_END_SIZE) {
+    return false;
+  }
+  // search backwards past any comment for the end record
+  INT64 end_offset=-1;
+  auto search_start=std::max(size-ZIP_END_SIZE-ZIP_COMMENT_MAX,(INT64)0);
+  for (auto i=size-ZIP_END_SIZE; i >= search_start; i--) {
+    if (zip_read_32(data+i) == ZIP_END_SIGNATURE) {
+      end_offset=i;
+      break;
+    }
+  }
+  if (end_offset < 0) {
+    return false;
+  }
+  auto entry_count=(INT64)zip_read_16(data+end_offset+10);
+  auto directory_size=(INT64)zip_read_32(data+end_offset+12);
+  auto directory_offset=(INT64)zip_read_32(data+end_offset+16);
+  // zip64 files have a locator just before the end record
+  auto locator_offset=end_offset-ZIP64_LOCATOR_SIZE;
+  if (locator_offset >= 0 &&
+      zip_read_32(data+locator_offset) == ZIP64_LOCATOR_SIGNATURE) {
+    auto end64_offset=(INT64)zip_read_64(data+locator_offset+8);
+    if (end64_offset < 0 || end64_offset+ZIP64_END_SIZE > locator_offset ||
+        zip_read_32(data+end64_offset) != ZIP64_END_SIGNATURE) {
+      return false;
+    }
+    entry_count=(INT64)zip_read_64(data+end64_offset+32);
+    directory_size=(INT64)zip_read_64(data+end64_offset+40);
+    directory_offset=(INT64)zip_read_64(data+end64_offset+48);
+  }
+  if (directory_offset < 0 || directory_size < 0 ||
+      directory_offset > size || directory_size > size-directory_offset) {
+    return false;
+  }
+  auto directory_end=directory_offset+directory_size;
+  auto position=directory_offset;
+  // every entry takes at least a header so this bounds the reservation
+  members.reserve(std::min(entry_count,directory_size/ZIP_CENTRAL_HEADER_SIZE));
+  for (INT64 i=0; i < entry_count; i++) {
+    if (position+ZIP_CENTRAL_HEADER_SIZE > directory_end ||
+        zip_read_32(data+position) != ZIP_CENTRAL_HEADER_SIGNATURE) {
+      members.clear();
+      return false;
+    }
+    auto header=data+position;
+    auto name_length=(INT64)zip_read_16(header+28);
+    auto extra_length=(INT64)zip_read_16(header+30);
+    auto comment_length=(INT64)zip_read_16(header+32);
+    auto entry_size=ZIP_CENTRAL_HEADER_SIZE+name_length+extra_length+comment_length;
+    if (position+entry_size > directory_end) {
+      members.clear();
+      return false;
+    }
+    ZipMember member;
+    member.compression_method=zip_read_16(header+10);
+    member.crc32=zip_read_32(header+16);
+    member.compressed_size=zip_read_32(header+20);
+    member.uncompressed_size=zip_read_32(header+24);
+    member.local_header_offset=zip_read_32(header+42);
+    member.name.assign((const char*)header+ZIP_CENTRAL_HEADER_SIZE,name_length);
+    if (!zip_read_zip64_extra(header+ZIP_CENTRAL_HEADER_SIZE+name_length,
+                              extra_length,
+                              member)) {
+      members.clear();
+      return false;
+    }
+    members.push_back(std::move(member));
+    position+=entry_size;
+  }
+  return true;
+}
+
+bool zip_find_member_data(const unsigned char* data,
+                          INT64 size,
+                          const ZipMember& member,
+                          const unsigned char*& member_data) {
+  auto offset=member.local_header_offset;
+  if (offset < 0 || offset > size-ZIP_LOCAL_HEADER_SIZE ||
+      zip_read_32(data+offset) != ZIP_LOCAL_HEADER_SIGNATURE) {
+    return false;
+  }
+  // the local header can have a different extra field to the central one
+  auto name_length=(INT64)zip_read_16(data+offset+26);
+  auto extra_length=(INT64)zip_read_16(data+offset+28);
+  auto data_offset=offset+ZIP_LOCAL_HEADER_SIZE+name_length+extra_length;
+  if (member.compressed_size < 0 || data_offset > size ||
+      member.compressed_size > size-data_offset) {
+    return false;
+  }
+  member_data=data+data_offset;
+  return true;
+}
+
+bool zip_check_crc(const unsigned char* member_data,
+                   const ZipMember& member) {
+  // zlib's crc32 takes a 32-bit length so large members are done in pieces
+  auto crc=crc32(0L,Z_NULL,0);
+  INT64 offset=0;
+  while (offset < member.uncompressed_size) {
+    auto length=std::min(member.uncompressed_size-offset,(INT64)UINT_MAX);
+    crc=crc32(crc,member_data+offset,(uInt)length);
+    offset+=length;
+  }
+  return crc == member.crc32;
+}
+
+bool zip_check_member_size(const ZipMember& member) {
+  if (member.compressed_size < 0 || member.uncompressed_size < 0 ||
+      member.uncompressed_size > ZIP_MEMBER_MAX_SIZE) {
+    return false;
+  }
+  if (member.compression_method == ZIP_METHOD_STORED) {
+    return member.uncompressed_size == member.compressed_size;
+  } else if (member.compression_method == ZIP_METHOD_DEFLATED) {
+    // divide so a huge compressed size can't overflow
+    return (member.uncompressed_size+ZIP_DEFLATE_MAX_RATIO-1)/ZIP_DEFLATE_MAX_RATIO <= member.compressed_size;
+  }
+  return true;
+}
+
+bool zip_inflate_member(const unsigned char* member_data,
+                        const ZipMember& member,
+                        std::vector<unsigned char>& output) {
+  // the sizes come from the file so they are checked before allocating
+  if (!zip_check_member_size(member)) {
+    ERROR_LOCAL("Invalid size for zip member: " << member.name);
+    return false;
+  }
+  output.resize(member.uncompressed_size);
+  if (member.compression_method == ZIP_METHOD_STORED) {
+    std::copy(member_data,member_data+member.compressed_size,output.begin());
+  } else if (member.compression_method == ZIP_METHOD_DEFLATED) {
+#ifdef IMAGEGRID_USE_LIBDEFLATE
+    auto decompressor=libdeflate_alloc_decompressor();
+    if (!decompressor) {
+      return false;
+    }
+    size_t actual_size;
+    auto result=libdeflate_deflate_decompress(decompressor,
+                                              member_data,
+                                              member.compressed_size,
+                                              output.data(),
+                                              output.size(),
+                                              &actual_size);
+    libdeflate_free_decompressor(decompressor);
+    if (result != LIBDEFLATE_SUCCESS || (INT64)actual_size != member.uncompressed_size) {
+      ERROR_LOCAL("Failed to inflate zip member: " << member.name);
+      return false;
+    }
+#else
+    // the whole member is available so inflate it in as few calls as possible
+    z_stream stream{};
+    if (inflateInit2(&stream,-MAX_WBITS) != Z_OK) {
+      return false;
+    }
+    INT64 input_offset=0;
+    INT64 output_offset=0;
+    auto result=Z_OK;
+    while (result == Z_OK) {
+      auto input_length=std::min(member.compressed_size-input_offset,(INT64)UINT_MAX);
+      auto output_length=std::min(member.uncompressed_size-output_offset,(INT64)UINT_MAX);
+      stream.next_in=(Bytef*)(member_data+input_offset);
+      stream.avail_in=(uInt)input_length;
+      stream.next_out=output.data()+output_offset;
+      stream.avail_out=(uInt)output_length;
+      result=inflate(&stream,Z_FINISH);
+      input_offset+=input_length-stream.avail_in;
+      output_offset+=output_length-stream.avail_out;
+      // Z_BUF_ERROR only means progress stopped at a 4GiB boundary
+      if (result == Z_BUF_ERROR && (stream.avail_in == 0 || stream.avail_out == 0) &&
+          input_offset < member.compressed_size && output_offset < member.uncompressed_size) {
+        result=Z_OK;
+      }
+    }
+    inflateEnd(&stream);
+    if (result != Z_STREAM_END || output_offset != member.uncompressed_size) {
+      ERROR_LOCAL("Failed to inflate zip member: " << member.name);
+      return false;
+    }
+#endif
+  } else {
+    ERROR_LOCAL("Unsupported zip compression method: " << member.compression_method);
+    return false;
+  }
+  if (!zip_check_crc(output.data(),member)) {
+    ERROR_LOCAL("CRC mismatch in zip member: " << member.name);
+    return false;
+  }
+  return true;
+}
@@ -0,0 +1,95 @@
+/**
+ * Header for reading members straight out of zip files held in
+ * memory, used for NTS files so the slower libzip path is only a
+ * fallback.
+ */
+#ifndef ZIP_READER_HPP
+#define ZIP_READER_HPP
+
+#include "../common.hpp"
+// C++ headers
+#include <string>
+#include <vector>
+// C headers
+#include <cstdint>
+
+// compression methods from the zip specification
+const INT64 ZIP_METHOD_STORED=0;
+const INT64 ZIP_METHOD_DEFLATED=8;
+
+// the most a deflate stream can expand, sizes in a zip file claiming
+// more are corrupt
+const INT64 ZIP_DEFLATE_MAX_RATIO=1032;
+// the largest member that is ever decompressed into memory
+const INT64 ZIP_MEMBER_MAX_SIZE=8L << 30;
+
+/**
+ * A member of a zip file as described by the central directory.
+ */
+struct ZipMember {
+  std::string name;
+  INT64 compression_method;
+  INT64 compressed_size;
+  INT64 uncompressed_size;
+  INT64 local_header_offset;
+  uint32_t crc32;
+};
+
+/**
+ * Read the central directory of a zip file, including zip64 files.
+ *
+ * @param data The zip file.
+ * @param size The size of the zip file in bytes.
+ * @param members Set to every member of the zip file.
+ * @return If the central directory could be read.
+ */
+bool zip_read_central_directory(const unsigned char* data,
+                                INT64 size,
+                                std::vector<ZipMember>& members);
+
+/**
+ * Find where the data for a member starts from its local header.
+ *
+ * @param data The zip file.
+ * @param size The size of the zip file in bytes.
+ * @param member The member to find.
+ * @param member_data Set to the start of the compressed data.
+ * @return If the local header is valid and the data is inside the file.
+ */
+bool zip_find_member_data(const unsigned char* data,
+                          INT64 size,
+                          const ZipMember& member,
+                          const unsigned char*& member_data);
+
+/**
+ * Check that the uncompressed size of a member is possible for its
+ * compressed size, so a corrupt size is never allocated.
+ *
+ * @param member The member to check.
+ * @return If the size is at most ZIP_MEMBER_MAX_SIZE and, for stored
+ *         and deflated members, what the compressed size can hold.
+ */
+bool zip_check_member_size(const ZipMember& member);
+
+/**
+ * Decompress a stored or deflated member in a single call and check
+ * its CRC.  Uses libdeflate when built with it, otherwise zlib.
+ *
+ * @param member_data The start of the compressed data.
+ * @param member The member being decompressed.
+ * @param output Set to the uncompressed data.
+ * @return If the size is valid and decompression was successful.
+ */
+bool zip_inflate_member(const unsigned char* member_data,
+                        const ZipMember& member,
+                        std::vector<unsigned char>& output);
+
+/**
+ * @param member_data The start of the uncompressed data.
+ * @param member The member to check.
+ * @return If the CRC of the data matches the central directory.
+ */
+bool zip_check_crc(const unsigned char* member_data,
+                   const ZipMember& member);
+
+#endif
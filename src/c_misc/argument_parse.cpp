@@ -1,4 +1,5 @@
 #include "../common.hpp"
+#include "argument_parse.hpp"
 // C++ headers
 #include <ostream>
 #include <string>
@@ -12,15 +13,31 @@
 bool parse_standard_arguments(int argc, char* const* argv,
                               INT64& wimage, INT64& himage,
                               bool& write_cache, bool& use_cache,
+                              std::string& cache_codec_name,
+                              INT64& shard_index, INT64& shard_count,
+                              bool& merge_shards,
+                              bool& use_cache_root,
+                              std::string& cache_root,
+                              INT64& cache_quota_mb,
+                              bool& stretch_color,
                               std::string& path_value, std::vector<std::string>& filenames,
                               std::string& text_filename) {
   int opt;
   char *end;
   bool size_arg=false;
   bool file_arg=false;
+  // long options only, they are given values past any character
+  const struct option long_options[]={
+    {"shard", required_argument, nullptr, OPTION_SHARD},
+    {"merge-shards", no_argument, nullptr, OPTION_MERGE_SHARDS},
+    {"cache-root", optional_argument, nullptr, OPTION_CACHE_ROOT},
+    {"cache-quota", required_argument, nullptr, OPTION_CACHE_QUOTA},
+    {"stretch", no_argument, nullptr, OPTION_STRETCH},
+    {nullptr, 0, nullptr, 0}
+  };
   // char path_value_local[PATH_BUFFER_SIZE]={ 0 };
   // get options
-  while((opt=getopt(argc ,argv, "w:h:p:f:cd")) != -1) {
+  while((opt=getopt_long(argc ,argv, "w:h:p:f:cdz:", long_options, nullptr)) != -1) {
     switch(opt) {
     case 'w':
       // width in images
@@ -48,8 +65,48 @@ bool parse_standard_arguments(int argc, char* const* argv,
       // use database
       use_cache=true;
       break;
+    case 'z':
+      // codec for writing the cache
+      cache_codec_name=std::string(optarg);
+      break;
+    case OPTION_SHARD:
+      // shard of the cache to build in the form INDEX/COUNT
+      shard_index=strtol(optarg,&end,10);
+      if (end == optarg || *end != '/') {
+        ERROR_LOCAL("Shard must be given as INDEX/COUNT: " << optarg);
+        return false;
+      }
+      shard_count=strtol(end+1,&end,10);
+      if (*end != '\0' || shard_count < 1 || shard_index < 0 || shard_index >= shard_count) {
+        ERROR_LOCAL("Shard index must be from 0 to one less than the count: " << optarg);
+        return false;
+      }
+      break;
+    case OPTION_MERGE_SHARDS:
+      // merge the partial manifests and zip indexes written by shards
+      merge_shards=true;
+      break;
+    case OPTION_CACHE_ROOT:
+      // central cache, the default location if no directory is given
+      use_cache_root=true;
+      if (optarg) {
+        cache_root=std::string(optarg);
+      }
+      break;
+    case OPTION_CACHE_QUOTA:
+      // quota of the central cache in megabytes
+      cache_quota_mb=strtol(optarg,&end,10);
+      if (end == optarg || *end != '\0' || cache_quota_mb < 0) {
+        ERROR_LOCAL("Cache quota must be a number of megabytes: " << optarg);
+        return false;
+      }
+      break;
+    case OPTION_STRETCH:
+      // stretch 16-bit color to each image instead of shifting it
+      stretch_color=true;
+      break;
     case '?':
-      if (optopt == 'w' || optopt == 'h' || optopt == 'p' || optopt == 'd') {
+      if (optopt == 'w' || optopt == 'h' || optopt == 'p' || optopt == 'd' || optopt == 'z') {
         ERROR_LOCAL("Option " << optopt << " requires an argument.");
       } else {
         ERROR_LOCAL("Unknown option: " << (char)optopt << std::endl);
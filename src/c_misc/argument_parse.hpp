@@ -3,6 +3,13 @@
 #include <string>
 #include <vector>
 
+// values for the options that only have a long form
+const int OPTION_SHARD=256;
+const int OPTION_MERGE_SHARDS=257;
+const int OPTION_CACHE_ROOT=258;
+const int OPTION_CACHE_QUOTA=259;
+const int OPTION_STRETCH=260;
+
 /**
  * Parse standard arguments from command line.
  *
@@ -12,6 +19,22 @@
  * @param himage Reference to set the height of the image grid.
  * @param write_cache Reference to set whether to write the cache.
  * @param use_cache Reference to set whether to use the cache.
+ * @param cache_codec_name Reference to set the name of the codec
+ *        used when writing the cache, left empty if not given.
+ * @param shard_index Reference to set which shard of the cache to
+ *        build, starting at 0, left unchanged if not given.
+ * @param shard_count Reference to set the number of shards the cache
+ *        build is split into, left unchanged if not given.
+ * @param merge_shards Reference to set whether to merge the partial
+ *        manifests written by shards.
+ * @param use_cache_root Reference to set whether to use a central
+ *        cache root.
+ * @param cache_root Reference to set the cache root, left empty for
+ *        the default cache root.
+ * @param cache_quota_mb Reference to set the quota of the cache root
+ *        in megabytes, left unchanged if not given.
+ * @param stretch_color Reference to set whether to stretch 16-bit
+ *        color images to the range of each image.
  * @param successful Reference to set whether arguments were valid.
  * @param path_value Reference to set a path value.
  * @param filenames Reference to se a vector of filesnames.
@@ -25,6 +48,14 @@ bool parse_standard_arguments(int argc,
                               INT64& himage,
                               bool& write_cache,
                               bool& use_cache,
+                              std::string& cache_codec_name,
+                              INT64& shard_index,
+                              INT64& shard_count,
+                              bool& merge_shards,
+                              bool& use_cache_root,
+                              std::string& cache_root,
+                              INT64& cache_quota_mb,
+                              bool& stretch_color,
                               std::string& path_value,
                               std::vector<std::string>& filenames,
                               std::string& text_filename);
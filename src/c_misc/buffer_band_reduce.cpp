@@ -0,0 +1,67 @@
+// local headers
+#include "../common.hpp"
+#include "../datatypes/coordinates.hpp"
+#include "buffer_band_reduce.hpp"
+#include "buffer_manip.hpp"
+// C++ headers
+#include <memory>
+#include <new>
+
+BufferBandReduce::BufferBandReduce(const BufferPixelSize& source_size,
+                                   PIXEL_RGBA* dest_buffer,
+                                   const BufferPixelSize& dest_size,
+                                   INT64 zoom_out_shift,
+                                   INT64* const row_buffer) :
+  _source_size(source_size),
+  _dest_buffer(dest_buffer),
+  _dest_size(dest_size),
+  _zoom_out_shift(zoom_out_shift),
+  _row_buffer(row_buffer) {
+  // bands must be a multiple of the reduction so no block of source
+  // pixels is ever split between two bands
+  auto zoom_out=1L << this->_zoom_out_shift;
+  this->_band_rows=((BAND_MIN_ROWS+zoom_out-1)/zoom_out)*zoom_out;
+  this->_band_buffer=std::unique_ptr<PIXEL_RGBA[]>(new (std::nothrow) PIXEL_RGBA[this->_source_size.w()*this->_band_rows]);
+}
+
+bool BufferBandReduce::valid() const {
+  return (bool)this->_band_buffer;
+}
+
+PIXEL_RGBA* BufferBandReduce::next_row() {
+  return this->_band_buffer.get()+this->_band_rows_filled*this->_source_size.w();
+}
+
+void BufferBandReduce::commit_row() {
+  this->_band_rows_filled++;
+  if (this->_band_rows_filled == this->_band_rows) {
+    this->_reduce_band();
+  }
+}
+
+void BufferBandReduce::finish() {
+  if (this->_band_rows_filled > 0) {
+    this->_reduce_band();
+  }
+}
+
+INT64 BufferBandReduce::rows_committed() const {
+  return this->_band_start_row+this->_band_rows_filled;
+}
+
+void BufferBandReduce::_reduce_band() {
+  auto band_size=BufferPixelSize(this->_source_size.w(),this->_band_rows_filled);
+  auto dest_start=BufferPixelCoordinate(0,this->_band_start_row >> this->_zoom_out_shift);
+  buffer_copy_reduce_standard(this->_band_buffer.get(),
+                              band_size,
+                              BufferPixelCoordinate(0,0),
+                              band_size,
+                              this->_dest_buffer,
+                              this->_dest_size,
+                              this->_dest_size,
+                              dest_start,
+                              this->_zoom_out_shift,
+                              this->_row_buffer);
+  this->_band_start_row+=this->_band_rows_filled;
+  this->_band_rows_filled=0;
+}
@@ -0,0 +1,75 @@
+/**
+ * Header for reducing images that are streamed in as bands of rows.
+ */
+#ifndef BUFFER_BAND_REDUCE_HPP
+#define BUFFER_BAND_REDUCE_HPP
+
+#include "../common.hpp"
+#include "../datatypes/coordinates.hpp"
+// C++ headers
+#include <memory>
+
+/**
+ * Reduce an image that arrives a few rows at a time, such as strips
+ * or scanlines from a decoder, without ever holding the full size
+ * image in memory.
+ *
+ * Rows are gathered into a band whose height is a multiple of the
+ * reduction factor so reducing each band gives exactly the same
+ * result as reducing the whole image at once.
+ */
+class BufferBandReduce {
+public:
+  BufferBandReduce()=delete;
+  /**
+   * @param source_size The full size of the image being streamed in.
+   * @param dest_buffer The destination buffer.
+   * @param dest_size The size of the destination buffer.
+   * @param zoom_out_shift The factor to reduce the image by as a bit shift.
+   * @param row_buffer A working buffer of size at least (source_w >> zoom_out_shift)*3).
+   */
+  BufferBandReduce(const BufferPixelSize& source_size,
+                   PIXEL_RGBA* dest_buffer,
+                   const BufferPixelSize& dest_size,
+                   INT64 zoom_out_shift,
+                   INT64* const row_buffer);
+  ~BufferBandReduce()=default;
+  BufferBandReduce(const BufferBandReduce&)=delete;
+  BufferBandReduce(const BufferBandReduce&&)=delete;
+  BufferBandReduce& operator=(const BufferBandReduce&)=delete;
+  BufferBandReduce& operator=(const BufferBandReduce&&)=delete;
+  /** @return If the band buffer could be allocated. */
+  bool valid() const;
+  /**
+   * Get the next row to be filled in by the decoder.
+   *
+   * @return A row of source_w pixels.
+   */
+  PIXEL_RGBA* next_row();
+  /**
+   * Mark the row from next_row() as filled in, reducing the band once
+   * it is full.
+   */
+  void commit_row();
+  /**
+   * Reduce any partial band left over at the end of the image.
+   */
+  void finish();
+  /** @return The number of source rows committed so far. */
+  INT64 rows_committed() const;
+private:
+  void _reduce_band();
+  BufferPixelSize _source_size;
+  PIXEL_RGBA* _dest_buffer;
+  BufferPixelSize _dest_size;
+  INT64 _zoom_out_shift;
+  INT64* _row_buffer;
+  /** Rows of source_w pixels held before being reduced. */
+  std::unique_ptr<PIXEL_RGBA[]> _band_buffer;
+  INT64 _band_rows;
+  INT64 _band_rows_filled{0};
+  /** The source row the current band starts on. */
+  INT64 _band_start_row{0};
+};
+
+#endif
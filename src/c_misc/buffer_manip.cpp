@@ -3,11 +3,17 @@
 #include "../datatypes/coordinates.hpp"
 #include "buffer_manip.hpp"
 // C++ headers
+#include <algorithm>
+#include <limits>
 #include <memory>
 // C headers
+#include <cmath>
 #include <cstring>
 #include <cstdint>
 // C library headers
+#ifdef __SSSE3__
+#include <immintrin.h>
+#endif
 #include <tiffio.h>
 
 typedef unsigned char (*rgb_extract)(unsigned char);
@@ -75,6 +81,339 @@ void buffer_copy_reduce_tiff (const uint32_t* const source_buffer,
   }
 }
 
+void buffer_copy_row_tiff (const uint32_t* const source_row,
+                           PIXEL_RGBA* const dest_row,
+                           INT64 row_wpixel) {
+  // libtiff packs ABGR the same way as PIXEL_RGBA so only alpha
+  // needs to be set
+  for (INT64 i=0; i < row_wpixel; i++) {
+    dest_row[i]=source_row[i] | DEFAULT_ALPHA;
+  }
+}
+
+void buffer_copy_row_rgb (const unsigned char* const source_row,
+                          PIXEL_RGBA* const dest_row,
+                          INT64 row_wpixel) {
+  for (INT64 i=0; i < row_wpixel; i++) {
+    dest_row[i]=(PIXEL_RGBA)source_row[i*3];
+    dest_row[i]+=(PIXEL_RGBA)source_row[i*3+1] << G_SHIFT;
+    dest_row[i]+=(PIXEL_RGBA)source_row[i*3+2] << B_SHIFT;
+    dest_row[i]+=DEFAULT_ALPHA;
+  }
+}
+
+void buffer_copy_row_cmyk (const unsigned char* const source_row,
+                           PIXEL_RGBA* const dest_row,
+                           INT64 row_wpixel,
+                           bool inverted) {
+  // each channel is what is left after its ink and the black ink
+  PIXEL_RGBA flip=(inverted ? 0 : 0xFF);
+  for (INT64 i=0; i < row_wpixel; i++) {
+    PIXEL_RGBA k=source_row[i*4+3] ^ flip;
+    dest_row[i]=((source_row[i*4] ^ flip)*k+127)/255;
+    dest_row[i]+=(((source_row[i*4+1] ^ flip)*k+127)/255) << G_SHIFT;
+    dest_row[i]+=(((source_row[i*4+2] ^ flip)*k+127)/255) << B_SHIFT;
+    dest_row[i]+=DEFAULT_ALPHA;
+  }
+}
+
+void buffer_copy_row_samples (const unsigned char* const source_row,
+                              INT64 samples_per_pixel,
+                              INT64 bytes_per_sample,
+                              PIXEL_RGBA* const dest_row,
+                              INT64 row_wpixel) {
+  auto pixel_bytes=samples_per_pixel*bytes_per_sample;
+  if (samples_per_pixel < 3) {
+    for (INT64 i=0; i < row_wpixel; i++) {
+      PIXEL_RGBA level=source_row[i*pixel_bytes];
+      dest_row[i]=level | (level << G_SHIFT) | (level << B_SHIFT) | DEFAULT_ALPHA;
+    }
+  } else {
+    for (INT64 i=0; i < row_wpixel; i++) {
+      auto source_pixel=source_row+i*pixel_bytes;
+      dest_row[i]=(PIXEL_RGBA)source_pixel[0] |
+        ((PIXEL_RGBA)source_pixel[bytes_per_sample] << G_SHIFT) |
+        ((PIXEL_RGBA)source_pixel[2*bytes_per_sample] << B_SHIFT) |
+        DEFAULT_ALPHA;
+    }
+  }
+}
+
+void buffer_palette_from_colormap (const uint16_t* const red,
+                                   const uint16_t* const green,
+                                   const uint16_t* const blue,
+                                   INT64 count,
+                                   PIXEL_RGBA* const palette) {
+  count=std::min(count,BUFFER_PALETTE_SIZE);
+  auto eight_bit=true;
+  for (INT64 i=0; i < count; i++) {
+    if (red[i] >= 256 || green[i] >= 256 || blue[i] >= 256) {
+      eight_bit=false;
+      break;
+    }
+  }
+  auto shift=(eight_bit ? 0 : 8);
+  for (INT64 i=0; i < BUFFER_PALETTE_SIZE; i++) {
+    if (i < count) {
+      palette[i]=((PIXEL_RGBA)(red[i] >> shift) & R_MASK) |
+        (((PIXEL_RGBA)(green[i] >> shift) << G_SHIFT) & G_MASK) |
+        (((PIXEL_RGBA)(blue[i] >> shift) << B_SHIFT) & B_MASK) |
+        DEFAULT_ALPHA;
+    } else {
+      palette[i]=DEFAULT_ALPHA;
+    }
+  }
+}
+
+void buffer_expand_palette_row (const unsigned char* const source_row,
+                                const PIXEL_RGBA* const palette,
+                                PIXEL_RGBA* const dest_row,
+                                INT64 row_wpixel) {
+  INT64 i=0;
+#ifdef __AVX2__
+  // widen 8 indices at a time and gather their palette entries
+  for (; i+8 <= row_wpixel; i+=8) {
+    auto indices=_mm_loadl_epi64((const __m128i*)(source_row+i));
+    auto pixels=_mm256_i32gather_epi32((const int*)palette,_mm256_cvtepu8_epi32(indices),4);
+    _mm256_storeu_si256((__m256i*)(dest_row+i),pixels);
+  }
+#endif
+  for (; i < row_wpixel; i++) {
+    dest_row[i]=palette[source_row[i]];
+  }
+}
+
+void buffer_expand_gray_row (const unsigned char* const source_row,
+                             PIXEL_RGBA* const dest_row,
+                             INT64 row_wpixel) {
+  INT64 i=0;
+#ifdef __SSSE3__
+  // spread each gray byte to the red, green and blue bytes of 4 pixels at a time
+  auto alpha=_mm_set1_epi32((int)DEFAULT_ALPHA);
+  const __m128i spread[4]={_mm_setr_epi8(0,0,0,-1,1,1,1,-1,2,2,2,-1,3,3,3,-1),
+                           _mm_setr_epi8(4,4,4,-1,5,5,5,-1,6,6,6,-1,7,7,7,-1),
+                           _mm_setr_epi8(8,8,8,-1,9,9,9,-1,10,10,10,-1,11,11,11,-1),
+                           _mm_setr_epi8(12,12,12,-1,13,13,13,-1,14,14,14,-1,15,15,15,-1)};
+  for (; i+16 <= row_wpixel; i+=16) {
+    auto gray=_mm_loadu_si128((const __m128i*)(source_row+i));
+    for (INT64 k=0; k < 4; k++) {
+      _mm_storeu_si128((__m128i*)(dest_row+i+k*4),
+                       _mm_or_si128(_mm_shuffle_epi8(gray,spread[k]),alpha));
+    }
+  }
+#endif
+  for (; i < row_wpixel; i++) {
+    PIXEL_RGBA value=source_row[i];
+    dest_row[i]=value | (value << G_SHIFT) | (value << B_SHIFT) | DEFAULT_ALPHA;
+  }
+}
+
+void buffer_reduce_gray (const unsigned char* const source_buffer,
+                         const BufferPixelSize& source_size,
+                         unsigned char* const dest_buffer,
+                         const BufferPixelSize& dest_size,
+                         INT64 zoom_out_shift,
+                         INT64* const row_buffer) {
+  auto source_w=source_size.w();
+  auto source_h=source_size.h();
+  auto dest_w=dest_size.w();
+  auto dest_h=dest_size.h();
+  auto zoom_out=1L << zoom_out_shift;
+  auto area_shift=2*zoom_out_shift;
+  for (INT64 dj=0; dj < dest_h; dj++) {
+    auto dest_row=dest_buffer+dj*dest_w;
+    auto sj_start=dj*zoom_out;
+    auto sj_end=std::min(sj_start+zoom_out,source_h);
+    INT64 di=0;
+#ifdef __SSSE3__
+    // halving is by far the most common reduction, add pairs of
+    // pixels from two rows at once and produce 8 pixels at a time
+    if (zoom_out_shift == 1 && sj_end-sj_start == 2) {
+      auto row_0=source_buffer+sj_start*source_w;
+      auto row_1=row_0+source_w;
+      auto ones=_mm_set1_epi8(1);
+      for (; di+8 <= dest_w && (di+8)*2 <= source_w; di+=8) {
+        auto sum_0=_mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(row_0+di*2)),ones);
+        auto sum_1=_mm_maddubs_epi16(_mm_loadu_si128((const __m128i*)(row_1+di*2)),ones);
+        auto average=_mm_srli_epi16(_mm_add_epi16(sum_0,sum_1),2);
+        _mm_storel_epi64((__m128i*)(dest_row+di),_mm_packus_epi16(average,average));
+      }
+    }
+#endif
+    if (di == dest_w) {
+      continue;
+    }
+    std::memset(row_buffer+di,0,(dest_w-di)*sizeof(INT64));
+    auto si_end=std::min(source_w,dest_w*zoom_out);
+    for (auto sj=sj_start; sj < sj_end; sj++) {
+      auto source_row=source_buffer+sj*source_w;
+      for (auto si=di*zoom_out; si < si_end; si++) {
+        row_buffer[si >> zoom_out_shift]+=source_row[si];
+      }
+    }
+    for (; di < dest_w; di++) {
+      dest_row[di]=(unsigned char)(row_buffer[di] >> area_shift);
+    }
+  }
+}
+
+void buffer_copy_palette (const unsigned char* const source_buffer,
+                          const PIXEL_RGBA* const palette,
+                          const BufferPixelSize& source_size,
+                          const BufferPixelCoordinate& source_start,
+                          const BufferPixelSize& source_copy_size,
+                          PIXEL_RGBA* const dest_buffer,
+                          const BufferPixelSize& dest_size,
+                          const BufferPixelSize& dest_size_visible,
+                          const BufferPixelCoordinate& dest_start) {
+  auto source_w=source_size.w();
+  auto source_start_x=source_start.x();
+  auto source_start_y=source_start.y();
+  auto dest_w=dest_size.w();
+  auto dest_start_x=dest_start.x();
+  auto dest_start_y=dest_start.y();
+  // clip to the same pixels the generic copy would touch so each row is one run
+  auto copy_w=std::min({source_copy_size.w(),
+                        source_w-source_start_x,
+                        dest_size_visible.w()-dest_start_x});
+  auto copy_h=std::min({source_copy_size.h(),
+                        source_size.h()-source_start_y,
+                        dest_size_visible.h()-dest_start_y});
+  for (INT64 j=0; j < copy_h; j++) {
+    auto source_row=source_buffer+(source_start_y+j)*source_w+source_start_x;
+    auto dest_row=dest_buffer+(dest_start_y+j)*dest_w+dest_start_x;
+    if (palette) {
+      buffer_expand_palette_row(source_row,palette,dest_row,copy_w);
+    } else {
+      buffer_expand_gray_row(source_row,dest_row,copy_w);
+    }
+  }
+}
+
+// bins in the histogram used to find stretch levels
+#define STRETCH_HISTOGRAM_BINS 4096L
+// how strong the nonlinear stretches are
+#define STRETCH_LOG_A 1000.0
+#define STRETCH_ASINH_B 10.0
+
+BufferStretch::BufferStretch(BufferStretchType stretch_type,
+                             FLOAT64 black_level_arg,
+                             FLOAT64 white_level_arg) {
+  if (!(white_level_arg > black_level_arg)) {
+    white_level_arg=black_level_arg+1.0;
+  }
+  this->black_level=(FLOAT32)black_level_arg;
+  this->table_scale=(FLOAT32)((FLOAT64)(BUFFER_STRETCH_TABLE_SIZE-1)/(white_level_arg-black_level_arg));
+  for (INT64 i=0; i < BUFFER_STRETCH_TABLE_SIZE; i++) {
+    auto t=(FLOAT64)i/(FLOAT64)(BUFFER_STRETCH_TABLE_SIZE-1);
+    FLOAT64 level;
+    switch (stretch_type) {
+    case BufferStretchType::log:
+      level=log1p(STRETCH_LOG_A*t)/log1p(STRETCH_LOG_A);
+      break;
+    case BufferStretchType::asinh:
+      level=asinh(STRETCH_ASINH_B*t)/asinh(STRETCH_ASINH_B);
+      break;
+    case BufferStretchType::linear:
+    default:
+      level=t;
+      break;
+    }
+    this->table[i]=(unsigned char)lround(level*255.0);
+  }
+}
+
+bool buffer_stretch_levels (const FLOAT32* const samples,
+                            INT64 count,
+                            FLOAT64 black_fraction,
+                            FLOAT64 white_fraction,
+                            FLOAT64& black_level,
+                            FLOAT64& white_level) {
+  auto sample_min=std::numeric_limits<FLOAT32>::infinity();
+  auto sample_max=-std::numeric_limits<FLOAT32>::infinity();
+  INT64 finite_count=0;
+  for (INT64 i=0; i < count; i++) {
+    if (std::isfinite(samples[i])) {
+      sample_min=std::min(sample_min,samples[i]);
+      sample_max=std::max(sample_max,samples[i]);
+      finite_count++;
+    }
+  }
+  if (finite_count == 0) {
+    return false;
+  }
+  if (!(sample_max > sample_min)) {
+    black_level=sample_min;
+    white_level=sample_min+1.0;
+    return true;
+  }
+  auto bin_width=((FLOAT64)sample_max-(FLOAT64)sample_min)/(FLOAT64)STRETCH_HISTOGRAM_BINS;
+  auto histogram=std::make_unique<INT64[]>(STRETCH_HISTOGRAM_BINS);
+  for (INT64 i=0; i < count; i++) {
+    if (std::isfinite(samples[i])) {
+      auto bin=std::min((INT64)(((FLOAT64)samples[i]-(FLOAT64)sample_min)/bin_width),STRETCH_HISTOGRAM_BINS-1);
+      histogram[bin]++;
+    }
+  }
+  auto black_count=(INT64)(black_fraction*(FLOAT64)finite_count);
+  auto white_count=(INT64)(white_fraction*(FLOAT64)finite_count);
+  INT64 black_bin=0;
+  INT64 white_bin=STRETCH_HISTOGRAM_BINS-1;
+  INT64 cumulative=0;
+  auto found_black=false;
+  for (INT64 bin=0; bin < STRETCH_HISTOGRAM_BINS; bin++) {
+    cumulative+=histogram[bin];
+    if (!found_black && cumulative > black_count) {
+      black_bin=bin;
+      found_black=true;
+    }
+    if (cumulative >= white_count) {
+      white_bin=bin;
+      break;
+    }
+  }
+  black_level=(FLOAT64)sample_min+(FLOAT64)black_bin*bin_width;
+  white_level=(FLOAT64)sample_min+(FLOAT64)(white_bin+1)*bin_width;
+  return true;
+}
+
+/**
+ * Find the table index for a sample, written without branches so the
+ * loops calling it can be vectorized.  NaN ends up as black.
+ */
+INT64 stretch_index (FLOAT32 sample,
+                     FLOAT32 black_level,
+                     FLOAT32 table_scale) {
+  FLOAT32 t=(sample-black_level)*table_scale;
+  t=(t > 0.0f) ? t : 0.0f;
+  t=(t < (FLOAT32)(BUFFER_STRETCH_TABLE_SIZE-1)) ? t : (FLOAT32)(BUFFER_STRETCH_TABLE_SIZE-1);
+  return (INT64)(t+0.5f);
+}
+
+void buffer_stretch_row (const FLOAT32* const source_row,
+                         INT64 samples_per_pixel,
+                         PIXEL_RGBA* const dest_row,
+                         INT64 row_wpixel,
+                         const BufferStretch& stretch) {
+  const auto table=stretch.table;
+  const auto black_level=stretch.black_level;
+  const auto table_scale=stretch.table_scale;
+  if (samples_per_pixel < 3) {
+    for (INT64 i=0; i < row_wpixel; i++) {
+      PIXEL_RGBA level=table[stretch_index(source_row[i*samples_per_pixel],black_level,table_scale)];
+      dest_row[i]=level | (level << G_SHIFT) | (level << B_SHIFT) | DEFAULT_ALPHA;
+    }
+  } else {
+    for (INT64 i=0; i < row_wpixel; i++) {
+      auto source_pixel=source_row+i*samples_per_pixel;
+      PIXEL_RGBA r=table[stretch_index(source_pixel[0],black_level,table_scale)];
+      PIXEL_RGBA g=table[stretch_index(source_pixel[1],black_level,table_scale)];
+      PIXEL_RGBA b=table[stretch_index(source_pixel[2],black_level,table_scale)];
+      dest_row[i]=r | (g << G_SHIFT) | (b << B_SHIFT) | DEFAULT_ALPHA;
+    }
+  }
+}
+
 #define SOURCE_TYPE TIFF_SOURCE_TYPE
 #define NOREDUCE_FUNCNAME TIFF_NOREDUCE_FUNCNAME
 #define NOREDUCE_COPY_EXPRESSION dest_buffer[dest_pixel]=(INT64)TIFFGetR(source_buffer[source_pixel]); \
@@ -7,6 +7,49 @@
 #include <cstddef>
 #include <cstdint>
 
+/**
+ * The curves used to map high bit depth samples to 8-bit levels.
+ */
+enum class BufferStretchType {
+  linear,
+  log,
+  asinh
+};
+
+/**
+ * The number of entries in the table used to apply a stretch.
+ */
+const INT64 BUFFER_STRETCH_TABLE_SIZE=4096;
+
+/**
+ * Maps samples between a black and white level to 8-bit levels.  The
+ * curve is applied through a table so the per-sample work is the
+ * same for every type of stretch.
+ */
+class BufferStretch {
+public:
+  BufferStretch()=delete;
+  /**
+   * @param stretch_type The curve to use.
+   * @param black_level The sample value that maps to black.
+   * @param white_level The sample value that maps to white.
+   */
+  BufferStretch(BufferStretchType stretch_type,
+                FLOAT64 black_level,
+                FLOAT64 white_level);
+  ~BufferStretch()=default;
+  BufferStretch(const BufferStretch&)=delete;
+  BufferStretch(const BufferStretch&&)=delete;
+  BufferStretch& operator=(const BufferStretch&)=delete;
+  BufferStretch& operator=(const BufferStretch&&)=delete;
+  /** The sample value that maps to the start of the table. */
+  FLOAT32 black_level;
+  /** Multiplies samples after black_level is subtracted to give a table index. */
+  FLOAT32 table_scale;
+  /** The 8-bit level for each table index. */
+  unsigned char table[BUFFER_STRETCH_TABLE_SIZE];
+};
+
 #define TIFF_SOURCE_TYPE const uint32_t* const
 #define TIFF_NOREDUCE_FUNCNAME buffer_copy_noreduce_tiff_safe
 #define TIFF_REDUCE2_FUNCNAME buffer_copy_reduce_2_tiff_safe
@@ -36,6 +79,207 @@ void buffer_copy_reduce_tiff (const uint32_t* const source_buffer,
                               INT64 zoom_out_shift,
                               INT64* const row_buffer);
 
+/**
+ * Copy a single row of pixels from libtiff to an RGBA buffer, making
+ * each pixel opaque.
+ *
+ * @param source_row The source row from libtiff.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ */
+void buffer_copy_row_tiff (const uint32_t* const source_row,
+                           PIXEL_RGBA* const dest_row,
+                           INT64 row_wpixel);
+
+/**
+ * Copy a single row of packed 8-bit RGB pixels to an RGBA buffer,
+ * making each pixel opaque.
+ *
+ * @param source_row The source row.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ */
+void buffer_copy_row_rgb (const unsigned char* const source_row,
+                          PIXEL_RGBA* const dest_row,
+                          INT64 row_wpixel);
+
+/**
+ * Copy a single row of packed 8-bit CMYK pixels to an RGBA buffer,
+ * making each pixel opaque.
+ *
+ * @param source_row The source row.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ * @param inverted Whether the samples are stored inverted, as Adobe
+ *                 applications write them.
+ */
+void buffer_copy_row_cmyk (const unsigned char* const source_row,
+                           PIXEL_RGBA* const dest_row,
+                           INT64 row_wpixel,
+                           bool inverted);
+
+/**
+ * Copy a single row of unsigned samples to an RGBA buffer, making each
+ * pixel opaque.  One or two samples per pixel are treated as
+ * grayscale, otherwise the first three samples are RGB.  Only the
+ * first byte of each sample is used, so wider samples must be big
+ * endian.
+ *
+ * @param source_row The source row.
+ * @param samples_per_pixel The number of samples for each pixel.
+ * @param bytes_per_sample The number of bytes in each sample.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ */
+void buffer_copy_row_samples (const unsigned char* const source_row,
+                              INT64 samples_per_pixel,
+                              INT64 bytes_per_sample,
+                              PIXEL_RGBA* const dest_row,
+                              INT64 row_wpixel);
+
+/**
+ * The number of entries in a palette for 8-bit indexed images.
+ */
+const INT64 BUFFER_PALETTE_SIZE=256;
+
+/**
+ * Make a palette from a tiff colormap.  Colormaps are meant to be
+ * 16-bit, but ones where every entry fits in 8 bits are treated as
+ * 8-bit the same way libtiff does.
+ *
+ * @param red The red entries of the colormap.
+ * @param green The green entries of the colormap.
+ * @param blue The blue entries of the colormap.
+ * @param count The number of entries in the colormap, at most
+ *              BUFFER_PALETTE_SIZE.
+ * @param palette The palette of BUFFER_PALETTE_SIZE entries, entries
+ *                past count are made opaque black.
+ */
+void buffer_palette_from_colormap (const uint16_t* const red,
+                                   const uint16_t* const green,
+                                   const uint16_t* const blue,
+                                   INT64 count,
+                                   PIXEL_RGBA* const palette);
+
+/**
+ * Expand a single row of 8-bit palette indices to RGBA.
+ *
+ * @param source_row The indices.
+ * @param palette The palette of BUFFER_PALETTE_SIZE entries.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ */
+void buffer_expand_palette_row (const unsigned char* const source_row,
+                                const PIXEL_RGBA* const palette,
+                                PIXEL_RGBA* const dest_row,
+                                INT64 row_wpixel);
+
+/**
+ * Expand a single row of 8-bit grayscale to RGBA.
+ *
+ * @param source_row The gray values.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ */
+void buffer_expand_gray_row (const unsigned char* const source_row,
+                             PIXEL_RGBA* const dest_row,
+                             INT64 row_wpixel);
+
+/**
+ * Reduce an 8-bit grayscale buffer by averaging blocks of pixels,
+ * the same way the RGBA reductions do.
+ *
+ * @param source_buffer The source buffer.
+ * @param source_size The size of the source buffer.
+ * @param dest_buffer The destination buffer.
+ * @param dest_size The size of the destination buffer.
+ * @param zoom_out_shift The power of 2 to reduce by.
+ * @param row_buffer A temporary buffer of at least dest_size.w() entries.
+ */
+void buffer_reduce_gray (const unsigned char* const source_buffer,
+                         const BufferPixelSize& source_size,
+                         unsigned char* const dest_buffer,
+                         const BufferPixelSize& dest_size,
+                         INT64 zoom_out_shift,
+                         INT64* const row_buffer);
+
+/**
+ * Copy without reducing size from a buffer of 8-bit palette indices
+ * or grayscale to an RGBA buffer.
+ *
+ * @param source_buffer The source indices or gray values.
+ * @param palette The palette of BUFFER_PALETTE_SIZE entries, or
+ *                nullptr if the source is grayscale.
+ * @param source_size The size of the source buffer.
+ * @param source_start The location on the source buffer to start copying.
+ * @param source_copy_size The size of the source buffer to copy.
+ * @param dest_buffer The destination buffer.
+ * @param dest_size The size of the destination buffer.
+ * @param dest_size_visible The visible size of the destination buffer.
+ * @param dest_start Where to start copying to on the destination buffer.
+ */
+void buffer_copy_palette (const unsigned char* const source_buffer,
+                          const PIXEL_RGBA* const palette,
+                          const BufferPixelSize& source_size,
+                          const BufferPixelCoordinate& source_start,
+                          const BufferPixelSize& source_copy_size,
+                          PIXEL_RGBA* const dest_buffer,
+                          const BufferPixelSize& dest_size,
+                          const BufferPixelSize& dest_size_visible,
+                          const BufferPixelCoordinate& dest_start);
+
+/**
+ * Convert samples of any numeric type to floating point.
+ *
+ * @param source The source samples.
+ * @param dest The destination samples.
+ * @param count The number of samples.
+ */
+template <typename T>
+void buffer_convert_samples (const T* const source,
+                             FLOAT32* const dest,
+                             INT64 count) {
+  for (INT64 i=0; i < count; i++) {
+    dest[i]=(FLOAT32)source[i];
+  }
+}
+
+/**
+ * Find black and white levels for a stretch from a histogram of
+ * samples.  Non-finite samples are ignored.
+ *
+ * @param samples The samples, usually a subset of the image.
+ * @param count The number of samples.
+ * @param black_fraction The fraction of samples that will be black.
+ * @param white_fraction The fraction of samples that will be at or below white.
+ * @param black_level Set to the black level.
+ * @param white_level Set to the white level.
+ * @return If there were any finite samples.
+ */
+bool buffer_stretch_levels (const FLOAT32* const samples,
+                            INT64 count,
+                            FLOAT64 black_fraction,
+                            FLOAT64 white_fraction,
+                            FLOAT64& black_level,
+                            FLOAT64& white_level);
+
+/**
+ * Stretch a single row of floating point samples to an RGBA buffer,
+ * making each pixel opaque.  One sample per pixel is treated as
+ * grayscale, otherwise the first three samples are RGB.
+ *
+ * @param source_row The source row.
+ * @param samples_per_pixel The number of samples for each pixel.
+ * @param dest_row The destination row.
+ * @param row_wpixel The number of pixels in the row.
+ * @param stretch The stretch to apply.
+ */
+void buffer_stretch_row (const FLOAT32* const source_row,
+                         INT64 samples_per_pixel,
+                         PIXEL_RGBA* const dest_row,
+                         INT64 row_wpixel,
+                         const BufferStretch& stretch);
+
 #define SOURCE_TYPE TIFF_SOURCE_TYPE
 #define NOREDUCE_FUNCNAME TIFF_NOREDUCE_FUNCNAME
 #define REDUCE2_FUNCNAME TIFF_REDUCE2_FUNCNAME
@@ -51,6 +51,7 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 // types for generic operations
+typedef float FLOAT32;
 typedef double FLOAT64;
 typedef uint64_t UINT64;
 typedef int64_t INT64;
@@ -149,11 +150,46 @@ const INT64 INVALID_PIXEL_VALUE=INT_MIN;
 const INT64 LOAD_FILES_BATCH=2;
 const INT64 LOAD_TEXTURES_BATCH=4;
 
+// when only part of a large full size image is loaded, load this
+// many screens around the center of the viewport
+const INT64 REGION_LOAD_SCREENS=3;
+
+// fraction of samples clipped to black and white when stretching high
+// bit depth images
+const FLOAT64 STRETCH_BLACK_FRACTION=0.001;
+const FLOAT64 STRETCH_WHITE_FRACTION=0.999;
+// the number of strips or tiles sampled to find the stretch of high
+// bit depth images
+const INT64 STRETCH_SAMPLE_CHUNKS=64;
+// the most samples used to find the stretch of high bit depth images
+const INT64 STRETCH_SAMPLE_MAX=1L << 20;
+
+// the most threads used to read image headers when setting up a grid
+const INT64 READ_DATA_THREADS_MAX=16;
+// the most squares loaded and cached at once when building the cache
+const INT64 CACHE_BUILD_THREADS_MAX=8;
+
+// files up to this size are read into memory in the background before
+// being decoded, larger files are memory mapped instead
+const INT64 ASYNC_READ_MAX_SIZE=64L << 20;
+// the most files being read in the background at once
+const INT64 ASYNC_READ_IN_FLIGHT_MAX=8;
+
+// the most threads used to decompress the strips or tiles of one tiff
+const INT64 TIFF_DECODE_THREADS_MAX=8;
+// the most memory used to hold the strips or tiles of one tiff, half
+// being decoded while the other half is passed on
+const INT64 TIFF_DECODE_BATCH_MAX_BYTES=64L << 20;
+
 // the filler color
 const PIXEL_RGBA FILLER_LEVEL=0xFF404040;
 
-// max cache pixel size
-const INT64 CACHE_MAX_PIXEL_SIZE=512;
+// minimum number of rows held at once when images are streamed in
+// from a decoder rather than loaded whole
+const INT64 BAND_MIN_ROWS=16;
+
+// the largest reduction libjpeg can do while decoding, as a bit shift
+const INT64 JPEG_MAX_SCALE_SHIFT=3;
 
 // where to put the overlay
 const INT64 OVERLAY_X=10;
@@ -165,9 +201,6 @@ const char OVERLAY_FONT_PATH[]="/usr/share/fonts/truetype/freefont/FreeSans.ttf"
 // placeholder in command line arguments for empty file
 const std::string EMPTY_FILE_PLACEHOLDER="[[EMPTY]]";
 
-// stuff that needs to be crossplatformed later
-const char TEMP_TEMPLATE_TIF[]="/tmp/imagegrid_temp_XXXXXX.tif";
-
 // NTS file internals
 const char NTS_TIF_INTERNAL_EXTENSION[]="tif";
 
@@ -180,11 +213,25 @@ const INT64 JOY_DEADZONE=2048;
 // Strings for user interaction
 
 const std::string HELP_STRING=
-  "Usage: imagegrid-viewer [-c|-d] -w WIDTH -h HEIGHT IMAGES...\n"
-  "       imagegrid-viewer [-c|-d] -f TEXT_FILE\n"
+  "Usage: imagegrid-viewer [-c [-z CODEC] [--shard INDEX/COUNT]|-d] -w WIDTH -h HEIGHT IMAGES...\n"
+  "       imagegrid-viewer [-c [-z CODEC] [--shard INDEX/COUNT]|-d] -f TEXT_FILE\n"
+  "       imagegrid-viewer --merge-shards -f TEXT_FILE\n"
   "\n"
   "  -c        create cache\n"
-  "  -d        use cache\n"
+  "  -d        use cache, caching images missing from it as they are viewed\n"
+  "  -z        codec for the cache tiles, lz4, zstd or deflate\n"
+  "  --shard   only create the part INDEX of the cache split into COUNT\n"
+  "            parts, INDEX starts at 0\n"
+  "  --merge-shards\n"
+  "            merge the manifests and zip indexes written by each part\n"
+  "            of the cache\n"
+  "  --cache-root[=DIR]\n"
+  "            keep the cache in DIR, or $XDG_CACHE_HOME/imagegrid if DIR\n"
+  "            is not given, instead of next to the images\n"
+  "  --cache-quota MB\n"
+  "            most megabytes the cache root may use, 0 for no limit\n"
+  "  --stretch stretch 16-bit color images to the range of each image\n"
+  "            instead of shifting them to 8 bits\n"
   "\n"
   "  -w        width of grid in images\n"
   "  -h        height of grid in images\n"
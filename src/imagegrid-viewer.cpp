@@ -30,6 +30,7 @@
 // local headers
 #include "common.hpp"
 #include "utility.hpp"
+#include "c_io_net/cache_root.hpp"
 #include "imagegrid/gridsetup.hpp"
 #include "imagegrid/imagegrid.hpp"
 #include "texture_overlay.hpp"
@@ -411,9 +412,23 @@ int main(int argc, char* argv[]) {
     ERROR_LOCAL("Failed to setup grid information.");
     return 1;
   }
+  // must be set before anything looks for cached data
+  if (grid_setup->cache_root().length() != 0 &&
+      !cache_root_set(grid_setup->cache_root(),grid_setup->cache_quota_mb())) {
+    ERROR_LOCAL("Failed to setup cache root.");
+    return 1;
+  }
   // set up whole program even when doing cache do to dependencies among objects
   auto imagegrid_viewer_context=std::make_unique<ImageGridViewerContext>(grid_setup.get());
-  if (grid_setup->setup_cache()) {
+  if (grid_setup->merge_shards()) {
+    // combine what the shards of a cache build wrote
+    MSG_LOCAL("Merging cache shards!");
+    if (!imagegrid_viewer_context->grid->merge_grid_cache_shards(grid_setup.get())) {
+      ERROR_LOCAL("Failed to merge cache shards.");
+      return 1;
+    }
+    return 0;
+  } else if (grid_setup->setup_cache()) {
     // now run the cache
     MSG_LOCAL("Starting cache!");
     imagegrid_viewer_context->grid->setup_grid_cache(grid_setup.get());
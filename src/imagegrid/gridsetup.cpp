@@ -6,6 +6,7 @@
 #include "gridsetup.hpp"
 #include "../datatypes/coordinates.hpp"
 #include "../c_io_net/fileload.hpp"
+#include "../c_io_net/pyramid_cache.hpp"
 #include "../c_misc/argument_parse.hpp"
 #include "../viewport_current_state.hpp"
 // C++ headers
@@ -29,6 +30,34 @@ bool GridSetup::use_cache() const {
   return this->_use_cache;
 }
 
+INT64 GridSetup::cache_codec() const {
+  return this->_cache_codec;
+}
+
+INT64 GridSetup::shard_index() const {
+  return this->_shard_index;
+}
+
+INT64 GridSetup::shard_count() const {
+  return this->_shard_count;
+}
+
+bool GridSetup::merge_shards() const {
+  return this->_merge_shards;
+}
+
+std::string GridSetup::cache_root() const {
+  return this->_cache_root;
+}
+
+INT64 GridSetup::cache_quota_mb() const {
+  return this->_cache_quota_mb;
+}
+
+bool GridSetup::stretch_color() const {
+  return this->_stretch_color;
+}
+
 GridImageSize GridSetup::grid_size() const {
   return this->_grid_image_size;
 }
@@ -98,15 +127,38 @@ void GridSetup::_post_setup() {
 
 GridSetupFromCommandLine::GridSetupFromCommandLine(int argc, char* const* argv) {
   INT64 wimage, himage;
+  std::string cache_codec_name;
+  auto use_cache_root=false;
 
   if (!parse_standard_arguments(argc, argv, wimage, himage,
                                 this->_setup_cache, this->_use_cache,
+                                cache_codec_name,
+                                this->_shard_index, this->_shard_count,
+                                this->_merge_shards,
+                                use_cache_root, this->_cache_root,
+                                this->_cache_quota_mb,
+                                this->_stretch_color,
                                 this->_path_value, this->_filenames, this->_text_filename)) {
     MSG_LOCAL("Error parsing arguments");
     std::cout << HELP_STRING << std::endl;
     this->_status=GridSetupStatus::load_error;
     return;
   }
+  if (use_cache_root && this->_cache_root.length() == 0) {
+    this->_cache_root=cache_root_default();
+    if (this->_cache_root.length() == 0) {
+      ERROR_LOCAL("No default cache root, neither XDG_CACHE_HOME nor HOME is set.");
+      this->_status=GridSetupStatus::load_error;
+      return;
+    }
+  }
+  if (cache_codec_name.length() == 0) {
+    this->_cache_codec=pyramid_cache_default_codec();
+  } else if (!pyramid_cache_codec_from_name(cache_codec_name,this->_cache_codec)) {
+    std::cout << HELP_STRING << std::endl;
+    this->_status=GridSetupStatus::load_error;
+    return;
+  }
   if (this->_text_filename.length() != 0) {
     INT64 max_i,max_j;
     if (!load_image_grid_from_text(this->_text_filename,
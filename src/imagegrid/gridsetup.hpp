@@ -10,6 +10,8 @@
 #include "../datatypes/coordinates.hpp"
 #include "../datatypes/containers.hpp"
 #include "../viewport_current_state.hpp"
+#include "../c_io_net/cache_root.hpp"
+#include "../c_io_net/pyramid_cache.hpp"
 // C++ headers
 #include <atomic>
 #include <list>
@@ -55,6 +57,53 @@ public:
    * @return Whether to try to use cached images.
    */
   bool use_cache() const;
+  /**
+   * The codec tiles are compressed with when writing the cache.
+   *
+   * @return One of the PYRAMID_CACHE_CODEC_* values.
+   */
+  INT64 cache_codec() const;
+  /**
+   * Which shard of the grid to cache when the cache is built by
+   * several processes.
+   *
+   * @return The index of the shard, starting at 0.
+   */
+  INT64 shard_index() const;
+  /**
+   * The number of shards the cache is built in, each one caches
+   * every shard_count'th grid square with data.
+   *
+   * @return The number of shards, 1 if the cache is not sharded.
+   */
+  INT64 shard_count() const;
+  /**
+   * Indicate whether to merge the partial manifests written by shards
+   * instead of caching images.
+   *
+   * @return Whether to merge the partial manifests.
+   */
+  bool merge_shards() const;
+  /**
+   * The central cache root to cache images in instead of a cache
+   * directory next to each image.
+   *
+   * @return The cache root, empty if not used.
+   */
+  std::string cache_root() const;
+  /**
+   * The most cached images in the cache root may use.
+   *
+   * @return The quota in megabytes, 0 for no quota.
+   */
+  INT64 cache_quota_mb() const;
+  /**
+   * Indicate whether to stretch 16-bit color images to the range of
+   * each image instead of shifting them to 8 bits.
+   *
+   * @return Whether to stretch 16-bit color images.
+   */
+  bool stretch_color() const;
   // The items allow access to the underlying data.
   /** @return The size of the imagegrid. */
   GridImageSize grid_size() const;
@@ -114,6 +163,13 @@ protected:
   // char _data_set[PATH_BUFFER_SIZE]={ 0 };
   bool _setup_cache=false;
   bool _use_cache=false;
+  INT64 _cache_codec=PYRAMID_CACHE_CODEC_DEFLATE;
+  INT64 _shard_index=0;
+  INT64 _shard_count=1;
+  bool _merge_shards=false;
+  std::string _cache_root;
+  INT64 _cache_quota_mb=CACHE_ROOT_QUOTA_DEFAULT_MB;
+  bool _stretch_color=false;
   // some underlying data
   StaticGrid<SubGridImageSize> _sub_size;
   StaticGrid<bool> _existing;
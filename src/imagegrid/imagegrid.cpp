@@ -12,10 +12,20 @@
 #include "../viewport_current_state.hpp"
 #include "imagegrid_load_file_data.hpp"
 // C compatible headers
+#include "../c_io_net/async_read.hpp"
+#include "../c_io_net/cache_manifest.hpp"
+#include "../c_io_net/cache_root.hpp"
+#include "../c_io_net/decoder_registry.hpp"
 #include "../c_io_net/fileload.hpp"
+#include "../c_io_net/mapped_file.hpp"
+#include "../c_io_net/pyramid_cache.hpp"
+#include "../c_io_net/zip_index.hpp"
+#include "../c_misc/buffer_manip.hpp"
 // C++ headers
+#include <algorithm>
 #include <atomic>
 #include <fstream>
+#include <set>
 #include <string>
 #include <utility>
 #include <vector>
@@ -34,6 +44,9 @@ ImageGridSquareZoomLevel::ImageGridSquareZoomLevel(ImageGridSquare* parent_squar
   this->_rgba_ypixel_origin.init(this->sub_size());
   // TODO: not yet
   this->_rgba_data.init(this->sub_size());
+  this->_rgba_mapping.init(this->sub_size());
+  this->_index_data.init(this->sub_size());
+  this->_palette.init(this->sub_size());
 }
 
 ImageGridSquareZoomLevel::~ImageGridSquareZoomLevel() {
@@ -43,7 +56,10 @@ ImageGridSquareZoomLevel::~ImageGridSquareZoomLevel() {
 bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
                                            bool use_cache,
                                            const std::vector<ImageGridSquareZoomLevel*>& dest_squares,
-                                           INT64* row_temp_buffer) {
+                                           INT64* row_temp_buffer,
+                                           const LoadFileRegion* region,
+                                           AsyncReadEngine* read_engine,
+                                           std::vector<SubGridIndex>* cache_missed) {
   bool load_successful=true;
   // iterate over square data
   LoadFileData file_data;
@@ -54,10 +70,16 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
   auto sub_size=sub_w*sub_h;
   data_transfer.original_rgba_wpixel.init(grid_square->sub_size());
   data_transfer.original_rgba_hpixel.init(grid_square->sub_size());
+  data_transfer.region=region;
+  data_transfer.allow_indexed=true;
+  data_transfer.stretch_color=grid_square->grid_setup()->stretch_color();
+  data_transfer.track_cache_loaded=true;
+  data_transfer.cache_loaded.init(grid_square->sub_size());
   for (INT64 sub_i_arr=0; sub_i_arr < sub_size; sub_i_arr++) {
     auto subgrid_index=SubGridIndex(sub_i_arr%sub_w,sub_i_arr/sub_w);
     data_transfer.original_rgba_wpixel.set(subgrid_index,grid_square->_subimages_wpixel[subgrid_index]);
     data_transfer.original_rgba_hpixel.set(subgrid_index,grid_square->_subimages_hpixel[subgrid_index]);
+    data_transfer.cache_loaded.set(subgrid_index,false);
   }
   for (auto& dest_square : dest_squares) {
     file_data.data_pairs.emplace_back(std::pair<ImageGridSquareZoomLevel* const,
@@ -74,8 +96,13 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
   //       transfer structure per square
   for (const auto& data_transfer_temp : data_transfer.data_transfer) {
     data_transfer_temp->rgba_data.init(grid_square->sub_size());
+    data_transfer_temp->rgba_mapping.init(grid_square->sub_size());
+    data_transfer_temp->index_data.init(grid_square->sub_size());
+    data_transfer_temp->palette.init(grid_square->sub_size());
     data_transfer_temp->rgba_wpixel.init(grid_square->sub_size());
     data_transfer_temp->rgba_hpixel.init(grid_square->sub_size());
+    data_transfer_temp->rgba_xpixel_offset.init(grid_square->sub_size());
+    data_transfer_temp->rgba_ypixel_offset.init(grid_square->sub_size());
     for(const auto& subgrid_index : ImageSubGridBasicIterator(grid_square->_grid_setup,
                                                           *grid_square->grid_index())) {
       if (grid_square->grid_setup()->subgrid_has_data(grid_square->_grid_index,
@@ -83,6 +110,8 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
         data_transfer_temp->rgba_data.set(subgrid_index,nullptr);
         data_transfer_temp->rgba_wpixel.set(subgrid_index,INT_MIN);
         data_transfer_temp->rgba_hpixel.set(subgrid_index,INT_MIN);
+        data_transfer_temp->rgba_xpixel_offset.set(subgrid_index,0);
+        data_transfer_temp->rgba_ypixel_offset.set(subgrid_index,0);
       }
     }
   }
@@ -94,13 +123,39 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
                                                     subgrid_index)) {
       auto filename=grid_square->grid_setup()->filename(grid_square->_grid_index,subgrid_index);
       if (use_cache) {
-        cached_filename=create_cache_filename(filename,"png");
+        cached_filename=create_cache_filename(filename,PYRAMID_CACHE_EXTENSION);
       } else {
         // TODO: something better for invalid cached filename
         cached_filename="";
       }
       // TODO: is this line necessary?
       auto current_subgrid=SubGridIndex(subgrid_index);
+      if (read_engine && check_load_from_memory(filename,
+                                                cached_filename,
+                                                data_transfer)) {
+        // decoded as each read finishes while the others are still
+        // being read, falling back to reading the file directly
+        read_engine->queue(filename,
+                           [&,current_subgrid,cached_filename](AsyncReadResult& result) mutable {
+                             auto load_successful_temp=(result.success &&
+                                                        load_memory_as_rgba(result.filename,
+                                                                            result.data,
+                                                                            current_subgrid,
+                                                                            data_transfer,
+                                                                            row_temp_buffer));
+                             if (!load_successful_temp) {
+                               load_successful_temp=load_data_as_rgba(result.filename,
+                                                                      cached_filename,
+                                                                      current_subgrid,
+                                                                      data_transfer,
+                                                                      row_temp_buffer);
+                             }
+                             if (!load_successful_temp) {
+                               load_successful=false;
+                             }
+                           });
+        continue;
+      }
       auto load_successful_temp=load_data_as_rgba(filename,
                                                   cached_filename,
                                                   current_subgrid,
@@ -114,6 +169,9 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
       }
     }
   }
+  if (read_engine) {
+    read_engine->wait_all();
+  }
   // TODO: change this once error handling is better
   if (load_successful) {
     for (auto& data_pair : file_data.data_pairs) {
@@ -124,17 +182,50 @@ bool ImageGridSquareZoomLevel::load_square(ImageGridSquare* grid_square,
         auto sub_j=subgrid_index.j();
         if (grid_square->grid_setup()->subgrid_has_data(grid_square->_grid_index,
                                                         subgrid_index)) {
-          auto origin_x=sub_i*(data_pair.first->_max_sub_size.w());
-          auto origin_y=sub_j*(data_pair.first->_max_sub_size.w());
+          auto origin_x=sub_i*(data_pair.first->_max_sub_size.w())+data_pair.second->rgba_xpixel_offset[subgrid_index];
+          auto origin_y=sub_j*(data_pair.first->_max_sub_size.h())+data_pair.second->rgba_ypixel_offset[subgrid_index];
+          // replace anything from an earlier region
+          data_pair.first->_free_rgba_data(subgrid_index);
           data_pair.first->_rgba_wpixel.set(subgrid_index,data_pair.second->rgba_wpixel[subgrid_index]);
           data_pair.first->_rgba_hpixel.set(subgrid_index,data_pair.second->rgba_hpixel[subgrid_index]);
           data_pair.first->_rgba_xpixel_origin.set(subgrid_index,origin_x);
           data_pair.first->_rgba_ypixel_origin.set(subgrid_index,origin_y);
           data_pair.first->_rgba_data.set(subgrid_index,data_pair.second->rgba_data[subgrid_index]);
+          data_pair.first->_rgba_mapping.set(subgrid_index,data_pair.second->rgba_mapping[subgrid_index]);
+          data_pair.first->_index_data.set(subgrid_index,data_pair.second->index_data[subgrid_index]);
+          data_pair.first->_palette.set(subgrid_index,data_pair.second->palette[subgrid_index]);
         }
       }
+      data_pair.first->_region_loaded=data_transfer.region_loaded;
+      if (data_transfer.region_loaded) {
+        data_pair.first->_region=*region;
+      }
+      data_pair.first->load_generation++;
       data_pair.first->is_loaded=true;
     }
+    // a region has nothing to add to the cache, which only keeps zoom
+    // levels loaded whole
+    if (use_cache && cache_missed && !data_transfer.region_loaded) {
+      for (const auto& subgrid_index : ImageSubGridBasicIterator(grid_square->_grid_setup,
+                                                             *grid_square->grid_index())) {
+        if (grid_square->grid_setup()->subgrid_has_data(grid_square->_grid_index,
+                                                        subgrid_index) &&
+            !data_transfer.cache_loaded[subgrid_index]) {
+          cache_missed->push_back(subgrid_index);
+        }
+      }
+    }
+  } else {
+    // don't leak anything that did load
+    for (auto& data_pair : file_data.data_pairs) {
+      for(const auto& subgrid_index : ImageSubGridBasicIterator(grid_square->_grid_setup,
+                                                            *grid_square->grid_index())) {
+        if (grid_square->grid_setup()->subgrid_has_data(grid_square->_grid_index,
+                                                        subgrid_index)) {
+          data_pair.second->free_rgba_data(subgrid_index);
+        }
+      }
+    }
   }
   return load_successful;
 }
@@ -143,17 +234,27 @@ void ImageGridSquareZoomLevel::unload_square() {
   if (this->is_loaded) {
     std::lock_guard<std::mutex> guard(this->load_mutex);
     this->is_loaded=false;
+    this->_region_loaded=false;
 
     for(const auto& subgrid_index : ImageSubGridBasicIterator(this->_parent_square->_grid_setup,
                                                           *this->_parent_square->grid_index())) {
-      if (this->_rgba_data[subgrid_index]) {
-        delete[] this->_rgba_data[subgrid_index];
-        this->_rgba_data.set(subgrid_index,nullptr);
-      }
+      this->_free_rgba_data(subgrid_index);
     }
   }
 }
 
+void ImageGridSquareZoomLevel::_free_rgba_data(const SubGridIndex& subgrid_index) {
+  if (this->_rgba_mapping[subgrid_index]) {
+    this->_rgba_mapping.set(subgrid_index,nullptr);
+  } else {
+    delete[] this->_rgba_data[subgrid_index];
+  }
+  this->_rgba_data.set(subgrid_index,nullptr);
+  delete[] this->_index_data[subgrid_index];
+  this->_index_data.set(subgrid_index,nullptr);
+  this->_palette.set(subgrid_index,nullptr);
+}
+
 INT64 ImageGridSquareZoomLevel::zoom_out_shift() const {
   return this->_zoom_out_shift;
 }
@@ -178,6 +279,15 @@ PIXEL_RGBA* ImageGridSquareZoomLevel::rgba_data(const SubGridIndex& subgrid_inde
   return this->_rgba_data[subgrid_index];
 }
 
+unsigned char* ImageGridSquareZoomLevel::index_data(const SubGridIndex& subgrid_index) const {
+  return this->_index_data[subgrid_index];
+}
+
+const PIXEL_RGBA* ImageGridSquareZoomLevel::palette(const SubGridIndex& subgrid_index) const {
+  auto palette=this->_palette[subgrid_index];
+  return (palette ? palette->data() : nullptr);
+}
+
 SubGridImageSize ImageGridSquareZoomLevel::sub_size() const {
   return this->_parent_square->sub_size();
 }
@@ -282,8 +392,19 @@ void ImageGrid::_read_grid_info_setup_squares(GridSetup* const grid_setup) {
   // not ready for an iterator until full sparsity is implemented and tested
   INT64 new_wpixel=INT_MIN;
   INT64 new_hpixel=INT_MIN;
+  std::vector<GridIndex> grid_indices;
   for (const auto& grid_index : ImageGridBasicIterator(this->_grid_setup)) {
-    this->_squares.set(grid_index,std::make_unique<ImageGridSquare>(grid_setup,this,GridIndex(grid_index)));
+    grid_indices.push_back(GridIndex(grid_index));
+  }
+  // reading the headers is mostly waiting on I/O, so do it in parallel,
+  // each square gets its own slot so the result is the same as
+  // reading serially
+  parallel_for((INT64)grid_indices.size(),
+               READ_DATA_THREADS_MAX,
+               [&](INT64, INT64 i) {
+                 this->_squares.set(grid_indices[i],std::make_unique<ImageGridSquare>(grid_setup,this,grid_indices[i]));
+               });
+  for (const auto& grid_index : grid_indices) {
     // TODO: not skipping rest for now, just setting as load error
     if (this->_squares[grid_index]->_status == ImageGridStatus::load_error) {
       this->_status=ImageGridStatus::load_error;
@@ -303,6 +424,12 @@ void ImageGrid::_read_grid_info_setup_squares(GridSetup* const grid_setup) {
   auto image_max_size_hpixel=this->_image_max_size.h();
   // allocate temporary buffers to use as a working area
   this->_row_temp_buffer=std::make_unique<INT64[]>(new_wpixel*3);
+  this->_async_read_engine=std::make_unique<AsyncReadEngine>(ASYNC_READ_IN_FLIGHT_MAX);
+  MSG_LOCAL("Reading files with: " << this->_async_read_engine->backend_name());
+  // images missing from the cache are cached as they are viewed
+  if (grid_setup->use_cache() && !grid_setup->setup_cache()) {
+    this->_cache_write_back=std::make_unique<PyramidCacheWriteBack>();
+  }
   // find how many zoom_out_shifts to get whole image grid as a 3x3 grid of original size
   // TODO: revise description of why this works
   auto max_scale=(INT64)ceil((FLOAT64)(fmax((FLOAT64)image_max_size_wpixel,(FLOAT64)image_max_size_hpixel))/(FLOAT64)MAX_MIN_SCALED_IMAGE_SIZE);
@@ -383,6 +510,52 @@ bool ImageGrid::_check_load(const ViewPortCurrentState& viewport_current_state,
   return return_value;
 }
 
+bool ImageGrid::_find_load_region(const ViewPortCurrentState& viewport_current_state,
+                                  const GridIndex* grid_index,
+                                  INT64 screens,
+                                  LoadFileRegion& region) {
+  auto zoom=viewport_current_state.zoom();
+  if (!(zoom > 0.0)) {
+    return false;
+  }
+  auto square_wpixel=this->squares(grid_index)->_square_size.w();
+  auto square_hpixel=this->squares(grid_index)->_square_size.h();
+  // calculate these with max reasonable resolution, rather than actual viewport
+  auto center_x=(viewport_current_state.current_grid_coordinate().x()-(FLOAT64)grid_index->i())*(FLOAT64)this->_image_max_size.w();
+  auto center_y=(viewport_current_state.current_grid_coordinate().y()-(FLOAT64)grid_index->j())*(FLOAT64)this->_image_max_size.h();
+  auto half_wpixel=(FLOAT64)(screens*MAX_SCREEN_WIDTH)/2.0/zoom;
+  auto half_hpixel=(FLOAT64)(screens*MAX_SCREEN_HEIGHT)/2.0/zoom;
+  auto clamp_pixel=[](FLOAT64 pixel, INT64 size) {
+    return std::clamp((INT64)floor(pixel),(INT64)0,size);
+  };
+  region=LoadFileRegion(clamp_pixel(center_x-half_wpixel,square_wpixel),
+                        clamp_pixel(center_y-half_hpixel,square_hpixel),
+                        clamp_pixel(ceil(center_x+half_wpixel),square_wpixel),
+                        clamp_pixel(ceil(center_y+half_hpixel),square_hpixel));
+  return !(region.x0 == 0 && region.y0 == 0 &&
+           region.x1 == square_wpixel && region.y1 == square_hpixel);
+}
+
+bool ImageGrid::_check_load_region(const GridIndex* grid_index) {
+  for (const auto& subgrid_index : ImageSubGridBasicIterator(this->_grid_setup,
+                                                         *grid_index)) {
+    if (!this->_grid_setup->subgrid_has_data(*grid_index,subgrid_index)) {
+      continue;
+    }
+    auto filename=this->_grid_setup->filename(*grid_index,subgrid_index);
+    if (check_empty(filename)) {
+      continue;
+    }
+    auto cached_filename=(this->_grid_setup->use_cache() ?
+                          create_cache_filename(filename,PYRAMID_CACHE_EXTENSION) :
+                          std::string(""));
+    if (!decoder_check_region(filename,cached_filename)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 bool ImageGrid::_load_square(const ViewPortCurrentState& viewport_current_state,
                              const GridIndex* grid_index,
                              INT64 zoom_out_shift_lower_limit,
@@ -391,6 +564,18 @@ bool ImageGrid::_load_square(const ViewPortCurrentState& viewport_current_state,
   bool tried_load=false;
   bool never_false=true;
   if (this->_check_bounds(grid_index)) {
+    // only part of large full size images is loaded when not loading
+    // everything, reload that part once the viewport leaves it, images
+    // that can't be region loaded are loaded whole with the other levels
+    LoadFileRegion visible_region;
+    auto use_region=(!load_all &&
+                     this->_find_load_region(viewport_current_state,
+                                             grid_index,
+                                             1,
+                                             visible_region));
+    auto square_zero=this->squares(grid_index)->image_array[0];
+    auto reload_zero=(square_zero->is_loaded && square_zero->_region_loaded &&
+                      (!use_region || !square_zero->_region.contains(visible_region)));
     std::vector<INT64> zoom_out_shift_list;
     for (INT64 zoom_out_shift=0; zoom_out_shift < this->_max_zoom_out_shift; zoom_out_shift++) {
       if (this->_check_load(viewport_current_state,
@@ -398,7 +583,8 @@ bool ImageGrid::_load_square(const ViewPortCurrentState& viewport_current_state,
                             grid_index,
                             zoom_out_shift_lower_limit,
                             load_all)) {
-        if (!this->squares(grid_index)->image_array[zoom_out_shift]->is_loaded) {
+        if (!this->squares(grid_index)->image_array[zoom_out_shift]->is_loaded ||
+            (zoom_out_shift == 0 && reload_zero)) {
           zoom_out_shift_list.push_back(zoom_out_shift);
         }
       }
@@ -409,12 +595,44 @@ bool ImageGrid::_load_square(const ViewPortCurrentState& viewport_current_state,
         dest_squares.push_back(this->squares(grid_index)->image_array[zoom_out_shift_item]);
       }
       tried_load=true;
-      auto load_successful_temp=ImageGridSquareZoomLevel::load_square(this->squares(grid_index),
-                                                                      grid_setup->use_cache(),
-                                                                      dest_squares,
-                                                                      this->_row_temp_buffer.get());
-      if (!load_successful_temp) {
-        never_false=false;
+      std::vector<SubGridIndex> cache_missed;
+      LoadFileRegion load_region;
+      // files that would be loaded whole anyways are only decoded
+      // once for every zoom level
+      if (use_region && dest_squares.front()->zoom_out_shift() == 0 &&
+          this->_find_load_region(viewport_current_state,
+                                  grid_index,
+                                  REGION_LOAD_SCREENS,
+                                  load_region) &&
+          this->_check_load_region(grid_index)) {
+        // the full size square is loaded on its own so the rest can
+        // still be reduced from the whole image
+        auto load_successful_temp=ImageGridSquareZoomLevel::load_square(this->squares(grid_index),
+                                                                        grid_setup->use_cache(),
+                                                                        {dest_squares.front()},
+                                                                        this->_row_temp_buffer.get(),
+                                                                        &load_region,
+                                                                        this->_async_read_engine.get(),
+                                                                        &cache_missed);
+        if (!load_successful_temp) {
+          never_false=false;
+        }
+        dest_squares.erase(dest_squares.begin());
+      }
+      if (dest_squares.size() > 0) {
+        auto load_successful_temp=ImageGridSquareZoomLevel::load_square(this->squares(grid_index),
+                                                                        grid_setup->use_cache(),
+                                                                        dest_squares,
+                                                                        this->_row_temp_buffer.get(),
+                                                                        nullptr,
+                                                                        this->_async_read_engine.get(),
+                                                                        &cache_missed);
+        if (!load_successful_temp) {
+          never_false=false;
+        }
+      }
+      if (!cache_missed.empty()) {
+        this->_queue_cache_write_back(*grid_index,cache_missed);
       }
     }
   }
@@ -422,47 +640,88 @@ bool ImageGrid::_load_square(const ViewPortCurrentState& viewport_current_state,
 }
 
 void ImageGrid::_write_cache(const GridIndex& grid_index) {
-  auto sub_w=this->_grid_setup->sub_size(grid_index).w();
-  auto sub_h=this->_grid_setup->sub_size(grid_index).h();
   for (const auto& subgrid_index : ImageSubGridBasicIterator(this->_grid_setup,
                                                          grid_index)) {
-    auto sub_i=subgrid_index.i();
-    auto sub_j=subgrid_index.j();
-      bool loaded_cache_size=false;
-      // TODO: probaby not optimal place to find this
-      auto dest_square_zero=this->squares(grid_index)->image_array[0];
-      auto full_wpixel=dest_square_zero->rgba_wpixel(subgrid_index);
-      auto full_hpixel=dest_square_zero->rgba_hpixel(subgrid_index);
-      for (INT64 k=0L; k<this->_max_zoom_out_shift; k++) {
-        if (loaded_cache_size) {
-          break;
-        }
-        auto dest_square=this->squares(grid_index)->image_array[k];
-        // find current size
-        auto wpixel=dest_square->rgba_wpixel(subgrid_index);
-        auto hpixel=dest_square->rgba_hpixel(subgrid_index);
-        auto filename=this->grid_setup()->filename(grid_index,subgrid_index);
-        if (check_valid_filename(filename)) {
-          // TODO: combine these
-          auto filename_png=create_cache_filename(filename,"png");
-          auto filename_txt=create_cache_filename(filename,"txt");
-          MSG_LOCAL("Trying to writing cache filenames: " <<
-              filename_png << " " <<  " " << filename_txt <<
-              " for " << filename << " at zoom index " << k <<
-              " i: " << grid_index.i() << " j: " << grid_index.j() <<
-              " sub_i: " << sub_i << " sub_j: " << sub_j);
-          if (sub_w*wpixel < CACHE_MAX_PIXEL_SIZE && sub_h*hpixel < CACHE_MAX_PIXEL_SIZE) {
-            loaded_cache_size=write_png_text(filename_png, filename_txt,
-                                             wpixel, hpixel,
-                                             full_wpixel, full_hpixel,
-                                             dest_square->_rgba_data[subgrid_index]);
-            MSG_LOCAL("Cache tried with return: " << loaded_cache_size);
-            if (loaded_cache_size) {
-              MSG_LOCAL("Cached worked with w: " << wpixel << " h: " << hpixel);
-            }
-          }
-        }
-      }
+    PyramidCacheWriteJob job;
+    if (!this->_cache_write_job(grid_index,subgrid_index,false,job)) {
+      continue;
+    }
+    MSG_LOCAL("Caching i: " << grid_index.i() << " j: " << grid_index.j() <<
+              " sub_i: " << subgrid_index.i() << " sub_j: " << subgrid_index.j());
+    pyramid_cache_write_job(job);
+  }
+}
+
+bool ImageGrid::_cache_write_job(const GridIndex& grid_index,
+                                 const SubGridIndex& subgrid_index,
+                                 bool copy_levels,
+                                 PyramidCacheWriteJob& job) {
+  auto square=this->squares(grid_index);
+  job.filename=this->_grid_setup->filename(grid_index,subgrid_index);
+  if (!check_valid_filename(job.filename) || check_empty(job.filename)) {
+    return false;
+  }
+  job.cache_filename=create_cache_filename(job.filename,PYRAMID_CACHE_EXTENSION);
+  if (!check_valid_filename(job.cache_filename)) {
+    return false;
+  }
+  // the full size even if only a region of it is loaded
+  job.width=square->_subimages_wpixel[subgrid_index];
+  job.height=square->_subimages_hpixel[subgrid_index];
+  job.codec=this->_grid_setup->cache_codec();
+  // only zoom levels loaded whole go in the pyramid
+  for (INT64 k=0L; k<this->_max_zoom_out_shift; k++) {
+    auto dest_square=square->image_array[k];
+    std::lock_guard<std::mutex> guard(dest_square->load_mutex);
+    if (!dest_square->is_loaded || dest_square->_region_loaded) {
+      continue;
+    }
+    auto wpixel=dest_square->rgba_wpixel(subgrid_index);
+    auto hpixel=dest_square->rgba_hpixel(subgrid_index);
+    auto rgba_data=(const unsigned char*)dest_square->rgba_data(subgrid_index);
+    auto index_data=dest_square->index_data(subgrid_index);
+    if (!rgba_data && !index_data) {
+      continue;
+    }
+    PyramidCacheWriteLevel level{dest_square->zoom_out_shift(),wpixel,hpixel,
+                                 (rgba_data ? 4 : 1),
+                                 (rgba_data ? rgba_data : index_data),
+                                 dest_square->_palette[subgrid_index],{}};
+    if (copy_levels) {
+      level.buffer.assign(level.data,level.data+wpixel*hpixel*level.channels);
+      level.data=nullptr;
+    }
+    job.levels.push_back(std::move(level));
+  }
+  return true;
+}
+
+void ImageGrid::_queue_cache_write_back(const GridIndex& grid_index,
+                                        const std::vector<SubGridIndex>& cache_missed) {
+  if (!this->_cache_write_back) {
+    return;
+  }
+  for (const auto& subgrid_index : cache_missed) {
+    // only images whose decoder reads the cache are worth caching
+    auto filename=this->_grid_setup->filename(grid_index,subgrid_index);
+    if (!decoder_has_capability(find_decoder(filename),DECODER_CAPABILITY_CACHE)) {
+      continue;
+    }
+    // size the levels without copying them, so nothing is copied for
+    // a job that would be dropped anyways
+    PyramidCacheWriteJob sized_job;
+    if (!this->_cache_write_job(grid_index,subgrid_index,false,sized_job) ||
+        sized_job.levels.empty() ||
+        this->_cache_write_back->busy(sized_job.cache_filename,
+                                      pyramid_cache_write_job_bytes(sized_job)) ||
+        !pyramid_cache_write_job_needed(sized_job)) {
+      continue;
+    }
+    PyramidCacheWriteJob job;
+    if (this->_cache_write_job(grid_index,subgrid_index,true,job) &&
+        !job.levels.empty()) {
+      this->_cache_write_back->queue(std::move(job));
+    }
   }
 }
 
@@ -542,25 +801,126 @@ ImageGridSquare* ImageGrid::squares(const GridIndex* grid_index) {
 void ImageGrid::setup_grid_cache(GridSetup* const grid_setup) {
   // no read_grid_info(...) called for now
   this->_read_grid_info_setup_squares(grid_setup);
-  // loop over the whole grid
+  // squares cached by an earlier run only need their manifest entries
+  // so an interrupted run picks up where it left off
+  std::vector<GridIndex> grid_indices;
+  INT64 skipped_count=0;
+  // shards take turns over the squares with data so every process
+  // splits the grid the same way and gets a similar mix of squares
+  INT64 data_square_count=0;
   for (const auto& grid_index : ImageGridBasicIterator(grid_setup)) {
-    // load the file into the data structure
-    // this is a dummy ViewPortCurrentState
-    this->_load_square(ViewPortCurrentState(GridCoordinate(0.0,0.0),
-                                            GridPixelSize(0,0),
-                                            0.0,
-                                            BufferPixelSize(0,0),
-                                            BufferPixelCoordinate(0,0),
-                                            BufferPixelCoordinate(0,0)),
-                       &grid_index,
-                       0L,true,grid_setup);
-    // TODO: eventually cache this out as tiles that fit in 128x128 and 512x512
-    this->_write_cache(grid_index);
-    // unload
-    for (auto k=this->_max_zoom_out_shift-1; k >= 0L; k--) {
-      this->_squares[grid_index]->image_array[k]->unload_square();
+    if (!grid_setup->square_has_data(grid_index)) {
+      continue;
+    }
+    if (data_square_count++ % grid_setup->shard_count() != grid_setup->shard_index()) {
+      continue;
+    }
+    if (this->_cache_up_to_date(grid_index)) {
+      for (const auto& subgrid_index : ImageSubGridBasicIterator(grid_setup,
+                                                             grid_index)) {
+        auto filename=grid_setup->filename(grid_index,subgrid_index);
+        if (check_valid_filename(filename) && !check_empty(filename)) {
+          cache_manifest_update(filename,
+                                this->_squares[grid_index]->_subimages_wpixel[subgrid_index],
+                                this->_squares[grid_index]->_subimages_hpixel[subgrid_index]);
+        }
+      }
+      skipped_count++;
+    } else {
+      grid_indices.push_back(grid_index);
+    }
+  }
+  auto square_count=(INT64)grid_indices.size();
+  if (grid_setup->shard_count() > 1) {
+    MSG_LOCAL("Caching shard " << grid_setup->shard_index() << " of " << grid_setup->shard_count());
+  }
+  MSG_LOCAL("Caching " << square_count << " squares, " << skipped_count << " already cached");
+  // each worker has its own working area and loads every zoom level
+  // of a square, writes its cache, then unloads it
+  auto worker_count=worker_thread_count(CACHE_BUILD_THREADS_MAX,square_count);
+  // the threads decoding and compressing inside each worker share what
+  // is left so there are never worker_count times as many
+  auto inner_thread_count=std::max((INT64)1,hardware_thread_count()/worker_count);
+  std::vector<std::unique_ptr<INT64[]>> row_temp_buffers;
+  for (INT64 worker=0; worker < worker_count; worker++) {
+    row_temp_buffers.push_back(std::make_unique<INT64[]>(this->_image_max_size.w()*3));
+  }
+  std::atomic<INT64> finished_count{0};
+  parallel_for(square_count,
+               worker_count,
+               [&](INT64 worker, INT64 i) {
+                 WorkerThreadLimit thread_limit(inner_thread_count);
+                 const auto& grid_index=grid_indices[i];
+                 auto square=this->_squares[grid_index];
+                 std::vector<ImageGridSquareZoomLevel*> dest_squares;
+                 for (INT64 k=0; k < this->_max_zoom_out_shift; k++) {
+                   dest_squares.push_back(square->image_array[k]);
+                 }
+                 if (ImageGridSquareZoomLevel::load_square(square,
+                                                           grid_setup->use_cache(),
+                                                           dest_squares,
+                                                           row_temp_buffers[worker].get(),
+                                                           nullptr,
+                                                           nullptr,
+                                                           nullptr)) {
+                   this->_write_cache(grid_index);
+                 } else {
+                   ERROR_LOCAL("Failed to cache square i: " << grid_index.i() << " j: " << grid_index.j());
+                 }
+                 for (auto k=this->_max_zoom_out_shift-1; k >= 0L; k--) {
+                   square->image_array[k]->unload_square();
+                 }
+                 auto finished=++finished_count;
+                 MSG_LOCAL("Cached " << finished << "/" << square_count << " squares");
+               });
+  if (grid_setup->shard_count() > 1) {
+    // other shards may be writing to the same cache directories
+    cache_manifest_save_all_shard(grid_setup->shard_index(),grid_setup->shard_count());
+    zip_index_save_all_shard(grid_setup->shard_index(),grid_setup->shard_count());
+  } else {
+    cache_manifest_save_all();
+    zip_index_save_all();
+  }
+}
+
+bool ImageGrid::merge_grid_cache_shards(GridSetup* const grid_setup) {
+  std::set<std::string> directories;
+  for (const auto& grid_index : ImageGridBasicIterator(grid_setup)) {
+    if (!grid_setup->square_has_data(grid_index)) {
+      continue;
+    }
+    for (const auto& subgrid_index : ImageSubGridBasicIterator(grid_setup,
+                                                           grid_index)) {
+      auto filename=grid_setup->filename(grid_index,subgrid_index);
+      if (check_valid_filename(filename) && !check_empty(filename)) {
+        directories.insert(cache_directory(filename));
+      }
+    }
+  }
+  auto success=true;
+  for (const auto& directory : directories) {
+    if (!cache_manifest_merge_shards(directory) ||
+        !zip_index_merge_shards(directory)) {
+      success=false;
+    }
+  }
+  return success;
+}
+
+bool ImageGrid::_cache_up_to_date(const GridIndex& grid_index) {
+  for (const auto& subgrid_index : ImageSubGridBasicIterator(this->_grid_setup,
+                                                         grid_index)) {
+    auto filename=this->_grid_setup->filename(grid_index,subgrid_index);
+    if (!check_valid_filename(filename) || check_empty(filename)) {
+      continue;
+    }
+    if (!pyramid_cache_up_to_date(create_cache_filename(filename,PYRAMID_CACHE_EXTENSION),
+                                  filename,
+                                  this->_max_zoom_out_shift)) {
+      return false;
     }
   }
+  return true;
 }
 
 GridSetup* ImageGrid::grid_setup() const {
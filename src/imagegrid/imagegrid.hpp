@@ -9,7 +9,10 @@
 #include "../datatypes/coordinates.hpp"
 #include "../datatypes/containers.hpp"
 #include "gridsetup.hpp"
+#include "imagegrid_load_file_data.hpp"
 #include "../viewport_current_state.hpp"
+#include "../c_io_net/async_read.hpp"
+#include "../c_io_net/pyramid_cache.hpp"
 // C++ headers
 #include <atomic>
 #include <memory>
@@ -55,6 +58,8 @@ public:
   std::mutex load_mutex;
   /** Has this been loaded? */
   std::atomic<bool> is_loaded{false};
+  /** Changes every time new data is loaded so textures can be updated. */
+  std::atomic<INT64> load_generation{0};
   /**
    * Load a file and fill out squares.
    *
@@ -62,12 +67,22 @@ public:
    * @param use_cache Whether to use the cache for initial loading.
    * @param dest_square A vector of this class to be loaded.
    * @param row_temp_buffer A buffer to use as a working area when loading images.
+   * @param region If not null, only this region of the full size
+   *               square is needed.
+   * @param read_engine If not null, used to read the files for the
+   *                    square into memory in the background.
+   * @param cache_missed If not null and using the cache, the images
+   *                     that were not loaded from their cache are
+   *                     added to it, unless only a region was loaded.
    * @return If loading the square was successful.
    */
   static bool load_square(ImageGridSquare* grid_square,
                           bool use_cache,
                           const std::vector<ImageGridSquareZoomLevel*>& dest_square,
-                          INT64* row_temp_buffer);
+                          INT64* row_temp_buffer,
+                          const LoadFileRegion* region,
+                          AsyncReadEngine* read_engine,
+                          std::vector<SubGridIndex>* cache_missed);
   /** Unload and free memory from a loaded file */
   void unload_square();
   /** @return The amount of right shift corresponding how zoomed out this square is. */
@@ -109,6 +124,21 @@ public:
    * @return A pointer to the RGBA data.
    */
   PIXEL_RGBA* rgba_data(const SubGridIndex& subgrid_index) const;
+  /**
+   * Get the palette indices or grayscale for this square, used
+   * instead of the RGBA data for palette images at full size and
+   * grayscale images at any size.
+   *
+   * @param subgrid_index The index of the subgrid.
+   * @return A pointer to the indices or nullptr if not 8-bit.
+   */
+  unsigned char* index_data(const SubGridIndex& subgrid_index) const;
+  /**
+   * @param subgrid_index The index of the subgrid.
+   * @return The BUFFER_PALETTE_SIZE entries used with index_data or
+   *         nullptr if it is grayscale.
+   */
+  const PIXEL_RGBA* palette(const SubGridIndex& subgrid_index) const;
   /** @return The subgrid size of this square. */
   SubGridImageSize sub_size() const;
   // /** @return The max subgrid pixel size for each image at the zoom out of this square. */
@@ -118,10 +148,22 @@ public:
 private:
   friend class ImageGrid;
   friend class ImageGridSquare;
+  /**
+   * Free the RGBA or indexed data for one image, releasing the mapped
+   * file it points into if there is one.
+   *
+   * @param subgrid_index The index of the subgrid.
+   */
+  void _free_rgba_data(const SubGridIndex& subgrid_index);
   std::atomic<ImageGridStatus> _status {ImageGridStatus::not_loaded};
   ImageGridSquare* _parent_square;
   /** The actual RGBA data for this square at the zoom out value. */
   StaticGrid<PIXEL_RGBA*> _rgba_data;
+  /** Keeps files mapped while _rgba_data points straight into them. */
+  StaticGrid<std::shared_ptr<MappedFile>> _rgba_mapping;
+  /** 8-bit palette indices or grayscale used instead of _rgba_data if set. */
+  StaticGrid<unsigned char*> _index_data;
+  StaticGrid<std::shared_ptr<std::vector<PIXEL_RGBA>>> _palette;
   // TOOD: will eventually use an object from coordinates.hpp, but for
   // now I want this freedom
   StaticGrid<INT64> _rgba_wpixel;
@@ -132,6 +174,10 @@ private:
   StaticGrid<INT64> _rgba_xpixel_origin;
   StaticGrid<INT64> _rgba_ypixel_origin;
   INT64 _zoom_out_shift;
+  /** If only part of the square was loaded. */
+  bool _region_loaded{false};
+  /** The part of the square that was requested if _region_loaded. */
+  LoadFileRegion _region;
 };
 
 /**
@@ -230,13 +276,27 @@ public:
   GridSetup* grid_setup() const;
   const GridImageSize grid_image_size() const;
   /**
-   * Used to setup and write the cache for this grid.
+   * Used to setup and write the cache for this grid.  If the grid
+   * setup gives a shard only that shard's squares are cached and a
+   * partial manifest and zip index are written for
+   * merge_grid_cache_shards.
    *
    * @param grid_setup The object holding the data on the images in
    *                   the grid, including the filenames and grid
    *                   size.
    */
   void setup_grid_cache(GridSetup* const grid_setup);
+  /**
+   * Merge the partial manifests and zip indexes written by every
+   * shard of a cache build into those of the cache directories of
+   * this grid.
+   *
+   * @param grid_setup The object holding the data on the images in
+   *                   the grid, including the filenames and grid
+   *                   size.
+   * @return If merging was successful.
+   */
+  bool merge_grid_cache_shards(GridSetup* const grid_setup);
 private:
   friend class ImageGridSquare;
   friend class ImageGridSquareZoomLevel;
@@ -267,6 +327,28 @@ private:
                    const GridIndex* grid_index,
                    INT64 zoom_out_shift_lower_limit,
                    INT64 load_all);
+  /**
+   * Find the region of a full size square around the viewport.
+   *
+   * @param viewport_current_state The current state of the viewport.
+   * @param grid_index The index of the grid square.
+   * @param screens How many screens wide and high the region is.
+   * @param region Set to the region in pixels of the full size square.
+   * @return If the region is smaller than the whole square.
+   */
+  bool _find_load_region(const ViewPortCurrentState& viewport_current_state,
+                         const GridIndex* grid_index,
+                         INT64 screens,
+                         LoadFileRegion& region);
+  /**
+   * Check if only a region of the full size image of every image in a
+   * grid square can be loaded, so loading the full size square on its
+   * own doesn't decode any image twice.
+   *
+   * @param grid_index The index of the grid square.
+   * @return If every image can be loaded a region at a time.
+   */
+  bool _check_load_region(const GridIndex* grid_index);
   /**
    * Actually load the square.
    *
@@ -300,6 +382,38 @@ private:
    * @param grid_index The index of grid square to write cache for.
    */
   void _write_cache(const GridIndex& grid_index);
+  /**
+   * Gather the zoom levels of an image loaded whole to cache them.
+   *
+   * @param grid_index The index of the grid square.
+   * @param subgrid_index The index of the image in the grid square.
+   * @param copy_levels Whether to copy the pixels so the levels can
+   *                    be unloaded before the cache is written.
+   * @param job Filled out with the image and its levels.
+   * @return If the image can be cached.
+   */
+  bool _cache_write_job(const GridIndex& grid_index,
+                        const SubGridIndex& subgrid_index,
+                        bool copy_levels,
+                        PyramidCacheWriteJob& job);
+  /**
+   * Queue writing the caches of images that were loaded without
+   * their cache, using the zoom levels just loaded.  Nothing is
+   * queued if the cache already has every level loaded whole.
+   *
+   * @param grid_index The index of the grid square.
+   * @param cache_missed The images not loaded from their cache.
+   */
+  void _queue_cache_write_back(const GridIndex& grid_index,
+                               const std::vector<SubGridIndex>& cache_missed);
+  /**
+   * Check if every image in a grid square has a valid cache built
+   * from the current version of the image.
+   *
+   * @param grid_index The index of grid square to check.
+   * @return If the cache for the square can be kept.
+   */
+  bool _cache_up_to_date(const GridIndex& grid_index);
   /** The individual squares in the image grid. */
   StaticGrid<std::unique_ptr<ImageGridSquare>> _squares;
   /** Maximum size of images loaded into the grid. */
@@ -315,6 +429,10 @@ private:
    * loading through this class becomes more multithreaded.
    */
   std::unique_ptr<INT64[]> _row_temp_buffer;
+  /** Reads files into memory in the background while loading. */
+  std::unique_ptr<AsyncReadEngine> _async_read_engine;
+  /** Writes caches while viewing with the cache, null otherwise. */
+  std::unique_ptr<PyramidCacheWriteBack> _cache_write_back;
 };
 
 #endif
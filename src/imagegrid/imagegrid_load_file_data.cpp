@@ -1,8 +1,10 @@
 /**
- * Placeholder for when the classes in imagegrid_load_file_data.hpp require more functionality.
+ * Implementation of the classes in imagegrid_load_file_data.hpp that
+ * require more functionality.
  */
 #include "../common.hpp"
 #include "imagegrid_load_file_data.hpp"
+#include "../c_io_net/mapped_file.hpp"
 
 // LoadFileData::LoadFileData () {
 //
@@ -15,3 +17,27 @@
 // LoadFileZoomLevelData::LoadFileZoomLevelData() {
 //
 // }
+
+LoadFileRegion::LoadFileRegion(INT64 start_x, INT64 start_y, INT64 end_x, INT64 end_y) {
+  this->x0=start_x;
+  this->y0=start_y;
+  this->x1=end_x;
+  this->y1=end_y;
+}
+
+bool LoadFileRegion::contains(const LoadFileRegion& region) const {
+  return (region.x0 >= this->x0 && region.y0 >= this->y0 &&
+          region.x1 <= this->x1 && region.y1 <= this->y1);
+}
+
+void LoadFileZoomLevelData::free_rgba_data(const SubGridIndex& subgrid_index) {
+  if (this->rgba_mapping[subgrid_index]) {
+    this->rgba_mapping.set(subgrid_index,nullptr);
+  } else {
+    delete[] this->rgba_data[subgrid_index];
+  }
+  this->rgba_data.set(subgrid_index,nullptr);
+  delete[] this->index_data[subgrid_index];
+  this->index_data.set(subgrid_index,nullptr);
+  this->palette.set(subgrid_index,nullptr);
+}
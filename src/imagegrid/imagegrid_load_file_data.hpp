@@ -16,6 +16,32 @@
 #include <cstddef>
 
 class ImageGridSquareZoomLevel;
+class MappedFile;
+
+/**
+ * A rectangle of a full size grid square in pixels, used when only
+ * part of a large image needs to be loaded.  The end is exclusive.
+ */
+class LoadFileRegion {
+public:
+  LoadFileRegion()=default;
+  /**
+   * @param start_x The left edge in pixels.
+   * @param start_y The top edge in pixels.
+   * @param end_x One past the right edge in pixels.
+   * @param end_y One past the bottom edge in pixels.
+   */
+  LoadFileRegion(INT64 start_x, INT64 start_y, INT64 end_x, INT64 end_y);
+  /**
+   * @param region The region to check.
+   * @return If region is entirely inside this one.
+   */
+  bool contains(const LoadFileRegion& region) const;
+  INT64 x0{0};
+  INT64 y0{0};
+  INT64 x1{0};
+  INT64 y1{0};
+};
 
 /**
  * Contains loaded file data in preparation to be transferred to
@@ -28,10 +54,31 @@ class ImageGridSquareZoomLevel;
 class LoadFileZoomLevelData {
 public:
   LoadFileZoomLevelData()=default;
+  /**
+   * Free the data for one image, either deleting it or releasing the
+   * mapped file it points into, along with any indexed data.
+   *
+   * @param subgrid_index The index of the image.
+   */
+  void free_rgba_data(const SubGridIndex& subgrid_index);
   std::string filename;
   StaticGrid<PIXEL_RGBA*> rgba_data;
+  /** If set rgba_data points straight into this file rather than being allocated. */
+  StaticGrid<std::shared_ptr<MappedFile>> rgba_mapping;
+  /**
+   * If set the image is held as 8 bits per pixel instead of in
+   * rgba_data, either indices into palette for the full size zoom
+   * level of palette images, or grayscale at any zoom level if there
+   * is no palette.
+   */
+  StaticGrid<unsigned char*> index_data;
+  /** The BUFFER_PALETTE_SIZE entries used with index_data, null for grayscale. */
+  StaticGrid<std::shared_ptr<std::vector<PIXEL_RGBA>>> palette;
   StaticGrid<INT64> rgba_wpixel;
   StaticGrid<INT64> rgba_hpixel;
+  /** Where rgba_data starts within the image, non-zero if only a region was loaded. */
+  StaticGrid<INT64> rgba_xpixel_offset;
+  StaticGrid<INT64> rgba_ypixel_offset;
   INT64 max_sub_wpixel{INT_MIN};
   INT64 max_sub_hpixel{INT_MIN};
   INT64 zoom_out_shift{INT_MIN};
@@ -48,6 +95,30 @@ public:
   SubGridImageSize sub_size;
   StaticGrid<INT64> original_rgba_wpixel;
   StaticGrid<INT64> original_rgba_hpixel;
+  /**
+   * If not null only this region of the full size square is needed,
+   * loaders that can't decode a region load the whole image.
+   */
+  const LoadFileRegion* region{nullptr};
+  /** Set by the loader if any image was only loaded for the region. */
+  bool region_loaded{false};
+  /**
+   * If cache_loaded has been initialized to false for every image, so
+   * loaders record which images came from their cache.
+   */
+  bool track_cache_loaded{false};
+  /** Set by the loader for each image loaded from its cache. */
+  StaticGrid<bool> cache_loaded;
+  /**
+   * If palette and grayscale images may be kept as 8 bits per pixel,
+   * only set by users that handle index_data.
+   */
+  bool allow_indexed{false};
+  /**
+   * If 16-bit unsigned color is stretched to the range of each image
+   * rather than shifted to 8 bits.
+   */
+  bool stretch_color{false};
 };
 
 /**
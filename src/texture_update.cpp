@@ -14,9 +14,11 @@
 #include "c_misc/buffer_manip.hpp"
 #include "c_sdl2/sdl2.hpp"
 // C++ headers
+#include <algorithm>
 #include <mutex>
 #include <string>
 #include <sstream>
+#include <vector>
 // C headers
 #include <cmath>
 
@@ -150,21 +152,26 @@ void TextureUpdate::load_new_textures(const ViewPortCurrentState& viewport_curre
         auto image_square=grid_square->image_array[load_index];
         if (image_square->is_loaded &&
             (!dest_square->is_loaded ||
-             dest_square->last_load_index>load_index)) {
+             dest_square->last_load_index>load_index ||
+             (dest_square->last_load_index == load_index &&
+              dest_square->last_load_generation != image_square->load_generation))) {
           std::unique_lock<std::mutex> load_lock(image_square->load_mutex, std::defer_lock);
           if (load_lock.try_lock()) {
             // try same conditions again after lock aquired
             if (image_square->is_loaded) {
               std::unique_lock<std::mutex> display_lock(dest_square->display_mutex, std::defer_lock);
               if (display_lock.try_lock()) {
+                auto load_generation=image_square->load_generation.load();
                 if (!dest_square->is_loaded ||
-                    dest_square->last_load_index>load_index) {
+                    dest_square->last_load_index>load_index ||
+                    (dest_square->last_load_index == load_index &&
+                     dest_square->last_load_generation != load_generation)) {
                   texture_copy_successful=this->load_texture(dest_square,
                                                              image_square,
                                                              zoom_out_shift,
                                                              row_buffer_temp);
                   if (texture_copy_successful) {
-                    dest_square->set_image_loaded(load_index);
+                    dest_square->set_image_loaded(load_index,load_generation);
                     texture_copy_count+=1;
                   }
                 }
@@ -258,16 +265,20 @@ bool TextureUpdate::load_texture (TextureGridSquareZoomLevel* const dest_square,
   // dest_square->clear_all_surfaces();
   // skip if can't load texture
   if (dest_square->all_surfaces_valid()) {
+    // palette indices and grayscale expanded to RGBA when they can't go straight to a surface
+    std::vector<PIXEL_RGBA> expanded_buffer;
     // everything is read, loop over
     auto grid_index=*source_square->parent_square()->grid_index();
     for (const auto& subgrid_index : ImageSubGridBasicIterator(source_square->parent_square()->grid_setup(),
                                                            grid_index)) {
       auto source_data=source_square->rgba_data(subgrid_index);
+      auto source_indices=source_square->index_data(subgrid_index);
+      auto source_palette=source_square->palette(subgrid_index);
       auto source_size=BufferPixelSize(source_square->rgba_wpixel(subgrid_index),
                                        source_square->rgba_hpixel(subgrid_index));
       auto source_data_origin_x=source_square->rgba_xpixel_origin(subgrid_index);
       auto source_data_origin_y=source_square->rgba_ypixel_origin(subgrid_index);
-      if (source_data) {
+      if (source_data || source_indices) {
         auto source_zoom_out_shift=source_square->zoom_out_shift();
         auto zoom_left_shift=zoom_out_shift-source_zoom_out_shift;
         auto source_texture_size=shift_left_signed(dest_tile_size,zoom_left_shift);
@@ -342,10 +353,43 @@ bool TextureUpdate::load_texture (TextureGridSquareZoomLevel* const dest_square,
             auto dest_array=dest_square->get_rgba_pixels(tile_index);
             auto dest_size=dest_square->display_texture_wrapper(tile_index)->texture_size_aligned();
             auto dest_size_visible=dest_square->display_texture_wrapper(tile_index)->texture_size_visible();
-            if (zoom_left_shift >= 0) {
-              buffer_copy_reduce_standard(source_data,
-                                          source_size,
-                                          source_start,
+            // indexed sources are expanded straight into the surface
+            // at the same zoom, otherwise just the part being copied is
+            // expanded before being reduced or expanded
+            const PIXEL_RGBA* copy_source=source_data;
+            auto copy_source_size=source_size;
+            auto copy_source_start=source_start;
+            if (source_indices && zoom_left_shift != 0) {
+              // clipped to the source so nothing past its edge is read
+              copy_source_size=BufferPixelSize(std::min(source_copy_size.w(),source_size.w()-source_start.x()),
+                                               std::min(source_copy_size.h(),source_size.h()-source_start.y()));
+              expanded_buffer.resize(copy_source_size.w()*copy_source_size.h());
+              buffer_copy_palette(source_indices,
+                                  source_palette,
+                                  source_size,
+                                  source_start,
+                                  copy_source_size,
+                                  expanded_buffer.data(),
+                                  copy_source_size,
+                                  copy_source_size,
+                                  BufferPixelCoordinate(0,0));
+              copy_source=expanded_buffer.data();
+              copy_source_start=BufferPixelCoordinate(0,0);
+            }
+            if (source_indices && zoom_left_shift == 0) {
+              buffer_copy_palette(source_indices,
+                                  source_palette,
+                                  source_size,
+                                  source_start,
+                                  source_copy_size,
+                                  dest_array,
+                                  dest_size,
+                                  dest_size_visible,
+                                  dest_start);
+            } else if (zoom_left_shift >= 0) {
+              buffer_copy_reduce_standard(copy_source,
+                                          copy_source_size,
+                                          copy_source_start,
                                           source_copy_size,
                                           dest_array,
                                           dest_size,
@@ -354,9 +398,9 @@ bool TextureUpdate::load_texture (TextureGridSquareZoomLevel* const dest_square,
                                           zoom_left_shift,
                                           row_buffer);
             } else {
-              buffer_copy_expand_generic(source_data,
-                                         source_size,
-                                         source_start,
+              buffer_copy_expand_generic(copy_source,
+                                         copy_source_size,
+                                         copy_source_start,
                                          source_copy_size,
                                          dest_array,
                                          dest_size,
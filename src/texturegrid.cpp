@@ -61,10 +61,12 @@ void TextureGridSquareZoomLevel::unload_all_textures () {
   this->is_loaded=false;
   this->is_displayable=false;
   this->last_load_index=INT_MAX;
+  this->last_load_generation=INT_MIN;
 }
 
-void TextureGridSquareZoomLevel::set_image_loaded (INT64 load_index) {
+void TextureGridSquareZoomLevel::set_image_loaded (INT64 load_index, INT64 load_generation) {
   this->last_load_index=load_index;
+  this->last_load_generation=load_generation;
   this->is_loaded=true;
   this->is_displayable=true;
 }
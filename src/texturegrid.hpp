@@ -45,8 +45,10 @@ public:
    *
    * @param load_index The last loaded index representing the zoom
    *                   level of what was loaded.
+   * @param load_generation The load generation of the image that
+   *                        was loaded.
    */
-  void set_image_loaded (INT64 load_index);
+  void set_image_loaded (INT64 load_index, INT64 load_generation);
   /**
    * Set this texture as a filler.
    */
@@ -66,6 +68,9 @@ public:
   // TODO: this one needs help being private and investigation whether
   // there's a better way
   INT64 last_load_index{INT_MAX};
+  // the load generation of the image last loaded, changes when only a
+  // region of an image was loaded and the region moves
+  INT64 last_load_generation{INT_MIN};
   // TODO: this will have to be made private
   ImageGridSquareZoomLevel* _source_square;
   /**
@@ -4,8 +4,14 @@
 #include "common.hpp"
 #include "utility.hpp"
 // C++ headers
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
 #include <thread>
+#include <vector>
 // C headers
 #include <cmath>
 
@@ -63,3 +69,120 @@ FLOAT64 ceil_minus_one (FLOAT64 num) {
     return num;
   }
 }
+
+// the limit set by the innermost WorkerThreadLimit on this thread, 0
+// if there is none
+thread_local INT64 worker_thread_limit=0;
+
+INT64 hardware_thread_count () {
+  // hardware_concurrency can return zero if it does not know
+  INT64 hardware_threads=std::thread::hardware_concurrency();
+  if (hardware_threads < 1) {
+    hardware_threads=1;
+  }
+  return hardware_threads;
+}
+
+INT64 worker_thread_count (INT64 max_threads, INT64 count) {
+  if (worker_thread_limit > 0) {
+    max_threads=std::min(max_threads,worker_thread_limit);
+  }
+  return std::max((INT64)1,std::min({hardware_thread_count(),max_threads,count}));
+}
+
+WorkerThreadLimit::WorkerThreadLimit(INT64 max_threads) {
+  this->_previous_max_threads=worker_thread_limit;
+  worker_thread_limit=std::max((INT64)1,max_threads);
+}
+
+WorkerThreadLimit::~WorkerThreadLimit() {
+  worker_thread_limit=this->_previous_max_threads;
+}
+
+void parallel_for (INT64 count,
+                   INT64 max_threads,
+                   const std::function<void(INT64,INT64)>& body) {
+  WorkerPool pool(worker_thread_count(max_threads,count));
+  pool.run(count,body);
+}
+
+WorkerPool::WorkerPool(INT64 number_threads) {
+  if (number_threads <= 1) {
+    return;
+  }
+  for (INT64 worker=0; worker < number_threads; worker++) {
+    this->_workers.emplace_back(&WorkerPool::_worker,this,worker);
+  }
+}
+
+WorkerPool::~WorkerPool() {
+  this->wait();
+  {
+    std::lock_guard<std::mutex> guard(this->_mutex);
+    this->_stopping=true;
+  }
+  this->_work_ready.notify_all();
+  for (auto& worker_thread : this->_workers) {
+    worker_thread.join();
+  }
+}
+
+INT64 WorkerPool::count() const {
+  return std::max((INT64)this->_workers.size(),(INT64)1);
+}
+
+void WorkerPool::start(INT64 count,
+                       std::function<void(INT64,INT64)> body) {
+  this->wait();
+  if (this->_workers.empty()) {
+    for (INT64 i=0; i < count; i++) {
+      body(0,i);
+    }
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> guard(this->_mutex);
+    this->_count=count;
+    this->_body=std::move(body);
+    this->_next_index=0;
+    this->_busy=this->_workers.size();
+    this->_round++;
+  }
+  this->_work_ready.notify_all();
+}
+
+void WorkerPool::wait() {
+  std::unique_lock<std::mutex> lock(this->_mutex);
+  this->_work_done.wait(lock,[this]() { return this->_busy == 0; });
+}
+
+void WorkerPool::run(INT64 count,
+                     std::function<void(INT64,INT64)> body) {
+  this->start(count,std::move(body));
+  this->wait();
+}
+
+void WorkerPool::_worker(INT64 worker) {
+  INT64 round=0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_work_ready.wait(lock,[&]() { return this->_stopping || this->_round != round; });
+      if (this->_stopping) {
+        return;
+      }
+      round=this->_round;
+    }
+    // workers take the next index as they finish so slow items
+    // don't hold up the others
+    INT64 i;
+    while ((i=this->_next_index.fetch_add(1)) < this->_count) {
+      this->_body(worker,i);
+    }
+    {
+      std::lock_guard<std::mutex> guard(this->_mutex);
+      this->_busy--;
+    }
+    this->_work_done.notify_all();
+  }
+}
@@ -6,7 +6,13 @@
 
 #include "common.hpp"
 // CPP headers
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 
 /**
  * Pad a number and then reduce by a factor.
@@ -63,4 +69,121 @@ INT64 shift_left_signed (INT64 num, INT64 shift);
  */
 FLOAT64 ceil_minus_one (FLOAT64 num);
 
+/**
+ * @return The number of threads the hardware can run at once, at
+ *         least one.
+ */
+INT64 hardware_thread_count ();
+
+/**
+ * Find how many worker threads to use.
+ *
+ * @param max_threads The most threads wanted.
+ * @param count The number of work items, no point in using more
+ *              threads than this.
+ * @return The number of threads, at least one and no more than any
+ *         WorkerThreadLimit on the current thread.
+ */
+INT64 worker_thread_count (INT64 max_threads, INT64 count);
+
+/**
+ * Limits the threads of every worker pool started from the current
+ * thread while it exists.  Pools started by each worker of another
+ * pool then share the hardware threads instead of each using all of
+ * them.
+ */
+class WorkerThreadLimit {
+public:
+  WorkerThreadLimit()=delete;
+  /**
+   * @param max_threads The most threads each pool may use.
+   */
+  explicit WorkerThreadLimit(INT64 max_threads);
+  ~WorkerThreadLimit();
+  WorkerThreadLimit(const WorkerThreadLimit&)=delete;
+  WorkerThreadLimit(const WorkerThreadLimit&&)=delete;
+  WorkerThreadLimit& operator=(const WorkerThreadLimit&)=delete;
+  WorkerThreadLimit& operator=(const WorkerThreadLimit&&)=delete;
+private:
+  INT64 _previous_max_threads;
+};
+
+/**
+ * Run a function over the indices 0 to count-1 spread across a
+ * bounded number of threads.  Each index is run exactly once, but in
+ * no particular order, so results should be written to a slot for
+ * each index.
+ *
+ * @param count The number of indices.
+ * @param max_threads The most threads to use.
+ * @param body The function to run, called with the worker number
+ *             (0 to the number of threads-1) and the index.
+ */
+void parallel_for (INT64 count,
+                   INT64 max_threads,
+                   const std::function<void(INT64,INT64)>& body);
+
+/**
+ * A set of threads kept for running several rounds of work, like
+ * parallel_for() without starting new threads for each round.  A
+ * round runs in the background after start() so the calling thread
+ * can use the results of the round before while it runs.  Only one
+ * thread should use a pool at a time.
+ */
+class WorkerPool {
+public:
+  WorkerPool()=delete;
+  /**
+   * @param number_threads The threads to run work on, with one or
+   *                       less the work is run by start() itself.
+   */
+  explicit WorkerPool(INT64 number_threads);
+  ~WorkerPool();
+  WorkerPool(const WorkerPool&)=delete;
+  WorkerPool(const WorkerPool&&)=delete;
+  WorkerPool& operator=(const WorkerPool&)=delete;
+  WorkerPool& operator=(const WorkerPool&&)=delete;
+  /** @return The number of workers, at least one. */
+  INT64 count() const;
+  /**
+   * Start running a function over the indices 0 to count-1, after
+   * waiting for any round still running.  Each index is run exactly
+   * once, but in no particular order.
+   *
+   * @param count The number of indices.
+   * @param body The function to run, called with the worker number
+   *             (0 to count()-1) and the index.
+   */
+  void start(INT64 count,
+             std::function<void(INT64,INT64)> body);
+  /**
+   * Wait until the round from start() has finished.
+   */
+  void wait();
+  /**
+   * Run a round and wait for it to finish.
+   *
+   * @param count The number of indices.
+   * @param body The function to run, called with the worker number
+   *             and the index.
+   */
+  void run(INT64 count,
+           std::function<void(INT64,INT64)> body);
+private:
+  /** Loop run by each thread. */
+  void _worker(INT64 worker);
+  std::vector<std::thread> _workers;
+  std::mutex _mutex;
+  std::condition_variable _work_ready;
+  std::condition_variable _work_done;
+  /** Changed for each round so workers know to start. */
+  INT64 _round{0};
+  /** The number of workers still on the current round. */
+  INT64 _busy{0};
+  bool _stopping{false};
+  INT64 _count{0};
+  std::function<void(INT64,INT64)> _body;
+  std::atomic<INT64> _next_index{0};
+};
+
 #endif
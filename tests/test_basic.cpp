@@ -4,11 +4,31 @@
 #include "../src/utility.hpp"
 #include "../src/datatypes/coordinates.hpp"
 #include "../src/datatypes/containers.hpp"
+#include "../src/c_io_net/async_read.hpp"
+#include "../src/c_io_net/cache_manifest.hpp"
+#include "../src/c_io_net/decoder_registry.hpp"
 #include "../src/c_io_net/fileload.hpp"
+#include "../src/c_io_net/mapped_file.hpp"
+#include "../src/c_io_net/pyramid_cache.hpp"
+#include "../src/c_io_net/zip_index.hpp"
+#include "../src/c_io_net/zip_reader.hpp"
 #include "../src/imagegrid/imagegrid_load_file_data.hpp"
+#include "../src/c_misc/buffer_band_reduce.hpp"
 #include "../src/c_misc/buffer_manip.hpp"
 // C++ headers
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
 #include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+// C headers
+#include <cstdio>
+#include <jpeglib.h>
 
 // entered manually as a basic test for the whole thing
 const unsigned char TEST_IMAGE[80]={
@@ -150,6 +170,35 @@ TEST_CASE("Do the utility functions work?") {
   CHECK(ceil_minus_one(1.0) == 1.0);
   CHECK(ceil_minus_one(-1.0) == -1.0);
   CHECK(ceil_minus_one(-1.5) == -2.0);
+  // every index should be visited exactly once
+  std::vector<INT64> parallel_visits(100,0);
+  parallel_for(100,4,[&](INT64, INT64 i) { parallel_visits[i]+=i; });
+  for (INT64 i=0; i < 100; i++) {
+    CHECK(parallel_visits[i] == i);
+  }
+  // a pool runs each round over its indices exactly once, and a
+  // round can run while the caller works
+  WorkerPool pool(4);
+  CHECK(pool.count() == 4);
+  std::vector<INT64> pool_visits(100,0);
+  for (INT64 round=0; round < 10; round++) {
+    pool.start(100,[&](INT64, INT64 i) { pool_visits[i]++; });
+  }
+  pool.wait();
+  for (INT64 i=0; i < 100; i++) {
+    CHECK(pool_visits[i] == 10);
+  }
+  WorkerPool serial_pool(1);
+  CHECK(serial_pool.count() == 1);
+  serial_pool.run(100,[&](INT64 worker, INT64 i) { pool_visits[i]+=worker; });
+  CHECK(pool_visits[99] == 10);
+  // pools started inside a limited thread share its limit
+  auto unlimited_count=worker_thread_count(8,100);
+  {
+    WorkerThreadLimit thread_limit(1);
+    CHECK(worker_thread_count(8,100) == 1);
+  }
+  CHECK(worker_thread_count(8,100) == unlimited_count);
 }
 
 TEST_CASE("Does basic functionality of coordinates and containers work?") {
@@ -264,6 +313,70 @@ TEST_CASE("Does basic functionality of coordinates and containers work?") {
   CHECK(static_grid_two_layer(static_grid_index_2,static_grid_layer_2_index_2) == 85);
 }
 
+TEST_CASE("Do CMYK JPEG images load correctly?") {
+  const INT64 test_image_wpixel=8;
+  const INT64 test_image_hpixel=8;
+  // write a solid red CMYK jpeg, libjpeg marks it as Adobe so the
+  // samples are stored inverted
+  auto filename=(std::filesystem::temp_directory_path() / "imagegrid_test_cmyk.jpg").string();
+  FILE* jpeg_fp=fopen(filename.c_str(),"wb");
+  CHECK(jpeg_fp);
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr error_mgr;
+  cinfo.err=jpeg_std_error(&error_mgr);
+  jpeg_create_compress(&cinfo);
+  jpeg_stdio_dest(&cinfo,jpeg_fp);
+  cinfo.image_width=test_image_wpixel;
+  cinfo.image_height=test_image_hpixel;
+  cinfo.input_components=4;
+  cinfo.in_color_space=JCS_CMYK;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo,100,TRUE);
+  jpeg_start_compress(&cinfo,TRUE);
+  std::vector<JSAMPLE> cmyk_row;
+  for (INT64 i=0; i < test_image_wpixel; i++) {
+    cmyk_row.insert(cmyk_row.end(),{255,0,0,255});
+  }
+  while (cinfo.next_scanline < cinfo.image_height) {
+    JSAMPROW row_pointer=cmyk_row.data();
+    jpeg_write_scanlines(&cinfo,&row_pointer,1);
+  }
+  jpeg_finish_compress(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  fclose(jpeg_fp);
+  INT64 row_temp_buffer[128];
+  auto subgrid_index=SubGridIndex(0,0);
+  auto subgrid_size=SubGridImageSize(1,1);
+  LoadFileDataTransfer load_file_data_transfer;
+  load_file_data_transfer.sub_size=SubGridImageSize(subgrid_size);
+  load_file_data_transfer.original_rgba_wpixel.init(subgrid_size);
+  load_file_data_transfer.original_rgba_wpixel.set(subgrid_index,test_image_wpixel);
+  load_file_data_transfer.original_rgba_hpixel.init(subgrid_size);
+  load_file_data_transfer.original_rgba_hpixel.set(subgrid_index,test_image_hpixel);
+  auto load_file_zoom_level_data=std::make_shared<LoadFileZoomLevelData>();
+  load_file_zoom_level_data->filename=filename;
+  load_file_zoom_level_data->rgba_wpixel.init(subgrid_size);
+  load_file_zoom_level_data->rgba_hpixel.init(subgrid_size);
+  load_file_zoom_level_data->max_sub_wpixel=test_image_wpixel;
+  load_file_zoom_level_data->max_sub_hpixel=test_image_hpixel;
+  load_file_zoom_level_data->rgba_data.init(subgrid_size);
+  load_file_zoom_level_data->zoom_out_shift=0;
+  load_file_data_transfer.data_transfer.emplace_back(load_file_zoom_level_data);
+  CHECK(load_jpeg_as_rgba(filename,subgrid_index,load_file_data_transfer,row_temp_buffer));
+  auto pixel=load_file_data_transfer.data_transfer[0]->rgba_data[subgrid_index][0];
+  CHECK((pixel & 0x000000FF) >= 250);
+  CHECK(((pixel & 0x0000FF00) >> 8) <= 5);
+  CHECK(((pixel & 0x00FF0000) >> 16) <= 5);
+  CHECK(((pixel & 0xFF000000) >> 24) == 255);
+  std::filesystem::remove(filename);
+  // without the Adobe marker the samples are the ink
+  const unsigned char cmyk[8]={0,255,255,0,0,0,0,255};
+  PIXEL_RGBA dest_row[2];
+  buffer_copy_row_cmyk(cmyk,dest_row,2,false);
+  CHECK(dest_row[0] == 0xFF0000FF);
+  CHECK(dest_row[1] == 0xFF000000);
+}
+
 // it would be nice to combine repeated code in PNG and TIFF tests,
 // but I don't want to deal with macro within macro errors or false
 // positives from an incorrectly coded function right now
@@ -424,6 +537,109 @@ TEST_CASE("Does our function for loading images to test work?") {
   // MSG_LOCAL("==============================");
 }
 
+// write an RGB tiff with a pattern that is different in every
+// pixel, in strips or tiles of the given size
+void write_tiff_test_pattern(const std::string& filename,
+                             INT64 width,
+                             INT64 height,
+                             INT64 rows_per_strip,
+                             INT64 tile_size) {
+  auto tif=TIFFOpen(filename.c_str(),"w");
+  CHECK(tif);
+  TIFFSetField(tif, TIFFTAG_IMAGEWIDTH, (uint32_t)width);
+  TIFFSetField(tif, TIFFTAG_IMAGELENGTH, (uint32_t)height);
+  TIFFSetField(tif, TIFFTAG_BITSPERSAMPLE, 8);
+  TIFFSetField(tif, TIFFTAG_SAMPLESPERPIXEL, 3);
+  TIFFSetField(tif, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB);
+  TIFFSetField(tif, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+  TIFFSetField(tif, TIFFTAG_COMPRESSION, COMPRESSION_LZW);
+  auto pattern=[](INT64 i, INT64 j, INT64 sample) {
+    return (unsigned char)(i*7+j*13+sample*101);
+  };
+  if (tile_size > 0) {
+    TIFFSetField(tif, TIFFTAG_TILEWIDTH, (uint32_t)tile_size);
+    TIFFSetField(tif, TIFFTAG_TILELENGTH, (uint32_t)tile_size);
+    std::vector<unsigned char> tile(tile_size*tile_size*3);
+    for (INT64 tile_y=0; tile_y < height; tile_y+=tile_size) {
+      for (INT64 tile_x=0; tile_x < width; tile_x+=tile_size) {
+        for (INT64 j=0; j < tile_size; j++) {
+          for (INT64 i=0; i < tile_size; i++) {
+            for (INT64 sample=0; sample < 3; sample++) {
+              tile[(j*tile_size+i)*3+sample]=pattern(tile_x+i,tile_y+j,sample);
+            }
+          }
+        }
+        CHECK(TIFFWriteTile(tif,tile.data(),tile_x,tile_y,0,0) > 0);
+      }
+    }
+  } else {
+    TIFFSetField(tif, TIFFTAG_ROWSPERSTRIP, (uint32_t)rows_per_strip);
+    std::vector<unsigned char> row(width*3);
+    for (INT64 j=0; j < height; j++) {
+      for (INT64 i=0; i < width; i++) {
+        for (INT64 sample=0; sample < 3; sample++) {
+          row[i*3+sample]=pattern(i,j,sample);
+        }
+      }
+      CHECK(TIFFWriteScanline(tif,row.data(),j,0) == 1);
+    }
+  }
+  TIFFClose(tif);
+}
+
+// decode a tiff through the streaming strip or tile path
+std::vector<PIXEL_RGBA> load_tiff_test_pattern(const std::string& filename,
+                                               INT64 width,
+                                               INT64 height,
+                                               INT64 batch_max_bytes) {
+  std::vector<PIXEL_RGBA> pixels(width*height,0);
+  std::vector<INT64> row_temp_buffer(width*3);
+  auto tif=TIFFOpen(filename.c_str(),"r");
+  CHECK(tif);
+  if (tif) {
+    BufferBandReduce band_reduce(BufferPixelSize(width,height),
+                                 pixels.data(),
+                                 BufferPixelSize(width,height),
+                                 0,
+                                 row_temp_buffer.data());
+    bool success;
+    if (TIFFIsTiled(tif)) {
+      success=load_tiff_tiles(tif,filename,batch_max_bytes,band_reduce);
+    } else {
+      success=load_tiff_strips(tif,filename,batch_max_bytes,band_reduce);
+    }
+    CHECK(success);
+    band_reduce.finish();
+    TIFFClose(tif);
+  }
+  return pixels;
+}
+
+TEST_CASE("Does decoding tiff strips and tiles in parallel match decoding them serially?") {
+  // sizes that leave partial strips, tiles and batches at the edges
+  const INT64 test_image_wpixel=77;
+  const INT64 test_image_hpixel=61;
+  auto strip_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_strips.tif").string();
+  auto tile_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_tiles.tif").string();
+  write_tiff_test_pattern(strip_filename,test_image_wpixel,test_image_hpixel,3,0);
+  write_tiff_test_pattern(tile_filename,test_image_wpixel,test_image_hpixel,0,16);
+  for (const auto& filename : {strip_filename,tile_filename}) {
+    std::vector<PIXEL_RGBA> serial_pixels;
+    {
+      WorkerThreadLimit thread_limit(1);
+      serial_pixels=load_tiff_test_pattern(filename,test_image_wpixel,test_image_hpixel,TIFF_DECODE_BATCH_MAX_BYTES);
+    }
+    // small batches so several are decoded while others are passed on
+    auto parallel_pixels=load_tiff_test_pattern(filename,test_image_wpixel,test_image_hpixel,test_image_wpixel*16*4*2*2);
+    CHECK(parallel_pixels == serial_pixels);
+    CHECK(((serial_pixels[0] & 0xFF000000) >> 24) == 255);
+    auto last_pixel=serial_pixels.back();
+    CHECK((last_pixel & 0x000000FF) == (unsigned char)((test_image_wpixel-1)*7+(test_image_hpixel-1)*13));
+    CHECK(((last_pixel & 0x0000FF00) >> 8) == (unsigned char)((test_image_wpixel-1)*7+(test_image_hpixel-1)*13+101));
+    std::filesystem::remove(filename);
+  }
+}
+
 TEST_CASE("Does buffer copy work correctly?") {
   auto subgrid_index=SubGridIndex(0,0);
   auto load_data=load_rgb_buffer_from_tiff("./tests/test_small.tif");
@@ -454,3 +670,567 @@ TEST_CASE("Does buffer copy work correctly?") {
     }
   }
 }
+
+TEST_CASE("Does expanding palette indices work?") {
+  // 8-bit colormaps are used as they are, 16-bit ones use the top byte
+  uint16_t red[3]={0,255,16};
+  uint16_t green[3]={1,2,3};
+  uint16_t blue[3]={4,5,6};
+  PIXEL_RGBA palette[BUFFER_PALETTE_SIZE];
+  buffer_palette_from_colormap(red,green,blue,3,palette);
+  CHECK(palette[1] == 0xFF0502FF);
+  CHECK(palette[3] == 0xFF000000);
+  uint16_t red_wide[1]={0xAB00};
+  uint16_t green_wide[1]={0xCD00};
+  uint16_t blue_wide[1]={0xEF00};
+  PIXEL_RGBA palette_wide[BUFFER_PALETTE_SIZE];
+  buffer_palette_from_colormap(red_wide,green_wide,blue_wide,1,palette_wide);
+  CHECK(palette_wide[0] == 0xFFEFCDAB);
+  // long enough to cover any vectorized part and the remainder
+  const INT64 width=19;
+  const INT64 height=3;
+  unsigned char indices[width*height];
+  for (INT64 i=0; i < width*height; i++) {
+    indices[i]=(unsigned char)(i*7);
+    palette[i*7 % BUFFER_PALETTE_SIZE]=0xFF000000 | (PIXEL_RGBA)(i*7 % BUFFER_PALETTE_SIZE);
+  }
+  PIXEL_RGBA row[width];
+  buffer_expand_palette_row(indices,palette,row,width);
+  for (INT64 i=0; i < width; i++) {
+    CHECK(row[i] == palette[indices[i]]);
+  }
+  // copying part of the indices to a surface clips to what is visible
+  PIXEL_RGBA dest[4*4];
+  std::fill(dest,dest+4*4,0);
+  buffer_copy_palette(indices,
+                      palette,
+                      BufferPixelSize(width,height),
+                      BufferPixelCoordinate(17,1),
+                      BufferPixelSize(4,4),
+                      dest,
+                      BufferPixelSize(4,4),
+                      BufferPixelSize(3,4),
+                      BufferPixelCoordinate(1,0));
+  CHECK(dest[1] == palette[indices[width+17]]);
+  CHECK(dest[2] == palette[indices[width+18]]);
+  CHECK(dest[4+1] == palette[indices[2*width+17]]);
+  CHECK(dest[3] == 0);
+  CHECK(dest[2*4+1] == 0);
+}
+
+TEST_CASE("Does reducing and expanding grayscale work?") {
+  // wide enough to cover any vectorized part and the remainder
+  const INT64 width=37;
+  const INT64 height=5;
+  unsigned char gray[width*height];
+  for (INT64 i=0; i < width*height; i++) {
+    gray[i]=(unsigned char)(i*13);
+  }
+  PIXEL_RGBA row[width];
+  buffer_expand_gray_row(gray,row,width);
+  for (INT64 i=0; i < width; i++) {
+    CHECK(row[i] == (0xFF000000 | (PIXEL_RGBA)gray[i]*0x010101));
+  }
+  // blocks are averaged over their full size like the RGBA reductions
+  for (INT64 zoom_out_shift=1; zoom_out_shift <= 2; zoom_out_shift++) {
+    auto zoom_out=1L << zoom_out_shift;
+    auto dest_w=(width+zoom_out-1)/zoom_out;
+    auto dest_h=(height+zoom_out-1)/zoom_out;
+    std::vector<unsigned char> reduced(dest_w*dest_h);
+    std::vector<INT64> row_buffer(dest_w);
+    buffer_reduce_gray(gray,
+                       BufferPixelSize(width,height),
+                       reduced.data(),
+                       BufferPixelSize(dest_w,dest_h),
+                       zoom_out_shift,
+                       row_buffer.data());
+    for (INT64 dj=0; dj < dest_h; dj++) {
+      for (INT64 di=0; di < dest_w; di++) {
+        INT64 sum=0;
+        for (auto sj=dj*zoom_out; sj < std::min((dj+1)*zoom_out,height); sj++) {
+          for (auto si=di*zoom_out; si < std::min((di+1)*zoom_out,width); si++) {
+            sum+=gray[sj*width+si];
+          }
+        }
+        CHECK(reduced[dj*dest_w+di] == sum >> (2*zoom_out_shift));
+      }
+    }
+  }
+}
+
+TEST_CASE("Does stretching high bit depth samples work?") {
+  std::vector<FLOAT32> samples;
+  for (INT64 i=0; i < 10000; i++) {
+    samples.push_back((FLOAT32)i);
+  }
+  samples.push_back(NAN);
+  FLOAT64 black_level,white_level;
+  CHECK(buffer_stretch_levels(samples.data(),samples.size(),0.01,0.99,black_level,white_level));
+  CHECK(black_level == doctest::Approx(100.0).epsilon(0.05));
+  CHECK(white_level == doctest::Approx(9900.0).epsilon(0.05));
+  BufferStretch stretch(BufferStretchType::linear,0.0,1000.0);
+  FLOAT32 row[]={-5.0f,0.0f,500.0f,1000.0f,2000.0f,NAN};
+  PIXEL_RGBA dest_row[6];
+  buffer_stretch_row(row,1,dest_row,6,stretch);
+  CHECK(dest_row[0] == 0xFF000000);
+  CHECK(dest_row[1] == 0xFF000000);
+  CHECK((dest_row[2] & 0xFF) >= 127);
+  CHECK((dest_row[2] & 0xFF) <= 128);
+  CHECK(dest_row[3] == 0xFFFFFFFF);
+  CHECK(dest_row[4] == 0xFFFFFFFF);
+  CHECK(dest_row[5] == 0xFF000000);
+  BufferStretch stretch_asinh(BufferStretchType::asinh,0.0,1000.0);
+  buffer_stretch_row(row,1,dest_row,6,stretch_asinh);
+  // nonlinear stretches brighten the middle
+  CHECK((dest_row[2] & 0xFF) > 128);
+  // 16-bit color uses the whole range unless stretching is asked for
+  BufferStretch stretch_full(BufferStretchType::linear,0.0,(FLOAT64)UINT16_MAX);
+  FLOAT32 row_full[]={0.0f,32768.0f,65535.0f};
+  buffer_stretch_row(row_full,1,dest_row,3,stretch_full);
+  CHECK(dest_row[0] == 0xFF000000);
+  CHECK((dest_row[1] & 0xFF) >= 127);
+  CHECK((dest_row[1] & 0xFF) <= 128);
+  CHECK(dest_row[2] == 0xFFFFFFFF);
+}
+
+TEST_CASE("Do raw image headers parse correctly?") {
+  RawImageLayout layout;
+  // farbfeld 2x1
+  const unsigned char farbfeld[32]={'f','a','r','b','f','e','l','d',
+                                    0,0,0,2,0,0,0,1,
+                                    0xFF,0x00,0x80,0x00,0x10,0x00,0xFF,0xFF,
+                                    0x00,0x00,0x00,0x00,0x00,0x00,0xFF,0xFF};
+  CHECK(parse_raw_image_header(farbfeld,32,layout));
+  CHECK(layout.width == 2);
+  CHECK(layout.height == 1);
+  CHECK(layout.samples_per_pixel == 4);
+  CHECK(layout.bytes_per_sample == 2);
+  CHECK(layout.data_offset == 16);
+  // truncated pixels are rejected
+  CHECK(!parse_raw_image_header(farbfeld,31,layout));
+  PIXEL_RGBA dest_row[2];
+  buffer_copy_row_samples(farbfeld+16,4,2,dest_row,2);
+  CHECK(dest_row[0] == 0xFF1080FF);
+  CHECK(dest_row[1] == 0xFF000000);
+  // PPM with a comment
+  std::string ppm("P6\n# comment\n1 2\n255\nabcdef");
+  CHECK(parse_raw_image_header((const unsigned char*)ppm.data(),ppm.size(),layout));
+  CHECK(layout.width == 1);
+  CHECK(layout.height == 2);
+  CHECK(layout.samples_per_pixel == 3);
+  CHECK(layout.bytes_per_sample == 1);
+  CHECK(layout.data_offset == 21);
+  // unsupported maximum value
+  std::string ppm_maxval("P6 1 1 100\nabc");
+  CHECK(!parse_raw_image_header((const unsigned char*)ppm_maxval.data(),ppm_maxval.size(),layout));
+  // PAM RGBA
+  std::string pam("P7\nWIDTH 1\nHEIGHT 1\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\nabcd");
+  CHECK(parse_raw_image_header((const unsigned char*)pam.data(),pam.size(),layout));
+  CHECK(layout.width == 1);
+  CHECK(layout.height == 1);
+  CHECK(layout.samples_per_pixel == 4);
+  CHECK(layout.bytes_per_sample == 1);
+  CHECK(layout.data_offset == (INT64)pam.size()-4);
+  // only opaque RGBA is used in place, anything else is made opaque
+  alignas(PIXEL_RGBA) unsigned char rgba_pixels[8]={1,2,3,0xFF,4,5,6,0xFF};
+  RawImageLayout rgba_layout{2,1,4,1,0};
+  // the bytes only match PIXEL_RGBA on little endian machines
+  const PIXEL_RGBA red=0xFF;
+  CHECK(check_raw_zero_copy(rgba_layout,rgba_pixels) == (*(const unsigned char*)&red == 0xFF));
+  rgba_pixels[7]=0x80;
+  CHECK(!check_raw_zero_copy(rgba_layout,rgba_pixels));
+}
+
+TEST_CASE("Does reading files in the background work?") {
+  // meant to be run from project root
+  std::string filename="./tests/test_small.png";
+  INT64 finished_count=0;
+  INT64 read_size=-1;
+  bool missing_success=true;
+  AsyncReadEngine read_engine(2);
+  read_engine.queue(filename,[&](AsyncReadResult& result) {
+    CHECK(result.success);
+    read_size=result.data.size();
+    finished_count++;
+  });
+  read_engine.queue("./tests/does_not_exist.png",[&](AsyncReadResult& result) {
+    missing_success=result.success;
+    finished_count++;
+  });
+  read_engine.wait_all();
+  CHECK(finished_count == 2);
+  CHECK(read_size == (INT64)std::filesystem::file_size(filename));
+  CHECK(!missing_success);
+}
+
+TEST_CASE("Does reading zip members from memory work?") {
+  // meant to be run from project root
+  MappedFile zip_file;
+  MappedFile tiff_file;
+  CHECK(zip_file.open("./tests/test_small.zip"));
+  CHECK(tiff_file.open("./tests/test_small.tif"));
+  std::vector<unsigned char> expected(tiff_file.data(),tiff_file.data()+tiff_file.size());
+  std::vector<ZipMember> members;
+  CHECK(zip_read_central_directory(zip_file.data(),zip_file.size(),members));
+  CHECK(members.size() == 2);
+  if (members.size() == 2) {
+    CHECK(members[0].name == "deflated.tif");
+    CHECK(members[0].compression_method == ZIP_METHOD_DEFLATED);
+    CHECK(members[1].name == "stored.tif");
+    CHECK(members[1].compression_method == ZIP_METHOD_STORED);
+  }
+  for (auto& member : members) {
+    const unsigned char* member_data=nullptr;
+    std::vector<unsigned char> output;
+    CHECK(zip_find_member_data(zip_file.data(),zip_file.size(),member,member_data));
+    CHECK(zip_inflate_member(member_data,member,output));
+    CHECK(output == expected);
+    // sizes more than the compressed data can hold are rejected
+    // before anything is allocated
+    auto corrupt_member=member;
+    corrupt_member.uncompressed_size=member.compressed_size*ZIP_DEFLATE_MAX_RATIO+1;
+    CHECK(!zip_check_member_size(corrupt_member));
+    CHECK(!zip_inflate_member(member_data,corrupt_member,output));
+    corrupt_member.uncompressed_size=INT64_MAX;
+    CHECK(!zip_inflate_member(member_data,corrupt_member,output));
+  }
+  // a truncated file has no end record to find
+  CHECK(!zip_read_central_directory(zip_file.data(),zip_file.size()-10,members));
+}
+
+TEST_CASE("Does the zip index save and load?") {
+  auto index_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_zip_index.bin").string();
+  ZipIndexEntry entry;
+  entry.file_size=6384;
+  entry.file_mtime=1234567890;
+  entry.data_offset=42;
+  entry.member=ZipMember{"sheet.tif",ZIP_METHOD_DEFLATED,1000,4696,0,0xdeadbeef};
+  ZipIndex saved_index;
+  saved_index.update("sheet.zip",entry);
+  CHECK(saved_index.dirty());
+  CHECK(saved_index.save(index_filename));
+  CHECK(!saved_index.dirty());
+  ZipIndex loaded_index;
+  CHECK(loaded_index.load(index_filename));
+  ZipIndexEntry found;
+  CHECK(!loaded_index.find("other.zip",found));
+  CHECK(loaded_index.find("sheet.zip",found));
+  CHECK(found.file_size == entry.file_size);
+  CHECK(found.file_mtime == entry.file_mtime);
+  CHECK(found.data_offset == entry.data_offset);
+  CHECK(found.member.name == "sheet.tif");
+  CHECK(found.member.compressed_size == 1000);
+  CHECK(found.member.uncompressed_size == 4696);
+  CHECK(found.member.crc32 == 0xdeadbeef);
+  // a member name pointing past the names table is rejected, not read
+  {
+    std::fstream index_io(index_filename,std::ios::binary | std::ios::in | std::ios::out);
+    UINT64 bad_member_name_offset=1L << 40;
+    index_io.seekp(8+4*sizeof(UINT64));
+    index_io.write((const char*)&bad_member_name_offset,sizeof(bad_member_name_offset));
+  }
+  ZipIndex corrupt_index;
+  CHECK(!corrupt_index.load(index_filename));
+  CHECK(!corrupt_index.find("sheet.zip",found));
+  std::filesystem::remove(index_filename);
+  // a stored member found in the index is read without checking its
+  // CRC again while the zip file is unchanged
+  auto directory=(std::filesystem::temp_directory_path() / "imagegrid_test_zip_index_trusted").string();
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  auto zip_filename=(std::filesystem::path(directory) / "sheet.zip").string();
+  std::filesystem::copy_file("./tests/test_small.zip",zip_filename);
+  MappedFile zip_file;
+  CHECK(zip_file.open(zip_filename));
+  std::vector<ZipMember> members;
+  CHECK(zip_read_central_directory(zip_file.data(),zip_file.size(),members));
+  CHECK(members.size() == 2);
+  if (members.size() == 2) {
+    auto stored_member=members[1];
+    const unsigned char* member_data=nullptr;
+    CHECK(zip_find_member_data(zip_file.data(),zip_file.size(),stored_member,member_data));
+    stored_member.crc32=~stored_member.crc32;
+    CHECK(zip_index_update(zip_filename,stored_member,member_data-zip_file.data()));
+    MappedFile mapped_file;
+    std::vector<unsigned char> tiff_buffer;
+    TiffMemorySource tiff_source;
+    CHECK(find_tiff_in_nts_file(zip_filename,mapped_file,tiff_buffer,tiff_source));
+    CHECK(tiff_source.data == mapped_file.data()+(member_data-zip_file.data()));
+    CHECK(tiff_source.size == (toff_t)stored_member.uncompressed_size);
+  }
+  // written now so it isn't written after the directory is removed
+  CHECK(zip_index_save_all());
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Does merging cache manifest shards work?") {
+  auto directory=(std::filesystem::temp_directory_path() / "imagegrid_test_manifest_shards").string();
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  auto manifest_filename=(std::filesystem::path(directory) / CACHE_MANIFEST_FILENAME).string();
+  // an existing manifest with one image that a shard has rebuilt
+  CacheManifest existing_manifest;
+  existing_manifest.update("a.tif",CacheManifestEntry{10,20,100,1});
+  existing_manifest.update("b.tif",CacheManifestEntry{30,40,200,2});
+  CHECK(existing_manifest.save(manifest_filename));
+  // the shards only write what they updated
+  CacheManifest shard_manifest_0;
+  CHECK(shard_manifest_0.load(manifest_filename));
+  shard_manifest_0.update("a.tif",CacheManifestEntry{11,21,101,3});
+  CHECK(shard_manifest_0.save_updates((std::filesystem::path(directory) / cache_manifest_shard_filename(0,2)).string()));
+  CacheManifest shard_manifest_1;
+  shard_manifest_1.update("c.tif",CacheManifestEntry{50,60,300,4});
+  CHECK(shard_manifest_1.save_updates((std::filesystem::path(directory) / cache_manifest_shard_filename(1,2)).string()));
+  CHECK(cache_manifest_merge_shards(directory));
+  CHECK(!std::filesystem::exists(std::filesystem::path(directory) / cache_manifest_shard_filename(0,2)));
+  CHECK(!std::filesystem::exists(std::filesystem::path(directory) / cache_manifest_shard_filename(1,2)));
+  CacheManifest merged_manifest;
+  CHECK(merged_manifest.load(manifest_filename));
+  CacheManifestEntry found;
+  CHECK(merged_manifest.find("a.tif",found));
+  CHECK(found.width == 11);
+  CHECK(found.file_mtime == 3);
+  CHECK(merged_manifest.find("b.tif",found));
+  CHECK(found.width == 30);
+  CHECK(merged_manifest.find("c.tif",found));
+  CHECK(found.height == 60);
+  // the zip indexes written by shards are merged the same way
+  ZipIndexEntry zip_entry;
+  zip_entry.file_size=6384;
+  zip_entry.file_mtime=5;
+  zip_entry.data_offset=42;
+  zip_entry.member=ZipMember{"c.tif",ZIP_METHOD_DEFLATED,1000,4696,0,0xdeadbeef};
+  ZipIndex shard_index;
+  shard_index.update("c.zip",zip_entry);
+  CHECK(shard_index.save_updates((std::filesystem::path(directory) /
+                                  cache_shard_filename(ZIP_INDEX_FILENAME,1,2)).string()));
+  CHECK(zip_index_merge_shards(directory));
+  CHECK(!std::filesystem::exists(std::filesystem::path(directory) / cache_shard_filename(ZIP_INDEX_FILENAME,1,2)));
+  ZipIndex merged_index;
+  CHECK(merged_index.load((std::filesystem::path(directory) / ZIP_INDEX_FILENAME).string()));
+  ZipIndexEntry zip_found;
+  CHECK(merged_index.find("c.zip",zip_found));
+  CHECK(zip_found.member.name == "c.tif");
+  // a name pointing past the names table is rejected, not read
+  {
+    std::fstream manifest_io(manifest_filename,std::ios::binary | std::ios::in | std::ios::out);
+    UINT64 bad_name_offset=1L << 40;
+    manifest_io.seekp(8+2*sizeof(UINT64));
+    manifest_io.write((const char*)&bad_name_offset,sizeof(bad_name_offset));
+  }
+  CacheManifest corrupt_manifest;
+  CHECK(!corrupt_manifest.load(manifest_filename));
+  CHECK(!corrupt_manifest.find("a.tif",found));
+  std::filesystem::remove_all(directory);
+}
+
+TEST_CASE("Does the pyramid cache write and read tiles?") {
+  // hashes are stored so every build must give the same XXH64
+  CHECK(pyramid_cache_hash_bytes((const unsigned char*)"",0) == 0xEF46DB3751D8E999ULL);
+  CHECK(pyramid_cache_hash_bytes((const unsigned char*)"abc",3) == 0x44BC2CF5AD770999ULL);
+  // every codec this build supports must round trip
+  for (auto codec : {PYRAMID_CACHE_CODEC_DEFLATE,PYRAMID_CACHE_CODEC_LZ4,PYRAMID_CACHE_CODEC_ZSTD}) {
+    if (!pyramid_cache_codec_supported(codec)) {
+      continue;
+    }
+    CAPTURE(codec);
+    auto cache_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_pyramid.igp").string();
+    // not a multiple of the tile size so edge tiles are partial
+    const INT64 width=PYRAMID_CACHE_TILE_SIZE+37;
+    const INT64 height=2*PYRAMID_CACHE_TILE_SIZE+5;
+    std::vector<PIXEL_RGBA> full(width*height);
+    for (INT64 i=0; i < width*height; i++) {
+      full[i]=(PIXEL_RGBA)(i*2654435761u);
+    }
+    std::vector<PIXEL_RGBA> reduced((width/2)*(height/2),0xFF00FF00);
+    // a stand in for the image the cache was built from
+    auto source_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_pyramid_source.bin").string();
+    {
+      std::ofstream source_out(source_filename,std::ios::binary | std::ios::trunc);
+      source_out.write((const char*)full.data(),full.size()*sizeof(PIXEL_RGBA));
+    }
+    PyramidCacheSource source;
+    CHECK(pyramid_cache_source(source_filename,source));
+    CHECK(source.file_size == (INT64)(full.size()*sizeof(PIXEL_RGBA)));
+    CHECK(pyramid_cache_write(cache_filename,
+                              source,
+                              4,
+                              codec,
+                              {PyramidCacheLevelData{0,width,height,(const unsigned char*)full.data()},
+                               PyramidCacheLevelData{1,width/2,height/2,(const unsigned char*)reduced.data()}}));
+    PyramidCacheReader reader;
+    CHECK(reader.open(cache_filename));
+    CHECK(reader.channels() == 4);
+    INT64 level_width,level_height;
+    CHECK(!reader.find_level(2,level_width,level_height));
+    CHECK(reader.find_level(0,level_width,level_height));
+    CHECK(level_width == width);
+    CHECK(level_height == height);
+    // a region crossing tiles reads back exactly
+    INT64 x0=PYRAMID_CACHE_TILE_SIZE-3,y0=PYRAMID_CACHE_TILE_SIZE-7,x1=width,y1=2*PYRAMID_CACHE_TILE_SIZE+2;
+    std::vector<PIXEL_RGBA> region((x1-x0)*(y1-y0));
+    CHECK(reader.read_region(0,x0,y0,x1,y1,(unsigned char*)region.data()));
+    auto region_matches=true;
+    for (auto y=y0; y < y1; y++) {
+      for (auto x=x0; x < x1; x++) {
+        if (region[(y-y0)*(x1-x0)+(x-x0)] != full[y*width+x]) {
+          region_matches=false;
+        }
+      }
+    }
+    CHECK(region_matches);
+    std::vector<PIXEL_RGBA> reduced_read(reduced.size());
+    CHECK(reader.read_region(1,0,0,width/2,height/2,(unsigned char*)reduced_read.data()));
+    CHECK(reduced_read == reduced);
+    CHECK(!reader.read_region(1,0,0,width,height,(unsigned char*)reduced_read.data()));
+    // a truncated tile is rejected instead of giving a partial tile
+    const INT64 tile_bytes=PYRAMID_CACHE_TILE_SIZE*PYRAMID_CACHE_TILE_SIZE*sizeof(PIXEL_RGBA);
+    std::vector<unsigned char> compressed;
+    CHECK(pyramid_cache_compress(codec,(const unsigned char*)full.data(),tile_bytes,compressed));
+    std::vector<unsigned char> decompressed(tile_bytes);
+    CHECK(pyramid_cache_decompress(codec,compressed.data(),compressed.size(),decompressed.data(),tile_bytes));
+    CHECK(!pyramid_cache_decompress(codec,compressed.data(),compressed.size()/2,decompressed.data(),tile_bytes));
+    CHECK(pyramid_cache_up_to_date(cache_filename,source_filename,2));
+    CHECK(!pyramid_cache_up_to_date(cache_filename,source_filename,3));
+    // a replaced image makes the cache out of date
+    {
+      std::ofstream source_out(source_filename,std::ios::binary | std::ios::app);
+      source_out.write("new edition",11);
+    }
+    CHECK(!pyramid_cache_up_to_date(cache_filename,source_filename,2));
+    // corrupt counts and offsets that would overflow the bounds checks
+    // are rejected instead of reading outside the file
+    std::vector<unsigned char> cache_bytes;
+    {
+      std::ifstream cache_in(cache_filename,std::ios::binary);
+      cache_bytes.assign(std::istreambuf_iterator<char>(cache_in),std::istreambuf_iterator<char>());
+    }
+    auto write_corrupt=[&](INT64 offset, INT64 value) {
+      auto corrupt_bytes=cache_bytes;
+      std::memcpy(corrupt_bytes.data()+offset,&value,sizeof(value));
+      std::ofstream cache_out(cache_filename,std::ios::binary | std::ios::trunc);
+      cache_out.write((const char*)corrupt_bytes.data(),corrupt_bytes.size());
+    };
+    PyramidCacheLevel first_level;
+    std::memcpy(&first_level,cache_bytes.data()+sizeof(PyramidCacheHeader),sizeof(first_level));
+    PyramidCacheReader corrupt_reader;
+    write_corrupt(offsetof(PyramidCacheHeader,level_count),1L << 60);
+    CHECK(!corrupt_reader.open(cache_filename));
+    write_corrupt(offsetof(PyramidCacheHeader,tile_size),1L << 40);
+    CHECK(!corrupt_reader.open(cache_filename));
+    write_corrupt(sizeof(PyramidCacheHeader)+offsetof(PyramidCacheLevel,tiles_offset),INT64_MAX);
+    CHECK(!corrupt_reader.open(cache_filename));
+    write_corrupt(first_level.tiles_offset+offsetof(PyramidCacheTile,offset),INT64_MAX-1);
+    CHECK(corrupt_reader.open(cache_filename));
+    CHECK(!corrupt_reader.read_region(0,0,0,1,1,(unsigned char*)region.data()));
+    std::filesystem::remove(source_filename);
+    std::filesystem::remove(cache_filename);
+  }
+}
+
+TEST_CASE("Does writing a pyramid cache keep the levels already cached?") {
+  auto source_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_write_job_source.bin").string();
+  auto cache_filename=(std::filesystem::temp_directory_path() / "imagegrid_test_write_job.igp").string();
+  std::filesystem::remove(cache_filename);
+  {
+    std::ofstream source_out(source_filename,std::ios::binary | std::ios::trunc);
+    source_out.write("a stand in image",16);
+  }
+  const INT64 width=300;
+  const INT64 height=20;
+  std::vector<unsigned char> gray(width*height);
+  for (INT64 i=0; i < width*height; i++) {
+    gray[i]=(unsigned char)(i*7);
+  }
+  std::vector<PIXEL_RGBA> reduced((width/2)*(height/2),0xFF102030);
+  // a zoomed out level is cached first, as when viewing zoomed out
+  PyramidCacheWriteJob reduced_job;
+  reduced_job.filename=source_filename;
+  reduced_job.cache_filename=cache_filename;
+  reduced_job.width=width;
+  reduced_job.height=height;
+  reduced_job.codec=PYRAMID_CACHE_CODEC_DEFLATE;
+  reduced_job.levels.push_back(PyramidCacheWriteLevel{1,width/2,height/2,4,nullptr,nullptr,{}});
+  reduced_job.levels.back().buffer.assign((const unsigned char*)reduced.data(),
+                                          (const unsigned char*)(reduced.data()+reduced.size()));
+  CHECK(pyramid_cache_write_job(reduced_job));
+  // then a grayscale full size level
+  PyramidCacheWriteJob full_job;
+  full_job.filename=source_filename;
+  full_job.cache_filename=cache_filename;
+  full_job.width=width;
+  full_job.height=height;
+  full_job.codec=PYRAMID_CACHE_CODEC_DEFLATE;
+  full_job.levels.push_back(PyramidCacheWriteLevel{0,width,height,1,gray.data(),nullptr,{}});
+  CHECK(pyramid_cache_write_job(full_job));
+  CHECK(pyramid_cache_up_to_date(cache_filename,source_filename,2));
+  PyramidCacheReader reader;
+  CHECK(reader.open(cache_filename));
+  // not every level is grayscale so the full size is expanded
+  CHECK(reader.channels() == 4);
+  std::vector<PIXEL_RGBA> full_read(width*height);
+  std::vector<PIXEL_RGBA> full_expected(width*height);
+  buffer_expand_gray_row(gray.data(),full_expected.data(),width*height);
+  CHECK(reader.read_region(0,0,0,width,height,(unsigned char*)full_read.data()));
+  CHECK(full_read == full_expected);
+  std::vector<PIXEL_RGBA> reduced_read(reduced.size());
+  CHECK(reader.read_region(1,0,0,width/2,height/2,(unsigned char*)reduced_read.data()));
+  CHECK(reduced_read == reduced);
+  std::filesystem::remove(cache_filename);
+  std::filesystem::remove(source_filename);
+}
+
+TEST_CASE("Does writing caches in the background work for NTS files?") {
+  auto directory=(std::filesystem::temp_directory_path() / "imagegrid_test_write_back").string();
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+  auto nts_filename=(std::filesystem::path(directory) / "sheet.zip").string();
+  std::filesystem::copy_file("./tests/test_small.zip",nts_filename);
+  // only images whose decoder reads the cache are written back
+  CHECK(decoder_has_capability(find_decoder(nts_filename),DECODER_CAPABILITY_CACHE));
+  CHECK(!decoder_has_capability(nullptr,DECODER_CAPABILITY_CACHE));
+  // the sheet is stripped so only its cache can load a region
+  CHECK(!decoder_check_region(nts_filename,""));
+  CHECK(!decoder_check_region(nts_filename,create_cache_filename(nts_filename,PYRAMID_CACHE_EXTENSION)));
+  CHECK(!decoder_check_region("./tests/test_small.png",""));
+  const INT64 width=40;
+  const INT64 height=30;
+  std::vector<PIXEL_RGBA> full(width*height,0xFF336699);
+  PyramidCacheWriteJob job;
+  job.filename=nts_filename;
+  job.cache_filename=create_cache_filename(nts_filename,PYRAMID_CACHE_EXTENSION);
+  job.width=width;
+  job.height=height;
+  job.codec=PYRAMID_CACHE_CODEC_DEFLATE;
+  job.levels.push_back(PyramidCacheWriteLevel{0,width,height,4,nullptr,nullptr,{}});
+  job.levels.back().buffer.assign((const unsigned char*)full.data(),
+                                  (const unsigned char*)(full.data()+full.size()));
+  auto cache_filename=job.cache_filename;
+  auto bytes=pyramid_cache_write_job_bytes(job);
+  CHECK(pyramid_cache_write_job_needed(job));
+  // only the sizes are needed to check the cache
+  auto sized_job=job;
+  sized_job.levels.back().buffer.clear();
+  CHECK(bytes == width*height*4);
+  {
+    PyramidCacheWriteBack write_back;
+    // levels that don't fit in the budget are refused before copying
+    CHECK(write_back.busy(cache_filename,PYRAMID_CACHE_WRITE_BACK_MAX_BYTES+1));
+    CHECK(!write_back.busy(cache_filename,bytes));
+    CHECK(write_back.queue(std::move(job)));
+    for (INT64 i=0; i < 1000 && write_back.busy(cache_filename,bytes); i++) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    CHECK(!write_back.busy(cache_filename,bytes));
+    // the budget is returned once the cache is written
+    CHECK(!write_back.busy(cache_filename,PYRAMID_CACHE_WRITE_BACK_MAX_BYTES));
+  }
+  CHECK(std::filesystem::exists(cache_filename));
+  CHECK(pyramid_cache_up_to_date(cache_filename,nts_filename,1));
+  CHECK(decoder_check_region(nts_filename,cache_filename));
+  // loading the same levels again adds nothing to the cache
+  CHECK(!pyramid_cache_write_job_needed(sized_job));
+  sized_job.levels.back().zoom_out_shift=1;
+  CHECK(pyramid_cache_write_job_needed(sized_job));
+  std::filesystem::remove_all(directory);
+}